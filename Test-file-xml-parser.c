@@ -2,67 +2,51 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <regex.h>
 #include <ctype.h>
+#include <limits.h>
+#include "escl-scan-settings.h"
 
 typedef struct ScanSettingsXml {
-    char* xml;
+    const char* xml; // borrowed from the caller, not copied
+    size_t length;
 } ScanSettingsXml;
 
 void initScanSettingsXml(ScanSettingsXml* settings, const char* s) {
-    settings->xml = (char*)malloc(strlen(s) + 1);
-    strcpy(settings->xml, s);
+    settings->xml = s;
+    settings->length = strlen(s);
 }
 
-char* getString(const ScanSettingsXml* settings, const char* name, const char* pattern) {
-    const int max_matches = 2;
-    regex_t regex;
-    regmatch_t matches[max_matches];
-
-    if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-        fprintf(stderr, "Could not compile regex\n");
-        exit(1);
-    }
-
-    if (regexec(&regex, settings->xml, max_matches, matches, 0) == 0) {
-        size_t match_length = matches[1].rm_eo - matches[1].rm_so;
-        char* result = (char*)malloc(match_length + 1);
-        strncpy(result, settings->xml + matches[1].rm_so, match_length);
-        result[match_length] = '\0';
-
-        regfree(&regex);
-        return result;
-    }
-
-    regfree(&regex);
-    char* empty = (char*)malloc(1);
-    empty[0] = '\0';
-    return empty;
+EsclStringView getString(const ScanSettingsXml* settings, ScanSettingsField field) {
+    EsclStringView value = { "", 0 };
+    findScanSettingsField(settings->xml, settings->length, field, &value);
+    return value;
 }
 
-double getNumber(const ScanSettingsXml* settings, const char* name, const char* pattern) {
-    char* string_value = getString(settings, name, pattern);
-    double result = strtod(string_value, NULL);
-    free(string_value);
+double getNumber(const ScanSettingsXml* settings, ScanSettingsField field) {
+    double result = 0;
+    parseEsclNumber(getString(settings, field), &result);
     return result;
 }
 
+// The digits that end str, as in the 8 of Grayscale8. -1 when there are none
+// or they do not fit an int.
 int extractNumericalPart(const char* str) {
-    int len = strlen(str);
-    int i = len - 1;
-    while (i >= 0 && isdigit(str[i])) {
+    size_t len = strlen(str);
+    size_t i = len;
+    while (i > 0 && isdigit((unsigned char)str[i - 1])) {
         i--;
     }
-    
-    if (i >= 0 && i < len - 1) {
-        char numericalPart[20];
-        strncpy(numericalPart, str + i + 1, len - i);
-        numericalPart[len - i] = '\0';
-        
-        return atoi(numericalPart);
-    } else {
-        return -1; // Return a default value or handle the error case appropriately
+
+    if (i == 0 || i == len)
+        return -1;
+    int value = 0;
+    for (; i < len; ++i) {
+        int digit = str[i] - '0';
+        if (value > (INT_MAX - digit) / 10)
+            return -1;
+        value = value * 10 + digit;
     }
+    return value;
 }
 
 // int main() {
@@ -71,56 +55,36 @@ int extractNumericalPart(const char* str) {
 
 //     printf("XML data: %s\n", scanSettings.xml);
 
-//     char* versionPattern = "<pwg:Version>([^<]*)</pwg:Version>";
-//     char* version = getString(&scanSettings, "Version", versionPattern);
-//     printf("Version: %s\n", version);
-//     free(version);
+//     EsclStringView version = getString(&scanSettings, SCAN_FIELD_VERSION);
+//     printf("Version: %.*s\n", (int)version.length, version.data);
 
-//     char* intentPattern = "<scan:Intent>([^<]*)</scan:Intent>";
-//     char* intent = getString(&scanSettings, "Intent", intentPattern);
-//     printf("Intent: %s\n", intent);
-//     free(intent);
+//     EsclStringView intent = getString(&scanSettings, SCAN_FIELD_INTENT);
+//     printf("Intent: %.*s\n", (int)intent.length, intent.data);
 
-//     char* heightPattern = "<pwg:Height>([^<]*)</pwg:Height>";
-//     char* height = getString(&scanSettings, "Height", heightPattern);
-//     printf("Height: %s\n", height);
-//     free(height);
+//     EsclStringView height = getString(&scanSettings, SCAN_FIELD_HEIGHT);
+//     printf("Height: %.*s\n", (int)height.length, height.data);
 
-//     char* contentRegionUnitsPattern = "<pwg:ContentRegionUnits>([^<]*)</pwg:ContentRegionUnits>";
-//     char* contentRegionUnits = getString(&scanSettings, "ContentRegionUnits", contentRegionUnitsPattern);
-//     printf("ContentRegionUnits: %s\n", contentRegionUnits);
-//     free(contentRegionUnits);
+//     EsclStringView contentRegionUnits = getString(&scanSettings, SCAN_FIELD_CONTENT_REGION_UNITS);
+//     printf("ContentRegionUnits: %.*s\n", (int)contentRegionUnits.length, contentRegionUnits.data);
 
-//     char* widthPattern = "<pwg:Width>([^<]*)</pwg:Width>";
-//     double width = getNumber(&scanSettings, "Width", widthPattern);
+//     double width = getNumber(&scanSettings, SCAN_FIELD_WIDTH);
 //     printf("Width: %.0lf\n", width);
 
-//     char* xOffsetPattern = "<pwg:XOffset>([^<]*)</pwg:XOffset>";
-//     double xOffset = getNumber(&scanSettings, "XOffset", xOffsetPattern);
+//     double xOffset = getNumber(&scanSettings, SCAN_FIELD_X_OFFSET);
 //     printf("XOffset: %.0lf\n", xOffset);
 
-//     char* yOffsetPattern = "<pwg:YOffset>([^<]*)</pwg:YOffset>";
-//     double yOffset = getNumber(&scanSettings, "YOffset", yOffsetPattern);
+//     double yOffset = getNumber(&scanSettings, SCAN_FIELD_Y_OFFSET);
 //     printf("YOffset: %.0lf\n", yOffset);
 
-//     char* inputSourcePattern = "<pwg:InputSource>([^<]*)</pwg:InputSource>";
-//     char* inputSource = getString(&scanSettings, "InputSource", inputSourcePattern);
-//     printf("InputSource: %s\n", inputSource);
-//     free(inputSource);
+//     EsclStringView inputSource = getString(&scanSettings, SCAN_FIELD_INPUT_SOURCE);
+//     printf("InputSource: %.*s\n", (int)inputSource.length, inputSource.data);
 
-//     char* colorModePattern = "<scan:ColorMode>([^<]*)</scan:ColorMode>";
-//     char* colorMode = getString(&scanSettings, "ColorMode", colorModePattern);
-//     int numPart1 = extractNumericalPart(colorMode);
-//     printf("Numerical part: %d\n", numPart1);
-//     printf("ColorMode: %s\n", colorMode);
-//     free(colorMode);
+//     EsclStringView colorMode = getString(&scanSettings, SCAN_FIELD_COLOR_MODE);
+//     printf("ColorMode: %.*s\n", (int)colorMode.length, colorMode.data);
 
-//     char* blankPageDetectionPattern = "<scan:BlankPageDetection>([^<]*)</scan:BlankPageDetection>";
-//     char* blankPageDetection = getString(&scanSettings, "BlankPageDetection", blankPageDetectionPattern);
-//     printf("BlankPageDetection: %s\n", blankPageDetection);
-//     free(blankPageDetection);
+//     EsclStringView blankPageDetection = getString(&scanSettings, SCAN_FIELD_BLANK_PAGE_DETECTION);
+//     printf("BlankPageDetection: %.*s\n", (int)blankPageDetection.length, blankPageDetection.data);
 
-//     free(scanSettings.xml);
 //     return 0;
 // }
 
@@ -128,6 +92,7 @@ int main() {
     const char str1[] = "RGB12356";
     const char str2[] = "RGB1";
     const char str3[] = "HelloWorld";
+    const char str4[] = "Grayscale123456789012345678901234567890";
     
     int numPart1 = extractNumericalPart(str1);
     if (numPart1 != -1) {
@@ -150,6 +115,13 @@ int main() {
         printf("No numerical part found.\n");
     }
     
+    int numPart4 = extractNumericalPart(str4);
+    if (numPart4 != -1) {
+        printf("Numerical part: %d\n", numPart4);
+    } else {
+        printf("No numerical part found.\n");
+    }
+    
     return 0;
 }
 
@@ -0,0 +1,28 @@
+#ifndef BENCH_CLOCK_H
+#define BENCH_CLOCK_H
+
+// Clock and sleep helpers for the bench-*.c programs.
+
+#include <time.h>
+
+// Seconds on the monotonic clock
+static inline double benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void benchSleepNs(long long nanoseconds) {
+    struct timespec delay = { (time_t)(nanoseconds / 1000000000), (long)(nanoseconds % 1000000000) };
+    nanosleep(&delay, NULL);
+}
+
+static inline void benchSleepUs(long long microseconds) {
+    benchSleepNs(microseconds * 1000);
+}
+
+static inline void benchSleepMs(long long milliseconds) {
+    benchSleepNs(milliseconds * 1000000);
+}
+
+#endif /* BENCH_CLOCK_H */
@@ -0,0 +1,349 @@
+#include "scan-job.h"
+#include "scan-queue.h"
+#include "scan-ticket.h"
+#include "scan-stats.h"
+#include "escl-status.h"
+#include "test-scan-options.h"
+#include "bench-escl.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+// scan-job.c getString over the generated tickets, then a load generator:
+// client threads replaying ScanJobs and ScannerStatus traffic against a stub
+// scanner behind a ScanQueue. A ScanJobs request takes its ticket from the
+// cache, lists the job in ScannerStatus and queues it; a ScannerStatus
+// request is a conditional poll. The stub warms up, resolves its options and
+// scans a page or a few per job, updating the job as a real one would.
+// Latencies are per request, as the daemon would see them. Every job must be
+// released and unlisted at the end. See bench-escl.h for -o, -b and -q.
+//
+// No request goes over HTTP: the client threads call the ticket cache,
+// ScanQueue and EsclStatus in this process, as the eSCL handlers do once
+// libcups has read the request. That is deliberate; with a socket and the
+// libcups parser in the loop these numbers would mostly measure those.
+//
+//   cc -O2 -pthread -I<pappl> $(xml2-config --cflags) -o bench-escl-load bench-escl-load.c escl-status.c scan-job.c scan-queue.c scan-ticket.c escl-scan-settings.c scan-region.c scan-pixel.c scan-gray.c scan-gamma.c scan-stats.c test-scan-options.c -lpappl -lsane -lm $(xml2-config --libs)
+
+#define TICKETS 2000
+#define LOOKUPS_PER_TICKET 5
+#define PRESETS 8              // most jobs reuse one of a few tickets
+#define CLIENTS 8
+#define LOAD_SECONDS 3.0
+#define JOBS_PER_MILLE 10      // share of requests that are ScanJobs
+#define THINK_US 1000          // between a client's requests
+#define WARM_UP_MS 5
+#define PAGE_MS 1
+#define OPTIONS_DEVICES 1000
+
+static const char* const ticketFields[LOOKUPS_PER_TICKET] = {
+    "Version", "ColorMode", "XResolution", "InputSource", "Height",
+};
+
+static int benchGetString(BenchReport* report) {
+    size_t count = report->quick ? TICKETS / 10 : TICKETS;
+    size_t jobs = report->quick ? count : count * 10;
+    int failures = 0;
+    char name[64], extra[64];
+
+    xmlInitParser();
+    for (int size = 0; size < TICKET_SIZES; ++size) {
+        BenchTicket* tickets = generateTicketCorpus(count, (BenchTicketSize)size, 1);
+        for (size_t i = 0; i < count; ++i) {
+            papplScanSettingsXML* settings = new_ScanSettingsXml(tickets[i].xml);
+            for (size_t f = 0; f < LOOKUPS_PER_TICKET; ++f) {
+                char* value = getString(settings, ticketFields[f]);
+                failures += value == NULL;
+                xmlFree(value);
+            }
+            delete_ScanSettingsXml(settings);
+        }
+
+        double best = 0;
+        for (int repeat = 0; repeat < 3; ++repeat) {
+            double start = benchNow();
+            for (size_t i = 0; i < jobs; ++i) {
+                papplScanSettingsXML* settings = new_ScanSettingsXml(tickets[i % count].xml);
+                for (size_t f = 0; f < LOOKUPS_PER_TICKET; ++f)
+                    xmlFree(getString(settings, ticketFields[f]));
+                delete_ScanSettingsXml(settings);
+            }
+            double seconds = benchNow() - start;
+            if (repeat == 0 || seconds < best)
+                best = seconds;
+        }
+        snprintf(name, sizeof(name), "getString/%s", benchTicketSizeNames[size]);
+        snprintf(extra, sizeof(extra), ",\"lookups_per_op\":%d", LOOKUPS_PER_TICKET);
+        reportBench(report, name, jobs, best, extra);
+        deleteTicketCorpus(tickets, count);
+    }
+    xmlCleanupParser();
+    if (failures)
+        printf("getString: %d lookups found nothing\n", failures);
+    return failures;
+}
+
+typedef struct {
+    EsclStatus status;
+    ScanQueue* queue;
+    ScanTicketCache* cache;
+    OptionsFile* options;
+    pappl_scanner_t scanner;
+    BenchTicket* tickets;
+    size_t ticketCount;
+    atomic_uint nextJob;
+    atomic_uint released;
+    atomic_uint pagesScanned;
+} StubScanner;
+
+typedef struct {
+    ScanQueueJob base;
+    ScanJobStatus status;
+    StubScanner* scanner;
+    ScanTicket* ticket;
+} LoadJob;
+
+static int openStub(void* device) {
+    setEsclScannerState(&((StubScanner*)device)->status, SCANNER_PROCESSING);
+    benchSleepUs(WARM_UP_MS * 1000);
+    return 0;
+}
+
+static int runStub(void* device, ScanQueueJob* queued) {
+    StubScanner* scanner = (StubScanner*)device;
+    LoadJob* job = (LoadJob*)queued;
+    const Options* options = scannerOptions(scanner->options, &scanner->scanner);
+    unsigned pages = esclStringViewEquals(job->ticket->settings.inputSource, "Feeder") ? 3 : 1;
+
+    for (unsigned page = 0; page < pages; ++page) {
+        benchSleepUs(PAGE_MS * 1000 * (options->synthesize_gray ? 2 : 1));
+        countScanJobImage(&job->status, false);
+        countScanJobImage(&job->status, true);
+        atomic_fetch_add(&scanner->pagesScanned, 1);
+    }
+    return 0;
+}
+
+static void closeStub(void* device) {
+    setEsclScannerState(&((StubScanner*)device)->status, SCANNER_IDLE);
+}
+
+static void releaseLoadJob(ScanQueueJob* queued) {
+    LoadJob* job = (LoadJob*)queued;
+    removeEsclStatusJob(&job->scanner->status, &job->status);
+    releaseScanTicket(job->ticket);
+    atomic_fetch_add(&job->scanner->released, 1);
+    free(job);
+}
+
+typedef struct {
+    StubScanner* scanner;
+    BenchRandom random;
+    double until;
+    ScanStatsHistogram jobs;       // ScanJobs latency, nanoseconds
+    ScanStatsHistogram polls;      // ScannerStatus
+    uint64_t submitted;
+    uint64_t rejected;             // 503: queue or status list full
+    uint64_t notModified;
+} LoadClient;
+
+static void recordLatency(ScanStatsHistogram* histogram, double seconds) {
+    uint64_t nanoseconds = (uint64_t)(seconds * 1e9);
+    histogram->buckets[scanStatsBucket(nanoseconds)]++;
+    histogram->count++;
+    histogram->sum += nanoseconds;
+    if (nanoseconds > histogram->max)
+        histogram->max = nanoseconds;
+}
+
+// POST /ScanJobs; false when the answer would be 503.
+static bool postScanJob(LoadClient* client) {
+    StubScanner* scanner = client->scanner;
+    size_t pick = benchBelow(&client->random, 10) < 8 ? benchBelow(&client->random, PRESETS)
+                                                       : benchBelow(&client->random, (uint32_t)scanner->ticketCount);
+    const BenchTicket* body = &scanner->tickets[pick];
+    ScanTicket* ticket = acquireScanTicket(scanner->cache, body->xml, body->length);
+    if (ticket == NULL)
+        return false;
+
+    LoadJob* job = (LoadJob*)calloc(1, sizeof(LoadJob));
+    char uuid[40];
+    job->scanner = scanner;
+    job->ticket = ticket;
+    initScanJobStatus(&job->status, time(NULL));
+    job->base.status = &job->status;
+    job->base.context = job;
+    snprintf(uuid, sizeof(uuid), "00000000-0000-0000-0000-%012u", atomic_fetch_add(&scanner->nextJob, 1));
+
+    unsigned retryAfter;
+    if (addEsclStatusJob(&scanner->status, &job->status, uuid) != 0) {
+        releaseScanTicket(ticket);
+        free(job);
+        return false;
+    }
+    if (submitScanJob(scanner->queue, &job->base, &retryAfter) != 0) {
+        removeEsclStatusJob(&scanner->status, &job->status);
+        releaseScanTicket(ticket);
+        free(job);
+        return false;
+    }
+    return true;
+}
+
+static void* runLoadClient(void* arg) {
+    LoadClient* client = (LoadClient*)arg;
+    EsclStatus* status = &client->scanner->status;
+    time_t lastModified = 0;
+
+    while (benchNow() < client->until) {
+        double start = benchNow();
+        if (benchBelow(&client->random, 1000) < JOBS_PER_MILLE) {
+            if (postScanJob(client))
+                client->submitted++;
+            else
+                client->rejected++;
+            recordLatency(&client->jobs, benchNow() - start);
+        } else {
+            time_t now = time(NULL);
+            if (esclStatusUnchanged(status, lastModified, now)) {
+                client->notModified++;
+            } else {
+                EsclDocument* document = acquireEsclStatus(status, now);
+                if (document != NULL) {
+                    lastModified = esclLastModified(document, now);
+                    releaseEsclDocument(document);
+                }
+            }
+            recordLatency(&client->polls, benchNow() - start);
+        }
+        benchSleepUs(THINK_US);
+    }
+    return NULL;
+}
+
+static void mergeHistogram(ScanStatsHistogram* to, const ScanStatsHistogram* from) {
+    to->count += from->count;
+    to->sum += from->sum;
+    if (from->max > to->max)
+        to->max = from->max;
+    for (size_t i = 0; i < SCAN_STATS_BUCKETS; ++i)
+        to->buckets[i] += from->buckets[i];
+}
+
+static void reportLatency(BenchReport* report, const char* name, const ScanStatsHistogram* histogram, const char* more) {
+    char extra[256];
+    snprintf(extra, sizeof(extra), ",\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f%s",
+             scanStatsPercentile(histogram, 0.5) / 1e3, scanStatsPercentile(histogram, 0.99) / 1e3,
+             histogram->max / 1e3, more);
+    // ns_per_op is the mean latency
+    reportBench(report, name, histogram->count, histogram->sum / 1e9, extra);
+}
+
+static int benchLoad(BenchReport* report) {
+    StubScanner* scanner = (StubScanner*)calloc(1, sizeof(StubScanner));
+    LoadClient* clients = (LoadClient*)calloc(CLIENTS, sizeof(LoadClient));
+    ScanStatsHistogram* jobs = (ScanStatsHistogram*)calloc(1, sizeof(ScanStatsHistogram));
+    ScanStatsHistogram* polls = (ScanStatsHistogram*)calloc(1, sizeof(ScanStatsHistogram));
+    char directory[] = "/tmp/bench-escl-XXXXXX";
+    char fileName[64], saneName[64], model[64], extra[160];
+    int failures = 0;
+
+    if (mkdtemp(directory) == NULL) {
+        printf("cannot make a directory for the options file\n");
+        return 1;
+    }
+    snprintf(fileName, sizeof(fileName), "%s/options.conf", directory);
+    writeOptionsFile(fileName, OPTIONS_DEVICES, 1);
+    benchSaneName(4, saneName, sizeof(saneName));
+    benchModelName(4, model, sizeof(model));
+    scanner->scanner.sane_name = saneName;
+    scanner->scanner.make_and_model = model;
+
+    // Presets first, then tickets of every size
+    scanner->ticketCount = report->quick ? TICKETS / 10 : TICKETS;
+    scanner->tickets = generateTicketCorpus(scanner->ticketCount, TICKET_SMALL, 2);
+    for (int size = TICKET_MEDIUM; size < TICKET_SIZES; ++size) {
+        size_t share = scanner->ticketCount / TICKET_SIZES;
+        BenchTicket* more = generateTicketCorpus(share, (BenchTicketSize)size, 2);
+        for (size_t i = 0; i < share; ++i) {
+            size_t slot = PRESETS + (size - 1) * share + i;
+            free(scanner->tickets[slot].xml);
+            scanner->tickets[slot] = more[i];
+        }
+        free(more);
+    }
+
+    ScanQueueDevice device = { scanner, openStub, runStub, closeStub, releaseLoadJob };
+    ScanQueueSettings settings = { SCAN_QUEUE_FIFO, 0, 0.05, 0 };
+    scanner->options = new_OptionsFile(fileName);
+    initEsclStatus(&scanner->status, true);
+    scanner->cache = new_ScanTicketCache(0);
+    scanner->queue = new_ScanQueue(&device, &settings);
+
+    double seconds = report->quick ? LOAD_SECONDS / 6 : LOAD_SECONDS;
+    double start = benchNow();
+    pthread_t threads[CLIENTS];
+    for (int i = 0; i < CLIENTS; ++i) {
+        clients[i].scanner = scanner;
+        clients[i].random.state = 0x9E3779B97F4A7C15u * (i + 1);
+        clients[i].until = start + seconds;
+        pthread_create(&threads[i], NULL, runLoadClient, &clients[i]);
+    }
+    uint64_t submitted = 0, rejected = 0, notModified = 0;
+    for (int i = 0; i < CLIENTS; ++i) {
+        pthread_join(threads[i], NULL);
+        mergeHistogram(jobs, &clients[i].jobs);
+        mergeHistogram(polls, &clients[i].polls);
+        submitted += clients[i].submitted;
+        rejected += clients[i].rejected;
+        notModified += clients[i].notModified;
+    }
+    double elapsed = benchNow() - start;
+
+    // Jobs still waiting are aborted and released here
+    ScanQueueStats queueStats;
+    ScanTicketCacheStats cacheStats;
+    getScanQueueStats(scanner->queue, &queueStats);
+    delete_ScanQueue(scanner->queue);
+    getScanTicketCacheStats(scanner->cache, &cacheStats);
+
+    failures += submitted == 0 || queueStats.completed == 0 || polls->count == 0;
+    failures += atomic_load(&scanner->released) != submitted;
+    failures += scanner->status.jobCount != 0 || cacheStats.invalid != 0;
+    if (failures)
+        printf("load: %d checks failed (%llu submitted, %u released, %zu still listed)\n", failures,
+               (unsigned long long)submitted, atomic_load(&scanner->released), scanner->status.jobCount);
+
+    snprintf(extra, sizeof(extra), ",\"submitted\":%llu,\"rejected\":%llu,\"completed\":%llu,\"ticket_hits\":%llu,\"ticket_misses\":%llu",
+             (unsigned long long)submitted, (unsigned long long)rejected, (unsigned long long)queueStats.completed,
+             (unsigned long long)cacheStats.hits, (unsigned long long)cacheStats.misses);
+    reportLatency(report, "load/ScanJobs", jobs, extra);
+    snprintf(extra, sizeof(extra), ",\"not_modified\":%llu", (unsigned long long)notModified);
+    reportLatency(report, "load/ScannerStatus", polls, extra);
+    snprintf(extra, sizeof(extra), ",\"clients\":%d,\"pages\":%u", CLIENTS, atomic_load(&scanner->pagesScanned));
+    reportBench(report, "load/requests", jobs->count + polls->count, elapsed, extra);
+
+    delete_ScanTicketCache(scanner->cache);
+    destroyEsclStatus(&scanner->status);
+    if (scanner->options != NULL)
+        delete_OptionsFile(scanner->options);
+    deleteTicketCorpus(scanner->tickets, scanner->ticketCount);
+    unlink(fileName);
+    rmdir(directory);
+    free(polls);
+    free(jobs);
+    free(clients);
+    free(scanner);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    BenchReport report;
+    if (!initBenchReport(&report, "bench-escl-load", argc, argv))
+        return 2;
+
+    int failures = benchGetString(&report);
+    failures += benchLoad(&report);
+    if (failures)
+        printf("%d checks failed\n", failures);
+    return finishBenchReport(&report, failures);
+}
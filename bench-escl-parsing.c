@@ -0,0 +1,210 @@
+#include "escl-ops.h"
+#include "test-scan-options.h"
+#include "bench-escl.h"
+#include <pthread.h>
+#include <sys/stat.h>
+
+// The request parsing and options layers on generated corpora:
+// ScanSettingsFromXML over tickets of three sizes with their elements in
+// random order, new_OptionsFile over files with up to ten thousand device
+// sections, and scannerOptions lookups from one and several threads. Every
+// result is checked before it is timed. See bench-escl.h for -o, -b and -q.
+//
+//   cc -O2 -pthread -I<pappl> $(xml2-config --cflags) -o bench-escl-parsing bench-escl-parsing.c escl-ops.c escl-client.c escl-scan-settings.c scan-ticket.c scan-region.c scan-pixel.c scan-gray.c scan-gamma.c scan-spool.c scan-stats.c test-scan-options.c -lpappl -lsane -lm $(xml2-config --libs)
+
+#define TICKETS 2000
+#define PARSES 200000
+#define LOOKUPS 400000
+#define LOOKUP_THREADS 4
+#define REPEATS 3              // the best of these is reported
+
+static int benchTickets(BenchReport* report) {
+    size_t count = report->quick ? TICKETS / 10 : TICKETS;
+    size_t parses = report->quick ? PARSES / 10 : PARSES;
+    ScanSettings settings;
+    int failures = 0;
+    char name[64], extra[64];
+
+    for (int size = 0; size < TICKET_SIZES; ++size) {
+        BenchTicket* tickets = generateTicketCorpus(count, (BenchTicketSize)size, 1);
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            bytes += tickets[i].length;
+            if (ScanSettingsFromXML(tickets[i].xml, NULL, &settings) != 0 || settings.regionCount != tickets[i].regions
+                || settings.color == SCAN_COLOR_NONE || settings.xResolution <= 0) {
+                if (failures++ == 0)
+                    printf("ticket %zu not parsed as generated:\n%s\n", i, tickets[i].xml);
+            }
+        }
+
+        double best = 0;
+        for (int repeat = 0; repeat < REPEATS; ++repeat) {
+            volatile size_t regions = 0;
+            double start = benchNow();
+            for (size_t i = 0; i < parses; ++i) {
+                ScanSettingsFromXML(tickets[i % count].xml, NULL, &settings);
+                regions += settings.regionCount;
+            }
+            double seconds = benchNow() - start;
+            if (repeat == 0 || seconds < best)
+                best = seconds;
+        }
+        snprintf(name, sizeof(name), "ScanSettingsFromXML/%s", benchTicketSizeNames[size]);
+        snprintf(extra, sizeof(extra), ",\"bytes_per_op\":%zu", bytes / count);
+        reportBench(report, name, parses, best, extra);
+        deleteTicketCorpus(tickets, count);
+    }
+    return failures;
+}
+
+typedef struct {
+    const OptionsFile* file;
+    pappl_scanner_t* scanners;
+    size_t scannerCount;
+    size_t lookups;
+    size_t first;
+} LookupWork;
+
+static void* lookUpOptions(void* arg) {
+    LookupWork* work = (LookupWork*)arg;
+    volatile double gamma = 0;
+    for (size_t i = 0; i < work->lookups; ++i)
+        gamma += scannerOptions(work->file, &work->scanners[(work->first + i) % work->scannerCount])->gray_gamma;
+    return NULL;
+}
+
+static double timeLookups(const OptionsFile* file, pappl_scanner_t* scanners, size_t count, size_t lookups, int threads) {
+    pthread_t ids[LOOKUP_THREADS];
+    LookupWork work[LOOKUP_THREADS];
+    double start = benchNow();
+    for (int t = 0; t < threads; ++t) {
+        work[t] = (LookupWork){ file, scanners, count, lookups / threads, (size_t)t * 7919 };
+        pthread_create(&ids[t], NULL, lookUpOptions, &work[t]);
+    }
+    for (int t = 0; t < threads; ++t)
+        pthread_join(ids[t], NULL);
+    return benchNow() - start;
+}
+
+// Which section each kind of scanner must get its options from.
+static int checkLookups(const OptionsFile* file, pappl_scanner_t* scanners, size_t count, unsigned devices) {
+    int failures = 0;
+    char note[32], location[32];
+    for (size_t i = 0; i < count; ++i) {
+        unsigned device = (unsigned)(i % (devices + 1));
+        const Options* options = scannerOptions(file, &scanners[i]);
+        if (device == devices) {
+            failures += options->note == NULL || strcmp(options->note, "Shared scanner") != 0;
+            continue;
+        }
+        snprintf(note, sizeof(note), "Device %u", device);
+        failures += options->note == NULL || strcmp(options->note, note) != 0;
+        if (benchHasModelSection(device)) {
+            snprintf(location, sizeof(location), "Room %u", device);
+            failures += options->location == NULL || strcmp(options->location, location) != 0;
+        }
+    }
+    return failures;
+}
+
+static int benchOptions(BenchReport* report) {
+    static const unsigned deviceCounts[] = { 100, 1000, 10000 };
+    size_t sizes = report->quick ? 2 : 3;
+    size_t lookups = report->quick ? LOOKUPS / 10 : LOOKUPS;
+    char directory[] = "/tmp/bench-escl-XXXXXX";
+    char fileName[64], name[64], extra[64];
+    int failures = 0;
+
+    if (mkdtemp(directory) == NULL) {
+        printf("cannot make a directory for the options files\n");
+        return 1;
+    }
+    snprintf(fileName, sizeof(fileName), "%s/options.conf", directory);
+
+    for (size_t s = 0; s < sizes; ++s) {
+        unsigned devices = deviceCounts[s];
+        size_t sections = writeOptionsFile(fileName, devices, 1);
+        struct stat info;
+        stat(fileName, &info);
+
+        // Batches of loads, about the same total size for every file
+        size_t loads = devices < 10000 ? 20000 / devices : 2;
+        double best = 0;
+        OptionsFile* file = NULL;
+        for (int repeat = 0; repeat < REPEATS; ++repeat) {
+            double start = benchNow();
+            for (size_t i = 0; i < loads; ++i) {
+                if (file != NULL)
+                    delete_OptionsFile(file);
+                file = new_OptionsFile(fileName);
+            }
+            double seconds = benchNow() - start;
+            if (repeat == 0 || seconds < best)
+                best = seconds;
+        }
+        if (file == NULL || file->deviceOptionsCount != sections) {
+            printf("%s: %zu of %zu sections loaded\n", fileName, file ? file->deviceOptionsCount : 0, sections);
+            failures++;
+        }
+        snprintf(name, sizeof(name), "new_OptionsFile/%u-devices", devices);
+        snprintf(extra, sizeof(extra), ",\"file_bytes\":%lld,\"sections\":%zu", (long long)info.st_size, sections);
+        reportBench(report, name, loads, best, extra);
+
+        // Scanners with a SANE name section, with that and a make-and-model
+        // section, and one with neither, in the proportions of the file
+        size_t scannerCount = devices + 1;
+        pappl_scanner_t* scanners = (pappl_scanner_t*)calloc(scannerCount, sizeof(pappl_scanner_t));
+        for (size_t i = 0; i < scannerCount; ++i) {
+            char saneName[64], model[64];
+            if (i < devices) {
+                benchSaneName((unsigned)i, saneName, sizeof(saneName));
+                benchModelName((unsigned)i, model, sizeof(model));
+            } else {
+                snprintf(saneName, sizeof(saneName), "test:0");
+                snprintf(model, sizeof(model), "Unknown Scanner");
+            }
+            scanners[i].sane_name = strdup(saneName);
+            scanners[i].make_and_model = strdup(model);
+        }
+        int wrong = file != NULL ? checkLookups(file, scanners, scannerCount, devices) : 1;
+        if (wrong) {
+            printf("scannerOptions/%u-devices: %d lookups found the wrong section\n", devices, wrong);
+            failures += wrong;
+        }
+
+        for (int threads = 1; file != NULL && threads <= LOOKUP_THREADS; threads *= LOOKUP_THREADS) {
+            best = 0;
+            for (int repeat = 0; repeat < REPEATS; ++repeat) {
+                double seconds = timeLookups(file, scanners, scannerCount, lookups, threads);
+                if (repeat == 0 || seconds < best)
+                    best = seconds;
+            }
+            snprintf(name, sizeof(name), "scannerOptions/%u-devices/%d-thread%s", devices, threads, threads > 1 ? "s" : "");
+            snprintf(extra, sizeof(extra), ",\"threads\":%d", threads);
+            reportBench(report, name, lookups, best, extra);
+        }
+
+        for (size_t i = 0; i < scannerCount; ++i) {
+            free(scanners[i].sane_name);
+            free(scanners[i].make_and_model);
+        }
+        free(scanners);
+        if (file != NULL)
+            delete_OptionsFile(file);
+    }
+    unlink(fileName);
+    rmdir(directory);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    BenchReport report;
+    if (!initBenchReport(&report, "bench-escl-parsing", argc, argv))
+        return 2;
+
+    int failures = benchTickets(&report);
+    failures += benchOptions(&report);
+    if (failures)
+        printf("%d checks failed\n", failures);
+    return finishBenchReport(&report, failures);
+}
@@ -0,0 +1,123 @@
+#include "escl-status.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Cost of ScannerStatus polls from many clients: rendering on every poll,
+// sending the cached document, and answering If-Modified-Since with 304. Also
+// checks that Last-Modified follows job changes.
+//
+//   cc -O2 -pthread -I<pappl> $(xml2-config --cflags) -o bench-escl-status bench-escl-status.c escl-status.c scan-job.c -lpappl $(xml2-config --libs)
+
+#define CLIENTS 50
+#define JOBS 3
+
+typedef enum { POLL_RENDER, POLL_CACHED, POLL_CONDITIONAL } PollMode;
+
+typedef struct {
+    EsclStatus* status;
+    PollMode mode;
+    time_t now;
+    int polls;
+    size_t bytes;
+} PollClient;
+
+static void* pollStatus(void* data) {
+    PollClient* client = (PollClient*)data;
+    time_t lastModified = 0;
+
+    for (int i = 0; i < client->polls; ++i) {
+        if (client->mode == POLL_CONDITIONAL && esclStatusUnchanged(client->status, lastModified, client->now))
+            continue;
+        if (client->mode == POLL_RENDER)
+            atomic_fetch_add(&client->status->version, 1);
+        EsclDocument* document = acquireEsclStatus(client->status, client->now);
+        client->bytes += document->length;
+        lastModified = esclLastModified(document, client->now);
+        releaseEsclDocument(document);
+    }
+    return NULL;
+}
+
+static double runClients(EsclStatus* status, PollMode mode, time_t seconds, int polls, size_t* bytes) {
+    PollClient clients[CLIENTS];
+    pthread_t threads[CLIENTS];
+    double start = benchNow();
+    for (int i = 0; i < CLIENTS; ++i) {
+        clients[i] = (PollClient){ status, mode, seconds, polls, 0 };
+        pthread_create(&threads[i], NULL, pollStatus, &clients[i]);
+    }
+    *bytes = 0;
+    for (int i = 0; i < CLIENTS; ++i) {
+        pthread_join(threads[i], NULL);
+        *bytes += clients[i].bytes;
+    }
+    return benchNow() - start;
+}
+
+static int checkLastModified(EsclStatus* status, ScanJobStatus* job) {
+    time_t seconds = time(NULL);
+    int failures = 0;
+
+    EsclDocument* before = acquireEsclStatus(status, seconds);
+    EsclDocument* again = acquireEsclStatus(status, seconds);
+    time_t modified = before->modified;
+    failures += before != again;
+    // No date while the document's second lasts, then its own
+    failures += esclLastModified(before, modified) != 0;
+    failures += esclLastModified(before, modified + 1) != modified;
+    failures += !esclStatusUnchanged(status, modified, modified + 1);
+    failures += esclStatusUnchanged(status, modified - 1, modified + 1);
+    failures += esclStatusUnchanged(status, 0, modified + 1);
+
+    // A change counts as new until it is rendered, then from that second
+    countScanJobImage(job, false);
+    failures += esclStatusUnchanged(status, modified, modified + 1);
+    EsclDocument* after = acquireEsclStatus(status, modified + 1);
+    failures += after->modified != modified + 1;
+    failures += esclStatusUnchanged(status, modified, modified + 2);
+    failures += !esclStatusUnchanged(status, modified + 1, modified + 2);
+    failures += strstr(after->body, "<pwg:ImagesToTransfer>1</pwg:ImagesToTransfer>") == NULL;
+
+    releaseEsclDocument(before);
+    releaseEsclDocument(again);
+    releaseEsclDocument(after);
+    if (failures)
+        printf("Last-Modified checks: %d failures\n", failures);
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    int polls = argc > 1 ? atoi(argv[1]) : 2000;
+    EsclStatus status;
+    ScanJobStatus jobs[JOBS];
+    time_t seconds = time(NULL);
+    int failures = 0;
+
+    initEsclStatus(&status, true);
+    setEsclAdfState(&status, ADF_LOADED);
+    for (int i = 0; i < JOBS; ++i) {
+        char uuid[40];
+        snprintf(uuid, sizeof(uuid), "4509a320-00a0-008f-00b6-0000000000%02d", i);
+        initScanJobStatus(&jobs[i], seconds);
+        addEsclStatusJob(&status, &jobs[i], uuid);
+        setScanJobState(&jobs[i], processing, reasonJobScanning, seconds);
+    }
+    setScanJobState(&jobs[0], completed, reasonJobCompletedSuccessfully, seconds);
+
+    // Each mode polls a second later than the one before, so the document
+    // the earlier ones left behind can be sent with its Last-Modified
+    static const char* names[] = { "render every poll", "cached document", "If-Modified-Since" };
+    for (PollMode mode = POLL_RENDER; mode <= POLL_CONDITIONAL; ++mode) {
+        size_t bytes;
+        double elapsed = runClients(&status, mode, seconds + mode, polls, &bytes);
+        printf("%-20s %12.0f polls/s %8.1f body bytes/poll\n", names[mode],
+               CLIENTS * (double)polls / elapsed, bytes / ((double)CLIENTS * polls));
+    }
+
+    failures += checkLastModified(&status, &jobs[2]);
+    destroyEsclStatus(&status);
+    return failures ? 1 : 0;
+}
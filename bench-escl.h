@@ -0,0 +1,319 @@
+#ifndef BENCH_ESCL_H
+#define BENCH_ESCL_H
+
+// Shared by bench-escl-parsing.c and bench-escl-load.c: generated corpora,
+// and results as JSON lines that a later run is checked against. They are two
+// programs because escl-ops.c and scan-job.c each define getString.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bench-clock.h"
+
+// There is nothing to measure without the corpus, so running out of memory
+// while generating it ends the program.
+static inline void* benchAlloc(size_t size) {
+    void* memory = malloc(size);
+    if (memory == NULL) {
+        fprintf(stderr, "out of memory generating the bench corpus\n");
+        exit(1);
+    }
+    return memory;
+}
+
+// xorshift64*: the same seed gives the same corpus on every run and machine.
+typedef struct {
+    uint64_t state;
+} BenchRandom;
+
+static inline uint32_t benchRandom(BenchRandom* random) {
+    random->state ^= random->state >> 12;
+    random->state ^= random->state << 25;
+    random->state ^= random->state >> 27;
+    return (uint32_t)((random->state * UINT64_C(2685821657736338717)) >> 32);
+}
+
+static inline uint32_t benchBelow(BenchRandom* random, uint32_t n) {
+    return (uint32_t)(((uint64_t)benchRandom(random) * n) >> 32);
+}
+
+static inline void shuffleStrings(BenchRandom* random, char** items, size_t count) {
+    for (size_t i = count; i > 1; --i) {
+        size_t j = benchBelow(random, (uint32_t)i);
+        char* t = items[i - 1];
+        items[i - 1] = items[j];
+        items[j] = t;
+    }
+}
+
+// Tickets as clients send them: a small one names a few fields, a large one
+// several regions and vendor extension elements; every level is in random order.
+typedef enum { TICKET_SMALL, TICKET_MEDIUM, TICKET_LARGE, TICKET_SIZES } BenchTicketSize;
+
+static const char* const benchTicketSizeNames[TICKET_SIZES] = { "small", "medium", "large" };
+
+#define BENCH_TICKET_CAPACITY (16 * 1024)
+#define BENCH_TICKET_PARTS 32
+
+typedef struct {
+    char* xml;
+    size_t length;
+    size_t regions;
+} BenchTicket;
+
+static inline void generateRegion(BenchRandom* random, char* out, size_t capacity) {
+    char parts[5][96];
+    char* order[5];
+    unsigned width = 300 + benchBelow(random, 2250), height = 300 + benchBelow(random, 3000);
+    snprintf(parts[0], sizeof(parts[0]), "<pwg:Height>%u</pwg:Height>", height);
+    snprintf(parts[1], sizeof(parts[1]), "<pwg:Width>%u</pwg:Width>", width);
+    snprintf(parts[2], sizeof(parts[2]), "<pwg:XOffset>%u</pwg:XOffset>", benchBelow(random, 2550 - width + 1));
+    snprintf(parts[3], sizeof(parts[3]), "<pwg:YOffset>%u</pwg:YOffset>", benchBelow(random, 3300 - height + 1));
+    snprintf(parts[4], sizeof(parts[4]), "<pwg:ContentRegionUnits>escl:ThreeHundredthsOfInches</pwg:ContentRegionUnits>");
+    for (int i = 0; i < 5; ++i)
+        order[i] = parts[i];
+    shuffleStrings(random, order, 5);
+    snprintf(out, capacity, "<pwg:ScanRegion>%s%s%s%s%s</pwg:ScanRegion>", order[0], order[1], order[2], order[3], order[4]);
+}
+
+static inline BenchTicket generateTicket(BenchRandom* random, BenchTicketSize size) {
+    static const char* const intents[] = { "Document", "TextAndGraphic", "Photo", "Preview" };
+    static const char* const colors[] = { "RGB24", "Grayscale8", "BlackAndWhite1" };
+    static const char* const formats[] = { "application/pdf", "image/png", "image/jpeg" };
+    static const unsigned resolutions[] = { 75, 150, 300, 600 };
+    char parts[BENCH_TICKET_PARTS][1024];
+    char regions[BENCH_TICKET_CAPACITY];
+    size_t count = 0;
+    BenchTicket ticket;
+
+    unsigned resolution = resolutions[benchBelow(random, 4)];
+    size_t format = benchBelow(random, 3);
+    // JPEG, also the default when a small ticket names no format, has no 1-bit pages
+    size_t color = benchBelow(random, format == 2 || size == TICKET_SMALL ? 2 : 3);
+    snprintf(parts[count++], 1024, "<pwg:Version>2.%u</pwg:Version>", 5 + benchBelow(random, 3));
+    snprintf(parts[count++], 1024, "<pwg:InputSource>%s</pwg:InputSource>", benchBelow(random, 2) ? "Feeder" : "Platen");
+    snprintf(parts[count++], 1024, "<scan:ColorMode>%s</scan:ColorMode>", colors[color]);
+    snprintf(parts[count++], 1024, "<scan:XResolution>%u</scan:XResolution>", resolution);
+    snprintf(parts[count++], 1024, "<scan:YResolution>%u</scan:YResolution>", resolution);
+    if (size != TICKET_SMALL) {
+        snprintf(parts[count++], 1024, "<scan:Intent>%s</scan:Intent>", intents[benchBelow(random, 4)]);
+        snprintf(parts[count++], 1024, "<scan:DocumentFormatExt>%s</scan:DocumentFormatExt>", formats[format]);
+        snprintf(parts[count++], 1024, "<pwg:DocumentFormat>%s</pwg:DocumentFormat>", formats[format]);
+        snprintf(parts[count++], 1024, "<scan:BlankPageDetection>%s</scan:BlankPageDetection>",
+                 benchBelow(random, 2) ? "true" : "false");
+    }
+
+    ticket.regions = size == TICKET_SMALL ? 1 : size == TICKET_MEDIUM ? 1 + benchBelow(random, 3) : 4 + benchBelow(random, 5);
+    size_t regionsLength = (size_t)snprintf(regions, BENCH_TICKET_CAPACITY, "<pwg:ScanRegions>");
+    for (size_t i = 0; i < ticket.regions; ++i) {
+        generateRegion(random, regions + regionsLength, BENCH_TICKET_CAPACITY - regionsLength);
+        regionsLength += strlen(regions + regionsLength);
+    }
+    snprintf(regions + regionsLength, BENCH_TICKET_CAPACITY - regionsLength, "</pwg:ScanRegions>");
+
+    // Vendor extensions the parser has to skip over
+    size_t extensions = size == TICKET_SMALL ? 0 : size == TICKET_MEDIUM ? 2 : 8 + benchBelow(random, 8);
+    for (size_t i = 0; i < extensions && count < BENCH_TICKET_PARTS; ++i) {
+        size_t padding = 32 + benchBelow(random, size == TICKET_LARGE ? 600 : 120);
+        int length = snprintf(parts[count], 1024, "<vnd:Extension%zu>", i);
+        for (size_t j = 0; j < padding; ++j)
+            parts[count][length++] = (char)('a' + benchBelow(random, 26));
+        snprintf(parts[count] + length, 1024 - (size_t)length, "</vnd:Extension%zu>", i);
+        count++;
+    }
+
+    char* order[BENCH_TICKET_PARTS + 1];
+    for (size_t i = 0; i < count; ++i)
+        order[i] = parts[i];
+    order[count++] = regions;
+    shuffleStrings(random, order, count);
+
+    ticket.xml = (char*)benchAlloc(BENCH_TICKET_CAPACITY + 1024);
+    ticket.length = (size_t)snprintf(ticket.xml, BENCH_TICKET_CAPACITY + 1024,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?><scan:ScanSettings "
+        "xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\" "
+        "xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\" xmlns:vnd=\"urn:vendor\">");
+    for (size_t i = 0; i < count; ++i) {
+        size_t length = strlen(order[i]);
+        memcpy(ticket.xml + ticket.length, order[i], length);
+        ticket.length += length;
+    }
+    ticket.length += (size_t)snprintf(ticket.xml + ticket.length, 32, "</scan:ScanSettings>");
+    return ticket;
+}
+
+static inline BenchTicket* generateTicketCorpus(size_t count, BenchTicketSize size, uint64_t seed) {
+    BenchRandom random = { seed * 0x9E3779B97F4A7C15u + size + 1 };
+    BenchTicket* tickets = (BenchTicket*)benchAlloc(count * sizeof(BenchTicket));
+    for (size_t i = 0; i < count; ++i)
+        tickets[i] = generateTicket(&random, size);
+    return tickets;
+}
+
+static inline void deleteTicketCorpus(BenchTicket* tickets, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        free(tickets[i].xml);
+    free(tickets);
+}
+
+// Device names in the generated options files. Every fourth device also has
+// a make-and-model section, so looking it up merges two sections.
+static inline void benchSaneName(unsigned device, char* name, size_t size) {
+    snprintf(name, size, "airscan:e%u:Scanner %u", device % 7, device);
+}
+
+static inline void benchModelName(unsigned device, char* name, size_t size) {
+    snprintf(name, size, "Vendor%u Model %u", device % 13, device);
+}
+
+static inline bool benchHasModelSection(unsigned device) {
+    return device % 4 == 0;
+}
+
+// Write an options file with global options and a section for each of
+// devices; returns the number of sections written, 0 on error.
+static inline size_t writeOptionsFile(const char* path, unsigned devices, uint64_t seed) {
+    static const char* const saneOptions[] = { "resolution", "mode", "source", "brightness", "contrast", "depth" };
+    BenchRandom random = { seed * 0x9E3779B97F4A7C15u + devices };
+    FILE* fp = fopen(path, "w");
+    size_t sections = 0;
+    char name[64];
+
+    if (fp == NULL)
+        return 0;
+    fprintf(fp, "# generated for bench-escl\nnote Shared scanner\ncolor-gamma 1.0\nsynthesize-gray 0\n\n");
+    for (unsigned device = 0; device < devices; ++device) {
+        benchSaneName(device, name, sizeof(name));
+        fprintf(fp, "device %s\nnote Device %u\n", name, device);
+        if (benchBelow(&random, 2))
+            fprintf(fp, "gray-gamma %.1f\n", 0.5 + benchBelow(&random, 20) / 10.0);
+        if (benchBelow(&random, 3) == 0)
+            fprintf(fp, "synthesize-gray 1\n");
+        for (unsigned i = benchBelow(&random, 4); i > 0; --i)
+            fprintf(fp, "%s %u\n", saneOptions[benchBelow(&random, 6)], benchBelow(&random, 600));
+        sections++;
+        if (benchHasModelSection(device)) {
+            benchModelName(device, name, sizeof(name));
+            fprintf(fp, "\ndevice %s\nlocation Room %u\nblank-deviation %u\n", name, device, 8 + benchBelow(&random, 32));
+            sections++;
+        }
+        fprintf(fp, "\n");
+    }
+    return fclose(fp) == 0 ? sections : 0;
+}
+
+// Results go to stdout as a table and, with -o, to a file as one JSON object
+// per line. With -b, each result is checked against the same name in an
+// earlier run's file, and one more than threshold slower counts as a regression.
+typedef struct {
+    const char* program;
+    FILE* json;
+    char* baseline;            // the baseline file's text, or NULL
+    double threshold;          // 0.15 for 15%
+    bool quick;                // -q: smaller corpora and shorter runs, for a smoke test
+    int regressions;
+} BenchReport;
+
+static inline char* readBenchFile(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char* text = size >= 0 ? (char*)malloc((size_t)size + 1) : NULL;
+    if (text != NULL)
+        text[fread(text, 1, (size_t)size, fp)] = '\0';
+    fclose(fp);
+    return text;
+}
+
+// -o results.jsonl, -b baseline.jsonl, -t percent, -q. Returns false on bad arguments.
+static inline bool initBenchReport(BenchReport* report, const char* program, int argc, char** argv) {
+    int option;
+    memset(report, 0, sizeof(*report));
+    report->program = program;
+    report->threshold = 0.15;
+    while ((option = getopt(argc, argv, "o:b:t:q")) != -1) {
+        switch (option) {
+        case 'o':
+            report->json = fopen(optarg, "w");
+            if (report->json == NULL) {
+                fprintf(stderr, "%s: cannot write '%s'\n", program, optarg);
+                return false;
+            }
+            break;
+        case 'b':
+            report->baseline = readBenchFile(optarg);
+            if (report->baseline == NULL) {
+                fprintf(stderr, "%s: cannot read '%s'\n", program, optarg);
+                return false;
+            }
+            break;
+        case 't':
+            report->threshold = atof(optarg) / 100;
+            break;
+        case 'q':
+            report->quick = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-q] [-o results.jsonl] [-b baseline.jsonl] [-t percent]\n", program);
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool baselineFor(const BenchReport* report, const char* name, double* nsPerOp) {
+    char key[160];
+    snprintf(key, sizeof(key), "\"name\":\"%s\"", name);
+    for (const char* line = report->baseline; line != NULL && *line != '\0';) {
+        const char* end = strchr(line, '\n');
+        const char* found = strstr(line, key);
+        if (found != NULL && (end == NULL || found < end)) {
+            const char* value = strstr(line, "\"ns_per_op\":");
+            if (value == NULL || (end != NULL && value > end))
+                return false;
+            *nsPerOp = strtod(value + strlen("\"ns_per_op\":"), NULL);
+            return true;
+        }
+        line = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
+// extra is more JSON members, starting with a comma, or "".
+static inline void reportBench(BenchReport* report, const char* name, uint64_t ops, double seconds, const char* extra) {
+    double nsPerOp = ops ? seconds * 1e9 / (double)ops : 0;
+    double previous;
+
+    printf("%-44s %10llu ops %12.1f ns/op", name, (unsigned long long)ops, nsPerOp);
+    if (report->baseline != NULL && baselineFor(report, name, &previous) && previous > 0) {
+        double change = nsPerOp / previous - 1;
+        printf("  %+6.1f%%", change * 100);
+        if (change > report->threshold) {
+            printf("  REGRESSION");
+            report->regressions++;
+        }
+    }
+    printf("\n");
+    if (report->json != NULL)
+        fprintf(report->json, "{\"bench\":\"%s\",\"name\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,\"ns_per_op\":%.2f%s}\n",
+                report->program, name, (unsigned long long)ops, seconds, nsPerOp, extra);
+}
+
+// 0 when nothing regressed; the exit status of the program.
+static inline int finishBenchReport(BenchReport* report, int failures) {
+    if (report->json != NULL)
+        fclose(report->json);
+    free(report->baseline);
+    if (report->regressions)
+        printf("%d results more than %.0f%% slower than the baseline\n", report->regressions, report->threshold * 100);
+    return failures || report->regressions ? 1 : 0;
+}
+
+#endif /* BENCH_ESCL_H */
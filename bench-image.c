@@ -0,0 +1,341 @@
+#include "scan-gamma.h"
+#include "scan-gray.h"
+#include "scan-blank.h"
+#include "scan-pixel.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Throughput of the per-scanline image kernels, checked bit-exact against
+// the scalar versions before timing.
+//
+//   cc -O2 -pthread -o bench-image bench-image.c scan-gamma.c scan-gray.c scan-blank.c scan-pixel.c -lm
+
+// A 600 dpi line across a US Letter platen: 5100 pixels.
+#define LINE_PIXELS 5100
+
+static void fillRandom(void* data, size_t bytes, unsigned seed) {
+    unsigned char* p = (unsigned char*)data;
+    for (size_t i = 0; i < bytes; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        p[i] = (unsigned char)(seed >> 16);
+    }
+}
+
+static void report(const char* name, size_t bytesPerRun, int runs, double seconds) {
+    printf("%-28s %10.1f MB/s\n", name, bytesPerRun * (double)runs / seconds / 1e6);
+}
+
+typedef struct {
+    const char* name;
+    GammaKernel8 kernel8;
+    GammaKernel16 kernel16;
+} GammaCandidate;
+
+static int benchGamma(int runs) {
+    size_t count = LINE_PIXELS * 3;
+    uint8_t* source = (uint8_t*)malloc(count * 2);
+    uint8_t* line = (uint8_t*)malloc(count * 2);
+    uint8_t* check = (uint8_t*)malloc(count * 2);
+    GammaStage stage8, stage16;
+    int failures = 0;
+
+    initGammaStage(&stage8, 2.2, 8);
+    initGammaStage(&stage16, 2.2, 16);
+    fillRandom(source, count * 2, 1);
+
+    GammaCandidate candidates[] = {
+        { "gamma RGB24 scalar", gammaScalar8, NULL },
+        { "gamma RGB24 selected", stage8.kernel8, NULL },
+        { "gamma RGB48 scalar", NULL, gammaScalar16 },
+        { "gamma RGB48 selected", NULL, stage16.kernel16 },
+#if defined(__x86_64__) || defined(__i386__)
+        { "gamma RGB24 avx2", __builtin_cpu_supports("avx2") ? gammaAvx2_8 : NULL, NULL },
+        { "gamma RGB48 avx2", NULL, __builtin_cpu_supports("avx2") ? gammaAvx2_16 : NULL },
+#endif
+    };
+
+    for (size_t c = 0; c < sizeof(candidates) / sizeof(candidates[0]); ++c) {
+        const GammaCandidate* candidate = &candidates[c];
+        size_t bytes = candidate->kernel8 ? count : count * 2;
+        if (candidate->kernel8 == NULL && candidate->kernel16 == NULL)
+            continue;
+
+        memcpy(line, source, bytes);
+        memcpy(check, source, bytes);
+        if (candidate->kernel8) {
+            candidate->kernel8(&stage8, line, count);
+            gammaScalar8(&stage8, check, count);
+        } else {
+            candidate->kernel16(&stage16, (uint16_t*)line, count);
+            gammaScalar16(&stage16, (uint16_t*)check, count);
+        }
+        if (memcmp(line, check, bytes) != 0) {
+            printf("%s: differs from scalar\n", candidate->name);
+            failures++;
+            continue;
+        }
+
+        double start = benchNow();
+        for (int i = 0; i < runs; ++i) {
+            if (candidate->kernel8)
+                candidate->kernel8(&stage8, line, count);
+            else
+                candidate->kernel16(&stage16, (uint16_t*)line, count);
+        }
+        report(candidate->name, bytes, runs, benchNow() - start);
+    }
+
+    deleteGammaStage(&stage8);
+    deleteGammaStage(&stage16);
+    free(source);
+    free(line);
+    free(check);
+    return failures;
+}
+
+typedef struct {
+    const char* name;
+    GrayKernel8 kernel8;
+    GrayKernel16 kernel16;
+} GrayCandidate;
+
+// RGB to gray is timed both bare and with the gray gamma folded in; the MB/s
+// figures count the RGB bytes read.
+static int benchGray(int runs) {
+    size_t pixels = LINE_PIXELS;
+    uint16_t* source = (uint16_t*)malloc(pixels * 3 * sizeof(uint16_t));
+    uint16_t* gray = (uint16_t*)malloc(pixels * sizeof(uint16_t));
+    uint16_t* check = (uint16_t*)malloc(pixels * sizeof(uint16_t));
+    GammaStage stage8, stage16;
+    int failures = 0;
+
+    initGammaStage(&stage8, 1.8, 8);
+    initGammaStage(&stage16, 1.8, 16);
+    fillRandom(source, pixels * 3 * sizeof(uint16_t), 2);
+
+    GrayCandidate candidates[] = {
+        { "gray RGB24 scalar", grayScalar8, NULL },
+        { "gray RGB24 selected", synthesizeGray8, NULL },
+        { "gray RGB48 scalar", NULL, grayScalar16 },
+        { "gray RGB48 selected", NULL, synthesizeGray16 },
+#if defined(__x86_64__) || defined(__i386__)
+        { "gray RGB24 ssse3", __builtin_cpu_supports("ssse3") ? graySsse3_8 : NULL, NULL },
+        { "gray RGB48 sse4.1", NULL, __builtin_cpu_supports("sse4.1") ? graySse41_16 : NULL },
+#endif
+    };
+
+    for (size_t c = 0; c < sizeof(candidates) / sizeof(candidates[0]); ++c) {
+        const GrayCandidate* candidate = &candidates[c];
+        if (candidate->kernel8 == NULL && candidate->kernel16 == NULL)
+            continue;
+
+        for (int withGamma = 0; withGamma < 2; ++withGamma) {
+            const GammaStage* gamma = withGamma ? (candidate->kernel8 ? &stage8 : &stage16) : NULL;
+            size_t bytes = candidate->kernel8 ? pixels * 3 : pixels * 3 * sizeof(uint16_t);
+            char name[64];
+            snprintf(name, sizeof(name), "%s%s", candidate->name, withGamma ? " +gamma" : "");
+
+            // Odd pixel counts exercise the scalar tail of the vector kernels
+            size_t sizes[] = { pixels, pixels - 7, 1 };
+            bool exact = true;
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+                if (candidate->kernel8) {
+                    candidate->kernel8((const uint8_t*)source, (uint8_t*)gray, sizes[s], gamma);
+                    grayScalar8((const uint8_t*)source, (uint8_t*)check, sizes[s], gamma);
+                    exact = exact && memcmp(gray, check, sizes[s]) == 0;
+                } else {
+                    candidate->kernel16(source, gray, sizes[s], gamma);
+                    grayScalar16(source, check, sizes[s], gamma);
+                    exact = exact && memcmp(gray, check, sizes[s] * sizeof(uint16_t)) == 0;
+                }
+            }
+            if (!exact) {
+                printf("%s: differs from scalar\n", name);
+                failures++;
+                continue;
+            }
+
+            double start = benchNow();
+            for (int i = 0; i < runs; ++i) {
+                if (candidate->kernel8)
+                    candidate->kernel8((const uint8_t*)source, (uint8_t*)gray, pixels, gamma);
+                else
+                    candidate->kernel16(source, gray, pixels, gamma);
+            }
+            report(name, bytes, runs, benchNow() - start);
+        }
+    }
+
+    deleteGammaStage(&stage8);
+    deleteGammaStage(&stage16);
+    free(source);
+    free(gray);
+    free(check);
+    return failures;
+}
+
+// The luma kernel for each ColorMode layout against the generic loop that
+// reads the layout per pixel; MB/s counts the line bytes read.
+static int benchLuma(int runs) {
+    static const struct {
+        const char* name;
+        int channels;
+        int depth;
+    } layouts[] = {
+        { "BlackAndWhite1", 1, 1 },
+        { "Grayscale8", 1, 8 },
+        { "Grayscale16", 1, 16 },
+        { "RGB24", 3, 8 },
+        { "RGB48", 3, 16 },
+    };
+    size_t pixels = LINE_PIXELS;
+    uint8_t* line = (uint8_t*)malloc(pixels * 3 * sizeof(uint16_t));
+    uint8_t* luma = (uint8_t*)malloc(pixels);
+    uint8_t* check = (uint8_t*)malloc(pixels);
+    int failures = 0;
+
+    fillRandom(line, pixels * 3 * sizeof(uint16_t), 4);
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+        const ScanPixelKernels* kernels = scanPixelKernelsFor(layouts[l].channels, layouts[l].depth);
+        size_t bytes = scanLineBytes(pixels, layouts[l].channels, layouts[l].depth);
+        char name[64];
+
+        if (kernels == NULL) {
+            printf("luma %s: no kernels\n", layouts[l].name);
+            failures++;
+            continue;
+        }
+        size_t sizes[] = { pixels, pixels - 7, 1 };
+        bool exact = true;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            kernels->luma(line, luma, sizes[s]);
+            lumaGeneric(line, check, sizes[s], layouts[l].channels, layouts[l].depth);
+            exact = exact && memcmp(luma, check, sizes[s]) == 0;
+        }
+        if (!exact) {
+            printf("luma %s: differs from generic\n", layouts[l].name);
+            failures++;
+            continue;
+        }
+
+        double start = benchNow();
+        for (int i = 0; i < runs; ++i)
+            lumaGeneric(line, luma, pixels, layouts[l].channels, layouts[l].depth);
+        snprintf(name, sizeof(name), "luma %s generic", layouts[l].name);
+        report(name, bytes, runs, benchNow() - start);
+
+        start = benchNow();
+        for (int i = 0; i < runs; ++i)
+            kernels->luma(line, luma, pixels);
+        snprintf(name, sizeof(name), "luma %s", layouts[l].name);
+        report(name, bytes, runs, benchNow() - start);
+    }
+
+    // Packing to 1 bit and reading it back gives 0 or 255 on the right side
+    // of the threshold
+    binarizeGray8(line, check, pixels, 128);
+    scanPixelKernelsFor(1, 1)->luma(check, luma, pixels);
+    for (size_t x = 0; x < pixels; ++x) {
+        if (luma[x] != (line[x] >= 128 ? 255 : 0)) {
+            printf("binarize: pixel %zu differs\n", x);
+            failures++;
+            break;
+        }
+    }
+    double start = benchNow();
+    for (int i = 0; i < runs; ++i)
+        binarizeGray8(line, check, pixels, 128);
+    report("binarize gray8", pixels, runs, benchNow() - start);
+
+    free(line);
+    free(luma);
+    free(check);
+    return failures;
+}
+
+// Synthetic 300 dpi letter pages: sensor noise on white paper, the same with
+// faint show-through from the front side, and a page of text.
+#define PAGE_WIDTH 2550
+#define PAGE_HEIGHT 3300
+
+typedef enum { PAGE_WHITE, PAGE_SHOW_THROUGH, PAGE_TEXT } PageKind;
+
+static void renderPageLine(PageKind kind, int y, int channels, uint8_t* line, unsigned* seed) {
+    for (int x = 0; x < PAGE_WIDTH; ++x) {
+        *seed = *seed * 1103515245u + 12345u;
+        int value = 236 + (int)((*seed >> 16) % 9) - 4;
+        int row = y % 48, column = x % 30;
+        bool glyph = y > 300 && y < PAGE_HEIGHT - 300 && x > 300 && x < PAGE_WIDTH - 300
+                     && row < 28 && column < 22 && ((x / 30 + y / 48) % 7 != 0);
+        if (kind == PAGE_SHOW_THROUGH && glyph && (row % 9 < 2 || column % 7 < 2))
+            value -= 18;
+        if (kind == PAGE_TEXT && glyph && (row % 9 < 2 || column % 7 < 2))
+            value = 30;
+        for (int c = 0; c < channels; ++c)
+            line[x * channels + c] = (uint8_t)value;
+    }
+}
+
+static int benchBlank(int pages) {
+    static const struct {
+        const char* name;
+        PageKind kind;
+        bool blank;
+    } kinds[] = {
+        { "white", PAGE_WHITE, true },
+        { "show-through", PAGE_SHOW_THROUGH, true },
+        { "text", PAGE_TEXT, false },
+    };
+    BlankPageThresholds thresholds = { 0.3, 0.5, 16 };
+    int failures = 0;
+
+    for (int channels = 1; channels <= 3; channels += 2) {
+        size_t stride = (size_t)PAGE_WIDTH * channels;
+        uint8_t* page = (uint8_t*)malloc(stride * PAGE_HEIGHT);
+        BlankPageDetector detector;
+        initBlankPageDetector(&detector, &thresholds, PAGE_WIDTH, channels, 8);
+
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) {
+            unsigned seed = 3;
+            for (int y = 0; y < PAGE_HEIGHT; ++y)
+                renderPageLine(kinds[k].kind, y, channels, page + y * stride, &seed);
+
+            char name[64];
+            snprintf(name, sizeof(name), "blank %s %s", channels == 1 ? "gray8" : "rgb24", kinds[k].name);
+
+            BlankPageStats stats;
+            double start = benchNow();
+            bool blank = false;
+            for (int p = 0; p < pages; ++p) {
+                for (int y = 0; y < PAGE_HEIGHT; ++y)
+                    feedBlankPageLine(&detector, page + y * stride);
+                blank = finishBlankPage(&detector, &stats);
+            }
+            double seconds = benchNow() - start;
+
+            if (blank != kinds[k].blank) {
+                printf("%s: detected as %s (ink %.2f%%, edges %.2f%%, deviation %.1f)\n", name,
+                       blank ? "blank" : "printed", stats.inkCoverage, stats.edgeDensity, stats.deviation);
+                failures++;
+                continue;
+            }
+            report(name, stride * PAGE_HEIGHT, pages, seconds);
+        }
+        deleteBlankPageDetector(&detector);
+        free(page);
+    }
+    return failures;
+}
+
+int main(int argc, char** argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : 20000;
+    int failures = 0;
+
+    failures += benchGamma(runs);
+    failures += benchGray(runs);
+    failures += benchLuma(runs);
+    failures += benchBlank(runs / 1000 > 0 ? runs / 1000 : 1);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#include "page-pool.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// A long ADF batch of 300 dpi Letter color pages, with page buffers from
+// malloc and free as the pipeline used to get them, and from the page pool.
+// Every page is written in full, as the device would, and read once, as the
+// encoder would. Reports time and minor page faults per page; after warm-up
+// the pool must not fault or map any more.
+//
+//   cc -O2 -pthread -o bench-page-pool bench-page-pool.c page-pool.c
+
+#define PAGE_WIDTH 2550
+#define PAGE_LINES 3300
+#define JOB_PAGES 4        // pages a job holds at once
+#define WARM_UP 2          // batches before the pool is measured
+
+static long minorFaults(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+static uint64_t scanPage(uint8_t* data, size_t stride, unsigned number) {
+    size_t lineBytes = PAGE_WIDTH * 3;
+    uint64_t sum = 0;
+    for (size_t y = 0; y < PAGE_LINES; ++y)
+        memset(data + y * stride, (int)(number + y), lineBytes);
+    for (size_t y = 0; y < PAGE_LINES; y += 8)
+        sum += data[y * stride + (y % lineBytes)];
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    int batches = argc > 1 ? atoi(argv[1]) : 20;
+    PageShape shape = { PAGE_WIDTH, PAGE_LINES, 3, 8 };
+    size_t stride = pageStrideFor(&shape);
+    uint64_t mallocSum = 0, poolSum = 0;
+    int failures = 0;
+
+    // Each batch gets fresh buffers, as every job did with malloc
+    long faults = minorFaults();
+    double start = benchNow();
+    for (int batch = 0; batch < batches; ++batch) {
+        uint8_t* pages[JOB_PAGES];
+        for (int i = 0; i < JOB_PAGES; ++i)
+            pages[i] = (uint8_t*)malloc(PAGE_WIDTH * 3 * PAGE_LINES);
+        for (int i = 0; i < JOB_PAGES; ++i)
+            mallocSum += scanPage(pages[i], PAGE_WIDTH * 3, (unsigned)(batch * JOB_PAGES + i));
+        for (int i = 0; i < JOB_PAGES; ++i)
+            free(pages[i]);
+    }
+    double mallocSeconds = benchNow() - start;
+    long mallocFaults = minorFaults() - faults;
+
+    PagePool* pool = new_PagePool(0);
+    PagePoolStats warm, stats;
+    double poolSeconds = 0;
+    long poolFaults = 0;
+    for (int batch = 0; batch < batches + WARM_UP; ++batch) {
+        PageBuffer* buffers[JOB_PAGES];
+        if (batch == WARM_UP) {
+            getPagePoolStats(pool, &warm);
+            faults = minorFaults();
+            start = benchNow();
+        }
+        if (reservePageBuffers(pool, &shape, JOB_PAGES, buffers) != 0) {
+            printf("reservation failed\n");
+            return 1;
+        }
+        for (int i = 0; i < JOB_PAGES; ++i) {
+            if ((uintptr_t)buffers[i]->data % PAGE_POOL_ALIGNMENT != 0 || buffers[i]->stride != stride)
+                failures++;
+            uint64_t sum = scanPage(buffers[i]->data, buffers[i]->stride, (unsigned)((batch - WARM_UP) * JOB_PAGES + i));
+            if (batch >= WARM_UP)
+                poolSum += sum;
+        }
+        releasePageBuffers(pool, buffers, JOB_PAGES);
+    }
+    poolSeconds = benchNow() - start;
+    poolFaults = minorFaults() - faults;
+    getPagePoolStats(pool, &stats);
+
+    // A limit below two jobs' worth refuses the second job as a whole
+    PagePool* limited = new_PagePool((size_t)JOB_PAGES * stride * PAGE_LINES * 3 / 2);
+    PageBuffer* first[JOB_PAGES];
+    PageBuffer* second[JOB_PAGES];
+    failures += reservePageBuffers(limited, &shape, JOB_PAGES, first) != 0;
+    failures += reservePageBuffers(limited, &shape, JOB_PAGES, second) == 0;
+    releasePageBuffers(limited, first, JOB_PAGES);
+    failures += reservePageBuffers(limited, &shape, JOB_PAGES, second) != 0;
+    releasePageBuffers(limited, second, JOB_PAGES);
+    delete_PagePool(limited);
+
+    if (mallocSum != poolSum)
+        failures++;
+    if (stats.maps != warm.maps || stats.bytesMapped != warm.bytesMapped)
+        failures++;
+
+    double pages = (double)batches * JOB_PAGES;
+    printf("%-8s %8.2f ms/page %10.1f faults/page\n", "malloc", mallocSeconds * 1e3 / pages, mallocFaults / pages);
+    printf("%-8s %8.2f ms/page %10.1f faults/page\n", "pool", poolSeconds * 1e3 / pages, poolFaults / pages);
+    printf("pool: %zu maps, %zu reuses, high water %.1f MB mapped, %.1f MB in use, stride %zu\n", stats.maps,
+           stats.reuses, stats.highWaterMapped / 1048576.0, stats.highWaterInUse / 1048576.0, stride);
+    if (failures)
+        printf("%d checks failed\n", failures);
+
+    delete_PagePool(pool);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+#include "scan-batch.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// Pages per minute for an adfBatch job run one page after another against
+// the three-stage pipeline. The device and the client link are simulated
+// with fixed delays; processing (gray synthesis, gamma, blank detection) and
+// a checksum standing in for the encoder are real work. Both runs must write
+// the same pages.
+//
+//   cc -O2 -pthread -I<pappl> $(xml2-config --cflags) -o bench-scan-batch bench-scan-batch.c scan-batch.c page-pool.c scan-job.c scan-blank.c scan-gamma.c scan-gray.c scan-pixel.c -lz -lm $(xml2-config --libs)
+
+// 150 dpi US Letter in RGB24
+#define PAGE_WIDTH 1275
+#define PAGE_HEIGHT 1650
+#define PAGE_BYTES ((size_t)PAGE_WIDTH * PAGE_HEIGHT * 3)
+#define MAX_PAGES 64
+
+typedef struct {
+    int sheets;             // in the feeder
+    int sheetsRead;
+    unsigned readMillis;    // device time per sheet
+    unsigned sendMillis;    // transfer time per page
+    uint8_t* printed;       // sheet templates
+    uint8_t* empty;
+    uLong checksums[MAX_PAGES];
+    unsigned numbers[MAX_PAGES];
+    int written;
+} SimulatedJob;
+
+// Every third sheet has a blank back side.
+static int readSheet(void* context, ScanPage* page) {
+    SimulatedJob* job = (SimulatedJob*)context;
+    if (job->sheetsRead == job->sheets)
+        return 0;
+    const uint8_t* source = job->sheetsRead++ % 3 == 2 ? job->empty : job->printed;
+    if (page->stride < PAGE_WIDTH * 3 || page->capacity < page->stride * PAGE_HEIGHT)
+        return -1;
+    for (size_t y = 0; y < PAGE_HEIGHT; ++y)
+        memcpy(page->data + y * page->stride, source + y * PAGE_WIDTH * 3, PAGE_WIDTH * 3);
+    page->width = PAGE_WIDTH;
+    page->lines = PAGE_HEIGHT;
+    page->bytesPerLine = page->stride;
+    page->channels = 3;
+    page->depth = 8;
+    benchSleepMs(job->readMillis);
+    return 1;
+}
+
+static int sendPage(void* context, const ScanPage* page) {
+    SimulatedJob* job = (SimulatedJob*)context;
+    if (job->written == MAX_PAGES)
+        return -1;
+    job->checksums[job->written] = crc32(0, page->data, (uInt)(page->bytesPerLine * page->lines));
+    job->numbers[job->written++] = page->number;
+    benchSleepMs(job->sendMillis);
+    return 0;
+}
+
+static void renderSheets(SimulatedJob* job) {
+    unsigned seed = 7;
+    job->printed = (uint8_t*)malloc(PAGE_BYTES);
+    job->empty = (uint8_t*)malloc(PAGE_BYTES);
+    for (size_t y = 0; y < PAGE_HEIGHT; ++y) {
+        for (size_t x = 0; x < PAGE_WIDTH; ++x) {
+            seed = seed * 1103515245u + 12345u;
+            uint8_t paper = (uint8_t)(232 + (seed >> 16) % 7);
+            bool ink = y > 150 && y < PAGE_HEIGHT - 150 && x > 150 && x < PAGE_WIDTH - 150 && y % 24 < 4 && x % 15 < 10;
+            for (int c = 0; c < 3; ++c) {
+                job->printed[(y * PAGE_WIDTH + x) * 3 + c] = ink ? 20 : paper;
+                job->empty[(y * PAGE_WIDTH + x) * 3 + c] = paper;
+            }
+        }
+    }
+}
+
+// The same stages as the pipeline, one page at a time, on a buffer laid out as the pool's are.
+static int runSerial(SimulatedJob* job, const ScanBatchProcessing* processing, const PageShape* shape) {
+    ScanPage page = { 0 };
+    BlankPageDetector detector;
+    page.stride = pageStrideFor(shape);
+    page.capacity = page.stride * PAGE_HEIGHT;
+    page.data = (uint8_t*)malloc(page.capacity);
+    initBlankPageDetector(&detector, &processing->blankThresholds, PAGE_WIDTH, 1, 8);
+
+    int status;
+    unsigned number = 0;
+    while ((status = readSheet(job, &page)) > 0) {
+        page.number = ++number;
+        if (processScanPage(processing, &detector, &page) && sendPage(job, &page) != 0) {
+            status = -1;
+            break;
+        }
+    }
+    deleteBlankPageDetector(&detector);
+    free(page.data);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    int sheets = argc > 1 ? atoi(argv[1]) : 24;
+    SimulatedJob serial = { 0 }, pipelined = { 0 };
+    GammaStage gamma;
+    int failures = 0;
+
+    if (sheets < 1 || sheets > MAX_PAGES)
+        sheets = 24;
+    initGammaStage(&gamma, 2.2, 8);
+    ScanBatchProcessing processing = {
+        .gamma = &gamma,
+        .synthesizeGray = true,
+        .dropBlank = true,
+        .blankThresholds = { .inkCoverage = 0.3, .edgeDensity = 0.5, .deviation = 16 },
+    };
+
+    renderSheets(&serial);
+    serial.sheets = sheets;
+    serial.readMillis = 40;
+    serial.sendMillis = 25;
+    pipelined = serial;
+
+    PageShape shape = { PAGE_WIDTH, PAGE_HEIGHT, 3, 8 };
+    double start = benchNow();
+    failures += runSerial(&serial, &processing, &shape) != 0;
+    double serialSeconds = benchNow() - start;
+
+    ScanBatchIO io = { readSheet, sendPage, &pipelined };
+    PagePool* pool = new_PagePool(0);
+    ScanBatch* batch = new_ScanBatch(adfBatch, &io, &processing, pool, &shape, 2);
+    start = benchNow();
+    failures += batch == NULL || runScanBatch(batch) != 0;
+    double pipelinedSeconds = benchNow() - start;
+
+    if (pipelined.written != serial.written
+        || memcmp(pipelined.checksums, serial.checksums, sizeof(uLong) * serial.written) != 0
+        || memcmp(pipelined.numbers, serial.numbers, sizeof(unsigned) * serial.written) != 0) {
+        printf("pipelined pages differ from serial\n");
+        failures++;
+    }
+
+    printf("%d sheets, %d written, %u blank dropped\n", sheets, pipelined.written,
+           batch ? atomic_load(&batch->pagesDropped) : 0);
+    printf("%-12s %8.1f pages/min\n", "serial", sheets * 60.0 / serialSeconds);
+    printf("%-12s %8.1f pages/min\n", "pipelined", sheets * 60.0 / pipelinedSeconds);
+
+    delete_ScanBatch(batch);
+    delete_PagePool(pool);
+    deleteGammaStage(&gamma);
+    free(serial.printed);
+    free(serial.empty);
+    return failures ? 1 : 0;
+}
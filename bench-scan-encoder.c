@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include "scan-encoder.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <zlib.h>
+#include <jpeglib.h>
+
+// Encoding a 300 dpi Letter color page in every DocumentFormat: one stripe on
+// one thread, as a plain encoder would, against stripes on a pool with a
+// thread per CPU (or as many as the second argument says). Reports the time
+// to the first byte and to the whole document, and decodes every document to
+// check it: striped JPEG must decode to the same pixels as the single-stripe
+// one, PNG and PDF to the page itself.
+//
+//   cc -O2 -pthread $(xml2-config --cflags) -o bench-scan-encoder bench-scan-encoder.c scan-encoder.c escl-scan-settings.c -ljpeg -lz -lm
+
+#define PAGE_WIDTH 2550
+#define PAGE_LINES 3300
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+    double started;
+    double firstByte;
+} Document;
+
+static int collect(void* context, const void* data, size_t length) {
+    Document* document = (Document*)context;
+    if (document->length == 0)
+        document->firstByte = benchNow() - document->started;
+    if (document->length + length > document->capacity) {
+        size_t capacity = document->capacity ? document->capacity : 1 << 20;
+        while (capacity < document->length + length)
+            capacity *= 2;
+        uint8_t* grown = (uint8_t*)realloc(document->data, capacity);
+        if (grown == NULL)
+            return -1;
+        document->data = grown;
+        document->capacity = capacity;
+    }
+    memcpy(document->data + document->length, data, length);
+    document->length += length;
+    return 0;
+}
+
+// Paper, a photo gradient and lines of "text", with sensor noise.
+static void fillPage(ScanPage* page) {
+    uint32_t seed = 12345;
+    for (size_t y = 0; y < page->lines; ++y) {
+        uint8_t* line = page->data + y * page->bytesPerLine;
+        for (size_t x = 0; x < page->width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int)(seed >> 28) - 8;
+            int r = 236, g = 234, b = 228;
+            if (y > 300 && y < 1500 && x > 300 && x < 2250) {
+                r = (int)(x * 255 / 2550);
+                g = (int)(y * 255 / 3300);
+                b = (int)((x + y) * 255 / 5850);
+            } else if (y > 1700 && (y / 50) % 2 == 0 && x > 300 && x < 2250 && (x * 7 + y) % 23 < 9) {
+                r = g = b = 30;
+            }
+            line[3 * x] = (uint8_t)(r + noise < 0 ? 0 : r + noise > 255 ? 255 : r + noise);
+            line[3 * x + 1] = (uint8_t)(g + noise < 0 ? 0 : g + noise > 255 ? 255 : g + noise);
+            line[3 * x + 2] = (uint8_t)(b + noise < 0 ? 0 : b + noise > 255 ? 255 : b + noise);
+        }
+    }
+}
+
+static int encodeDocument(ScanEncoderPool* pool, ScanDocumentFormat format, size_t stripeLines,
+                          const ScanPage* page, Document* document) {
+    ScanEncoderSettings settings = { format, 0, 0, stripeLines, 300, 300 };
+    memset(document, 0, sizeof(*document));
+    document->started = benchNow();
+    ScanEncoder* encoder = new_ScanEncoder(pool, &settings, collect, document);
+    int result = encodeScanPage(encoder, page);
+    if (result == 0)
+        result = finishScanEncoder(encoder);
+    delete_ScanEncoder(encoder);
+    return result;
+}
+
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf escape;
+} DecodeErrors;
+
+static void decodeFailed(j_common_ptr info) {
+    longjmp(((DecodeErrors*)info->err)->escape, 1);
+}
+
+static bool decodeJpeg(const Document* document, uint8_t* pixels) {
+    struct jpeg_decompress_struct info;
+    DecodeErrors errors;
+
+    info.err = jpeg_std_error(&errors.base);
+    errors.base.error_exit = decodeFailed;
+    if (setjmp(errors.escape)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, document->data, document->length);
+    jpeg_read_header(&info, TRUE);
+    jpeg_start_decompress(&info);
+    if (info.output_width != PAGE_WIDTH || info.output_height != PAGE_LINES || info.output_components != 3)
+        longjmp(errors.escape, 1);
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW line = pixels + (size_t)info.output_scanline * PAGE_WIDTH * 3;
+        jpeg_read_scanlines(&info, &line, 1);
+    }
+    jpeg_finish_decompress(&info);
+    // Corrupt restart markers only produce warnings
+    int warnings = (int)errors.base.num_warnings;
+    jpeg_destroy_decompress(&info);
+    return warnings == 0;
+}
+
+// Inflate a zlib stream of Up/None-filtered lines and compare it with the page.
+static int checkFiltered(const uint8_t* stream, size_t length, const ScanPage* page) {
+    size_t lineBytes = page->width * 3;
+    size_t size = (lineBytes + 1) * page->lines;
+    uint8_t* filtered = (uint8_t*)malloc(size);
+    uLongf inflated = size;
+    int failures = 0;
+
+    if (uncompress(filtered, &inflated, stream, length) != Z_OK || inflated != size) {
+        free(filtered);
+        return 1;
+    }
+    for (size_t y = 0; y < page->lines && !failures; ++y) {
+        uint8_t* line = filtered + y * (lineBytes + 1);
+        const uint8_t* expected = page->data + y * page->bytesPerLine;
+        for (size_t i = 0; i < lineBytes; ++i) {
+            uint8_t value = line[1 + i];
+            if (line[0] == 2)
+                value += expected[i - page->bytesPerLine];
+            else if (line[0] != 0)
+                failures = 1;
+            if (value != expected[i])
+                failures = 1;
+        }
+    }
+    free(filtered);
+    return failures;
+}
+
+static uint32_t bigEndian32(const uint8_t* bytes) {
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+static int checkPng(const Document* document, const ScanPage* page) {
+    uint8_t* idat = (uint8_t*)malloc(document->length);
+    size_t idatLength = 0;
+    size_t p = 8;
+    bool ended = false;
+
+    while (p + 12 <= document->length && !ended) {
+        uint32_t length = bigEndian32(document->data + p);
+        const uint8_t* type = document->data + p + 4;
+        if (p + 12 + length > document->length
+            || crc32(0, type, length + 4) != bigEndian32(document->data + p + 8 + length)) {
+            free(idat);
+            return 1;
+        }
+        if (memcmp(type, "IDAT", 4) == 0) {
+            memcpy(idat + idatLength, type + 4, length);
+            idatLength += length;
+        }
+        ended = memcmp(type, "IEND", 4) == 0;
+        p += 12 + length;
+    }
+    int failures = !ended || checkFiltered(idat, idatLength, page);
+    free(idat);
+    return failures;
+}
+
+static int checkPdf(const Document* document, const ScanPage* page) {
+    const char* text = (const char*)document->data;
+    const char* image = strstr(text, "/Subtype /Image");
+    const char* stream = image ? strstr(image, "stream\n") : NULL;
+    const char* end = stream ? (const char*)memmem(stream, document->length - (stream - text), "\nendstream", 10) : NULL;
+    if (end == NULL)
+        return 1;
+    // startxref must point at the table
+    const char* startxref = (const char*)memmem(end, document->length - (end - text), "startxref\n", 10);
+    if (startxref == NULL || strncmp(text + strtoul(startxref + 10, NULL, 10), "xref\n", 5) != 0)
+        return 1;
+    stream += 7;
+    return checkFiltered((const uint8_t*)stream, (size_t)(end - stream), page);
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 3;
+    size_t threads = argc > 2 ? (size_t)atoi(argv[2]) : 0;
+    ScanPage page = { NULL, 0, PAGE_WIDTH * 3, PAGE_WIDTH, PAGE_LINES, PAGE_WIDTH * 3, 3, 8, 1, false };
+    ScanEncoderPool* single = new_ScanEncoderPool(1);
+    ScanEncoderPool* pool = new_ScanEncoderPool(threads);
+    int failures = 0;
+
+    page.capacity = page.bytesPerLine * page.lines;
+    page.data = (uint8_t*)malloc(page.capacity);
+    fillPage(&page);
+    printf("%zu encoder threads\n", pool->threadCount);
+
+    static const char* names[] = { "JPEG", "PNG", "PDF" };
+    for (ScanDocumentFormat format = SCAN_FORMAT_JPEG; format <= SCAN_FORMAT_PDF; ++format) {
+        Document serial, striped;
+        double serialTime = 1e9, stripedTime = 1e9, serialFirst = 0, stripedFirst = 0;
+        for (int round = 0; round < rounds; ++round) {
+            if (round)
+                free(serial.data), free(striped.data);
+            if (encodeDocument(single, format, PAGE_LINES, &page, &serial) != 0) {
+                printf("%s: encoding failed\n", names[format]);
+                return 1;
+            }
+            double serialElapsed = benchNow() - serial.started;
+            if (encodeDocument(pool, format, 0, &page, &striped) != 0) {
+                printf("%s: encoding failed\n", names[format]);
+                return 1;
+            }
+            double stripedElapsed = benchNow() - striped.started;
+            if (serialElapsed < serialTime) {
+                serialTime = serialElapsed;
+                serialFirst = serial.firstByte;
+            }
+            if (stripedElapsed < stripedTime) {
+                stripedTime = stripedElapsed;
+                stripedFirst = striped.firstByte;
+            }
+        }
+
+        int failed = 0;
+        if (format == SCAN_FORMAT_JPEG) {
+            uint8_t* expected = (uint8_t*)malloc(page.capacity);
+            uint8_t* decoded = (uint8_t*)malloc(page.capacity);
+            failed = !decodeJpeg(&serial, expected) || !decodeJpeg(&striped, decoded)
+                     || memcmp(expected, decoded, page.capacity) != 0;
+            free(expected);
+            free(decoded);
+        } else if (format == SCAN_FORMAT_PNG) {
+            failed = checkPng(&serial, &page) || checkPng(&striped, &page);
+        } else {
+            failed = checkPdf(&serial, &page) || checkPdf(&striped, &page);
+        }
+        if (failed)
+            printf("%s: decoded document does not match\n", names[format]);
+        failures += failed;
+
+        printf("%-5s one stripe  %7.1f ms first byte %7.1f ms  %8zu bytes\n", names[format], serialTime * 1e3,
+               serialFirst * 1e3, serial.length);
+        printf("%-5s striped     %7.1f ms first byte %7.1f ms  %8zu bytes  %.2fx\n", names[format],
+               stripedTime * 1e3, stripedFirst * 1e3, striped.length, serialTime / stripedTime);
+        free(serial.data);
+        free(striped.data);
+    }
+
+    delete_ScanEncoderPool(single);
+    delete_ScanEncoderPool(pool);
+    free(page.data);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+#include "scan-job.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Per-job cost of N field lookups: re-parsing the ticket on every lookup
+// (the old getString) against the parse-once cache in scan-job.c.
+//
+//   cc -O2 -I<pappl> $(xml2-config --cflags) -o bench-scan-job bench-scan-job.c scan-job.c $(xml2-config --libs)
+
+static const char* sampleTicket =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?><scan:ScanSettings xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\" xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\"><pwg:Version>2.6</pwg:Version><scan:Intent>Photo</scan:Intent><pwg:ScanRegions><pwg:ScanRegion><pwg:Height>1200</pwg:Height><pwg:ContentRegionUnits>escl:ThreeHundredthsOfInches</pwg:ContentRegionUnits><pwg:Width>1800</pwg:Width><pwg:XOffset>0</pwg:XOffset><pwg:YOffset>10</pwg:YOffset></pwg:ScanRegion></pwg:ScanRegions><pwg:InputSource>Platen</pwg:InputSource><scan:ColorMode>Grayscale823</scan:ColorMode><scan:BlankPageDetection>true</scan:BlankPageDetection></scan:ScanSettings>";
+
+static const char* fieldNames[] = {
+    "Version", "Intent", "Height", "ContentRegionUnits", "Width",
+    "XOffset", "YOffset", "InputSource", "ColorMode", "BlankPageDetection",
+};
+
+// The previous getString: parse, walk the root's children, free the tree.
+static char* reparseGetString(const char* xml, const char* name) {
+    xmlDocPtr doc = xmlParseMemory(xml, strlen(xml));
+    if (doc == NULL)
+        return NULL;
+    xmlNodePtr cur = xmlDocGetRootElement(doc);
+    for (cur = cur ? cur->xmlChildrenNode : NULL; cur != NULL; cur = cur->next) {
+        if (!xmlStrcmp(cur->name, (const xmlChar *)name)) {
+            char* content = (char*)xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
+            xmlFreeDoc(doc);
+            return content;
+        }
+    }
+    xmlFreeDoc(doc);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 5000;
+    size_t fieldCount = sizeof(fieldNames) / sizeof(fieldNames[0]);
+
+    xmlInitParser();
+    printf("%8s %16s %16s\n", "lookups", "reparse ns/job", "cached ns/job");
+
+    for (size_t n = 1; n <= fieldCount; ++n) {
+        double start = benchNow();
+        for (int i = 0; i < iterations; ++i) {
+            for (size_t f = 0; f < n; ++f)
+                xmlFree(reparseGetString(sampleTicket, fieldNames[f]));
+        }
+        double reparseTime = benchNow() - start;
+
+        start = benchNow();
+        for (int i = 0; i < iterations; ++i) {
+            papplScanSettingsXML* scanSettings = new_ScanSettingsXml(sampleTicket);
+            for (size_t f = 0; f < n; ++f)
+                xmlFree(getString(scanSettings, fieldNames[f]));
+            delete_ScanSettingsXml(scanSettings);
+        }
+        double cachedTime = benchNow() - start;
+
+        printf("%8zu %16.0f %16.0f\n", n, reparseTime * 1e9 / iterations, cachedTime * 1e9 / iterations);
+    }
+
+    xmlCleanupParser();
+    return 0;
+}
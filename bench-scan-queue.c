@@ -0,0 +1,267 @@
+#include "scan-queue.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// A client sending jobs to one simulated scanner whose warm-up (lamp, motor,
+// calibration) costs more than a short scan, with the device closed after
+// every job and kept warm between jobs. The client pauses longer than a scan
+// between jobs, so the queue drains each time: closing must then warm up for
+// every job and keeping warm only once. Queue order, admission control,
+// cancellation and a failing warm-up are checked first.
+//
+//   cc -O2 -pthread -I<pappl> $(xml2-config --cflags) -o bench-scan-queue bench-scan-queue.c scan-queue.c scan-job.c -lm $(xml2-config --libs)
+
+#define WARM_UP_MS 60
+#define SCAN_MS 15
+#define CLIENTS 1
+#define THINK_MS 40        // between a client's jobs; longer than SCAN_MS
+
+typedef struct {
+    atomic_int opens;
+    atomic_int failOpens;      // opens still to fail
+    pthread_mutex_t lock;
+    int order[16];             // job ids in run order
+    int ran;
+} SimulatedScanner;
+
+typedef struct {
+    ScanQueueJob base;
+    ScanJobStatus status;
+    int id;
+    atomic_bool released;
+} BenchJob;
+
+static int openScanner(void* device) {
+    SimulatedScanner* scanner = (SimulatedScanner*)device;
+    benchSleepMs(WARM_UP_MS);
+    if (atomic_load(&scanner->failOpens) > 0) {
+        atomic_fetch_sub(&scanner->failOpens, 1);
+        return -1;
+    }
+    atomic_fetch_add(&scanner->opens, 1);
+    return 0;
+}
+
+static int runScan(void* device, ScanQueueJob* job) {
+    SimulatedScanner* scanner = (SimulatedScanner*)device;
+    pthread_mutex_lock(&scanner->lock);
+    if (scanner->ran < 16)
+        scanner->order[scanner->ran] = ((BenchJob*)job)->id;
+    scanner->ran++;
+    pthread_mutex_unlock(&scanner->lock);
+    benchSleepMs(SCAN_MS);
+    return 0;
+}
+
+static void closeScanner(void* device) {
+    (void)device;
+}
+
+static void releaseJob(ScanQueueJob* job) {
+    atomic_store(&((BenchJob*)job)->released, true);
+}
+
+static void initBenchJob(BenchJob* job, int id, int priority) {
+    memset(job, 0, sizeof(*job));
+    initScanJobStatus(&job->status, time(NULL));
+    job->base.status = &job->status;
+    job->base.priority = priority;
+    job->id = id;
+}
+
+static ScanQueue* newBenchQueue(SimulatedScanner* scanner, ScanQueuePolicy policy, size_t depth, double keepWarm) {
+    ScanQueueDevice device = { scanner, openScanner, runScan, closeScanner, releaseJob };
+    ScanQueueSettings settings = { policy, depth, keepWarm, 0.05 };
+    memset(scanner->order, 0, sizeof(scanner->order));
+    scanner->ran = 0;
+    atomic_store(&scanner->opens, 0);
+    return new_ScanQueue(&device, &settings);
+}
+
+static bool waitReleased(BenchJob* jobs, int count) {
+    double deadline = benchNow() + 10;
+    for (int i = 0; i < count; ++i) {
+        while (!atomic_load(&jobs[i].released)) {
+            if (benchNow() > deadline)
+                return false;
+            benchSleepMs(1);
+        }
+    }
+    return true;
+}
+
+static int checkOrder(const char* name, SimulatedScanner* scanner, const int* expected, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (scanner->order[i] != expected[i]) {
+            printf("%s: job %d ran at %d, expected %d\n", name, scanner->order[i], i, expected[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Jobs submitted while the device warms up are all waiting when the first
+// one is dispatched, so the run order is the queue order.
+static int checkQueue(SimulatedScanner* scanner) {
+    int failures = 0;
+    BenchJob jobs[5];
+    unsigned retryAfter = 0;
+
+    ScanQueue* queue = newBenchQueue(scanner, SCAN_QUEUE_FIFO, 0, -1);
+    for (int i = 0; i < 5; ++i) {
+        initBenchJob(&jobs[i], i, 5 - i);
+        failures += submitScanJob(queue, &jobs[i].base, NULL) != 0;
+    }
+    failures += scanJobQueuePosition(queue, &jobs[3].base) != 3;
+    failures += !waitReleased(jobs, 5);
+    failures += checkOrder("fifo", scanner, (const int[]){ 0, 1, 2, 3, 4 }, 5);
+    for (int i = 0; i < 5; ++i)
+        failures += snapshotScanJob(&jobs[i].status).state != completed;
+    delete_ScanQueue(queue);
+
+    static const int priorities[] = { 1, 3, 2, 3, 1 };
+    queue = newBenchQueue(scanner, SCAN_QUEUE_PRIORITY, 0, -1);
+    for (int i = 0; i < 5; ++i) {
+        initBenchJob(&jobs[i], i, priorities[i]);
+        failures += submitScanJob(queue, &jobs[i].base, NULL) != 0;
+    }
+    failures += !waitReleased(jobs, 5);
+    failures += checkOrder("priority", scanner, (const int[]){ 1, 3, 2, 0, 4 }, 5);
+    delete_ScanQueue(queue);
+
+    // Depth 2: a third job is refused, and a canceled job frees its slot
+    queue = newBenchQueue(scanner, SCAN_QUEUE_FIFO, 2, -1);
+    for (int i = 0; i < 5; ++i)
+        initBenchJob(&jobs[i], i, 0);
+    failures += submitScanJob(queue, &jobs[0].base, NULL) != 0;
+    failures += submitScanJob(queue, &jobs[1].base, NULL) != 0;
+    failures += submitScanJob(queue, &jobs[2].base, &retryAfter) == 0;
+    failures += retryAfter != SCAN_QUEUE_RETRY_AFTER;
+    failures += !cancelQueuedScanJob(queue, &jobs[1].base);
+    failures += snapshotScanJob(&jobs[1].status).state != canceled || !atomic_load(&jobs[1].released);
+    failures += submitScanJob(queue, &jobs[3].base, NULL) != 0;
+    failures += !waitReleased(&jobs[0], 1) || !waitReleased(&jobs[3], 1);
+    failures += cancelQueuedScanJob(queue, &jobs[0].base);
+    failures += checkOrder("admission", scanner, (const int[]){ 0, 3 }, 2);
+    ScanQueueStats stats;
+    getScanQueueStats(queue, &stats);
+    failures += stats.rejected != 1 || stats.canceled != 1 || stats.completed != 2;
+    delete_ScanQueue(queue);
+
+    // A device that fails to warm up leaves the job pending, not ready, until it works
+    atomic_store(&scanner->failOpens, 2);
+    queue = newBenchQueue(scanner, SCAN_QUEUE_FIFO, 0, -1);
+    initBenchJob(&jobs[0], 0, 0);
+    failures += submitScanJob(queue, &jobs[0].base, NULL) != 0;
+    benchSleepMs(WARM_UP_MS * 3 / 2);
+    ScanJobSnapshot waiting = snapshotScanJob(&jobs[0].status);
+    failures += waiting.state != pending || waiting.reason != reasonResourcesAreNotReady;
+    failures += !waitReleased(jobs, 1);
+    failures += snapshotScanJob(&jobs[0].status).state != completed;
+    getScanQueueStats(queue, &stats);
+    failures += stats.openFailures != 2;
+    delete_ScanQueue(queue);
+
+    // Jobs still waiting at shutdown are aborted and released
+    queue = newBenchQueue(scanner, SCAN_QUEUE_FIFO, 0, -1);
+    for (int i = 0; i < 3; ++i) {
+        initBenchJob(&jobs[i], i, 0);
+        failures += submitScanJob(queue, &jobs[i].base, NULL) != 0;
+    }
+    delete_ScanQueue(queue);
+    for (int i = 0; i < 3; ++i)
+        failures += !atomic_load(&jobs[i].released);
+    failures += snapshotScanJob(&jobs[2].status).state != aborted;
+
+    if (failures)
+        printf("%d queue checks failed\n", failures);
+    return failures;
+}
+
+typedef struct {
+    ScanQueue* queue;
+    int jobs;
+    int id;
+    double latency;        // submit to release, summed
+    int rejected;
+} BenchClient;
+
+static void* runClient(void* arg) {
+    BenchClient* client = (BenchClient*)arg;
+    for (int i = 0; i < client->jobs; ++i) {
+        BenchJob job;
+        unsigned retryAfter;
+        initBenchJob(&job, client->id, 0);
+        double start = benchNow();
+        while (submitScanJob(client->queue, &job.base, &retryAfter) != 0) {
+            client->rejected++;
+            benchSleepMs(SCAN_MS);
+        }
+        waitReleased(&job, 1);
+        client->latency += benchNow() - start;
+        benchSleepMs(THINK_MS);
+    }
+    return NULL;
+}
+
+static double runLoad(SimulatedScanner* scanner, double keepWarm, int jobsPerClient, double* latency, int* opens) {
+    ScanQueue* queue = newBenchQueue(scanner, SCAN_QUEUE_FIFO, 2, keepWarm);
+    BenchClient clients[CLIENTS];
+    pthread_t threads[CLIENTS];
+
+    double start = benchNow();
+    for (int c = 0; c < CLIENTS; ++c) {
+        clients[c] = (BenchClient){ queue, jobsPerClient, c, 0, 0 };
+        pthread_create(&threads[c], NULL, runClient, &clients[c]);
+    }
+    *latency = 0;
+    for (int c = 0; c < CLIENTS; ++c) {
+        pthread_join(threads[c], NULL);
+        *latency += clients[c].latency;
+    }
+    double seconds = benchNow() - start;
+    *latency /= CLIENTS * jobsPerClient;
+    *opens = atomic_load(&scanner->opens);
+    delete_ScanQueue(queue);
+    return seconds;
+}
+
+int main(int argc, char** argv) {
+    int jobsPerClient = argc > 1 ? atoi(argv[1]) : 10;
+    SimulatedScanner scanner;
+    memset(&scanner, 0, sizeof(scanner));
+    pthread_mutex_init(&scanner.lock, NULL);
+
+    int failures = checkQueue(&scanner);
+
+    static const struct {
+        const char* name;
+        double keepWarm;
+    } modes[] = {
+        { "close after each job", -1 },
+        { "keep warm", SCAN_QUEUE_KEEP_WARM },
+    };
+    double rates[2];
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+        double latency;
+        int opens;
+        double seconds = runLoad(&scanner, modes[m].keepWarm, jobsPerClient, &latency, &opens);
+        printf("%-22s %8.1f jobs/min %8.1f ms/job latency %4d warm-ups\n", modes[m].name,
+               CLIENTS * jobsPerClient * 60 / seconds, latency * 1e3, opens);
+        int expected = modes[m].keepWarm < 0 ? CLIENTS * jobsPerClient : 1;
+        if (opens != expected) {
+            printf("%s: %d warm-ups, expected %d\n", modes[m].name, opens, expected);
+            failures++;
+        }
+        rates[m] = CLIENTS * jobsPerClient / seconds;
+    }
+    printf("keeping warm: %.2fx the job throughput\n", rates[1] / rates[0]);
+
+    pthread_mutex_destroy(&scanner.lock);
+    return failures ? 1 : 0;
+}
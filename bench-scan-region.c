@@ -0,0 +1,127 @@
+#include "scan-region.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// Four regions on a Letter platen at 300 dpi: one device pass per region, as
+// before, against one pass over their bounds fanned out to every region. The
+// device is simulated at a fixed time per line; the sinks checksum their lines
+// in place of an encoder, and both ways must give the same checksums.
+//
+//   cc -O2 -pthread -o bench-scan-region bench-scan-region.c scan-region.c escl-scan-settings.c -lsane -lz -lm
+
+#define PLATEN_WIDTH 2550
+#define PLATEN_HEIGHT 3300
+#define CHANNELS 3
+#define REGIONS 4
+
+typedef struct {
+    size_t line;           // next device line
+    size_t end;
+    long lineNanoseconds;
+} SimulatedDevice;
+
+typedef struct {
+    uLong crc;
+    size_t lines;
+} RegionChecksum;
+
+static long readDevice(void* context, uint8_t* lines, size_t stride, size_t maxLines) {
+    SimulatedDevice* device = (SimulatedDevice*)context;
+    size_t count = device->end - device->line < maxLines ? device->end - device->line : maxLines;
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t* line = lines + i * stride;
+        size_t y = device->line + i;
+        for (size_t x = 0; x < PLATEN_WIDTH * CHANNELS; ++x)
+            line[x] = (uint8_t)(x * 7 + y * 13 + (x * y >> 9));
+    }
+    device->line += count;
+    if (count > 0)
+        benchSleepNs((long long)device->lineNanoseconds * (long long)count);
+    return (long)count;
+}
+
+static int checksumLine(void* context, const uint8_t* line, size_t length) {
+    RegionChecksum* checksum = (RegionChecksum*)context;
+    checksum->crc = crc32(checksum->crc, line, (uInt)length);
+    checksum->lines++;
+    return 0;
+}
+
+// One device pass per region, the device reading just that region's lines.
+static void scanSeparately(const ScanRect* rects, long lineNanoseconds, RegionChecksum* checksums) {
+    size_t stride = PLATEN_WIDTH * CHANNELS;
+    uint8_t* lines = (uint8_t*)malloc(SCAN_FANOUT_STRIP_LINES * stride);
+    for (int r = 0; r < REGIONS; ++r) {
+        ScanRect platen = { 0, 0, PLATEN_WIDTH, PLATEN_HEIGHT };
+        ScanCrop crop;
+        SimulatedDevice device = { rects[r].y, rects[r].y + rects[r].height, lineNanoseconds };
+        scanCropFor(&rects[r], &platen, CHANNELS, &crop);
+        checksums[r] = (RegionChecksum){ crc32(0, NULL, 0), 0 };
+        long count;
+        while ((count = readDevice(&device, lines, stride, SCAN_FANOUT_STRIP_LINES)) > 0) {
+            for (long i = 0; i < count; ++i)
+                checksumLine(&checksums[r], lines + i * stride + crop.firstByte, crop.lineBytes);
+        }
+    }
+    free(lines);
+}
+
+static int scanOnce(const ScanRect* rects, long lineNanoseconds, RegionChecksum* checksums) {
+    static ScanRegionOutput outputs[REGIONS];
+    ScanRect bounds = scanRegionBounds(rects, REGIONS);
+    // The device reads full-width lines over the bounds, as a backend without tl-x would
+    ScanRect delivered = { 0, bounds.y, PLATEN_WIDTH, bounds.height };
+    SimulatedDevice device = { bounds.y, bounds.y + bounds.height, lineNanoseconds };
+
+    for (int r = 0; r < REGIONS; ++r) {
+        checksums[r] = (RegionChecksum){ crc32(0, NULL, 0), 0 };
+        scanCropFor(&rects[r], &delivered, CHANNELS, &outputs[r].crop);
+        outputs[r].sink = checksumLine;
+        outputs[r].context = &checksums[r];
+    }
+    return fanOutScanRegions(readDevice, &device, PLATEN_WIDTH * CHANNELS, outputs, REGIONS);
+}
+
+int main(int argc, char** argv) {
+    long lineNanoseconds = argc > 1 ? atol(argv[1]) : 20000;
+    // A receipt, a business card and two photos laid out on the glass
+    static const ScanRect rects[REGIONS] = {
+        { 150, 150, 900, 2400 },
+        { 1350, 150, 1050, 600 },
+        { 1350, 1050, 1050, 1500 },
+        { 300, 2700, 1950, 450 },
+    };
+    RegionChecksum separate[REGIONS], once[REGIONS];
+    int failures = 0;
+
+    double start = benchNow();
+    scanSeparately(rects, lineNanoseconds, separate);
+    double separateSeconds = benchNow() - start;
+
+    start = benchNow();
+    if (scanOnce(rects, lineNanoseconds, once) != 0) {
+        printf("fan-out scan failed\n");
+        return 1;
+    }
+    double onceSeconds = benchNow() - start;
+
+    for (int r = 0; r < REGIONS; ++r) {
+        if (separate[r].crc != once[r].crc || separate[r].lines != rects[r].height || once[r].lines != rects[r].height) {
+            printf("region %d: checksum %08lx/%08lx, %zu/%zu lines\n", r, separate[r].crc, once[r].crc,
+                   separate[r].lines, once[r].lines);
+            failures++;
+        }
+    }
+
+    size_t lines = 0;
+    for (int r = 0; r < REGIONS; ++r)
+        lines += rects[r].height;
+    printf("%-22s %8.3f s %8zu device lines\n", "one pass per region", separateSeconds, lines);
+    lines = scanRegionBounds(rects, REGIONS).height;
+    printf("%-22s %8.3f s %8zu device lines\n", "single pass, fan-out", onceSeconds, lines);
+    printf("speedup %.2fx\n", separateSeconds / onceSeconds);
+    return failures ? 1 : 0;
+}
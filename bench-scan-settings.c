@@ -0,0 +1,163 @@
+#include "escl-scan-settings.h"
+#include "bench-clock.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <regex.h>
+#include <pthread.h>
+
+// Microbenchmark: single-pass parseScanSettings vs the per-field regex lookups
+// that ScanSettingsFromXML used before, then per-field lookups through the
+// shared element table vs regcomp per lookup as the number of threads grows.
+//
+//   cc -O2 -pthread -o bench-scan-settings bench-scan-settings.c escl-scan-settings.c
+
+static const char* sampleTicket =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?><scan:ScanSettings xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\" xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\"><pwg:Version>2.6</pwg:Version><scan:Intent>Photo</scan:Intent><pwg:ScanRegions><pwg:ScanRegion><pwg:Height>1200</pwg:Height><pwg:ContentRegionUnits>escl:ThreeHundredthsOfInches</pwg:ContentRegionUnits><pwg:Width>1800</pwg:Width><pwg:XOffset>0</pwg:XOffset><pwg:YOffset>10</pwg:YOffset></pwg:ScanRegion></pwg:ScanRegions><pwg:InputSource>Platen</pwg:InputSource><scan:ColorMode>Grayscale823</scan:ColorMode><scan:BlankPageDetection>true</scan:BlankPageDetection></scan:ScanSettings>";
+
+// Bodies that are not a complete ScanSettings document or hold a number out
+// of range; each must be rejected.
+static const char* rejectedTickets[] = {
+    "",
+    "hello world",
+    "<html><body>nope</body></html>",
+    "<scan:ScanSettings><pwg:Version>2.6</pwg:Version>",
+    "<scan:ScanSettings><scan:XResolution>1e400</scan:XResolution></scan:ScanSettings>",
+};
+
+static const char* regexPatterns[] = {
+    "<pwg:Version>([^<]*)</pwg:Version>",
+    "<scan:Intent>([^<]*)</scan:Intent>",
+    "<pwg:Height>([^<]*)</pwg:Height>",
+    "<pwg:ContentRegionUnits>([^<]*)</pwg:ContentRegionUnits>",
+    "<pwg:Width>([^<]*)</pwg:Width>",
+    "<pwg:XOffset>([^<]*)</pwg:XOffset>",
+    "<pwg:YOffset>([^<]*)</pwg:YOffset>",
+    "<pwg:InputSource>([^<]*)</pwg:InputSource>",
+    "<scan:ColorMode>([^<]*)</scan:ColorMode>",
+    "<scan:BlankPageDetection>([^<]*)</scan:BlankPageDetection>",
+};
+
+// Same steps as getString in escl-ops.c: compile, match, copy, free.
+static char* regexGetString(const char* xml, const char* pattern) {
+    regex_t regex;
+    regmatch_t matches[2];
+    char* result;
+
+    if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
+        fprintf(stderr, "Could not compile regex\n");
+        exit(1);
+    }
+    if (regexec(&regex, xml, 2, matches, 0) == 0) {
+        size_t match_length = matches[1].rm_eo - matches[1].rm_so;
+        result = (char*)malloc(match_length + 1);
+        strncpy(result, xml + matches[1].rm_so, match_length);
+        result[match_length] = '\0';
+    } else {
+        result = strdup("");
+    }
+    regfree(&regex);
+    return result;
+}
+
+static double regexParse(const char* xml) {
+    char* copy = strdup(xml);
+    double sum = 0;
+    for (size_t i = 0; i < sizeof(regexPatterns) / sizeof(regexPatterns[0]); ++i) {
+        char* value = regexGetString(copy, regexPatterns[i]);
+        sum += strtod(value, NULL);
+        free(value);
+    }
+    free(copy);
+    return sum;
+}
+
+typedef struct {
+    int iterations;
+    bool useRegex;
+    double sink;
+} LookupWorker;
+
+static void* lookupWorker(void* arg) {
+    LookupWorker* worker = (LookupWorker*)arg;
+    size_t length = strlen(sampleTicket);
+
+    for (int i = 0; i < worker->iterations; ++i) {
+        if (worker->useRegex) {
+            worker->sink += regexParse(sampleTicket);
+            continue;
+        }
+        for (int field = 0; field < SCAN_FIELD_COUNT; ++field) {
+            EsclStringView value;
+            if (findScanSettingsField(sampleTicket, length, (ScanSettingsField)field, &value))
+                worker->sink += value.length;
+        }
+    }
+    return NULL;
+}
+
+static double lookupThroughput(int threads, int iterations, bool useRegex) {
+    pthread_t ids[64];
+    LookupWorker workers[64];
+
+    double start = benchNow();
+    for (int t = 0; t < threads; ++t) {
+        workers[t].iterations = iterations;
+        workers[t].useRegex = useRegex;
+        workers[t].sink = 0;
+        pthread_create(&ids[t], NULL, lookupWorker, &workers[t]);
+    }
+    for (int t = 0; t < threads; ++t)
+        pthread_join(ids[t], NULL);
+    return threads * (double)iterations / (benchNow() - start);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    size_t length = strlen(sampleTicket);
+    ScanSettings settings;
+    ScanSettings rejected;
+    volatile double sink = 0;
+
+    if (parseScanSettings(sampleTicket, length, &settings) != 0) {
+        fprintf(stderr, "sample ticket did not parse\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(rejectedTickets) / sizeof(rejectedTickets[0]); ++i) {
+        if (parseScanSettings(rejectedTickets[i], strlen(rejectedTickets[i]), &rejected) != -1) {
+            fprintf(stderr, "accepted \"%s\"\n", rejectedTickets[i]);
+            return 1;
+        }
+    }
+    printf("Version: %.*s Intent: %.*s Height: %.0lf Width: %.0lf Units: %.*s ColorMode: %.*s\n",
+           (int)settings.version.length, settings.version.data,
+           (int)settings.intent.length, settings.intent.data,
+           settings.regions[0].height, settings.regions[0].width,
+           (int)settings.regions[0].contentRegionUnits.length, settings.regions[0].contentRegionUnits.data,
+           (int)settings.colorMode.length, settings.colorMode.data);
+
+    double start = benchNow();
+    for (int i = 0; i < iterations; ++i)
+        sink += regexParse(sampleTicket);
+    double regexTime = benchNow() - start;
+
+    start = benchNow();
+    for (int i = 0; i < iterations; ++i) {
+        parseScanSettings(sampleTicket, length, &settings);
+        sink += settings.regions[0].width;
+    }
+    double singlePassTime = benchNow() - start;
+
+    printf("regex:       %10.1f ns/ticket\n", regexTime * 1e9 / iterations);
+    printf("single-pass: %10.1f ns/ticket\n", singlePassTime * 1e9 / iterations);
+    printf("speedup:     %10.1fx\n", regexTime / singlePassTime);
+
+    printf("\n%8s %18s %18s\n", "threads", "regex tickets/s", "table tickets/s");
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        double regexRate = lookupThroughput(threads, iterations / 10 + 1, true);
+        double tableRate = lookupThroughput(threads, iterations, false);
+        printf("%8d %18.0f %18.0f\n", threads, regexRate, tableRate);
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+#include "scan-spool.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// An ADF batch whose client fetches nothing until the last page is scanned:
+// every document held in memory, as a heap-only store would, against a
+// spool with a small RAM tier. Delivery then goes over a socket with
+// sendfile, as chunks of a chunked body with sendfile and, for comparison,
+// with the read-back copy TLS connections use.
+// Every byte is checked at the other end, and all space must be back once
+// the documents are delivered or the job is canceled.
+//
+//   cc -O2 -pthread -o bench-scan-spool bench-scan-spool.c scan-spool.c -lz
+
+#define JOB_PAGES 16
+#define PAGE_BYTES (4 * 1024 * 1024)       // an encoded 300 dpi color page, roughly
+#define WRITE_PIECE (64 * 1024)            // what the encoder hands over at a time
+#define RAM_TIER (12 * 1024 * 1024)
+
+static uint64_t mix(uint64_t sum, const uint8_t* data, size_t length) {
+    return crc32((uLong)sum, data, (uInt)length);
+}
+
+static void fillPage(uint8_t* page, unsigned number) {
+    uint32_t seed = 0x9E3779B9u * (number + 1);
+    for (size_t i = 0; i < PAGE_BYTES; i += 4) {
+        seed = seed * 1103515245u + 12345u;
+        memcpy(page + i, &seed, 4);
+    }
+}
+
+typedef enum { DELIVER_SENDFILE, DELIVER_CHUNKED, DELIVER_COPIED } Delivery;
+
+typedef struct {
+    int socket;
+    size_t expected;
+    bool chunked;       // documents arrive as chunks of a chunked body
+    uint64_t sum;
+    size_t received;    // document bytes, without chunk framing
+    size_t chunkSize;   // size line read so far
+    size_t chunkLeft;   // data still due in the current chunk
+    int crlfLeft;       // bytes of the CRLF after a chunk's data still due
+    bool sizeLineCr;
+    bool badChunk;
+} Reader;
+
+// Sum the data of a chunked body as it arrives, checking every chunk's framing.
+static void readChunks(Reader* reader, const uint8_t* p, size_t length) {
+    const uint8_t* end = p + length;
+
+    while (p < end && !reader->badChunk) {
+        if (reader->chunkLeft > 0) {
+            size_t piece = (size_t)(end - p) < reader->chunkLeft ? (size_t)(end - p) : reader->chunkLeft;
+            reader->sum = mix(reader->sum, p, piece);
+            reader->received += piece;
+            reader->chunkLeft -= piece;
+            reader->crlfLeft = reader->chunkLeft == 0 ? 2 : 0;
+            p += piece;
+            continue;
+        }
+        char c = (char)*p++;
+        if (reader->crlfLeft > 0) {
+            reader->badChunk = c != (reader->crlfLeft-- == 2 ? '\r' : '\n');
+        } else if (!reader->sizeLineCr && ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+            reader->chunkSize = reader->chunkSize * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+        } else if (!reader->sizeLineCr && c == '\r') {
+            reader->sizeLineCr = true;
+        } else if (reader->sizeLineCr && c == '\n' && reader->chunkSize > 0) {
+            reader->chunkLeft = reader->chunkSize;
+            reader->chunkSize = 0;
+            reader->sizeLineCr = false;
+        } else {
+            reader->badChunk = true;
+        }
+    }
+}
+
+static void* drainSocket(void* arg) {
+    Reader* reader = (Reader*)arg;
+    uint8_t* buffer = (uint8_t*)malloc(WRITE_PIECE);
+    while (reader->received < reader->expected || reader->crlfLeft > 0) {
+        ssize_t bytes = read(reader->socket, buffer, WRITE_PIECE);
+        if (bytes <= 0)
+            break;
+        if (reader->chunked) {
+            readChunks(reader, buffer, (size_t)bytes);
+            if (reader->badChunk)
+                break;
+            continue;
+        }
+        reader->sum = mix(reader->sum, buffer, (size_t)bytes);
+        reader->received += (size_t)bytes;
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int writeToSocket(void* context, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t written = write(*(int*)context, p, length);
+        if (written <= 0)
+            return -1;
+        p += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static int spoolJob(ScanSpool* spool, uint8_t* page, uint64_t* sum) {
+    for (unsigned n = 0; n < JOB_PAGES; ++n) {
+        fillPage(page, n);
+        *sum = mix(*sum, page, PAGE_BYTES);
+        if (beginSpooledDocument(spool) != 0)
+            return -1;
+        for (size_t offset = 0; offset < PAGE_BYTES; offset += WRITE_PIECE) {
+            if (writeSpooledDocument(spool, page + offset, WRITE_PIECE) != 0)
+                return -1;
+        }
+        if (finishSpooledDocument(spool) != 0)
+            return -1;
+    }
+    endScanSpool(spool);
+    return 0;
+}
+
+static int runJob(const char* name, size_t ramLimit, Delivery delivery, uint8_t* page) {
+    ScanSpoolStore* store = new_ScanSpoolStore(NULL, ramLimit);
+    ScanSpool* spool = new_ScanSpool(store);
+    ScanSpoolStats stats;
+    uint64_t sum = 0;
+    int sockets[2];
+    int failures = 0;
+
+    if (spoolJob(spool, page, &sum) != 0) {
+        printf("%s: spooling failed\n", name);
+        return 1;
+    }
+    getScanSpoolStats(store, &stats);
+    size_t peakRam = stats.highWaterRam, peakDisk = stats.highWaterDisk, spilled = stats.spilled;
+
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+    Reader reader = { .socket = sockets[1], .expected = (size_t)JOB_PAGES * PAGE_BYTES,
+                      .chunked = delivery == DELIVER_CHUNKED };
+    pthread_t thread;
+    pthread_create(&thread, NULL, drainSocket, &reader);
+
+    double start = benchNow();
+    bool ended = false;
+    ScanSpoolDocument* document;
+    while ((document = takeSpooledDocument(spool, 1, &ended)) != NULL) {
+        int result;
+        if (delivery == DELIVER_SENDFILE)
+            result = sendSpooledDocument(spool, document, sockets[0]);
+        else if (delivery == DELIVER_CHUNKED)
+            result = sendSpooledChunk(spool, document, sockets[0]);
+        else
+            result = copySpooledDocument(spool, document, writeToSocket, &sockets[0]);
+        failures += result != 0;
+        releaseSpooledDocument(spool, document);
+    }
+    pthread_join(thread, NULL);
+    double seconds = benchNow() - start;
+
+    struct stat file;
+    getScanSpoolStats(store, &stats);
+    failures += !ended || reader.sum != sum || reader.received != (size_t)JOB_PAGES * PAGE_BYTES;
+    failures += reader.badChunk || reader.chunkLeft != 0 || reader.crlfLeft != 0 || reader.sizeLineCr;
+    failures += stats.bytesInRam != 0 || stats.bytesOnDisk != 0;
+    failures += spool->fd >= 0 && (fstat(spool->fd, &file) != 0 || file.st_size != 0);
+    printf("%-20s peak RAM %6.1f MB  peak disk %6.1f MB  %2zu spilled  delivery %7.1f MB/s  (%.0f%% sendfile)\n",
+           name, peakRam / 1048576.0, peakDisk / 1048576.0, spilled,
+           reader.received / seconds / 1e6,
+           100.0 * stats.bytesSentZeroCopy / (stats.bytesSentZeroCopy + stats.bytesSentCopied));
+
+    close(sockets[0]);
+    close(sockets[1]);
+    delete_ScanSpool(spool);
+    delete_ScanSpoolStore(store);
+    if (failures)
+        printf("%s: %d checks failed\n", name, failures);
+    return failures;
+}
+
+// Canceling a job with undelivered documents, one of them half written, gives everything back.
+static int checkCancel(uint8_t* page) {
+    ScanSpoolStore* store = new_ScanSpoolStore(NULL, RAM_TIER);
+    ScanSpool* spool = new_ScanSpool(store);
+    ScanSpoolStats stats;
+    int failures = 0;
+
+    fillPage(page, 0);
+    for (int n = 0; n < 5; ++n) {
+        failures += beginSpooledDocument(spool) != 0;
+        failures += writeSpooledDocument(spool, page, PAGE_BYTES) != 0;
+        failures += finishSpooledDocument(spool) != 0;
+    }
+    failures += beginSpooledDocument(spool) != 0;
+    failures += writeSpooledDocument(spool, page, PAGE_BYTES / 2) != 0;
+    delete_ScanSpool(spool);
+    getScanSpoolStats(store, &stats);
+    failures += stats.bytesInRam != 0 || stats.bytesOnDisk != 0 || stats.spilled == 0;
+    delete_ScanSpoolStore(store);
+    if (failures)
+        printf("cancel: %d checks failed\n", failures);
+    return failures;
+}
+
+int main(void) {
+    uint8_t* page = (uint8_t*)malloc(PAGE_BYTES);
+    int failures = checkCancel(page);
+
+    failures += runJob("heap only", (size_t)JOB_PAGES * PAGE_BYTES * 2, DELIVER_SENDFILE, page);
+    failures += runJob("spool, sendfile", RAM_TIER, DELIVER_SENDFILE, page);
+    failures += runJob("spool, chunked", RAM_TIER, DELIVER_CHUNKED, page);
+    failures += runJob("spool, copied", RAM_TIER, DELIVER_COPIED, page);
+    free(page);
+    return failures ? 1 : 0;
+}
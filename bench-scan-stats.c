@@ -0,0 +1,175 @@
+#include "scan-stats.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// What a stage timing costs on the scan path, and whether the histograms
+// tell the truth: percentiles against the exact ones from sorted samples,
+// and nothing lost when recording threads come and go as scan batches do.
+//
+//   cc -O2 -pthread -DESCL_SCAN_STATS -o bench-scan-stats bench-scan-stats.c scan-stats.c
+
+#define SAMPLES 200000
+#define THREADS 4
+#define ROUNDS 8
+#define PER_THREAD 50000
+#define TIMINGS 5000000
+
+static int compareValues(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Page reads are long-tailed: mostly around 200 ms, some much slower.
+static uint64_t sampleLatency(uint32_t* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    uint64_t value = 150000000u + (*seed >> 8) % 100000000u;
+    if ((*seed & 0xff) < 8)
+        value *= 1 + (*seed >> 28);
+    return value;
+}
+
+static int checkBuckets(void) {
+    int failures = 0;
+    for (uint64_t value = 0; value < (UINT64_C(1) << SCAN_STATS_MAX_BITS); value = value * 9 / 8 + 1) {
+        size_t bucket = scanStatsBucket(value);
+        uint64_t limit = scanStatsBucketLimit(bucket);
+        uint64_t below = bucket > 0 ? scanStatsBucketLimit(bucket - 1) : 0;
+        failures += bucket >= SCAN_STATS_BUCKETS || value > limit || (bucket > 0 && value <= below);
+        failures += (double)(limit - value) > value / 16.0 + 1;
+    }
+    failures += scanStatsBucket(UINT64_MAX) != SCAN_STATS_BUCKETS - 1;
+    if (failures)
+        printf("buckets: %d checks failed\n", failures);
+    return failures;
+}
+
+static int checkPercentiles(void) {
+    uint64_t* values = (uint64_t*)malloc(SAMPLES * sizeof(uint64_t));
+    ScanStatsHistogram* histogram = (ScanStatsHistogram*)calloc(1, sizeof(ScanStatsHistogram));
+    uint32_t seed = 1;
+    int failures = 0;
+
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        values[i] = sampleLatency(&seed);
+        histogram->buckets[scanStatsBucket(values[i])]++;
+        histogram->count++;
+        histogram->sum += values[i];
+        if (values[i] > histogram->max)
+            histogram->max = values[i];
+    }
+    qsort(values, SAMPLES, sizeof(uint64_t), compareValues);
+
+    static const double fractions[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+    printf("percentile      exact ms  histogram ms\n");
+    for (size_t i = 0; i < sizeof(fractions) / sizeof(fractions[0]); ++i) {
+        size_t rank = (size_t)(fractions[i] * SAMPLES + 0.5);
+        uint64_t exact = values[rank > 0 ? rank - 1 : 0];
+        uint64_t reported = scanStatsPercentile(histogram, fractions[i]);
+        printf("p%-8g %14.3f %13.3f\n", fractions[i] * 100, exact / 1e6, reported / 1e6);
+        failures += reported < exact || (double)(reported - exact) > exact / 16.0;
+    }
+    free(histogram);
+    free(values);
+    if (failures)
+        printf("percentiles: %d checks failed\n", failures);
+    return failures;
+}
+
+static void* recordStages(void* arg) {
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    for (int i = 0; i < PER_THREAD; ++i) {
+        recordScanStage(SCAN_STAGE_PAGE_READ, sampleLatency(&seed));
+        countScanStats(SCAN_COUNTER_BYTES_READ, 3);
+    }
+    return NULL;
+}
+
+// Threads that exit keep their numbers, and snapshots taken meanwhile never go backwards.
+static int checkThreads(void) {
+    ScanStatsSnapshot* snapshot = (ScanStatsSnapshot*)malloc(sizeof(ScanStatsSnapshot));
+    uint64_t seen = 0;
+    int failures = 0;
+
+    takeScanStatsSnapshot(snapshot);
+    uint64_t before = snapshot->stages[SCAN_STAGE_PAGE_READ].count;
+    for (int round = 0; round < ROUNDS; ++round) {
+        pthread_t threads[THREADS];
+        for (int i = 0; i < THREADS; ++i)
+            pthread_create(&threads[i], NULL, recordStages, (void*)(uintptr_t)(round * THREADS + i + 1));
+        takeScanStatsSnapshot(snapshot);
+        failures += snapshot->stages[SCAN_STAGE_PAGE_READ].count < seen;
+        seen = snapshot->stages[SCAN_STAGE_PAGE_READ].count;
+        for (int i = 0; i < THREADS; ++i)
+            pthread_join(threads[i], NULL);
+    }
+    takeScanStatsSnapshot(snapshot);
+    uint64_t recorded = snapshot->stages[SCAN_STAGE_PAGE_READ].count - before;
+    failures += recorded != (uint64_t)ROUNDS * THREADS * PER_THREAD;
+    failures += snapshot->counters[SCAN_COUNTER_BYTES_READ] != 3 * recorded;
+    failures += snapshot->threads > 1;
+    free(snapshot);
+    if (failures)
+        printf("threads: %d checks failed (%llu recorded)\n", failures, (unsigned long long)recorded);
+    return failures;
+}
+
+static double timeLoop(bool timed) {
+    volatile uint64_t sink = 0;
+    double start = benchNow();
+    for (int i = 0; i < TIMINGS; ++i) {
+        if (timed) {
+            SCAN_STATS_START(timer);
+            sink += i;
+            SCAN_STATS_STOP(timer, SCAN_STAGE_GAMMA);
+        } else {
+            sink += i;
+        }
+    }
+    return (benchNow() - start) / TIMINGS * 1e9;
+}
+
+static int checkDump(void) {
+    FILE* log = tmpfile();
+    ScanStatsDump* dump = new_ScanStatsDump(1, log);
+    int failures = dump == NULL;
+
+    usleep(1200000);
+    delete_ScanStatsDump(dump);
+    long length = ftell(log);
+    failures += length <= 0;
+    if (length > 0) {
+        char* text = (char*)calloc(1, (size_t)length + 1);
+        rewind(log);
+        failures += fread(text, 1, (size_t)length, log) != (size_t)length;
+        failures += strstr(text, "page-read") == NULL;
+        free(text);
+    }
+    fclose(log);
+    if (failures)
+        printf("dump: %d checks failed\n", failures);
+    return failures;
+}
+
+int main(void) {
+    int failures = checkBuckets();
+    failures += checkPercentiles();
+    failures += checkThreads();
+
+    double bare = timeLoop(false);
+    double timed = timeLoop(true);
+    printf("stage timing: %.1f ns each (%.1f ns loop)\n", timed - bare, bare);
+
+    failures += checkDump();
+
+    ScanStatsSnapshot* snapshot = (ScanStatsSnapshot*)malloc(sizeof(ScanStatsSnapshot));
+    char text[4096];
+    takeScanStatsSnapshot(snapshot);
+    failures += formatScanStats(snapshot, text, sizeof(text)) <= 0;
+    printf("%s", text);
+    free(snapshot);
+    return failures ? 1 : 0;
+}
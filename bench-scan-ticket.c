@@ -0,0 +1,203 @@
+#include "scan-ticket.h"
+#include "bench-clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// A day of POST /ScanJobs from clients that use a handful of presets, with
+// the odd one-off ticket: every ticket resolved from scratch against the
+// ticket cache, from one thread and from several. Cached tickets are checked
+// against freshly resolved ones first.
+//
+//   cc -O2 -pthread -o bench-scan-ticket bench-scan-ticket.c scan-ticket.c escl-scan-settings.c scan-region.c scan-pixel.c scan-gray.c scan-gamma.c -lsane -lm
+
+#define PRESETS 6
+#define ONE_OFF_EVERY 50       // one request in this many is a ticket nobody sent before
+#define THREADS 4
+
+static const struct {
+    const char* colorMode;
+    int resolution;
+    const char* format;
+    int width;
+    int height;
+} presets[PRESETS] = {
+    { "RGB24", 300, "image/jpeg", 2550, 3300 },
+    { "Grayscale8", 300, "application/pdf", 2550, 3300 },
+    { "BlackAndWhite1", 600, "application/pdf", 2550, 3300 },
+    { "RGB24", 150, "image/jpeg", 1800, 1200 },
+    { "RGB48", 600, "image/png", 2550, 3508 },
+    { "Grayscale16", 200, "image/png", 2480, 3508 },
+};
+
+static int formatTicket(char* buffer, size_t size, int preset, int yOffset) {
+    return snprintf(buffer, size,
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+                    "<scan:ScanSettings xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\" "
+                    "xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\">"
+                    "<pwg:Version>2.6</pwg:Version><scan:Intent>Document</scan:Intent>"
+                    "<pwg:ScanRegions><pwg:ScanRegion><pwg:Height>%d</pwg:Height>"
+                    "<pwg:ContentRegionUnits>escl:ThreeHundredthsOfInches</pwg:ContentRegionUnits>"
+                    "<pwg:Width>%d</pwg:Width><pwg:XOffset>0</pwg:XOffset><pwg:YOffset>%d</pwg:YOffset>"
+                    "</pwg:ScanRegion></pwg:ScanRegions>"
+                    "<pwg:InputSource>Platen</pwg:InputSource><scan:ColorMode>%s</scan:ColorMode>"
+                    "<scan:XResolution>%d</scan:XResolution><scan:YResolution>%d</scan:YResolution>"
+                    "<pwg:DocumentFormat>%s</pwg:DocumentFormat>"
+                    "<scan:BlankPageDetection>false</scan:BlankPageDetection></scan:ScanSettings>",
+                    presets[preset].height, presets[preset].width, yOffset, presets[preset].colorMode,
+                    presets[preset].resolution, presets[preset].resolution, presets[preset].format);
+}
+
+// The request stream: preset i about twice as often as preset i + 1.
+static int pickTicket(unsigned* seed, char* buffer, size_t size) {
+    *seed = *seed * 1103515245u + 12345u;
+    unsigned r = *seed >> 8;
+    if (r % ONE_OFF_EVERY == 0)
+        return formatTicket(buffer, size, 0, 1 + (int)(r % 100000));
+    int preset = 0;
+    while (preset < PRESETS - 1 && (r & (1u << preset)) == 0)
+        preset++;
+    return formatTicket(buffer, size, preset, 0);
+}
+
+static bool sameTicket(const ScanTicket* a, const ScanTicket* b) {
+    return a->format == b->format && a->xResolution == b->xResolution && a->yResolution == b->yResolution
+           && a->color == b->color && a->kernels == b->kernels && a->binarize == b->binarize
+           && a->settings.fields == b->settings.fields && a->rectCount == b->rectCount
+           && memcmp(a->rects, b->rects, sizeof(ScanRect) * a->rectCount) == 0;
+}
+
+static int checkCache(void) {
+    ScanTicketCache* cache = new_ScanTicketCache(0);
+    ScanTicketCacheStats stats;
+    char xml[2048];
+    int failures = 0;
+
+    for (int round = 0; round < 2; ++round) {
+        for (int preset = 0; preset < PRESETS; ++preset) {
+            int length = formatTicket(xml, sizeof(xml), preset, 0);
+            ScanTicket* cached = acquireScanTicket(cache, xml, (size_t)length);
+            ScanTicket* fresh = resolveScanTicket(xml, (size_t)length);
+            if (cached == NULL || fresh == NULL || !sameTicket(cached, fresh)) {
+                printf("preset %d: cached ticket differs\n", preset);
+                failures++;
+            }
+            // The caller's buffer may be reused at once; the ticket has its own copy
+            memset(xml, 'x', (size_t)length);
+            if (cached != NULL && !esclStringViewEquals(cached->settings.colorMode, presets[preset].colorMode))
+                failures++;
+            releaseScanTicket(cached);
+            releaseScanTicket(fresh);
+        }
+    }
+    getScanTicketCacheStats(cache, &stats);
+    failures += stats.misses != PRESETS || stats.hits != PRESETS;
+
+    // A bad ticket is not cached, and a full cache evicts but keeps tickets in use alive
+    failures += acquireScanTicket(cache, "<scan:ScanSettings><scan:ColorMode>CMYK32", 41) != NULL;
+    int length = formatTicket(xml, sizeof(xml), 0, 7);
+    ScanTicket* held = acquireScanTicket(cache, xml, (size_t)length);
+    for (int i = 0; i < 64; ++i) {
+        length = formatTicket(xml, sizeof(xml), 1, 100 + i);
+        releaseScanTicket(acquireScanTicket(cache, xml, (size_t)length));
+    }
+    getScanTicketCacheStats(cache, &stats);
+    failures += held == NULL || held->settings.regions[0].yOffset != 7;
+    failures += stats.evictions == 0 || stats.entries > stats.capacity || stats.invalid != 1;
+    releaseScanTicket(held);
+
+    delete_ScanTicketCache(cache);
+    if (failures)
+        printf("%d cache checks failed\n", failures);
+    return failures;
+}
+
+// Request bodies are made up front so only the lookups are timed.
+typedef struct {
+    char* bodies;
+    size_t* offsets;           // count + 1
+    int count;
+} TicketCorpus;
+
+static void makeCorpus(TicketCorpus* corpus, int count, unsigned seed) {
+    char xml[2048];
+    corpus->bodies = (char*)malloc((size_t)count * sizeof(xml));
+    corpus->offsets = (size_t*)malloc(((size_t)count + 1) * sizeof(size_t));
+    corpus->count = count;
+    corpus->offsets[0] = 0;
+    for (int i = 0; i < count; ++i) {
+        int length = pickTicket(&seed, xml, sizeof(xml));
+        memcpy(corpus->bodies + corpus->offsets[i], xml, (size_t)length);
+        corpus->offsets[i + 1] = corpus->offsets[i] + (size_t)length;
+    }
+}
+
+typedef struct {
+    ScanTicketCache* cache;    // NULL to resolve every ticket
+    const TicketCorpus* corpus;
+    size_t checksum;
+} BenchThread;
+
+static void* runRequests(void* arg) {
+    BenchThread* thread = (BenchThread*)arg;
+    const TicketCorpus* corpus = thread->corpus;
+    for (int i = 0; i < corpus->count; ++i) {
+        const char* xml = corpus->bodies + corpus->offsets[i];
+        size_t length = corpus->offsets[i + 1] - corpus->offsets[i];
+        ScanTicket* ticket = thread->cache ? acquireScanTicket(thread->cache, xml, length)
+                                           : resolveScanTicket(xml, length);
+        if (ticket != NULL)
+            thread->checksum += ticket->rects[0].height + ticket->format;
+        releaseScanTicket(ticket);
+    }
+    return NULL;
+}
+
+static double runBench(ScanTicketCache* cache, int threads, const TicketCorpus* corpora, size_t* checksum) {
+    BenchThread state[THREADS];
+    pthread_t ids[THREADS];
+    double start = benchNow();
+    for (int t = 0; t < threads; ++t) {
+        state[t] = (BenchThread){ cache, &corpora[t], 0 };
+        pthread_create(&ids[t], NULL, runRequests, &state[t]);
+    }
+    *checksum = 0;
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        *checksum += state[t].checksum;
+    }
+    return benchNow() - start;
+}
+
+int main(int argc, char** argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 400000;
+    int failures = checkCache();
+    TicketCorpus corpora[THREADS];
+
+    for (int t = 0; t < THREADS; ++t)
+        makeCorpus(&corpora[t], requests / THREADS, 17u + (unsigned)t);
+    for (int threads = 1; threads <= THREADS; threads += THREADS - 1) {
+        size_t resolvedSum, cachedSum;
+        ScanTicketCache* cache = new_ScanTicketCache(0);
+        ScanTicketCacheStats stats;
+        double resolved = runBench(NULL, threads, corpora, &resolvedSum);
+        double cached = runBench(cache, threads, corpora, &cachedSum);
+        getScanTicketCacheStats(cache, &stats);
+        if (resolvedSum != cachedSum) {
+            printf("%d threads: cached results differ\n", threads);
+            failures++;
+        }
+        double tickets = (double)threads * corpora[0].count;
+        printf("%d thread%s  resolve %7.0f ns/ticket  cache %7.0f ns/ticket  %5.1fx  hits %.1f%%  evictions %llu\n",
+               threads, threads > 1 ? "s" : " ", resolved * 1e9 / tickets, cached * 1e9 / tickets,
+               resolved / cached, 100.0 * stats.hits / (stats.hits + stats.misses),
+               (unsigned long long)stats.evictions);
+        delete_ScanTicketCache(cache);
+    }
+    for (int t = 0; t < THREADS; ++t) {
+        free(corpora[t].bodies);
+        free(corpora[t].offsets);
+    }
+    return failures ? 1 : 0;
+}
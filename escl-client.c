@@ -0,0 +1,76 @@
+#include "escl-client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// One row per kind: the product token that names it and what it needs. A
+// prefix token also matches longer product names, as in MopriaScan.
+static const struct {
+    const char* name;
+    const char* token;
+    bool prefix;
+    unsigned quirks;
+} clientKinds[ESCL_CLIENT_KINDS] = {
+    [ESCL_CLIENT_UNKNOWN] = { "unknown", NULL, false, 0 },
+    [ESCL_CLIENT_AIRSCAN] = { "AirScan", "AirScanScanner", false, ESCL_QUIRK_CHUNKED_DOCUMENTS },
+    [ESCL_CLIENT_SANE_AIRSCAN] = { "sane-airscan", "sane-airscan", false, ESCL_QUIRK_CHUNKED_DOCUMENTS },
+    [ESCL_CLIENT_MOPRIA] = { "Mopria", "Mopria", true, ESCL_QUIRK_CHUNKED_DOCUMENTS },
+};
+
+static int parseVersionPart(const char** p) {
+    int value = 0;
+    if (!isdigit((unsigned char)**p))
+        return -1;
+    for (; isdigit((unsigned char)**p); ++*p) {
+        if (value > 9999)
+            return -1;
+        value = value * 10 + (**p - '0');
+    }
+    return value;
+}
+
+// The token must end at whitespace, '/' before a version, or the end of the header.
+static const char* findProductToken(const char* userAgent, const char* token, bool prefix) {
+    size_t length = strlen(token);
+    for (const char* p = strstr(userAgent, token); p != NULL; p = strstr(p + 1, token)) {
+        const char* end = p + length;
+        while (prefix && (isalnum((unsigned char)*end) || *end == '-'))
+            ++end;
+        char next = *end;
+        if (next == '\0' || next == '/' || isspace((unsigned char)next))
+            return end;
+    }
+    return NULL;
+}
+
+void classifyEsclUserAgent(const char* userAgent, EsclClientInfo* info) {
+    info->kind = ESCL_CLIENT_UNKNOWN;
+    info->major = info->minor = -1;
+    info->quirks = 0;
+    if (userAgent == NULL)
+        return;
+
+    for (int kind = ESCL_CLIENT_UNKNOWN + 1; kind < ESCL_CLIENT_KINDS; ++kind) {
+        const char* end = findProductToken(userAgent, clientKinds[kind].token, clientKinds[kind].prefix);
+        if (end == NULL)
+            continue;
+        info->kind = (EsclClientKind)kind;
+        info->quirks = clientKinds[kind].quirks;
+        if (*end == '/') {
+            ++end;
+            info->major = parseVersionPart(&end);
+            if (info->major >= 0 && *end == '.') {
+                ++end;
+                info->minor = parseVersionPart(&end);
+            }
+        }
+        return;
+    }
+}
+
+const char* esclClientKindName(EsclClientKind kind) {
+    if ((unsigned)kind >= ESCL_CLIENT_KINDS)
+        return clientKinds[ESCL_CLIENT_UNKNOWN].name;
+    return clientKinds[kind].name;
+}
@@ -0,0 +1,43 @@
+#ifndef ESCL_CLIENT_H
+#define ESCL_CLIENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    ESCL_CLIENT_UNKNOWN,
+    ESCL_CLIENT_AIRSCAN,       // Apple's AirScanScanner
+    ESCL_CLIENT_SANE_AIRSCAN,
+    ESCL_CLIENT_MOPRIA,
+    ESCL_CLIENT_KINDS
+} EsclClientKind;
+
+// Quirk bits, per client kind
+#define ESCL_QUIRK_CHUNKED_DOCUMENTS 0x1   // takes NextDocument chunked; others get a Content-Length (respondNextDocument)
+
+typedef struct {
+    EsclClientKind kind;
+    int major;                 // version from the User-Agent product token; -1 when it has none
+    int minor;
+    unsigned quirks;
+} EsclClientInfo;
+
+// Classify a User-Agent header, which may be NULL.
+void classifyEsclUserAgent(const char* userAgent, EsclClientInfo* info);
+
+// "AirScan", "sane-airscan", ...; for logs.
+const char* esclClientKindName(EsclClientKind kind);
+
+static inline bool esclClientHas(const EsclClientInfo* info, unsigned quirk) {
+    return (info->quirks & quirk) != 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESCL_CLIENT_H */
@@ -3,135 +3,263 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <regex.h>
+#include "escl-ops.h"
 
 char* readXmlContent(const char* filePath) {
-    char* xmlContent = NULL;
-    long length;
     FILE* file = fopen(filePath, "rb");
+    char* xmlContent = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+
+    if (file == NULL)
+        return NULL;
 
-    if (file) {
-        fseek(file, 0, SEEK_END);
-        length = ftell(file);
-        fseek(file, 0, SEEK_SET);
-        xmlContent = (char*)malloc(length + 1);
-        if (xmlContent) {
-            fread(xmlContent, 1, length, file);
-            xmlContent[length] = '\0';  
+    // Read in chunks rather than sizing with fseek/ftell, so pipes work too.
+    bool tooLarge = false;
+    for (;;) {
+        if (capacity - length < 4096 && capacity < SCAN_SETTINGS_MAX_SIZE_DEFAULT + 1) {
+            size_t newCapacity = capacity ? capacity * 2 : 4096;
+            if (newCapacity > SCAN_SETTINGS_MAX_SIZE_DEFAULT + 1)
+                newCapacity = SCAN_SETTINGS_MAX_SIZE_DEFAULT + 1;
+            char* grown = (char*)realloc(xmlContent, newCapacity);
+            if (grown == NULL)
+                break;
+            xmlContent = grown;
+            capacity = newCapacity;
         }
+        if (length + 1 == capacity) {
+            tooLarge = fgetc(file) != EOF;
+            break;
+        }
+        size_t bytes = fread(xmlContent + length, 1, capacity - length - 1, file);
+        length += bytes;
+        if (bytes == 0)
+            break;
+    }
+
+    if (tooLarge || ferror(file) || !feof(file)) {
+        fprintf(stderr, "could not read '%s' (limit %d bytes)\n", filePath, SCAN_SETTINGS_MAX_SIZE_DEFAULT);
+        free(xmlContent);
         fclose(file);
+        return NULL;
     }
+    fclose(file);
 
+    if (xmlContent == NULL)
+        return NULL;
+    xmlContent[length] = '\0';
     return xmlContent;
 }
 
-typedef struct ScanSettingsXml {
-    char* xml;
-} ScanSettingsXml;
-
 void initScanSettingsXml(ScanSettingsXml* settings, const char* s) {
-    settings->xml = (char*)malloc(strlen(s) + 1);
-    strcpy(settings->xml, s);
+    settings->xml = s;
+    settings->length = strlen(s);
 }
 
-char* getString(const ScanSettingsXml* settings, const char* name, const char* pattern) {
-    const int max_matches = 2;
-    regex_t regex;
-    regmatch_t matches[max_matches];
+EsclStringView getString(const ScanSettingsXml* settings, ScanSettingsField field) {
+    EsclStringView value = { "", 0 };
+    findScanSettingsField(settings->xml, settings->length, field, &value);
+    return value;
+}
 
-    if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-        fprintf(stderr, "Could not compile regex\n");
-        exit(1);
-    }
+double getNumber(const ScanSettingsXml* settings, ScanSettingsField field) {
+    double result = 0;
+    parseEsclNumber(getString(settings, field), &result);
+    return result;
+}
 
-    if (regexec(&regex, settings->xml, max_matches, matches, 0) == 0) {
-        size_t match_length = matches[1].rm_eo - matches[1].rm_so;
-        char* result = (char*)malloc(match_length + 1);
-        strncpy(result, settings->xml + matches[1].rm_so, match_length);
-        result[match_length] = '\0';
+// PAPPL serves each connection on a thread of its own, so the last client
+// this thread classified is the one it is serving unless the connection changed.
+static _Thread_local struct {
+    http_t* http;
+    EsclClientInfo info;
+} connectionClient;
 
-        regfree(&regex);
-        return result;
+const EsclClientInfo* EsclClientFromConnection(pappl_client_t *client) {
+    if (connectionClient.http != client->http) {
+        classifyEsclUserAgent(httpGetField(client->http, HTTP_FIELD_USER_AGENT), &connectionClient.info);
+        connectionClient.http = client->http;
     }
+    return &connectionClient.info;
+}
 
-    regfree(&regex);
-    char* empty = (char*)malloc(1);
-    empty[0] = '\0';
-    return empty;
+bool ClientAlreadyAirScan(pappl_client_t *client) {
+    return EsclClientFromConnection(client)->kind == ESCL_CLIENT_AIRSCAN;
 }
 
-double getNumber(const ScanSettingsXml* settings, const char* name, const char* pattern) {
-    char* string_value = getString(settings, name, pattern);
-    double result = strtod(string_value, NULL);
-    free(string_value);
-    return result;
+int ScanSettingsFromXML(const char* xmlString, pappl_client_t *client, ScanSettings* settings)
+{
+    return parseScanSettings(xmlString, strlen(xmlString), settings);
 }
 
-bool ClientAlreadyAirScan(pappl_client_t *client) {
-    const char* airscan_string = "AirScanScanner";
-    size_t airscan_length = strlen(airscan_string);
-
-    const char* user_agent = httpGetField(client->http, HTTP_FIELD_USER_AGENT);
-    const char* result = strstr(user_agent, airscan_string);
-
-    if (result != NULL) {
-        size_t substring_length = strlen(result);
-        if (substring_length > airscan_length) {
-            char next_char = *(result + airscan_length);
-            if (next_char != ' ' && next_char != '\t' && next_char != '\r' && next_char != '\n') {
-                return false;
-            }
-        }
+int ScanSettingsFromClient(pappl_client_t *client, ScanSettingsReader* reader)
+{
+    ssize_t bytes;
 
-        return true;
+    // Read straight into the reader's buffer and parse each chunk as it arrives.
+    while (reader->length < reader->maxSize) {
+        bytes = httpRead2(client->http, reader->buffer + reader->length, reader->maxSize - reader->length);
+        if (bytes < 0)
+            return -1;
+        if (bytes == 0)
+            return finishScanSettingsReader(reader);
+        if (commitScanSettingsReader(reader, (size_t)bytes) != 0)
+            return -1;
     }
 
-    return false;
+    // Buffer is full: accept only if the body ends exactly here.
+    char probe;
+    if (httpRead2(client->http, &probe, 1) != 0)
+        return -1;
+    return finishScanSettingsReader(reader);
 }
 
-void ScanSettingsFromXML(const char* xmlString, pappl_client_t *client)
+ScanTicket* ScanTicketFromClient(pappl_client_t *client, ScanTicketCache* cache, ScanSettingsReader* reader)
 {
-ScanSettingsXml scanSettings;
-initScanSettingsXml(&scanSettings, xmlString);
+    ssize_t bytes;
+
+    // The whole body is needed for the lookup, so it is read before anything is parsed.
+    while (reader->length < reader->maxSize) {
+        bytes = httpRead2(client->http, reader->buffer + reader->length, reader->maxSize - reader->length);
+        if (bytes < 0)
+            return NULL;
+        if (bytes == 0)
+            return acquireScanTicket(cache, reader->buffer, reader->length);
+        reader->length += (size_t)bytes;
+    }
 
-char* versionPattern = "<pwg:Version>([^<]*)</pwg:Version>";
-char* version = getString(&scanSettings, "Version", versionPattern);
+    char probe;
+    if (httpRead2(client->http, &probe, 1) != 0)
+        return NULL;
+    return acquireScanTicket(cache, reader->buffer, reader->length);
+}
 
-char* intentPattern = "<scan:Intent>([^<]*)</scan:Intent>";
-char* intent = getString(&scanSettings, "Intent", intentPattern);
+bool startScanDocument(pappl_client_t* client, const char* contentType)
+{
+    httpClearFields(client->http);
+    httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, contentType);
+    httpSetField(client->http, HTTP_FIELD_TRANSFER_ENCODING, "chunked");
+    return httpWriteResponse(client->http, HTTP_STATUS_OK) >= 0;
+}
 
-char* heightPattern = "<pwg:Height>([^<]*)</pwg:Height>";
-char* height = getString(&scanSettings, "Height", heightPattern);
+int writeScanDocument(void* client, const void* data, size_t length)
+{
+    // Stripes are larger than the write buffer, so each one leaves as a chunk of its own
+    if (httpWrite2(((pappl_client_t*)client)->http, (const char*)data, length) < 0)
+        return -1;
+    SCAN_STATS_COUNT(SCAN_COUNTER_BYTES_SENT, length);
+    return 0;
+}
 
-char* contentRegionUnitsPattern = "<pwg:ContentRegionUnits>([^<]*)</pwg:ContentRegionUnits>";
-char* contentRegionUnits = getString(&scanSettings, "ContentRegionUnits", contentRegionUnitsPattern);
+bool finishScanDocument(pappl_client_t* client)
+{
+    // A zero-length write ends the chunked body
+    if (httpWrite2(client->http, "", 0) < 0)
+        return false;
+    return httpFlushWrite(client->http) >= 0;
+}
 
-char* widthPattern = "<pwg:Width>([^<]*)</pwg:Width>";
-double width = getNumber(&scanSettings, "Width", widthPattern);
+bool respondScanQueueFull(pappl_client_t* client, unsigned retryAfter)
+{
+    char seconds[16];
+    snprintf(seconds, sizeof(seconds), "%u", retryAfter);
+    httpClearFields(client->http);
+    httpSetField(client->http, HTTP_FIELD_RETRY_AFTER, seconds);
+    httpSetLength(client->http, 0);
+    if (httpWriteResponse(client->http, HTTP_STATUS_SERVICE_UNAVAILABLE) < 0)
+        return false;
+    return httpFlushWrite(client->http) >= 0;
+}
 
-char* xOffsetPattern = "<pwg:XOffset>([^<]*)</pwg:XOffset>";
-double xOffset = getNumber(&scanSettings, "XOffset", xOffsetPattern);
+bool respondSpooledDocument(pappl_client_t* client, ScanSpool* spool, const ScanSpoolDocument* document,
+                            const char* contentType)
+{
+    bool zeroCopy = !httpIsEncrypted(client->http);
+    bool sent;
 
-char* yOffsetPattern = "<pwg:YOffset>([^<]*)</pwg:YOffset>";
-double yOffset = getNumber(&scanSettings, "YOffset", yOffsetPattern);
+    SCAN_STATS_START(start);
+    httpClearFields(client->http);
+    httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, contentType);
+    // sendfile goes around the http_t, which would still be waiting for the
+    // body, so the connection must not carry another request: with keep-alive
+    // off the client loop closes it after this response
+    if (zeroCopy) {
+        httpSetKeepAlive(client->http, HTTP_KEEPALIVE_OFF);
+        httpSetField(client->http, HTTP_FIELD_CONNECTION, "close");
+    }
+    httpSetLength(client->http, document->length);
+    if (httpWriteResponse(client->http, HTTP_STATUS_OK) < 0 || httpFlushWrite(client->http) < 0)
+        return false;
 
-char* inputSourcePattern = "<pwg:InputSource>([^<]*)</pwg:InputSource>";
-char* inputSource = getString(&scanSettings, "InputSource", inputSourcePattern);
+    if (zeroCopy) {
+        sent = sendSpooledDocument(spool, document, httpGetFd(client->http)) == 0;
+        if (sent)
+            SCAN_STATS_COUNT(SCAN_COUNTER_BYTES_SENT, document->length);
+    } else {
+        sent = copySpooledDocument(spool, document, writeScanDocument, client) == 0
+               && httpFlushWrite(client->http) >= 0;
+    }
+    if (sent)
+        SCAN_STATS_STOP(start, SCAN_STAGE_TRANSFER);
+    return sent;
+}
 
-char* colorModePattern = "<scan:ColorMode>([^<]*)</scan:ColorMode>";
-char* colorMode = getString(&scanSettings, "ColorMode", colorModePattern);
+bool respondNextDocument(pappl_client_t* client, ScanSpool* spool, const ScanSpoolDocument* document,
+                         const char* contentType)
+{
+    if (!esclClientHas(EsclClientFromConnection(client), ESCL_QUIRK_CHUNKED_DOCUMENTS))
+        return respondSpooledDocument(client, spool, document, contentType);
 
-char* blankPageDetectionPattern = "<scan:BlankPageDetection>([^<]*)</scan:BlankPageDetection>";
-char* blankPageDetection = getString(&scanSettings, "BlankPageDetection", blankPageDetectionPattern);
+    bool sent;
 
-free(version);
-free(intent);
-free(height);
-free(contentRegionUnits);
-free(inputSource);
-free(colorMode);
-free(blankPageDetection);
-free(scanSettings.xml);
+    SCAN_STATS_START(start);
+    if (!startScanDocument(client, contentType))
+        return false;
+    if (httpIsEncrypted(client->http)) {
+        sent = copySpooledDocument(spool, document, writeScanDocument, client) == 0;
+    } else {
+        // The chunk goes around the http_t, which does not count chunked
+        // bytes, so the connection stays usable for the next request
+        sent = httpFlushWrite(client->http) >= 0
+               && sendSpooledChunk(spool, document, httpGetFd(client->http)) == 0;
+        if (sent)
+            SCAN_STATS_COUNT(SCAN_COUNTER_BYTES_SENT, document->length);
+    }
+    if (!sent || !finishScanDocument(client))
+        return false;
+    SCAN_STATS_STOP(start, SCAN_STAGE_TRANSFER);
+    return true;
 }
 
+bool respondScanStats(pappl_client_t* client)
+{
+    ScanStatsSnapshot* snapshot = NULL;
+    http_status_t status = HTTP_STATUS_NOT_FOUND;
+    char text[4096];
+    int length = 0;
+
+    if (!httpAddrLocalhost(httpGetAddress(client->http))) {
+        status = HTTP_STATUS_FORBIDDEN;
+    } else if ((snapshot = (ScanStatsSnapshot*)malloc(sizeof(ScanStatsSnapshot))) != NULL
+               && takeScanStatsSnapshot(snapshot)) {
+        length = formatScanStats(snapshot, text, sizeof(text));
+        if (length >= 0 && (size_t)length < sizeof(text))
+            status = HTTP_STATUS_OK;
+        else
+            status = HTTP_STATUS_SERVER_ERROR;
+    }
+    free(snapshot);
 
+    httpClearFields(client->http);
+    if (status != HTTP_STATUS_OK) {
+        httpSetLength(client->http, 0);
+        if (httpWriteResponse(client->http, status) < 0)
+            return false;
+        return httpFlushWrite(client->http) >= 0;
+    }
+    httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, "text/plain");
+    httpSetLength(client->http, (size_t)length);
+    if (httpWriteResponse(client->http, HTTP_STATUS_OK) < 0 || httpWrite2(client->http, text, (size_t)length) < 0)
+        return false;
+    return httpFlushWrite(client->http) >= 0;
+}
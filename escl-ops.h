@@ -5,29 +5,79 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <regex.h>
 #include <assert.h>
+#include "escl-scan-settings.h"
+#include "escl-client.h"
+#include "scan-spool.h"
+#include "scan-stats.h"
+#include "scan-ticket.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Function to read XML content from a file
+// Function to read XML content from a file; NULL on error or above SCAN_SETTINGS_MAX_SIZE_DEFAULT
 char* readXmlContent(const char* filePath);
 
 typedef struct ScanSettingsXml {
-    char* xml;
+    const char* xml; // borrowed from the caller, not copied
+    size_t length;
 } ScanSettingsXml;
 
 void initScanSettingsXml(ScanSettingsXml* settings, const char* s);
 
-char* getString(const ScanSettingsXml* settings, const char* name, const char* pattern);
+// Returns a view into settings->xml; empty if the element is missing
+EsclStringView getString(const ScanSettingsXml* settings, ScanSettingsField field);
 
-double getNumber(const ScanSettingsXml* settings, const char* name, const char* pattern);
+double getNumber(const ScanSettingsXml* settings, ScanSettingsField field);
+
+// Who is on the other end of this connection, worked out from the User-Agent
+// of its first request and kept for the rest of the keep-alive session.
+const EsclClientInfo* EsclClientFromConnection(pappl_client_t* client);
 
 bool ClientAlreadyAirScan(pappl_client_t* client);
 
-void ScanSettingsFromXML(const char* xmlString, pappl_client_t* client);
+// Parse a ScanSettings request body into settings; returns 0 on success, -1 on a malformed ticket
+int ScanSettingsFromXML(const char* xmlString, pappl_client_t* client, ScanSettings* settings);
+
+// Parse the request body of a POST /ScanJobs while it is received; results are in reader->settings
+int ScanSettingsFromClient(pappl_client_t* client, ScanSettingsReader* reader);
+
+// Read the body of a POST /ScanJobs into reader's buffer and take its ticket
+// from cache, so a repeated ticket is not parsed again. The result is
+// released with releaseScanTicket; NULL if the body is too large or the ticket is bad.
+ScanTicket* ScanTicketFromClient(pappl_client_t* client, ScanTicketCache* cache, ScanSettingsReader* reader);
+
+// Start a NextDocument response whose length is not known yet; the body goes out chunked.
+bool startScanDocument(pappl_client_t* client, const char* contentType);
+
+// ScanEncoderOutput writing to a client after startScanDocument; context is the pappl_client_t.
+int writeScanDocument(void* client, const void* data, size_t length);
+
+// Send the last chunk.
+bool finishScanDocument(pappl_client_t* client);
+
+// Answer NextDocument with a spooled document and its Content-Length, for
+// clients that cannot take a chunked one. Plain connections get it with
+// sendfile, which leaves their http_t out of step, so keep-alive is turned off
+// and the caller must close the connection and not read or write it again;
+// TLS ones get a copy through the http_t and stay open.
+bool respondSpooledDocument(pappl_client_t* client, ScanSpool* spool, const ScanSpoolDocument* document,
+                            const char* contentType);
+
+// Answer NextDocument with a spooled document in the form this client takes.
+// Kinds with ESCL_QUIRK_CHUNKED_DOCUMENTS get one chunk, sent with sendfile on
+// plain connections and copied through the http_t on TLS ones; either way the
+// connection stays open. Other clients go through respondSpooledDocument.
+bool respondNextDocument(pappl_client_t* client, ScanSpool* spool, const ScanSpoolDocument* document,
+                         const char* contentType);
+
+// Answer a POST /ScanJobs that submitScanJob refused: 503 with Retry-After.
+bool respondScanQueueFull(pappl_client_t* client, unsigned retryAfter);
+
+// The scan path's stage latencies as text/plain, for clients on the local
+// host only; 404 when built without ESCL_SCAN_STATS.
+bool respondScanStats(pappl_client_t* client);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,532 @@
+#include "escl-scan-settings.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only element table indexed by ScanSettingsField. It is plain const data,
+// so every client thread shares it without locking and nothing is compiled per
+// request. Elements are matched on their local name, so any namespace prefix is
+// accepted.
+static const ScanSettingsElement scanSettingsElements[SCAN_FIELD_COUNT] = {
+    { SCAN_FIELD_VERSION, "pwg:Version", "Version", 7 },
+    { SCAN_FIELD_INTENT, "scan:Intent", "Intent", 6 },
+    { SCAN_FIELD_HEIGHT, "pwg:Height", "Height", 6 },
+    { SCAN_FIELD_CONTENT_REGION_UNITS, "pwg:ContentRegionUnits", "ContentRegionUnits", 18 },
+    { SCAN_FIELD_WIDTH, "pwg:Width", "Width", 5 },
+    { SCAN_FIELD_X_OFFSET, "pwg:XOffset", "XOffset", 7 },
+    { SCAN_FIELD_Y_OFFSET, "pwg:YOffset", "YOffset", 7 },
+    { SCAN_FIELD_INPUT_SOURCE, "pwg:InputSource", "InputSource", 11 },
+    { SCAN_FIELD_COLOR_MODE, "scan:ColorMode", "ColorMode", 9 },
+    { SCAN_FIELD_BLANK_PAGE_DETECTION, "scan:BlankPageDetection", "BlankPageDetection", 18 },
+    { SCAN_FIELD_X_RESOLUTION, "scan:XResolution", "XResolution", 11 },
+    { SCAN_FIELD_Y_RESOLUTION, "scan:YResolution", "YResolution", 11 },
+    { SCAN_FIELD_DOCUMENT_FORMAT, "pwg:DocumentFormat", "DocumentFormat", 14 },
+    { SCAN_FIELD_DOCUMENT_FORMAT_EXT, "scan:DocumentFormatExt", "DocumentFormatExt", 17 },
+    { SCAN_FIELD_SCAN_REGION, "pwg:ScanRegion", "ScanRegion", 10 },
+};
+
+const ScanSettingsElement* scanSettingsElement(ScanSettingsField field) {
+    if ((unsigned)field >= SCAN_FIELD_COUNT)
+        return NULL;
+    return &scanSettingsElements[field];
+}
+
+static int lookupElement(const char* name, size_t length) {
+    for (size_t i = 0; i < SCAN_FIELD_COUNT; ++i) {
+        if (scanSettingsElements[i].length == length && memcmp(scanSettingsElements[i].name, name, length) == 0)
+            return (int)scanSettingsElements[i].field;
+    }
+    return -1;
+}
+
+// XML whitespace only; isspace() would depend on the process locale.
+static bool isXmlSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static const char* findSequence(const char* p, const char* end, const char* sequence) {
+    size_t length = strlen(sequence);
+    while (p + length <= end) {
+        const char* c = memchr(p, sequence[0], end - p);
+        if (c == NULL || c + length > end)
+            return NULL;
+        if (memcmp(c, sequence, length) == 0)
+            return c;
+        p = c + 1;
+    }
+    return NULL;
+}
+
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static double scaleByPowerOfTen(double value, int exponent) {
+    const int largest = (int)(sizeof(powersOfTen) / sizeof(powersOfTen[0])) - 1;
+    while (exponent > largest) {
+        value *= powersOfTen[largest];
+        exponent -= largest;
+    }
+    while (exponent < -largest) {
+        value /= powersOfTen[largest];
+        exponent += largest;
+    }
+    return exponent < 0 ? value / powersOfTen[-exponent] : value * powersOfTen[exponent];
+}
+
+bool parseEsclNumber(EsclStringView view, double* number) {
+    const char* p = view.data;
+    const char* end = view.data + view.length;
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool negative = false;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+        if (mantissa < 1000000000000000000ULL)
+            mantissa = mantissa * 10 + (*p - '0');
+        else
+            exponent++;
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+            if (mantissa < 1000000000000000000ULL) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0)
+        return false;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        bool negativeExponent = false;
+        int value = 0;
+        if (++p < end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+        if (p == end)
+            return false;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            if (value < 10000)
+                value = value * 10 + (*p - '0');
+        }
+        exponent += negativeExponent ? -value : value;
+    }
+    if (p != end)
+        return false;
+
+    // Exponents past the double range come out as inf
+    double result = scaleByPowerOfTen((double)mantissa, exponent);
+    if (!isfinite(result))
+        return false;
+    *number = negative ? -result : result;
+    return true;
+}
+
+static const struct {
+    const char* name;
+    ScanColorMode mode;
+    int channels;
+    int depth;
+} colorModes[] = {
+    { "BlackAndWhite1", SCAN_COLOR_BLACK_AND_WHITE1, 1, 1 },
+    { "Grayscale8", SCAN_COLOR_GRAYSCALE8, 1, 8 },
+    { "Grayscale16", SCAN_COLOR_GRAYSCALE16, 1, 16 },
+    { "RGB24", SCAN_COLOR_RGB24, 3, 8 },
+    { "RGB48", SCAN_COLOR_RGB48, 3, 16 },
+};
+
+ScanColorMode parseScanColorMode(EsclStringView name) {
+    if (name.length == 0)
+        return SCAN_COLOR_NONE;
+    for (size_t i = 0; i < sizeof(colorModes) / sizeof(colorModes[0]); ++i) {
+        if (esclStringViewEquals(name, colorModes[i].name))
+            return colorModes[i].mode;
+    }
+    return SCAN_COLOR_UNKNOWN;
+}
+
+bool scanColorModeLayout(ScanColorMode mode, int* channels, int* depth) {
+    for (size_t i = 0; i < sizeof(colorModes) / sizeof(colorModes[0]); ++i) {
+        if (colorModes[i].mode == mode) {
+            *channels = colorModes[i].channels;
+            *depth = colorModes[i].depth;
+            return true;
+        }
+    }
+    return false;
+}
+
+int scanDocumentFormatFor(const ScanSettings* settings, ScanDocumentFormat* format) {
+    EsclStringView type = settings->documentFormatExt.length ? settings->documentFormatExt : settings->documentFormat;
+    if (type.length == 0 || esclStringViewEquals(type, "image/jpeg"))
+        *format = SCAN_FORMAT_JPEG;
+    else if (esclStringViewEquals(type, "image/png"))
+        *format = SCAN_FORMAT_PNG;
+    else if (esclStringViewEquals(type, "application/pdf"))
+        *format = SCAN_FORMAT_PDF;
+    else
+        return -1;
+    return 0;
+}
+
+const char* scanDocumentFormatType(ScanDocumentFormat format) {
+    switch (format) {
+    case SCAN_FORMAT_PNG:
+        return "image/png";
+    case SCAN_FORMAT_PDF:
+        return "application/pdf";
+    default:
+        return "image/jpeg";
+    }
+}
+
+static int viewValue(EsclStringView* target, const char* value, size_t length) {
+    target->data = value;
+    target->length = length;
+    return 0;
+}
+
+static int numberValue(double* target, const char* value, size_t length) {
+    EsclStringView view = { value, length };
+    if (length == 0) {
+        *target = 0;
+        return 0;
+    }
+    return parseEsclNumber(view, target) ? 0 : -1;
+}
+
+static bool isRegionField(ScanSettingsField field) {
+    return field == SCAN_FIELD_HEIGHT || field == SCAN_FIELD_WIDTH || field == SCAN_FIELD_X_OFFSET
+           || field == SCAN_FIELD_Y_OFFSET || field == SCAN_FIELD_CONTENT_REGION_UNITS;
+}
+
+// Region fields outside any ScanRegion element belong to an implicit first region.
+static ScanRegion* currentRegion(ScanSettings* settings) {
+    if (settings->regionCount == 0)
+        settings->regionCount = 1;
+    return &settings->regions[settings->regionCount - 1];
+}
+
+static int storeField(ScanSettings* settings, ScanSettingsField field, const char* value, size_t length) {
+    switch (field) {
+    case SCAN_FIELD_VERSION:
+        return viewValue(&settings->version, value, length);
+    case SCAN_FIELD_INTENT:
+        return viewValue(&settings->intent, value, length);
+    case SCAN_FIELD_HEIGHT:
+        return numberValue(&currentRegion(settings)->height, value, length);
+    case SCAN_FIELD_CONTENT_REGION_UNITS:
+        return viewValue(&currentRegion(settings)->contentRegionUnits, value, length);
+    case SCAN_FIELD_WIDTH:
+        return numberValue(&currentRegion(settings)->width, value, length);
+    case SCAN_FIELD_X_OFFSET:
+        return numberValue(&currentRegion(settings)->xOffset, value, length);
+    case SCAN_FIELD_Y_OFFSET:
+        return numberValue(&currentRegion(settings)->yOffset, value, length);
+    case SCAN_FIELD_INPUT_SOURCE:
+        return viewValue(&settings->inputSource, value, length);
+    case SCAN_FIELD_COLOR_MODE:
+        viewValue(&settings->colorMode, value, length);
+        settings->color = parseScanColorMode(settings->colorMode);
+        return 0;
+    case SCAN_FIELD_BLANK_PAGE_DETECTION:
+        settings->blankPageDetection = (length == 4 && memcmp(value, "true", 4) == 0)
+                                    || (length == 1 && value[0] == '1');
+        return 0;
+    case SCAN_FIELD_X_RESOLUTION:
+        return numberValue(&settings->xResolution, value, length);
+    case SCAN_FIELD_Y_RESOLUTION:
+        return numberValue(&settings->yResolution, value, length);
+    case SCAN_FIELD_DOCUMENT_FORMAT:
+        return viewValue(&settings->documentFormat, value, length);
+    case SCAN_FIELD_DOCUMENT_FORMAT_EXT:
+        return viewValue(&settings->documentFormatExt, value, length);
+    case SCAN_FIELD_SCAN_REGION:
+        if (settings->regionCount == SCAN_SETTINGS_MAX_REGIONS)
+            return -1;
+        settings->regionCount++;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+// Advance *cursor past the next known element's start tag and return its field,
+// with its trimmed text in value. *depth counts the elements open at the cursor
+// and becomes -1 once the ScanSettings root has been closed. Returns -1 when
+// the input is used up, -2 if it ends inside a tag and -3 if it is not a
+// ScanSettings document.
+static int nextElement(const char** cursor, const char* end, int* depth, EsclStringView* value) {
+    const char* p = *cursor;
+
+    while (p < end) {
+        *cursor = p;
+        const char* tag = memchr(p, '<', end - p);
+        // Only markup and whitespace may surround the root element.
+        if (*depth <= 0) {
+            for (const char* c = p; c < (tag != NULL ? tag : end); ++c) {
+                if (!isXmlSpace(*c))
+                    return -3;
+            }
+        }
+        if (tag == NULL)
+            break;
+        p = tag + 1;
+        if (p >= end)
+            return -2;
+
+        if (*p == '?') {
+            p = findSequence(p, end, "?>");
+            if (p == NULL)
+                return -2;
+            p += 2;
+            continue;
+        }
+        if (*p == '!') {
+            if (end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+                p = findSequence(p + 3, end, "-->");
+                if (p == NULL)
+                    return -2;
+                p += 3;
+            } else {
+                p = memchr(p, '>', end - p);
+                if (p == NULL)
+                    return -2;
+                p++;
+            }
+            continue;
+        }
+
+        const char* close = memchr(p, '>', end - p);
+        if (close == NULL)
+            return -2;
+        if (*p == '/') {
+            if (*depth <= 0)
+                return -3;
+            if (--*depth == 0)
+                *depth = -1;
+            p = close + 1;
+            continue;
+        }
+
+        bool empty = close[-1] == '/';
+        const char* name = p;
+        const char* nameEnd = p;
+        while (nameEnd < close && !isXmlSpace(*nameEnd) && *nameEnd != '/') {
+            if (*nameEnd == ':')
+                name = nameEnd + 1;
+            nameEnd++;
+        }
+        p = close + 1;
+
+        if (*depth < 0)
+            return -3;
+        if (*depth == 0) {
+            if (nameEnd - name != 12 || memcmp(name, "ScanSettings", 12) != 0)
+                return -3;
+            *depth = empty ? -1 : 1;
+            continue;
+        }
+        if (empty)
+            continue;
+        ++*depth;
+
+        int field = lookupElement(name, nameEnd - name);
+        if (field < 0)
+            continue;
+
+        const char* valueEnd = memchr(p, '<', end - p);
+        if (valueEnd == NULL) {
+            --*depth;
+            return -2;
+        }
+        const char* first = p;
+        while (first < valueEnd && isXmlSpace(*first))
+            first++;
+        const char* last = valueEnd;
+        while (last > first && isXmlSpace(last[-1]))
+            last--;
+
+        value->data = first;
+        value->length = last - first;
+        *cursor = valueEnd;
+        return field;
+    }
+
+    *cursor = end;
+    return -1;
+}
+
+int continueScanSettings(ScanSettings* settings, const char** cursor, const char* end) {
+    EsclStringView value;
+    int field;
+
+    while ((field = nextElement(cursor, end, &settings->depth, &value)) >= 0) {
+        if ((settings->fields & (1u << field)) != 0 && !isRegionField((ScanSettingsField)field)
+            && field != SCAN_FIELD_SCAN_REGION)
+            continue;
+        if (storeField(settings, (ScanSettingsField)field, value.data, value.length) != 0)
+            return -1;
+        settings->fields |= 1u << field;
+    }
+
+    if (field == -3)
+        return -1;
+    return settings->depth < 0 ? 0 : 1;
+}
+
+int parseScanSettings(const char* xml, size_t length, ScanSettings* settings) {
+    const char* p = xml;
+
+    memset(settings, 0, sizeof(*settings));
+    return continueScanSettings(settings, &p, xml + length) == 0 ? 0 : -1;
+}
+
+bool findScanSettingsField(const char* xml, size_t length, ScanSettingsField field, EsclStringView* value) {
+    const char* p = xml;
+    const char* end = xml + length;
+    int depth = 0;
+    int found;
+
+    while ((found = nextElement(&p, end, &depth, value)) >= 0) {
+        if (found == (int)field)
+            return true;
+    }
+    return false;
+}
+
+ScanSettingsReader* new_ScanSettingsReader(size_t maxSize) {
+    ScanSettingsReader* reader = (ScanSettingsReader*)calloc(1, sizeof(ScanSettingsReader));
+    if (reader == NULL)
+        return NULL;
+
+    reader->maxSize = maxSize ? maxSize : SCAN_SETTINGS_MAX_SIZE_DEFAULT;
+    // One allocation up front, so views handed out while parsing never move.
+    reader->buffer = (char*)malloc(reader->maxSize);
+    if (reader->buffer == NULL) {
+        free(reader);
+        return NULL;
+    }
+    reader->cursor = reader->buffer;
+    return reader;
+}
+
+ScanSettingsReader* new_ScanSettingsReaderFromFile(const char* filePath, size_t maxSize) {
+    int fd = open(filePath, O_RDONLY);
+    struct stat info;
+    ScanSettingsReader* reader = NULL;
+
+    if (fd < 0)
+        return NULL;
+    if (maxSize == 0)
+        maxSize = SCAN_SETTINGS_MAX_SIZE_DEFAULT;
+
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        if ((size_t)info.st_size > maxSize) {
+            close(fd);
+            return NULL;
+        }
+        void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            reader = (ScanSettingsReader*)calloc(1, sizeof(ScanSettingsReader));
+            if (reader == NULL) {
+                munmap(mapping, info.st_size);
+                close(fd);
+                return NULL;
+            }
+            reader->buffer = (char*)mapping;
+            reader->length = info.st_size;
+            reader->maxSize = maxSize;
+            reader->cursor = reader->buffer;
+            reader->mapped = true;
+            close(fd);
+            if (continueScanSettings(&reader->settings, &reader->cursor, reader->buffer + reader->length) < 0)
+                reader->failed = true;
+            return reader;
+        }
+    }
+
+    // Pipes, FIFOs and anything that cannot be mapped are read in chunks.
+    reader = new_ScanSettingsReader(maxSize);
+    if (reader == NULL) {
+        close(fd);
+        return NULL;
+    }
+    for (;;) {
+        size_t space = reader->maxSize - reader->length;
+        if (space == 0) {
+            char probe;
+            if (read(fd, &probe, 1) > 0)
+                reader->failed = true;
+            break;
+        }
+        ssize_t bytes = read(fd, reader->buffer + reader->length, space);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0) {
+            if (bytes < 0)
+                reader->failed = true;
+            break;
+        }
+        reader->length += bytes;
+        if (continueScanSettings(&reader->settings, &reader->cursor, reader->buffer + reader->length) < 0) {
+            reader->failed = true;
+            break;
+        }
+    }
+    close(fd);
+    return reader;
+}
+
+void delete_ScanSettingsReader(ScanSettingsReader* reader) {
+    if (reader == NULL)
+        return;
+    if (reader->mapped)
+        munmap(reader->buffer, reader->length);
+    else
+        free(reader->buffer);
+    free(reader);
+}
+
+int feedScanSettingsReader(ScanSettingsReader* reader, const char* data, size_t length) {
+    if (reader->failed || reader->mapped)
+        return -1;
+    if (length > reader->maxSize - reader->length) {
+        reader->failed = true;
+        return -1;
+    }
+
+    memcpy(reader->buffer + reader->length, data, length);
+    return commitScanSettingsReader(reader, length);
+}
+
+int commitScanSettingsReader(ScanSettingsReader* reader, size_t length) {
+    if (reader->failed || reader->mapped || length > reader->maxSize - reader->length)
+        return -1;
+
+    reader->length += length;
+    if (continueScanSettings(&reader->settings, &reader->cursor, reader->buffer + reader->length) < 0) {
+        reader->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+int finishScanSettingsReader(ScanSettingsReader* reader) {
+    if (reader->failed)
+        return -1;
+    // Anything still pending at end of input is a truncated element or an
+    // unclosed root.
+    return continueScanSettings(&reader->settings, &reader->cursor, reader->buffer + reader->length) == 0 ? 0 : -1;
+}
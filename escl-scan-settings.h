@@ -0,0 +1,169 @@
+#ifndef ESCL_SCAN_SETTINGS_H
+#define ESCL_SCAN_SETTINGS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A (pointer, length) view into a caller-owned buffer; not NUL-terminated.
+typedef struct EsclStringView {
+    const char* data;
+    size_t length;
+} EsclStringView;
+
+typedef enum ScanSettingsField {
+    SCAN_FIELD_VERSION,
+    SCAN_FIELD_INTENT,
+    SCAN_FIELD_HEIGHT,
+    SCAN_FIELD_CONTENT_REGION_UNITS,
+    SCAN_FIELD_WIDTH,
+    SCAN_FIELD_X_OFFSET,
+    SCAN_FIELD_Y_OFFSET,
+    SCAN_FIELD_INPUT_SOURCE,
+    SCAN_FIELD_COLOR_MODE,
+    SCAN_FIELD_BLANK_PAGE_DETECTION,
+    SCAN_FIELD_X_RESOLUTION,
+    SCAN_FIELD_Y_RESOLUTION,
+    SCAN_FIELD_DOCUMENT_FORMAT,
+    SCAN_FIELD_DOCUMENT_FORMAT_EXT,
+    SCAN_FIELD_SCAN_REGION,    // container: each one starts a new region
+    SCAN_FIELD_COUNT
+} ScanSettingsField;
+
+typedef struct ScanSettingsElement {
+    ScanSettingsField field;
+    const char* qualifiedName; // as written by eSCL clients, e.g. "pwg:Version"
+    const char* name;          // local name used for matching
+    size_t length;
+} ScanSettingsElement;
+
+typedef struct ScanRegion {
+    double height;
+    double width;
+    double xOffset;
+    double yOffset;
+    EsclStringView contentRegionUnits;
+} ScanRegion;
+
+// scan:ColorMode. Each known mode is a fixed pixel layout, so a job picks its
+// kernels once from this rather than looking at the name again.
+typedef enum ScanColorMode {
+    SCAN_COLOR_NONE,           // the ticket names no ColorMode
+    SCAN_COLOR_BLACK_AND_WHITE1,
+    SCAN_COLOR_GRAYSCALE8,
+    SCAN_COLOR_GRAYSCALE16,
+    SCAN_COLOR_RGB24,
+    SCAN_COLOR_RGB48,
+    SCAN_COLOR_UNKNOWN         // a name we don't know; reject the ticket
+} ScanColorMode;
+
+ScanColorMode parseScanColorMode(EsclStringView name);
+
+// Channels and bits per sample of mode; false for NONE and UNKNOWN.
+bool scanColorModeLayout(ScanColorMode mode, int* channels, int* depth);
+
+// Largest number of pwg:ScanRegion elements a ticket may hold.
+#define SCAN_SETTINGS_MAX_REGIONS 8
+
+typedef struct ScanSettings {
+    EsclStringView version;
+    EsclStringView intent;
+    ScanRegion regions[SCAN_SETTINGS_MAX_REGIONS]; // in document order
+    size_t regionCount;
+    EsclStringView inputSource;
+    EsclStringView colorMode;
+    ScanColorMode color;               // colorMode, parsed with the ticket
+    EsclStringView documentFormat;     // pwg:DocumentFormat
+    EsclStringView documentFormatExt;  // scan:DocumentFormatExt, preferred when both are given
+    bool blankPageDetection;
+    double xResolution;
+    double yResolution;
+    unsigned int fields; // bit (1u << ScanSettingsField) set for each element found
+    int depth;           // elements open where parsing stopped; -1 once the root has closed
+} ScanSettings;
+
+typedef enum { SCAN_FORMAT_JPEG, SCAN_FORMAT_PNG, SCAN_FORMAT_PDF } ScanDocumentFormat;
+
+// The format a ticket asks for: scan:DocumentFormatExt over pwg:DocumentFormat,
+// JPEG when it names neither. Returns -1 for a format we cannot produce.
+int scanDocumentFormatFor(const ScanSettings* settings, ScanDocumentFormat* format);
+
+// MIME type for the Content-Type of NextDocument.
+const char* scanDocumentFormatType(ScanDocumentFormat format);
+
+// Parse a ScanSettings document in a single pass, without allocating. String
+// fields are views into xml, which must outlive settings. Region fields go to
+// the enclosing ScanRegion; every other field keeps its first occurrence.
+// Returns 0 on success, -1 if the root element is not ScanSettings, the document
+// is truncated, a number is malformed or there are more than
+// SCAN_SETTINGS_MAX_REGIONS regions.
+int parseScanSettings(const char* xml, size_t length, ScanSettings* settings);
+
+// Resume parsing at *cursor, storing every element that is complete before end.
+// Returns 0 once the ScanSettings root has been closed, 1 while it is still open
+// or an element is cut off at end (feed more input and call again with the same
+// cursor), -1 if this is not a ScanSettings document or a value is bad.
+int continueScanSettings(ScanSettings* settings, const char** cursor, const char* end);
+
+// Element description for field, from a process-wide read-only table; NULL if out of range.
+const ScanSettingsElement* scanSettingsElement(ScanSettingsField field);
+
+// Find the first element for field and point value at its trimmed text inside xml.
+bool findScanSettingsField(const char* xml, size_t length, ScanSettingsField field, EsclStringView* value);
+
+// Parse a decimal number such as "1200", "-2.5" or "3e2" without consulting the
+// locale. Returns false unless the whole view is a finite number.
+bool parseEsclNumber(EsclStringView view, double* number);
+
+#define SCAN_SETTINGS_MAX_SIZE_DEFAULT (64 * 1024)
+
+// Incremental ScanSettings input. Chunks are parsed as they arrive, so parsing
+// overlaps with receiving the request body, and the document may not grow past
+// maxSize. The views in settings point into buffer and live as long as the reader.
+typedef struct ScanSettingsReader {
+    char* buffer;         // maxSize bytes, or the file mapping
+    size_t length;
+    size_t maxSize;
+    const char* cursor;   // where parsing resumes
+    ScanSettings settings;
+    bool mapped;
+    bool failed;
+} ScanSettingsReader;
+
+// maxSize 0 selects SCAN_SETTINGS_MAX_SIZE_DEFAULT
+ScanSettingsReader* new_ScanSettingsReader(size_t maxSize);
+
+// Map a regular file, or read pipes and other streams in chunks. The whole file is
+// parsed before returning; check finishScanSettingsReader for the result.
+ScanSettingsReader* new_ScanSettingsReaderFromFile(const char* filePath, size_t maxSize);
+
+void delete_ScanSettingsReader(ScanSettingsReader* reader);
+
+// Returns -1 once the document exceeds maxSize or holds a malformed value.
+int feedScanSettingsReader(ScanSettingsReader* reader, const char* data, size_t length);
+
+// Parse length bytes that were written directly at buffer + length, e.g. by a
+// socket read, saving the copy feedScanSettingsReader makes.
+int commitScanSettingsReader(ScanSettingsReader* reader, size_t length);
+
+// Call at end of input; returns 0 if a complete document was parsed.
+int finishScanSettingsReader(ScanSettingsReader* reader);
+
+static inline bool esclStringViewEquals(EsclStringView view, const char* s) {
+    size_t length = strlen(s);
+    return view.length == length && memcmp(view.data, s, length) == 0;
+}
+
+static inline bool hasScanSettingsField(const ScanSettings* settings, ScanSettingsField field) {
+    return (settings->fields & (1u << field)) != 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESCL_SCAN_SETTINGS_H */
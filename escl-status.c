@@ -0,0 +1,373 @@
+#include "escl-status.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "escl-scan-settings.h"
+
+static const char* const scannerStateNames[] = {
+    "Idle", "Processing", "Testing", "Stopped", "Down",
+};
+
+static const char* const adfStateNames[] = {
+    "ScannerAdfProcessing", "ScannerAdfEmpty", "ScannerAdfJam",
+    "ScannerAdfLoaded", "ScannerAdfMispick", "ScannerAdfHatchOpen",
+};
+
+static const struct {
+    unsigned bit;
+    const char* name;
+} colorModeNames[] = {
+    { ESCL_COLOR_BLACK_AND_WHITE1, "BlackAndWhite1" },
+    { ESCL_COLOR_GRAYSCALE8, "Grayscale8" },
+    { ESCL_COLOR_GRAYSCALE16, "Grayscale16" },
+    { ESCL_COLOR_RGB24, "RGB24" },
+    { ESCL_COLOR_RGB48, "RGB48" },
+};
+
+static const char* const documentFormats[] = {
+    "image/jpeg", "image/png", "application/pdf",
+};
+
+static const char escl_header[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+static const char escl_namespaces[] =
+    "xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\" "
+    "xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\"";
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} XmlBuffer;
+
+static void appendXml(XmlBuffer* buffer, const char* format, ...) {
+    if (buffer->failed)
+        return;
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+        va_end(args);
+        if (written < 0) {
+            buffer->failed = true;
+            return;
+        }
+        if ((size_t)written < buffer->capacity - buffer->length) {
+            buffer->length += (size_t)written;
+            return;
+        }
+        size_t capacity = buffer->capacity * 2 + (size_t)written;
+        char* data = (char*)realloc(buffer->data, capacity);
+        if (data == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+}
+
+static void appendEscaped(XmlBuffer* buffer, const char* text) {
+    for (; text != NULL && *text; ++text) {
+        switch (*text) {
+        case '&': appendXml(buffer, "&amp;"); break;
+        case '<': appendXml(buffer, "&lt;"); break;
+        case '>': appendXml(buffer, "&gt;"); break;
+        case '"': appendXml(buffer, "&quot;"); break;
+        default: appendXml(buffer, "%c", *text); break;
+        }
+    }
+}
+
+// Hands the buffer's text over to a new document, or NULL if building it failed.
+static EsclDocument* finishDocument(XmlBuffer* buffer) {
+    EsclDocument* document = NULL;
+    if (!buffer->failed)
+        document = (EsclDocument*)malloc(sizeof(EsclDocument) + buffer->length + 1);
+    if (document != NULL) {
+        atomic_init(&document->refs, 1);
+        document->modified = 0;
+        document->length = buffer->length;
+        memcpy(document->body, buffer->data, buffer->length);
+        document->body[buffer->length] = '\0';
+    }
+    free(buffer->data);
+    return document;
+}
+
+EsclDocument* retainEsclDocument(EsclDocument* document) {
+    atomic_fetch_add_explicit(&document->refs, 1, memory_order_relaxed);
+    return document;
+}
+
+void releaseEsclDocument(EsclDocument* document) {
+    if (document != NULL && atomic_fetch_sub_explicit(&document->refs, 1, memory_order_acq_rel) == 1)
+        free(document);
+}
+
+time_t esclLastModified(const EsclDocument* document, time_t now) {
+    return document->modified < now ? document->modified : 0;
+}
+
+static void appendInputCaps(XmlBuffer* buffer, const char* element, const Options* options, const EsclScannerLimits* limits) {
+    unsigned colorModes = limits->colorModes;
+    if (options != NULL && options->synthesize_gray) {
+        if (colorModes & ESCL_COLOR_RGB24)
+            colorModes |= ESCL_COLOR_GRAYSCALE8;
+        if (colorModes & ESCL_COLOR_RGB48)
+            colorModes |= ESCL_COLOR_GRAYSCALE16;
+    }
+    // BlackAndWhite1 is binarized from 8-bit gray
+    if (colorModes & ESCL_COLOR_GRAYSCALE8)
+        colorModes |= ESCL_COLOR_BLACK_AND_WHITE1;
+
+    appendXml(buffer, "<scan:%s>"
+                      "<scan:MinWidth>16</scan:MinWidth><scan:MaxWidth>%d</scan:MaxWidth>"
+                      "<scan:MinHeight>16</scan:MinHeight><scan:MaxHeight>%d</scan:MaxHeight>"
+                      "<scan:MaxScanRegions>%d</scan:MaxScanRegions>"
+                      "<scan:SettingProfiles><scan:SettingProfile><scan:ColorModes>",
+              element, limits->maxWidth, limits->maxHeight, SCAN_SETTINGS_MAX_REGIONS);
+    for (size_t i = 0; i < sizeof(colorModeNames) / sizeof(colorModeNames[0]); ++i) {
+        if (colorModes & colorModeNames[i].bit)
+            appendXml(buffer, "<scan:ColorMode>%s</scan:ColorMode>", colorModeNames[i].name);
+    }
+    appendXml(buffer, "</scan:ColorModes><scan:DocumentFormats>");
+    for (size_t i = 0; i < sizeof(documentFormats) / sizeof(documentFormats[0]); ++i)
+        appendXml(buffer, "<pwg:DocumentFormat>%s</pwg:DocumentFormat><scan:DocumentFormatExt>%s</scan:DocumentFormatExt>",
+                  documentFormats[i], documentFormats[i]);
+    appendXml(buffer, "</scan:DocumentFormats><scan:SupportedResolutions><scan:DiscreteResolutions>");
+    for (size_t i = 0; i < limits->resolutionCount; ++i)
+        appendXml(buffer, "<scan:DiscreteResolution><scan:XResolution>%d</scan:XResolution>"
+                          "<scan:YResolution>%d</scan:YResolution></scan:DiscreteResolution>",
+                  limits->resolutions[i], limits->resolutions[i]);
+    appendXml(buffer, "</scan:DiscreteResolutions></scan:SupportedResolutions>"
+                      "</scan:SettingProfile></scan:SettingProfiles>"
+                      "<scan:SupportedIntents><scan:Intent>Document</scan:Intent><scan:Intent>TextAndGraphic</scan:Intent>"
+                      "<scan:Intent>Photo</scan:Intent><scan:Intent>Preview</scan:Intent></scan:SupportedIntents>"
+                      "</scan:%s>", element);
+}
+
+EsclDocument* buildScannerCapabilities(const SANE_Device* device, const Options* options,
+                                       const EsclScannerLimits* limits, const char* uuid) {
+    XmlBuffer buffer = { NULL, 0, 0, false };
+    appendXml(&buffer, "%s<scan:ScannerCapabilities %s><pwg:Version>2.63</pwg:Version><pwg:MakeAndModel>",
+              escl_header, escl_namespaces);
+    appendEscaped(&buffer, device->vendor);
+    appendXml(&buffer, " ");
+    appendEscaped(&buffer, device->model);
+    appendXml(&buffer, "</pwg:MakeAndModel><scan:UUID>%s</scan:UUID>", uuid);
+    if (limits->platen) {
+        appendXml(&buffer, "<scan:Platen>");
+        appendInputCaps(&buffer, "PlatenInputCaps", options, limits);
+        appendXml(&buffer, "</scan:Platen>");
+    }
+    if (limits->adf) {
+        appendXml(&buffer, "<scan:Adf>");
+        appendInputCaps(&buffer, "AdfSimplexInputCaps", options, limits);
+        if (limits->duplex)
+            appendInputCaps(&buffer, "AdfDuplexInputCaps", options, limits);
+        appendXml(&buffer, "</scan:Adf>");
+    }
+    appendXml(&buffer, "<scan:BlankPageDetection>true</scan:BlankPageDetection>"
+                       "<scan:BlankPageDetectionAndRemoval>true</scan:BlankPageDetectionAndRemoval>"
+                       "</scan:ScannerCapabilities>\n");
+
+    EsclDocument* document = finishDocument(&buffer);
+    if (document != NULL)
+        document->modified = time(NULL);
+    return document;
+}
+
+void initEsclStatus(EsclStatus* status, bool adf) {
+    memset(status, 0, sizeof(*status));
+    pthread_mutex_init(&status->lock, NULL);
+    atomic_init(&status->version, 1);
+    atomic_init(&status->refreshAt, 0);
+    atomic_init(&status->state, SCANNER_IDLE);
+    atomic_init(&status->adfState, adf ? ADF_EMPTY : -1);
+    atomic_init(&status->documentVersion, 0);
+    atomic_init(&status->documentModified, 0);
+}
+
+void destroyEsclStatus(EsclStatus* status) {
+    releaseEsclDocument(status->document);
+    status->document = NULL;
+    pthread_mutex_destroy(&status->lock);
+}
+
+static void bumpEsclStatus(EsclStatus* status) {
+    atomic_fetch_add_explicit(&status->version, 1, memory_order_release);
+}
+
+void setEsclScannerState(EsclStatus* status, EsclScannerState state) {
+    if (atomic_exchange(&status->state, (int)state) != (int)state)
+        bumpEsclStatus(status);
+}
+
+void setEsclAdfState(EsclStatus* status, EsclAdfState state) {
+    if (atomic_exchange(&status->adfState, (int)state) != (int)state)
+        bumpEsclStatus(status);
+}
+
+static bool isFinishedJob(const ScanJobSnapshot* snapshot) {
+    return snapshot->state == aborted || snapshot->state == canceled || snapshot->state == completed;
+}
+
+// Must be called before the job starts, since it attaches the job to the version counter.
+int addEsclStatusJob(EsclStatus* status, ScanJobStatus* job, const char* uuid) {
+    pthread_mutex_lock(&status->lock);
+    if (status->jobCount == ESCL_STATUS_MAX_JOBS) {
+        size_t oldest = ESCL_STATUS_MAX_JOBS;
+        time_t oldestUpdate = 0;
+        for (size_t i = 0; i < status->jobCount; ++i) {
+            ScanJobSnapshot snapshot = snapshotScanJob(status->jobs[i].job);
+            if (isFinishedJob(&snapshot) && (oldest == ESCL_STATUS_MAX_JOBS || snapshot.updated < oldestUpdate)) {
+                oldest = i;
+                oldestUpdate = snapshot.updated;
+            }
+        }
+        if (oldest == ESCL_STATUS_MAX_JOBS) {
+            pthread_mutex_unlock(&status->lock);
+            return -1;
+        }
+        atomic_store_explicit(&status->jobs[oldest].job->changes, NULL, memory_order_release);
+        status->jobs[oldest] = status->jobs[--status->jobCount];
+    }
+
+    EsclStatusJob* entry = &status->jobs[status->jobCount++];
+    snprintf(entry->uuid, sizeof(entry->uuid), "%s", uuid);
+    entry->job = job;
+    atomic_store_explicit(&job->changes, &status->version, memory_order_release);
+    pthread_mutex_unlock(&status->lock);
+    bumpEsclStatus(status);
+    return 0;
+}
+
+void removeEsclStatusJob(EsclStatus* status, ScanJobStatus* job) {
+    pthread_mutex_lock(&status->lock);
+    for (size_t i = 0; i < status->jobCount; ++i) {
+        if (status->jobs[i].job == job) {
+            status->jobs[i] = status->jobs[--status->jobCount];
+            atomic_store_explicit(&job->changes, NULL, memory_order_release);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&status->lock);
+    bumpEsclStatus(status);
+}
+
+// Job ages are part of the body, so a listed job makes the document expire now and then.
+static void refreshJobAges(EsclStatus* status, time_t now) {
+    long long refreshAt = atomic_load_explicit(&status->refreshAt, memory_order_relaxed);
+    if (refreshAt != 0 && now >= refreshAt
+        && atomic_compare_exchange_strong(&status->refreshAt, &refreshAt, 0))
+        bumpEsclStatus(status);
+}
+
+// A version is only dated once it is rendered, which is no earlier than the
+// change that made it; until then it counts as modified now.
+bool esclStatusUnchanged(EsclStatus* status, time_t ifModifiedSince, time_t now) {
+    if (ifModifiedSince <= 0)
+        return false;
+    refreshJobAges(status, now);
+    uint64_t version = atomic_load_explicit(&status->version, memory_order_acquire);
+    if (atomic_load_explicit(&status->documentVersion, memory_order_acquire) != version)
+        return false;
+    time_t modified = (time_t)atomic_load_explicit(&status->documentModified, memory_order_relaxed);
+    return ifModifiedSince >= modified;
+}
+
+static EsclDocument* renderScannerStatus(EsclStatus* status, time_t now) {
+    XmlBuffer buffer = { NULL, 0, 0, false };
+    int state = atomic_load(&status->state);
+    int adfState = atomic_load(&status->adfState);
+    char info[1024];
+
+    appendXml(&buffer, "%s<scan:ScannerStatus %s><pwg:Version>2.63</pwg:Version><pwg:State>%s</pwg:State>",
+              escl_header, escl_namespaces, scannerStateNames[state]);
+    if (adfState >= 0)
+        appendXml(&buffer, "<scan:AdfState>%s</scan:AdfState>", adfStateNames[adfState]);
+    if (status->jobCount > 0) {
+        appendXml(&buffer, "<scan:Jobs>");
+        for (size_t i = 0; i < status->jobCount; ++i) {
+            ScanJobSnapshot snapshot = snapshotScanJob(status->jobs[i].job);
+            formatScanJobInfo(&snapshot, status->jobs[i].uuid, now, info, sizeof(info));
+            appendXml(&buffer, "%s", info);
+        }
+        appendXml(&buffer, "</scan:Jobs>");
+        atomic_store(&status->refreshAt, (long long)now + ESCL_STATUS_AGE_REFRESH);
+    }
+    appendXml(&buffer, "</scan:ScannerStatus>\n");
+
+    EsclDocument* document = finishDocument(&buffer);
+    if (document != NULL)
+        document->modified = now;
+    return document;
+}
+
+EsclDocument* acquireEsclStatus(EsclStatus* status, time_t now) {
+    refreshJobAges(status, now);
+    pthread_mutex_lock(&status->lock);
+    // Read the version before the state it describes: a change made while
+    // rendering then leaves the document behind and the next request redoes it
+    uint64_t version = atomic_load_explicit(&status->version, memory_order_acquire);
+    if (status->document == NULL || atomic_load_explicit(&status->documentVersion, memory_order_relaxed) != version) {
+        EsclDocument* document = renderScannerStatus(status, now);
+        if (document != NULL) {
+            releaseEsclDocument(status->document);
+            status->document = document;
+            // The date before the version, so a check that sees the version sees its date or a later one
+            atomic_store_explicit(&status->documentModified, (long long)document->modified, memory_order_relaxed);
+            atomic_store_explicit(&status->documentVersion, version, memory_order_release);
+        }
+    }
+    EsclDocument* document = status->document ? retainEsclDocument(status->document) : NULL;
+    pthread_mutex_unlock(&status->lock);
+    return document;
+}
+
+static bool writeEsclResponse(pappl_client_t* client, http_status_t code, const EsclDocument* document, time_t now) {
+    char date[64];
+    httpClearFields(client->http);
+    if (document != NULL) {
+        time_t modified = esclLastModified(document, now);
+        if (modified != 0)
+            httpSetField(client->http, HTTP_FIELD_LAST_MODIFIED, httpGetDateString2(modified, date, sizeof(date)));
+        httpSetField(client->http, HTTP_FIELD_CONTENT_TYPE, "text/xml");
+    }
+    httpSetLength(client->http, document ? document->length : 0);
+    if (httpWriteResponse(client->http, code) < 0)
+        return false;
+    if (document != NULL && httpWrite2(client->http, document->body, document->length) < 0)
+        return false;
+    return httpFlushWrite(client->http) >= 0;
+}
+
+// 0 when the request has no If-Modified-Since or one that is not a date.
+static time_t ifModifiedSince(pappl_client_t* client) {
+    const char* value = httpGetField(client->http, HTTP_FIELD_IF_MODIFIED_SINCE);
+    return value != NULL && *value ? httpGetDateTime(value) : 0;
+}
+
+bool respondEsclDocument(pappl_client_t* client, EsclDocument* document) {
+    time_t since = ifModifiedSince(client);
+    time_t now = time(NULL);
+    if (since > 0 && since >= document->modified)
+        return writeEsclResponse(client, HTTP_STATUS_NOT_MODIFIED, NULL, now);
+    return writeEsclResponse(client, HTTP_STATUS_OK, document, now);
+}
+
+bool respondEsclStatus(pappl_client_t* client, EsclStatus* status) {
+    time_t now = time(NULL);
+    if (esclStatusUnchanged(status, ifModifiedSince(client), now))
+        return writeEsclResponse(client, HTTP_STATUS_NOT_MODIFIED, NULL, now);
+
+    EsclDocument* document = acquireEsclStatus(status, now);
+    if (document == NULL)
+        return false;
+    bool sent = writeEsclResponse(client, HTTP_STATUS_OK, document, now);
+    releaseEsclDocument(document);
+    return sent;
+}
@@ -0,0 +1,120 @@
+#ifndef ESCL_STATUS_H
+#define ESCL_STATUS_H
+
+#include "pappl-private.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <sane/sane.h>
+#include "scan-job.h"
+#include "test-scan-options.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A serialized response body, shared by every request that sends it and
+// freed with its last reference.
+typedef struct {
+    atomic_int refs;
+    time_t modified;       // when the body was built, for Last-Modified
+    size_t length;
+    char body[];
+} EsclDocument;
+
+EsclDocument* retainEsclDocument(EsclDocument* document);
+void releaseEsclDocument(EsclDocument* document);
+
+// CUPS 2.x has no ETag or If-None-Match field, so conditional requests go by
+// Last-Modified and If-Modified-Since, which count whole seconds. A document
+// built in the current second could still change within it without its date
+// moving, so until that second is over it is sent without a Last-Modified:
+// this returns 0 then, and document->modified afterwards.
+time_t esclLastModified(const EsclDocument* document, time_t now);
+
+// ColorMode bits for EsclScannerLimits.colorModes
+#define ESCL_COLOR_BLACK_AND_WHITE1 0x1
+#define ESCL_COLOR_GRAYSCALE8 0x2
+#define ESCL_COLOR_GRAYSCALE16 0x4
+#define ESCL_COLOR_RGB24 0x8
+#define ESCL_COLOR_RGB48 0x10
+
+#define ESCL_MAX_RESOLUTIONS 16
+
+// What the device can do, read from its SANE option descriptors.
+typedef struct {
+    int resolutions[ESCL_MAX_RESOLUTIONS];
+    size_t resolutionCount;
+    int maxWidth;          // 300ths of an inch
+    int maxHeight;
+    unsigned colorModes;   // native modes; gray ones are added when options->synthesize_gray,
+                           // and BlackAndWhite1 with Grayscale8
+    bool platen;
+    bool adf;
+    bool duplex;
+} EsclScannerLimits;
+
+// ScannerCapabilities never changes while the options stay the same, so it is
+// built once per scanner. NULL on allocation failure.
+EsclDocument* buildScannerCapabilities(const SANE_Device* device, const Options* options,
+                                       const EsclScannerLimits* limits, const char* uuid);
+
+#define ESCL_STATUS_MAX_JOBS 32
+// JobInfo Age is only re-rendered this often while nothing else changes.
+#define ESCL_STATUS_AGE_REFRESH 10
+
+typedef struct {
+    char uuid[40];
+    ScanJobStatus* job;
+} EsclStatusJob;
+
+// ScannerStatus for one scanner. Every change bumps version; the document is
+// rendered again only when a request finds it older than version, and a poll
+// whose If-Modified-Since is no older than the current version's document is
+// answered without rendering or taking the lock.
+typedef struct {
+    pthread_mutex_t lock;          // jobs and document
+    _Atomic uint64_t version;
+    atomic_llong refreshAt;        // when the Age of listed jobs is due a refresh, 0 if none
+    atomic_int state;              // index into the pwg:State names
+    atomic_int adfState;           // index into the scan:AdfState names, or -1 without a feeder
+    EsclStatusJob jobs[ESCL_STATUS_MAX_JOBS];
+    size_t jobCount;
+    EsclDocument* document;
+    _Atomic uint64_t documentVersion;
+    atomic_llong documentModified; // the document's modified, for the lock-free check
+} EsclStatus;
+
+typedef enum { SCANNER_IDLE, SCANNER_PROCESSING, SCANNER_TESTING, SCANNER_STOPPED, SCANNER_DOWN } EsclScannerState;
+typedef enum { ADF_PROCESSING, ADF_EMPTY, ADF_JAM, ADF_LOADED, ADF_MISPICK, ADF_HATCH_OPEN } EsclAdfState;
+
+void initEsclStatus(EsclStatus* status, bool adf);
+void destroyEsclStatus(EsclStatus* status);
+
+void setEsclScannerState(EsclStatus* status, EsclScannerState state);
+void setEsclAdfState(EsclStatus* status, EsclAdfState state);
+
+// List a job in the status; its updates then bump the version. When the list
+// is full the oldest finished job makes room. Returns -1 if every listed job is still active.
+int addEsclStatusJob(EsclStatus* status, ScanJobStatus* job, const char* uuid);
+void removeEsclStatusJob(EsclStatus* status, ScanJobStatus* job);
+
+// True when a copy with Last-Modified ifModifiedSince is still current, so
+// 304 can be sent as is. ifModifiedSince is 0 when the request had none.
+bool esclStatusUnchanged(EsclStatus* status, time_t ifModifiedSince, time_t now);
+
+// The current document, rendered again if needed; release it when sent.
+EsclDocument* acquireEsclStatus(EsclStatus* status, time_t now);
+
+// GET /ScannerStatus and /ScannerCapabilities: 304 when the client's copy is current, the document otherwise.
+bool respondEsclStatus(pappl_client_t* client, EsclStatus* status);
+bool respondEsclDocument(pappl_client_t* client, EsclDocument* document);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESCL_STATUS_H */
@@ -0,0 +1,243 @@
+#include "page-pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+size_t pageStrideFor(const PageShape* shape) {
+    size_t bytes = (shape->width * shape->channels * shape->depth + 7) / 8;
+    size_t stride = (bytes + PAGE_POOL_ALIGNMENT - 1) / PAGE_POOL_ALIGNMENT * PAGE_POOL_ALIGNMENT;
+    if (stride % 4096 == 0)
+        stride += PAGE_POOL_ALIGNMENT;
+    return stride;
+}
+
+static bool sameShape(const PageShape* a, const PageShape* b) {
+    return a->width == b->width && a->lines == b->lines && a->channels == b->channels && a->depth == b->depth;
+}
+
+static size_t mappedSize(size_t size) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+// Map and touch a buffer. Called without the lock: touching tens of
+// megabytes takes a while.
+static PageBuffer* mapPageBuffer(PagePoolClass* owner) {
+    PageBuffer* buffer = (PageBuffer*)calloc(1, sizeof(PageBuffer));
+    if (buffer == NULL)
+        return NULL;
+    buffer->owner = owner;
+    buffer->stride = owner->stride;
+    buffer->size = owner->stride * owner->shape.lines;
+    buffer->mapped = mappedSize(buffer->size);
+    void* data = mmap(NULL, buffer->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        free(buffer);
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(data, buffer->mapped, MADV_HUGEPAGE);
+#endif
+    // Fault every page in now, on this thread, rather than in the middle of a scan
+    for (size_t offset = 0; offset < buffer->mapped; offset += 4096)
+        ((volatile uint8_t*)data)[offset] = 0;
+    buffer->data = (uint8_t*)data;
+    return buffer;
+}
+
+static void unmapPageBuffers(PageBuffer* buffers) {
+    while (buffers != NULL) {
+        PageBuffer* next = buffers->next;
+        munmap(buffers->data, buffers->mapped);
+        free(buffers);
+        buffers = next;
+    }
+}
+
+// The class for shape, claiming a slot (or that of a class nobody uses) for a new
+// shape. Idle buffers of an evicted class go to *idle for unmapping. Called locked.
+static PagePoolClass* classFor(PagePool* pool, const PageShape* shape, PageBuffer** idle) {
+    PagePoolClass* vacant = NULL;
+    for (size_t i = 0; i < pool->classCount; ++i) {
+        PagePoolClass* poolClass = &pool->classes[i];
+        if (sameShape(&poolClass->shape, shape))
+            return poolClass;
+        if (vacant == NULL && poolClass->inUse == 0)
+            vacant = poolClass;
+    }
+    if (pool->classCount < PAGE_POOL_CLASSES) {
+        vacant = &pool->classes[pool->classCount++];
+    } else if (vacant != NULL) {
+        while (vacant->free != NULL) {
+            PageBuffer* buffer = vacant->free;
+            vacant->free = buffer->next;
+            pool->stats.bytesMapped -= buffer->mapped;
+            pool->stats.unmaps++;
+            buffer->next = *idle;
+            *idle = buffer;
+        }
+    } else {
+        return NULL;
+    }
+    memset(vacant, 0, sizeof(*vacant));
+    vacant->shape = *shape;
+    vacant->stride = pageStrideFor(shape);
+    return vacant;
+}
+
+// Make room under the limit for bytes more by giving up idle buffers of other
+// shapes. Called locked; false if even that is not enough.
+static bool makeRoom(PagePool* pool, const PagePoolClass* keep, size_t bytes, PageBuffer** idle) {
+    if (pool->limit == 0)
+        return true;
+    for (size_t i = 0; i < pool->classCount && pool->stats.bytesMapped + bytes > pool->limit; ++i) {
+        PagePoolClass* poolClass = &pool->classes[i];
+        while (poolClass != keep && poolClass->free != NULL && pool->stats.bytesMapped + bytes > pool->limit) {
+            PageBuffer* buffer = poolClass->free;
+            poolClass->free = buffer->next;
+            poolClass->freeCount--;
+            pool->stats.bytesMapped -= buffer->mapped;
+            pool->stats.unmaps++;
+            buffer->next = *idle;
+            *idle = buffer;
+        }
+    }
+    return pool->stats.bytesMapped + bytes <= pool->limit;
+}
+
+static void countInUse(PagePool* pool, size_t bytes) {
+    pool->stats.bytesInUse += bytes;
+    if (pool->stats.bytesInUse > pool->stats.highWaterInUse)
+        pool->stats.highWaterInUse = pool->stats.bytesInUse;
+    if (pool->stats.bytesMapped > pool->stats.highWaterMapped)
+        pool->stats.highWaterMapped = pool->stats.bytesMapped;
+}
+
+PagePool* new_PagePool(size_t limit) {
+    PagePool* pool = (PagePool*)calloc(1, sizeof(PagePool));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->limit = limit;
+    return pool;
+}
+
+void delete_PagePool(PagePool* pool) {
+    if (pool == NULL)
+        return;
+    for (size_t i = 0; i < pool->classCount; ++i) {
+        if (pool->classes[i].inUse != 0)
+            fprintf(stderr, "page pool: %zu buffers still in use\n", pool->classes[i].inUse);
+        unmapPageBuffers(pool->classes[i].free);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int reservePageBuffers(PagePool* pool, const PageShape* shape, size_t count, PageBuffer** buffers) {
+    PageBuffer* idle = NULL;
+    size_t reused = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    PagePoolClass* poolClass = classFor(pool, shape, &idle);
+    if (poolClass == NULL) {
+        pool->stats.failures++;
+        pthread_mutex_unlock(&pool->lock);
+        unmapPageBuffers(idle);
+        fprintf(stderr, "page pool: every class is in use\n");
+        return -1;
+    }
+    size_t missing = count > poolClass->freeCount ? count - poolClass->freeCount : 0;
+    size_t bytes = missing * mappedSize(poolClass->stride * shape->lines);
+    if (!makeRoom(pool, poolClass, bytes, &idle)) {
+        pool->stats.failures++;
+        pthread_mutex_unlock(&pool->lock);
+        unmapPageBuffers(idle);
+        return -1;
+    }
+    // Take the idle buffers and count the ones still to be mapped as mapped
+    // already, so concurrent reservations see the limit
+    for (; reused < count && poolClass->free != NULL; ++reused) {
+        buffers[reused] = poolClass->free;
+        poolClass->free = buffers[reused]->next;
+        poolClass->freeCount--;
+    }
+    poolClass->inUse += count;
+    pool->stats.bytesMapped += bytes;
+    pool->stats.reuses += reused;
+    countInUse(pool, reused * mappedSize(poolClass->stride * shape->lines) + bytes);
+    pthread_mutex_unlock(&pool->lock);
+    unmapPageBuffers(idle);
+
+    for (size_t i = reused; i < count; ++i) {
+        buffers[i] = mapPageBuffer(poolClass);
+        if (buffers[i] == NULL) {
+            // Give back what was taken, and the bytes of what was not mapped
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.bytesMapped -= (count - i) * mappedSize(poolClass->stride * shape->lines);
+            pool->stats.bytesInUse -= (count - i) * mappedSize(poolClass->stride * shape->lines);
+            pool->stats.maps += i - reused;
+            pool->stats.failures++;
+            poolClass->inUse -= count - i;
+            pthread_mutex_unlock(&pool->lock);
+            releasePageBuffers(pool, buffers, i);
+            fprintf(stderr, "page pool: cannot map %zu bytes\n", poolClass->stride * shape->lines);
+            return -1;
+        }
+    }
+    if (count > reused) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stats.maps += count - reused;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return 0;
+}
+
+void releasePageBuffers(PagePool* pool, PageBuffer** buffers, size_t count) {
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < count; ++i) {
+        PagePoolClass* poolClass = buffers[i]->owner;
+        buffers[i]->next = poolClass->free;
+        poolClass->free = buffers[i];
+        poolClass->freeCount++;
+        poolClass->inUse--;
+        pool->stats.bytesInUse -= buffers[i]->mapped;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+PageBuffer* acquirePageBuffer(PagePool* pool, const PageShape* shape) {
+    PageBuffer* buffer;
+    return reservePageBuffers(pool, shape, 1, &buffer) == 0 ? buffer : NULL;
+}
+
+void releasePageBuffer(PagePool* pool, PageBuffer* buffer) {
+    releasePageBuffers(pool, &buffer, 1);
+}
+
+void trimPagePool(PagePool* pool, size_t keepBytes) {
+    PageBuffer* idle = NULL;
+    pthread_mutex_lock(&pool->lock);
+    for (size_t i = 0; i < pool->classCount && pool->stats.bytesMapped > keepBytes; ++i) {
+        PagePoolClass* poolClass = &pool->classes[i];
+        while (poolClass->free != NULL && pool->stats.bytesMapped > keepBytes) {
+            PageBuffer* buffer = poolClass->free;
+            poolClass->free = buffer->next;
+            poolClass->freeCount--;
+            pool->stats.bytesMapped -= buffer->mapped;
+            pool->stats.unmaps++;
+            buffer->next = idle;
+            idle = buffer;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    unmapPageBuffers(idle);
+}
+
+void getPagePoolStats(PagePool* pool, PagePoolStats* stats) {
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
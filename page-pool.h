@@ -0,0 +1,97 @@
+#ifndef PAGE_POOL_H
+#define PAGE_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What a page buffer has to hold; buffers are pooled per shape.
+typedef struct {
+    size_t width;          // pixels per line
+    size_t lines;
+    int channels;
+    int depth;             // bits per sample
+} PageShape;
+
+// Line starts are 64-byte aligned for the SIMD kernels, and a stride of a
+// whole number of 4 KiB pages gets one more cache line so that vertically
+// adjacent pixels do not fall into the same cache set.
+#define PAGE_POOL_ALIGNMENT 64
+
+size_t pageStrideFor(const PageShape* shape);
+
+typedef struct PagePoolClass PagePoolClass;
+
+typedef struct PageBuffer {
+    struct PageBuffer* next;   // in its class's free list
+    PagePoolClass* owner;
+    uint8_t* data;             // PAGE_POOL_ALIGNMENT aligned
+    size_t stride;             // bytes from one line to the next
+    size_t size;               // stride * lines
+    size_t mapped;             // bytes mapped for data
+} PageBuffer;
+
+struct PagePoolClass {
+    PageShape shape;
+    size_t stride;
+    PageBuffer* free;
+    size_t freeCount;
+    size_t inUse;
+};
+
+#define PAGE_POOL_CLASSES 16
+
+typedef struct {
+    size_t bytesMapped;        // held by the pool, in use or not
+    size_t bytesInUse;
+    size_t highWaterMapped;
+    size_t highWaterInUse;
+    size_t maps;               // buffers mapped from the system
+    size_t unmaps;
+    size_t reuses;             // buffers handed out again without mapping
+    size_t failures;           // requests refused by the limit or the system
+} PagePoolStats;
+
+// Page buffers for every job of a scanner. Buffers are mapped once, touched
+// when they are mapped so they never fault later, and kept when released:
+// after the first few pages a batch of any length runs on the same memory.
+// Memory is first touched by the thread that maps it, so on NUMA hosts it
+// lands on that thread's node.
+typedef struct {
+    pthread_mutex_t lock;
+    PagePoolClass classes[PAGE_POOL_CLASSES];
+    size_t classCount;
+    size_t limit;              // most bytes mapped at once, 0 for no limit
+    PagePoolStats stats;
+} PagePool;
+
+PagePool* new_PagePool(size_t limit);
+
+// Unmaps every buffer; all of them must have been released.
+void delete_PagePool(PagePool* pool);
+
+// One buffer, or NULL when the limit would be exceeded.
+PageBuffer* acquirePageBuffer(PagePool* pool, const PageShape* shape);
+void releasePageBuffer(PagePool* pool, PageBuffer* buffer);
+
+// A job's working set, all or nothing, so a job that cannot get its memory
+// fails when it starts rather than after some pages were scanned. Returns -1
+// and takes nothing if count buffers are not available.
+int reservePageBuffers(PagePool* pool, const PageShape* shape, size_t count, PageBuffer** buffers);
+void releasePageBuffers(PagePool* pool, PageBuffer** buffers, size_t count);
+
+// Unmap idle buffers until at most keepBytes are mapped.
+void trimPagePool(PagePool* pool, size_t keepBytes);
+
+void getPagePoolStats(PagePool* pool, PagePoolStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAGE_POOL_H */
@@ -0,0 +1,28 @@
+#ifndef SCAN_BACKOFF_H
+#define SCAN_BACKOFF_H
+
+#include <sched.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One round of waiting for another pipeline thread: spin a while, then yield,
+// then sleep for sleepNanos at a time. spins starts at 0 for each wait.
+static inline void scanBackOff(unsigned* spins, long sleepNanos) {
+    if (++*spins < 64)
+        return;
+    if (*spins < 128) {
+        sched_yield();
+        return;
+    }
+    struct timespec delay = { 0, sleepNanos };
+    nanosleep(&delay, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_BACKOFF_H */
@@ -0,0 +1,313 @@
+#include "scan-batch.h"
+#include "scan-gray.h"
+#include "scan-pixel.h"
+#include "scan-stats.h"
+#include "scan-backoff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int initPageRing(ScanPageRing* ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+    ring->slots = (ScanPage**)calloc(size, sizeof(ScanPage*));
+    if (ring->slots == NULL)
+        return -1;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+static bool pushPage(ScanPageRing* ring, ScanPage* page) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) > ring->mask)
+        return false;
+    ring->slots[tail & ring->mask] = page;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool popPage(ScanPageRing* ring, ScanPage** page) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+        return false;
+    *page = ring->slots[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Stages hand over whole pages, tens of milliseconds apart, so a waiting
+// stage backs off to longer sleeps than the strip fan-out does.
+static void backOff(unsigned* spins) {
+    scanBackOff(spins, 200000);
+}
+
+// A NULL page marks the end of the batch. Both return false once the batch is stopped.
+static bool sendPage(ScanBatch* batch, ScanPageRing* ring, ScanPage* page) {
+    unsigned spins = 0;
+    while (!pushPage(ring, page)) {
+        if (atomic_load_explicit(&batch->stop, memory_order_relaxed))
+            return false;
+        backOff(&spins);
+    }
+    return true;
+}
+
+static bool receivePage(ScanBatch* batch, ScanPageRing* ring, ScanPage** page) {
+    unsigned spins = 0;
+    while (!popPage(ring, page)) {
+        if (atomic_load_explicit(&batch->stop, memory_order_relaxed))
+            return false;
+        backOff(&spins);
+    }
+    return true;
+}
+
+static void failScanBatch(ScanBatch* batch) {
+    atomic_store(&batch->result, -1);
+    atomic_store(&batch->stop, true);
+}
+
+ScanBatch* new_ScanBatch(Kind kind, const ScanBatchIO* io, const ScanBatchProcessing* processing,
+                         PagePool* pool, const PageShape* shape, size_t depth) {
+    ScanBatch* batch = (ScanBatch*)calloc(1, sizeof(ScanBatch));
+    if (batch == NULL)
+        return NULL;
+
+    batch->kind = kind;
+    batch->io = *io;
+    batch->processing = *processing;
+    if (depth == 0)
+        depth = 1;
+    // Each stage holds one page while the rings hold the rest
+    batch->pageCount = depth + 3;
+    batch->pages = (ScanPage*)calloc(batch->pageCount, sizeof(ScanPage));
+    batch->buffers = (PageBuffer**)calloc(batch->pageCount, sizeof(PageBuffer*));
+    if (batch->pages == NULL || batch->buffers == NULL
+        || initPageRing(&batch->read, depth + 1) != 0
+        || initPageRing(&batch->processed, depth + 1) != 0
+        || initPageRing(&batch->free, batch->pageCount) != 0) {
+        delete_ScanBatch(batch);
+        return NULL;
+    }
+
+    if (reservePageBuffers(pool, shape, batch->pageCount, batch->buffers) != 0) {
+        delete_ScanBatch(batch);
+        return NULL;
+    }
+    batch->pagePool = pool;
+    for (size_t i = 0; i < batch->pageCount; ++i) {
+        ScanPage* page = &batch->pages[i];
+        page->data = batch->buffers[i]->data;
+        page->capacity = batch->buffers[i]->size;
+        page->stride = batch->buffers[i]->stride;
+        pushPage(&batch->free, page);
+    }
+    return batch;
+}
+
+void delete_ScanBatch(ScanBatch* batch) {
+    if (batch == NULL)
+        return;
+    if (batch->pagePool != NULL)
+        releasePageBuffers(batch->pagePool, batch->buffers, batch->pageCount);
+    free(batch->buffers);
+    free(batch->pages);
+    free(batch->read.slots);
+    free(batch->processed.slots);
+    free(batch->free.slots);
+    free(batch);
+}
+
+void cancelScanBatch(ScanBatch* batch) {
+    atomic_store(&batch->canceled, true);
+    failScanBatch(batch);
+}
+
+bool processScanPage(const ScanBatchProcessing* processing, BlankPageDetector* detector, ScanPage* page) {
+    const ScanPixelKernels* kernels = scanPixelKernelsFor(page->channels, page->depth);
+    const GammaStage* gamma = processing->gamma;
+    if (gamma != NULL && (gamma->identity || gamma->depth != page->depth))
+        gamma = NULL;
+
+    SCAN_STATS_START(gray);
+    if (processing->synthesizeGray && kernels != NULL && kernels->gray != NULL) {
+        // Gray lines are a third as long, so each one lands behind the RGB still to be read
+        size_t grayBytesPerLine = scanLineBytes(page->width, 1, page->depth);
+        for (size_t y = 0; y < page->lines; ++y)
+            kernels->gray(page->data + y * page->bytesPerLine, page->data + y * grayBytesPerLine, page->width, gamma);
+        page->channels = 1;
+        page->bytesPerLine = grayBytesPerLine;
+        SCAN_STATS_STOP(gray, SCAN_STAGE_GAMMA);
+    } else if (gamma != NULL) {
+        for (size_t y = 0; y < page->lines; ++y)
+            applyGamma(gamma, page->data + y * page->bytesPerLine, page->width * page->channels);
+        SCAN_STATS_STOP(gray, SCAN_STAGE_GAMMA);
+    }
+
+    page->blank = false;
+    if (detector != NULL) {
+        SCAN_STATS_START(blank);
+        for (size_t y = 0; y < page->lines; ++y)
+            feedBlankPageLine(detector, page->data + y * page->bytesPerLine);
+        page->blank = finishBlankPage(detector, NULL);
+        SCAN_STATS_STOP(blank, SCAN_STAGE_BLANK);
+    }
+
+    if (processing->binarize && page->channels == 1 && page->depth == 8 && !page->blank) {
+        // Packed lines are shorter still, so the same holds as for gray
+        size_t bitsPerLine = scanLineBytes(page->width, 1, 1);
+        uint8_t threshold = processing->threshold ? processing->threshold : 128;
+        SCAN_STATS_START(binarize);
+        for (size_t y = 0; y < page->lines; ++y)
+            binarizeGray8(page->data + y * page->bytesPerLine, page->data + y * bitsPerLine, page->width, threshold);
+        SCAN_STATS_STOP(binarize, SCAN_STAGE_BINARIZE);
+        page->depth = 1;
+        page->bytesPerLine = bitsPerLine;
+    }
+    return !page->blank;
+}
+
+// Processing leaves a page packed and in another layout; the next sheet read
+// into the buffer gets it back as the pool shaped it.
+static void resetPage(ScanPage* page) {
+    page->width = 0;
+    page->lines = 0;
+    page->bytesPerLine = page->stride;
+    page->channels = 0;
+    page->depth = 0;
+    page->blank = false;
+}
+
+static void* readStage(void* data) {
+    ScanBatch* batch = (ScanBatch*)data;
+    unsigned number = 0;
+
+    for (;;) {
+        ScanPage* page;
+        if (!receivePage(batch, &batch->free, &page))
+            return NULL;
+
+        resetPage(page);
+        page->number = ++number;
+        SCAN_STATS_START(read);
+        int status = batch->io.readPage(batch->io.context, page);
+        if (status > 0) {
+            SCAN_STATS_STOP(read, SCAN_STAGE_PAGE_READ);
+            SCAN_STATS_COUNT(SCAN_COUNTER_BYTES_READ, page->lines * page->bytesPerLine);
+        }
+        if (status < 0) {
+            failScanBatch(batch);
+            return NULL;
+        }
+        if (status == 0) {
+            sendPage(batch, &batch->read, NULL);
+            return NULL;
+        }
+        atomic_fetch_add(&batch->pagesRead, 1);
+        if (!sendPage(batch, &batch->read, page))
+            return NULL;
+        if (batch->kind != adfBatch) {
+            sendPage(batch, &batch->read, NULL);
+            return NULL;
+        }
+    }
+}
+
+static void* processStage(void* data) {
+    ScanBatch* batch = (ScanBatch*)data;
+    BlankPageDetector detector;
+    bool haveDetector = false;
+
+    for (;;) {
+        ScanPage* page;
+        if (!receivePage(batch, &batch->read, &page))
+            break;
+        if (page == NULL) {
+            sendPage(batch, &batch->processed, NULL);
+            break;
+        }
+
+        BlankPageDetector* blank = NULL;
+        if (batch->processing.dropBlank) {
+            // The detector sees pages after gray synthesis
+            int channels = batch->processing.synthesizeGray ? 1 : page->channels;
+            if (haveDetector && (detector.width != page->width || detector.channels != channels || detector.depth != page->depth)) {
+                deleteBlankPageDetector(&detector);
+                haveDetector = false;
+            }
+            if (!haveDetector)
+                haveDetector = initBlankPageDetector(&detector, &batch->processing.blankThresholds,
+                                                     page->width, channels, page->depth) == 0;
+            blank = haveDetector ? &detector : NULL;
+        }
+
+        // Dropped pages still go through the writer, the free ring's only producer
+        if (processScanPage(&batch->processing, blank, page) && batch->status != NULL)
+            countScanJobImage(batch->status, false);
+        if (!sendPage(batch, &batch->processed, page))
+            break;
+    }
+
+    if (haveDetector)
+        deleteBlankPageDetector(&detector);
+    return NULL;
+}
+
+static void* writeStage(void* data) {
+    ScanBatch* batch = (ScanBatch*)data;
+
+    for (;;) {
+        ScanPage* page;
+        if (!receivePage(batch, &batch->processed, &page) || page == NULL)
+            return NULL;
+        if (page->blank) {
+            atomic_fetch_add(&batch->pagesDropped, 1);
+        } else if (batch->io.writePage(batch->io.context, page) != 0) {
+            failScanBatch(batch);
+            return NULL;
+        } else {
+            bool first = atomic_fetch_add(&batch->pagesWritten, 1) == 0;
+            if (batch->status != NULL) {
+                if (first)
+                    setScanJobState(batch->status, processing, reasonJobScanningAndTransferring, time(NULL));
+                countScanJobImage(batch->status, true);
+            }
+        }
+        if (!sendPage(batch, &batch->free, page))
+            return NULL;
+    }
+}
+
+int runScanBatch(ScanBatch* batch) {
+    void* (*stages[3])(void*) = { readStage, processStage, writeStage };
+    pthread_t threads[3];
+    int started = 0;
+
+    atomic_store(&batch->result, 0);
+    if (batch->status != NULL && !setScanJobState(batch->status, processing, reasonJobScanning, time(NULL)))
+        return -1;
+    for (; started < 3; ++started) {
+        if (pthread_create(&threads[started], NULL, stages[started], batch) != 0) {
+            fprintf(stderr, "scan batch: cannot start stage thread\n");
+            failScanBatch(batch);
+            break;
+        }
+    }
+    for (int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    int result = atomic_load(&batch->result);
+    if (batch->status != NULL) {
+        if (result == 0)
+            setScanJobState(batch->status, completed, reasonJobCompletedSuccessfully, time(NULL));
+        else if (atomic_load(&batch->canceled))
+            setScanJobState(batch->status, canceled, reasonJobCanceledByUser, time(NULL));
+        else
+            setScanJobState(batch->status, aborted, reasonErrorsDetected, time(NULL));
+    }
+    return result;
+}
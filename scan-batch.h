@@ -0,0 +1,105 @@
+#ifndef SCAN_BATCH_H
+#define SCAN_BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "scan-job.h"
+#include "scan-gamma.h"
+#include "scan-blank.h"
+#include "page-pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One page travelling through the pipeline. The buffers belong to the batch
+// and are recycled once the page has been written.
+typedef struct {
+    uint8_t* data;
+    size_t capacity;
+    size_t stride;         // the buffer's line length; every read starts with bytesPerLine at this
+    size_t width;          // pixels per line
+    size_t lines;
+    size_t bytesPerLine;   // processing packs lines, so it may end up shorter than stride
+    int channels;          // 1 or 3
+    int depth;             // 1, 8 or 16; 1-bit lines are packed, 1 for white
+    unsigned number;       // 1-based sheet number as read from the device
+    bool blank;
+} ScanPage;
+
+// Device and client ends of the pipeline.
+typedef struct {
+    // Fill page with the next sheet, lines page->stride bytes apart: 1 if one
+    // was read, 0 when there are no more, -1 on error.
+    int (*readPage)(void* context, ScanPage* page);
+    // Encode and send one processed page: 0 or -1 on error.
+    int (*writePage)(void* context, const ScanPage* page);
+    void* context;
+} ScanBatchIO;
+
+typedef struct {
+    const GammaStage* gamma;   // gray gamma when synthesizing, color gamma otherwise; may be NULL
+    bool synthesizeGray;       // turn RGB pages into gray ones
+    bool dropBlank;            // scan:BlankPageDetection
+    BlankPageThresholds blankThresholds;
+    bool binarize;             // BlackAndWhite1 from a gray scan: pack 8-bit gray to 1 bit
+    uint8_t threshold;         // gray level from which a pixel is white; 0 for 128
+} ScanBatchProcessing;
+
+// Single-producer single-consumer ring of pages; capacity is a power of two.
+typedef struct {
+    ScanPage** slots;
+    size_t mask;
+    _Alignas(64) atomic_size_t head;   // next slot to pop, owned by the consumer
+    _Alignas(64) atomic_size_t tail;   // next slot to push, owned by the producer
+} ScanPageRing;
+
+// Reads, processing and writes run on their own threads, so sheet N+1 is
+// being fed while sheet N is processed and sheet N-1 is sent.
+typedef struct {
+    Kind kind;
+    ScanBatchIO io;
+    ScanBatchProcessing processing;
+    ScanPage* pages;
+    size_t pageCount;
+    PagePool* pagePool;
+    PageBuffer** buffers;      // under pages, reserved from pagePool for the whole job
+    ScanPageRing read;         // device -> processing
+    ScanPageRing processed;    // processing -> writer
+    ScanPageRing free;         // writer -> device
+    ScanJobStatus* status;     // the job's status, or NULL; set before runScanBatch
+    atomic_bool stop;          // cancelled or a stage failed
+    atomic_bool canceled;
+    atomic_int result;
+    atomic_uint pagesRead;
+    atomic_uint pagesWritten;
+    atomic_uint pagesDropped;
+} ScanBatch;
+
+// depth is how many pages may wait between two stages; shape the largest page
+// the device can produce. The job's pages are reserved from pool up front, so
+// NULL also means the pool could not give the job its memory.
+ScanBatch* new_ScanBatch(Kind kind, const ScanBatchIO* io, const ScanBatchProcessing* processing,
+                         PagePool* pool, const PageShape* shape, size_t depth);
+
+void delete_ScanBatch(ScanBatch* batch);
+
+// Run the job to the end. Returns 0 when every page was written, -1 on error or cancellation.
+int runScanBatch(ScanBatch* batch);
+
+// May be called from any thread while runScanBatch is in progress.
+void cancelScanBatch(ScanBatch* batch);
+
+// The processing stage on its own: gamma, gray synthesis, blank detection and
+// binarization, in place, with the kernels for the page's layout.
+// detector may be NULL when blank pages are kept. Returns false if the page should be dropped.
+bool processScanPage(const ScanBatchProcessing* processing, BlankPageDetector* detector, ScanPage* page);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_BATCH_H */
@@ -0,0 +1,109 @@
+#include "scan-blank.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+int initBlankPageDetector(BlankPageDetector* detector, const BlankPageThresholds* thresholds,
+                          size_t width, int channels, int depth) {
+    memset(detector, 0, sizeof(*detector));
+    const ScanPixelKernels* kernels = scanPixelKernelsFor(channels, depth);
+    if (width == 0 || kernels == NULL)
+        return -1;
+
+    detector->lines = (uint8_t*)malloc(width * 2);
+    if (detector->lines == NULL)
+        return -1;
+    detector->luma = detector->lines;
+    detector->previous = detector->lines + width;
+    detector->thresholds = *thresholds;
+    detector->width = width;
+    detector->channels = channels;
+    detector->depth = depth;
+    detector->toLuma = kernels->luma;
+    return 0;
+}
+
+void deleteBlankPageDetector(BlankPageDetector* detector) {
+    free(detector->lines);
+    detector->lines = NULL;
+    detector->luma = NULL;
+    detector->previous = NULL;
+}
+
+void feedBlankPageLine(BlankPageDetector* detector, const void* line) {
+    uint8_t* luma = detector->luma;
+    size_t width = detector->width;
+    uint64_t sum = 0, sumSquares = 0, edges = 0;
+
+    detector->toLuma(line, luma, width);
+    // The first line of a page has nothing above it: compare it with itself
+    const uint8_t* above = detector->havePrevious ? detector->previous : luma;
+    uint64_t (*histogram)[256] = detector->histogram;
+    unsigned left = luma[0];
+    for (size_t x = 0; x < width; ++x) {
+        int value = luma[x];
+        histogram[x & 3][value]++;
+        sum += value;
+        sumSquares += (unsigned)(value * value);
+
+        int dx = value - (int)left, dy = value - (int)above[x];
+        edges += (unsigned)(dx * dx > BLANK_PAGE_EDGE_STEP * BLANK_PAGE_EDGE_STEP)
+                 | (unsigned)(dy * dy > BLANK_PAGE_EDGE_STEP * BLANK_PAGE_EDGE_STEP);
+        left = (unsigned)value;
+    }
+
+    detector->pixels += width;
+    detector->sum += sum;
+    detector->sumSquares += sumSquares;
+    detector->edgePixels += edges;
+    detector->luma = detector->previous;
+    detector->previous = luma;
+    detector->havePrevious = true;
+}
+
+bool finishBlankPage(BlankPageDetector* detector, BlankPageStats* stats) {
+    BlankPageStats page = { 0, 0, 0, 255 };
+    bool blank = true;
+
+    if (detector->pixels > 0) {
+        // The paper is the median luma, since noise spreads it over several levels
+        // while ink rarely covers half a page; ink is anything well below it, so
+        // tinted or grey-backed paper is not mistaken for coverage.
+        uint64_t histogram[256];
+        uint64_t below = 0;
+        int paper = -1;
+        for (int level = 0; level < 256; ++level) {
+            histogram[level] = detector->histogram[0][level] + detector->histogram[1][level]
+                               + detector->histogram[2][level] + detector->histogram[3][level];
+            below += histogram[level];
+            if (paper < 0 && below * 2 >= detector->pixels)
+                paper = level;
+        }
+        uint64_t ink = 0;
+        for (int level = 0; level < paper - BLANK_PAGE_INK_STEP; ++level)
+            ink += histogram[level];
+
+        double pixels = (double)detector->pixels;
+        double mean = detector->sum / pixels;
+        double variance = detector->sumSquares / pixels - mean * mean;
+        page.paperLevel = paper;
+        page.inkCoverage = 100.0 * ink / pixels;
+        page.edgeDensity = 100.0 * detector->edgePixels / pixels;
+        page.deviation = variance > 0 ? sqrt(variance) : 0;
+
+        blank = page.inkCoverage <= detector->thresholds.inkCoverage
+                && page.edgeDensity <= detector->thresholds.edgeDensity
+                && page.deviation <= detector->thresholds.deviation;
+    }
+
+    if (stats)
+        *stats = page;
+    memset(detector->histogram, 0, sizeof(detector->histogram));
+    detector->pixels = 0;
+    detector->sum = 0;
+    detector->sumSquares = 0;
+    detector->edgePixels = 0;
+    detector->havePrevious = false;
+    return blank;
+}
@@ -0,0 +1,68 @@
+#ifndef SCAN_BLANK_H
+#define SCAN_BLANK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scan-pixel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sensitivity for scan:BlankPageDetection, from the options file. A page is
+// blank when all three statistics stay at or below their limit.
+typedef struct {
+    double inkCoverage;   // percent of pixels clearly darker than the paper
+    double edgeDensity;   // percent of pixels on a strong edge
+    double deviation;     // standard deviation of the luma, 0-255 scale
+} BlankPageThresholds;
+
+typedef struct {
+    double inkCoverage;
+    double edgeDensity;
+    double deviation;
+    double paperLevel;    // median luma, taken as the paper colour
+} BlankPageStats;
+
+// Running statistics for one page at a time. Lines are reduced to 8-bit luma
+// as they stream through, so only the previous line is ever kept.
+typedef struct {
+    BlankPageThresholds thresholds;
+    size_t width;          // pixels per line
+    int channels;          // 1 (gray) or 3 (RGB)
+    int depth;             // 1, 8 or 16 bits per sample
+    LumaKernel toLuma;     // for channels and depth, chosen at init
+    uint8_t* lines;        // two lines of luma, width bytes each
+    uint8_t* luma;         // the line being fed
+    uint8_t* previous;     // the line above it
+    bool havePrevious;
+    uint64_t histogram[4][256];  // interleaved so runs of equal pixels don't serialize
+    uint64_t pixels;
+    uint64_t sum;
+    uint64_t sumSquares;
+    uint64_t edgePixels;
+} BlankPageDetector;
+
+// Luma steps above this count as an edge, both along and across lines.
+#define BLANK_PAGE_EDGE_STEP 48
+// Pixels this far below the paper level count as ink.
+#define BLANK_PAGE_INK_STEP 64
+
+// Returns 0 on success, -1 on a bad format or if the line buffers cannot be allocated.
+int initBlankPageDetector(BlankPageDetector* detector, const BlankPageThresholds* thresholds,
+                          size_t width, int channels, int depth);
+
+void deleteBlankPageDetector(BlankPageDetector* detector);
+
+void feedBlankPageLine(BlankPageDetector* detector, const void* line);
+
+// Decide on the page fed so far and reset for the next one. Returns true if
+// the page is blank; stats may be NULL.
+bool finishBlankPage(BlankPageDetector* detector, BlankPageStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_BLANK_H */
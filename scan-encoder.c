@@ -0,0 +1,664 @@
+#include "scan-encoder.h"
+#include "scan-pixel.h"
+#include "scan-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <setjmp.h>
+#include <math.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <jpeglib.h>
+
+typedef struct {
+    ScanEncoder* encoder;
+    const ScanPage* page;
+    size_t stripeLines;
+    atomic_bool abandoned;     // the page failed; skip stripes not yet started
+} ScanPageWork;
+
+struct ScanStripe {
+    ScanStripe* next;          // in the pool queue
+    ScanPageWork* work;
+    size_t firstLine;
+    size_t lines;
+    bool last;
+    uint8_t* data;
+    size_t length;
+    size_t scan;               // JPEG: offset of the SOS segment
+    size_t payload;            // first byte of compressed data
+    size_t payloadEnd;
+    uLong adler;               // PNG and PDF: Adler-32 of the filtered lines
+    size_t filteredLength;
+    bool done;
+    int result;
+};
+
+// JPEG
+
+#define JPEG_MCU_LINES 16      // 4:2:0 color; gray MCUs are 8 lines and divide it
+
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf escape;
+} JpegErrors;
+
+static void jpegFailed(j_common_ptr info) {
+    char message[JMSG_LENGTH_MAX];
+    info->err->format_message(info, message);
+    fprintf(stderr, "jpeg: %s\n", message);
+    longjmp(((JpegErrors*)info->err)->escape, 1);
+}
+
+// Find the SOS segment and the entropy-coded data after it. With lines set,
+// also put the page height into the frame header.
+static bool findJpegScan(uint8_t* data, size_t length, size_t lines, size_t* scan, size_t* entropy) {
+    size_t p = 2;
+    while (p + 4 <= length && data[p] == 0xFF) {
+        uint8_t marker = data[p + 1];
+        size_t segment = 2 + ((size_t)data[p + 2] << 8 | data[p + 3]);
+        if (p + segment > length)
+            return false;
+        if (marker == 0xDA) {
+            *scan = p;
+            *entropy = p + segment;
+            return true;
+        }
+        if (lines && marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            data[p + 5] = (uint8_t)(lines >> 8);
+            data[p + 6] = (uint8_t)lines;
+        }
+        p += segment;
+    }
+    return false;
+}
+
+static int encodeJpegStripe(ScanStripe* stripe) {
+    const ScanPage* page = stripe->work->page;
+    const ScanEncoderSettings* settings = &stripe->work->encoder->settings;
+    struct jpeg_compress_struct info;
+    JpegErrors errors;
+    unsigned char* buffer = NULL;
+    unsigned long size = 0;
+    uint8_t* row = page->depth == 16 ? (uint8_t*)malloc(page->width * page->channels) : NULL;
+
+    if (page->depth == 16 && row == NULL)
+        return -1;
+    info.err = jpeg_std_error(&errors.base);
+    errors.base.error_exit = jpegFailed;
+    if (setjmp(errors.escape)) {
+        jpeg_destroy_compress(&info);
+        free(buffer);
+        free(row);
+        return -1;
+    }
+    jpeg_create_compress(&info);
+    jpeg_mem_dest(&info, &buffer, &size);
+    info.image_width = (JDIMENSION)page->width;
+    info.image_height = (JDIMENSION)stripe->lines;
+    info.input_components = page->channels;
+    info.in_color_space = page->channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, settings->quality, TRUE);
+    info.density_unit = 1;
+    info.X_density = (UINT16)lround(settings->xResolution);
+    info.Y_density = (UINT16)lround(settings->yResolution);
+    jpeg_start_compress(&info, TRUE);
+
+    for (size_t y = 0; y < stripe->lines; ++y) {
+        JSAMPROW line = page->data + (stripe->firstLine + y) * page->bytesPerLine;
+        if (page->depth == 16) {
+            const uint16_t* samples = (const uint16_t*)line;
+            for (size_t i = 0; i < page->width * page->channels; ++i)
+                row[i] = (uint8_t)(samples[i] >> 8);
+            line = row;
+        }
+        jpeg_write_scanlines(&info, &line, 1);
+    }
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+    free(row);
+
+    stripe->data = buffer;
+    stripe->length = size;
+    stripe->payloadEnd = size - 2;     // before EOI
+    if (!findJpegScan(buffer, size, stripe->firstLine == 0 ? page->lines : 0, &stripe->scan, &stripe->payload)) {
+        fprintf(stderr, "jpeg: no scan in encoded stripe\n");
+        return -1;
+    }
+    return 0;
+}
+
+// PNG and PDF
+
+// A page line as PNG samples: 16-bit ones are big-endian.
+static const uint8_t* pngLine(const ScanPage* page, size_t y, uint8_t* scratch) {
+    const uint8_t* line = page->data + y * page->bytesPerLine;
+    if (page->depth != 16)
+        return line;
+    const uint16_t* samples = (const uint16_t*)line;
+    for (size_t i = 0; i < page->width * page->channels; ++i) {
+        scratch[2 * i] = (uint8_t)(samples[i] >> 8);
+        scratch[2 * i + 1] = (uint8_t)samples[i];
+    }
+    return scratch;
+}
+
+static int deflateLine(z_stream* stream, ScanStripe* stripe, size_t* capacity, int flush) {
+    int status;
+    do {
+        if (stream->avail_out == 0) {
+            uint8_t* grown = (uint8_t*)realloc(stripe->data, *capacity * 2);
+            if (grown == NULL)
+                return -1;
+            stripe->data = grown;
+            stream->next_out = grown + stream->total_out;
+            stream->avail_out = (uInt)(*capacity * 2 - stream->total_out);
+            *capacity *= 2;
+        }
+        status = deflate(stream, flush);
+        if (status == Z_STREAM_ERROR)
+            return -1;
+    } while (stream->avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+    return 0;
+}
+
+// A raw deflate stream of the filtered lines. Lines use the Up filter, which
+// suits scans and needs only the line above; that line may belong to the
+// previous stripe, since the filters work on the image and not on the
+// compressed data. All but the last stripe end with a sync flush so the
+// streams can simply be joined.
+static int encodeFlateStripe(ScanStripe* stripe) {
+    const ScanPage* page = stripe->work->page;
+    size_t lineBytes = scanLineBytes(page->width, page->channels, page->depth);
+    uint8_t* buffers = (uint8_t*)malloc(3 * lineBytes + 1);
+    z_stream stream;
+    int result = 0;
+
+    if (buffers == NULL)
+        return -1;
+    uint8_t* filtered = buffers;
+    uint8_t* scratch[2] = { buffers + lineBytes + 1, buffers + 2 * lineBytes + 1 };
+
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, stripe->work->encoder->settings.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(buffers);
+        return -1;
+    }
+    size_t capacity = deflateBound(&stream, (lineBytes + 1) * stripe->lines) + 64;
+    stripe->data = (uint8_t*)malloc(capacity);
+    stripe->adler = adler32(0, NULL, 0);
+    stream.next_out = stripe->data;
+    stream.avail_out = (uInt)capacity;
+
+    const uint8_t* above = stripe->firstLine > 0 ? pngLine(page, stripe->firstLine - 1, scratch[1]) : NULL;
+    for (size_t y = 0; y < stripe->lines && stripe->data != NULL; ++y) {
+        const uint8_t* line = pngLine(page, stripe->firstLine + y, scratch[y & 1]);
+        if (above == NULL) {
+            filtered[0] = 0;
+            memcpy(filtered + 1, line, lineBytes);
+        } else {
+            filtered[0] = 2;
+            for (size_t i = 0; i < lineBytes; ++i)
+                filtered[1 + i] = (uint8_t)(line[i] - above[i]);
+        }
+        above = line;
+
+        stripe->adler = adler32(stripe->adler, filtered, (uInt)(lineBytes + 1));
+        stream.next_in = filtered;
+        stream.avail_in = (uInt)(lineBytes + 1);
+        int flush = y + 1 < stripe->lines ? Z_NO_FLUSH : stripe->last ? Z_FINISH : Z_SYNC_FLUSH;
+        if (deflateLine(&stream, stripe, &capacity, flush) != 0) {
+            result = -1;
+            break;
+        }
+    }
+    if (stripe->data == NULL)
+        result = -1;
+    stripe->length = stream.total_out;
+    stripe->payload = 0;
+    stripe->payloadEnd = stream.total_out;
+    stripe->filteredLength = (lineBytes + 1) * stripe->lines;
+    deflateEnd(&stream);
+    free(buffers);
+    return result;
+}
+
+// Pool
+
+static void encodeStripe(ScanStripe* stripe) {
+    ScanEncoder* encoder = stripe->work->encoder;
+    int result = -1;
+    if (!atomic_load_explicit(&stripe->work->abandoned, memory_order_relaxed))
+        result = encoder->settings.format == SCAN_FORMAT_JPEG ? encodeJpegStripe(stripe) : encodeFlateStripe(stripe);
+
+    pthread_mutex_lock(&encoder->lock);
+    stripe->result = result;
+    stripe->done = true;
+    pthread_cond_broadcast(&encoder->done);
+    pthread_mutex_unlock(&encoder->lock);
+}
+
+static void* encoderWorker(void* data) {
+    ScanEncoderPool* pool = (ScanEncoderPool*)data;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == NULL && !pool->stopping)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->head == NULL)
+            break;
+        ScanStripe* stripe = pool->head;
+        pool->head = stripe->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+        encodeStripe(stripe);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ScanEncoderPool* new_ScanEncoderPool(size_t threads) {
+    ScanEncoderPool* pool = (ScanEncoderPool*)calloc(1, sizeof(ScanEncoderPool));
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t)online : 1;
+    }
+    if (pool == NULL || (pool->threads = (pthread_t*)calloc(threads, sizeof(pthread_t))) == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    for (; pool->threadCount < threads; ++pool->threadCount) {
+        if (pthread_create(&pool->threads[pool->threadCount], NULL, encoderWorker, pool) != 0)
+            break;
+    }
+    if (pool->threadCount == 0) {
+        delete_ScanEncoderPool(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void delete_ScanEncoderPool(ScanEncoderPool* pool) {
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->threadCount; ++i)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    free(pool->threads);
+    free(pool);
+}
+
+static void submitStripes(ScanEncoderPool* pool, ScanStripe* stripes, size_t count) {
+    for (size_t i = 0; i + 1 < count; ++i)
+        stripes[i].next = &stripes[i + 1];
+    stripes[count - 1].next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL)
+        pool->tail->next = &stripes[0];
+    else
+        pool->head = &stripes[0];
+    pool->tail = &stripes[count - 1];
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void waitForStripe(ScanEncoder* encoder, ScanStripe* stripe) {
+    pthread_mutex_lock(&encoder->lock);
+    while (!stripe->done)
+        pthread_cond_wait(&encoder->done, &encoder->lock);
+    pthread_mutex_unlock(&encoder->lock);
+}
+
+// Output
+
+static int emit(ScanEncoder* encoder, const void* data, size_t length) {
+    if (encoder->result != 0)
+        return -1;
+    if (length > 0 && encoder->output(encoder->context, data, length) != 0)
+        encoder->result = -1;
+    encoder->offset += length;
+    return encoder->result;
+}
+
+static int emitf(ScanEncoder* encoder, const char* format, ...) {
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length < 0 || (size_t)length >= sizeof(text))
+        return encoder->result = -1;
+    return emit(encoder, text, (size_t)length);
+}
+
+static void putBigEndian32(uint8_t* bytes, uint32_t value) {
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+// The zlib header in front of the joined deflate streams.
+static const uint8_t zlibHeader[2] = { 0x78, 0x9C };
+
+static int emitPngChunk(ScanEncoder* encoder, const char* type, const uint8_t* data, size_t length) {
+    uint8_t head[8], tail[4];
+    putBigEndian32(head, (uint32_t)length);
+    memcpy(head + 4, type, 4);
+    putBigEndian32(tail, (uint32_t)crc32(crc32(0, head + 4, 4), data, (uInt)length));
+    emit(encoder, head, sizeof(head));
+    emit(encoder, data, length);
+    return emit(encoder, tail, sizeof(tail));
+}
+
+static int emitPngHeader(ScanEncoder* encoder, const ScanPage* page) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t header[13], physical[9];
+    putBigEndian32(header, (uint32_t)page->width);
+    putBigEndian32(header + 4, (uint32_t)page->lines);
+    header[8] = (uint8_t)page->depth;
+    header[9] = page->channels == 1 ? 0 : 2;
+    header[10] = header[11] = header[12] = 0;
+    putBigEndian32(physical, (uint32_t)lround(encoder->settings.xResolution / 0.0254));
+    putBigEndian32(physical + 4, (uint32_t)lround(encoder->settings.yResolution / 0.0254));
+    physical[8] = 1;
+
+    emit(encoder, signature, sizeof(signature));
+    emitPngChunk(encoder, "IHDR", header, sizeof(header));
+    return emitPngChunk(encoder, "pHYs", physical, sizeof(physical));
+}
+
+// One IDAT chunk per stripe; the first carries the zlib header and the last the Adler-32.
+static int emitPngStripe(ScanEncoder* encoder, const ScanStripe* stripe, uLong adler) {
+    const uint8_t* payload = stripe->data + stripe->payload;
+    size_t length = stripe->payloadEnd - stripe->payload;
+    bool first = stripe->firstLine == 0;
+    uint8_t head[8], tail[8];
+
+    putBigEndian32(head, (uint32_t)(length + (first ? 2 : 0) + (stripe->last ? 4 : 0)));
+    memcpy(head + 4, "IDAT", 4);
+    uLong crc = crc32(0, head + 4, 4);
+    if (first)
+        crc = crc32(crc, zlibHeader, 2);
+    crc = crc32(crc, payload, (uInt)length);
+    size_t tailLength = 4;
+    if (stripe->last) {
+        putBigEndian32(tail, (uint32_t)adler);
+        crc = crc32(crc, tail, 4);
+        tailLength = 8;
+    }
+    putBigEndian32(tail + tailLength - 4, (uint32_t)crc);
+
+    emit(encoder, head, sizeof(head));
+    if (first)
+        emit(encoder, zlibHeader, 2);
+    emit(encoder, payload, length);
+    return emit(encoder, tail, tailLength);
+}
+
+static int emitJpegStripe(ScanEncoder* encoder, const ScanStripe* stripe, size_t index, unsigned restartInterval) {
+    if (index == 0) {
+        emit(encoder, stripe->data, stripe->scan);
+        if (!stripe->last) {
+            uint8_t restart[6] = { 0xFF, 0xDD, 0, 4, (uint8_t)(restartInterval >> 8), (uint8_t)restartInterval };
+            emit(encoder, restart, sizeof(restart));
+        }
+        emit(encoder, stripe->data + stripe->scan, stripe->payload - stripe->scan);
+    } else {
+        uint8_t marker[2] = { 0xFF, (uint8_t)(0xD0 + ((index - 1) & 7)) };
+        emit(encoder, marker, sizeof(marker));
+    }
+    emit(encoder, stripe->data + stripe->payload, stripe->payloadEnd - stripe->payload);
+    if (stripe->last) {
+        static const uint8_t end[2] = { 0xFF, 0xD9 };
+        emit(encoder, end, sizeof(end));
+    }
+    return encoder->result;
+}
+
+// PDF objects are numbered from 1 in the order they are reserved.
+static size_t reservePdfObject(ScanEncoder* encoder) {
+    if (encoder->objectCount == encoder->objectCapacity) {
+        size_t capacity = encoder->objectCapacity ? encoder->objectCapacity * 2 : 32;
+        size_t* grown = (size_t*)realloc(encoder->objects, capacity * sizeof(size_t));
+        if (grown == NULL) {
+            encoder->result = -1;
+            return 0;
+        }
+        encoder->objects = grown;
+        encoder->objectCapacity = capacity;
+    }
+    encoder->objects[encoder->objectCount++] = 0;
+    return encoder->objectCount;
+}
+
+static int beginPdfObject(ScanEncoder* encoder, size_t object) {
+    if (object == 0)
+        return -1;
+    encoder->objects[object - 1] = encoder->offset;
+    return emitf(encoder, "%zu 0 obj\n", object);
+}
+
+static int beginPdf(ScanEncoder* encoder) {
+    // Catalog and page tree are objects 1 and 2; the tree is written last
+    reservePdfObject(encoder);
+    reservePdfObject(encoder);
+    emitf(encoder, "%%PDF-1.4\n%%\xE2\xE3\xCF\xD3\n");
+    beginPdfObject(encoder, 1);
+    return emitf(encoder, "<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+}
+
+static int beginPdfPage(ScanEncoder* encoder, const ScanPage* page, size_t* image) {
+    if (encoder->objectCount == 0 && beginPdf(encoder) != 0)
+        return -1;
+    size_t* grown = (size_t*)realloc(encoder->pageObjects, (encoder->pageCount + 1) * sizeof(size_t));
+    if (grown == NULL)
+        return encoder->result = -1;
+    encoder->pageObjects = grown;
+
+    size_t pageObject = reservePdfObject(encoder);
+    *image = reservePdfObject(encoder);
+    size_t length = reservePdfObject(encoder);
+    size_t contents = reservePdfObject(encoder);
+    if (contents == 0)
+        return -1;
+    encoder->pageObjects[encoder->pageCount++] = pageObject;
+
+    double width = page->width * 72.0 / encoder->settings.xResolution;
+    double height = page->lines * 72.0 / encoder->settings.yResolution;
+    char drawing[128];
+    int drawingLength = snprintf(drawing, sizeof(drawing), "q %.2f 0 0 %.2f 0 0 cm /Im0 Do Q", width, height);
+
+    beginPdfObject(encoder, pageObject);
+    emitf(encoder, "<< /Type /Page /Parent 2 0 R /MediaBox [0 0 %.2f %.2f] "
+                   "/Resources << /XObject << /Im0 %zu 0 R >> >> /Contents %zu 0 R >>\nendobj\n",
+          width, height, *image, contents);
+    beginPdfObject(encoder, contents);
+    emitf(encoder, "<< /Length %d >>\nstream\n%s\nendstream\nendobj\n", drawingLength, drawing);
+    beginPdfObject(encoder, *image);
+    return emitf(encoder, "<< /Type /XObject /Subtype /Image /Width %zu /Height %zu /ColorSpace /%s "
+                          "/BitsPerComponent %d /Filter /FlateDecode /DecodeParms << /Predictor 15 /Colors %d "
+                          "/BitsPerComponent %d /Columns %zu >> /Length %zu 0 R >>\nstream\n",
+                 page->width, page->lines, page->channels == 1 ? "DeviceGray" : "DeviceRGB", page->depth,
+                 page->channels, page->depth, page->width, length);
+}
+
+static int endPdfPage(ScanEncoder* encoder, size_t image, size_t streamStart) {
+    size_t streamLength = encoder->offset - streamStart;
+    emitf(encoder, "\nendstream\nendobj\n");
+    beginPdfObject(encoder, image + 1);
+    return emitf(encoder, "%zu\nendobj\n", streamLength);
+}
+
+static int emitPdfStripe(ScanEncoder* encoder, const ScanStripe* stripe, uLong adler) {
+    if (stripe->firstLine == 0)
+        emit(encoder, zlibHeader, 2);
+    emit(encoder, stripe->data + stripe->payload, stripe->payloadEnd - stripe->payload);
+    if (stripe->last) {
+        uint8_t checksum[4];
+        putBigEndian32(checksum, (uint32_t)adler);
+        emit(encoder, checksum, sizeof(checksum));
+    }
+    return encoder->result;
+}
+
+// Encoder
+
+ScanEncoder* new_ScanEncoder(ScanEncoderPool* pool, const ScanEncoderSettings* settings,
+                             ScanEncoderOutput output, void* context) {
+    ScanEncoder* encoder = (ScanEncoder*)calloc(1, sizeof(ScanEncoder));
+    if (encoder == NULL)
+        return NULL;
+    encoder->pool = pool;
+    encoder->settings = *settings;
+    if (encoder->settings.quality <= 0 || encoder->settings.quality > 100)
+        encoder->settings.quality = SCAN_ENCODER_DEFAULT_QUALITY;
+    if (encoder->settings.level <= 0 || encoder->settings.level > 9)
+        encoder->settings.level = SCAN_ENCODER_DEFAULT_LEVEL;
+    if (encoder->settings.stripeLines == 0)
+        encoder->settings.stripeLines = SCAN_ENCODER_STRIPE_LINES;
+    encoder->settings.stripeLines = (encoder->settings.stripeLines + JPEG_MCU_LINES - 1) / JPEG_MCU_LINES * JPEG_MCU_LINES;
+    if (!(encoder->settings.xResolution > 0))
+        encoder->settings.xResolution = 300;
+    if (!(encoder->settings.yResolution > 0))
+        encoder->settings.yResolution = 300;
+    encoder->output = output;
+    encoder->context = context;
+    pthread_mutex_init(&encoder->lock, NULL);
+    pthread_cond_init(&encoder->done, NULL);
+    return encoder;
+}
+
+void delete_ScanEncoder(ScanEncoder* encoder) {
+    if (encoder == NULL)
+        return;
+    pthread_mutex_destroy(&encoder->lock);
+    pthread_cond_destroy(&encoder->done);
+    free(encoder->objects);
+    free(encoder->pageObjects);
+    free(encoder);
+}
+
+// Stripe height for the page; a JPEG restart interval has to fit in 16 bits.
+static size_t stripeLinesFor(const ScanEncoder* encoder, const ScanPage* page, unsigned* restartInterval) {
+    size_t mcuLines = page->channels == 1 ? 8 : JPEG_MCU_LINES;
+    size_t mcusPerLine = (page->width + mcuLines - 1) / mcuLines;
+    size_t lines = encoder->settings.stripeLines;
+    if (encoder->settings.format == SCAN_FORMAT_JPEG && mcusPerLine * (lines / mcuLines) > 65535)
+        lines = 65535 / mcusPerLine / (JPEG_MCU_LINES / mcuLines) * JPEG_MCU_LINES;
+    *restartInterval = (unsigned)(mcusPerLine * (lines / mcuLines));
+    return lines;
+}
+
+int encodeScanPage(ScanEncoder* encoder, const ScanPage* page) {
+    if (encoder->result != 0)
+        return -1;
+    if (encoder->settings.format != SCAN_FORMAT_PDF && encoder->pageCount > 0) {
+        fprintf(stderr, "%s documents hold one page\n", scanDocumentFormatType(encoder->settings.format));
+        return -1;
+    }
+    if ((page->channels != 1 && page->channels != 3) || (page->depth != 8 && page->depth != 16 && page->depth != 1)
+        || (page->depth == 1 && page->channels != 1) || page->lines == 0)
+        return -1;
+    if (encoder->settings.format == SCAN_FORMAT_JPEG && page->depth == 1) {
+        fprintf(stderr, "image/jpeg has no 1-bit pages\n");
+        return -1;
+    }
+
+    SCAN_STATS_START(start);
+    ScanPageWork work;
+    unsigned restartInterval;
+    work.encoder = encoder;
+    work.page = page;
+    work.stripeLines = stripeLinesFor(encoder, page, &restartInterval);
+    atomic_init(&work.abandoned, false);
+    size_t count = (page->lines + work.stripeLines - 1) / work.stripeLines;
+    ScanStripe* stripes = (ScanStripe*)calloc(count, sizeof(ScanStripe));
+    if (stripes == NULL)
+        return -1;
+    for (size_t i = 0; i < count; ++i) {
+        stripes[i].work = &work;
+        stripes[i].firstLine = i * work.stripeLines;
+        stripes[i].lines = i + 1 < count ? work.stripeLines : page->lines - stripes[i].firstLine;
+        stripes[i].last = i + 1 == count;
+    }
+    submitStripes(encoder->pool, stripes, count);
+
+    // The document header goes out while the first stripe is being encoded
+    size_t image = 0, streamStart = 0;
+    if (encoder->settings.format == SCAN_FORMAT_PNG) {
+        emitPngHeader(encoder, page);
+        encoder->pageCount++;
+    } else if (encoder->settings.format == SCAN_FORMAT_PDF) {
+        beginPdfPage(encoder, page, &image);
+        streamStart = encoder->offset;
+    } else {
+        encoder->pageCount++;
+    }
+
+    uLong adler = adler32(0, NULL, 0);
+    for (size_t i = 0; i < count; ++i) {
+        ScanStripe* stripe = &stripes[i];
+        waitForStripe(encoder, stripe);
+        if (stripe->result != 0)
+            encoder->result = -1;
+        if (encoder->result == 0) {
+            adler = adler32_combine(adler, stripe->adler, (z_off_t)stripe->filteredLength);
+            if (encoder->settings.format == SCAN_FORMAT_JPEG)
+                emitJpegStripe(encoder, stripe, i, restartInterval);
+            else if (encoder->settings.format == SCAN_FORMAT_PNG)
+                emitPngStripe(encoder, stripe, adler);
+            else
+                emitPdfStripe(encoder, stripe, adler);
+        }
+        if (encoder->result != 0)
+            atomic_store(&work.abandoned, true);
+        free(stripe->data);
+    }
+    free(stripes);
+
+    if (encoder->settings.format == SCAN_FORMAT_PNG) {
+        static const uint8_t none[1] = { 0 };
+        emitPngChunk(encoder, "IEND", none, 0);
+    } else if (encoder->settings.format == SCAN_FORMAT_PDF) {
+        endPdfPage(encoder, image, streamStart);
+    }
+    SCAN_STATS_STOP(start, SCAN_STAGE_ENCODE);
+    return encoder->result;
+}
+
+int finishScanEncoder(ScanEncoder* encoder) {
+    if (encoder->settings.format != SCAN_FORMAT_PDF || encoder->result != 0)
+        return encoder->result;
+    if (encoder->objectCount == 0 && beginPdf(encoder) != 0)
+        return -1;
+
+    beginPdfObject(encoder, 2);
+    emitf(encoder, "<< /Type /Pages /Kids [");
+    for (size_t i = 0; i < encoder->pageCount; ++i)
+        emitf(encoder, "%s%zu 0 R", i ? " " : "", encoder->pageObjects[i]);
+    emitf(encoder, "] /Count %zu >>\nendobj\n", encoder->pageCount);
+
+    size_t xref = encoder->offset;
+    emitf(encoder, "xref\n0 %zu\n0000000000 65535 f \n", encoder->objectCount + 1);
+    for (size_t i = 0; i < encoder->objectCount; ++i)
+        emitf(encoder, "%010zu 00000 n \n", encoder->objects[i]);
+    return emitf(encoder, "trailer\n<< /Size %zu /Root 1 0 R >>\nstartxref\n%zu\n%%%%EOF\n",
+                 encoder->objectCount + 1, xref);
+}
+
+int writeEncodedScanPage(void* encoder, const ScanPage* page) {
+    return encodeScanPage((ScanEncoder*)encoder, page);
+}
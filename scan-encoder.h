@@ -0,0 +1,93 @@
+#ifndef SCAN_ENCODER_H
+#define SCAN_ENCODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "escl-scan-settings.h"
+#include "scan-batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Receives the document in order as it is produced: 0, or -1 to stop encoding.
+typedef int (*ScanEncoderOutput)(void* context, const void* data, size_t length);
+
+typedef struct ScanStripe ScanStripe;
+
+// Worker threads shared by every encoder in the process.
+typedef struct {
+    pthread_t* threads;
+    size_t threadCount;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    ScanStripe* head;      // stripes waiting for a worker
+    ScanStripe* tail;
+    bool stopping;
+} ScanEncoderPool;
+
+// threads 0 starts one per online CPU. NULL if no thread could be started.
+ScanEncoderPool* new_ScanEncoderPool(size_t threads);
+void delete_ScanEncoderPool(ScanEncoderPool* pool);
+
+// Lines per stripe unless the settings say otherwise; a multiple of the JPEG MCU height.
+#define SCAN_ENCODER_STRIPE_LINES 128
+#define SCAN_ENCODER_DEFAULT_QUALITY 85
+#define SCAN_ENCODER_DEFAULT_LEVEL 6
+
+typedef struct {
+    ScanDocumentFormat format;
+    int quality;           // JPEG, 1-100; 0 for SCAN_ENCODER_DEFAULT_QUALITY
+    int level;             // zlib level for PNG and PDF, 1-9; 0 for SCAN_ENCODER_DEFAULT_LEVEL
+    size_t stripeLines;    // 0 for SCAN_ENCODER_STRIPE_LINES
+    double xResolution;    // recorded in the document; 0 for 300
+    double yResolution;
+} ScanEncoderSettings;
+
+// One output document. Pages are cut into horizontal stripes that the pool
+// encodes in parallel, and each stripe is sent as soon as it and the ones
+// above it are done:
+//   JPEG  every stripe is one restart interval, so the stripes' entropy-coded
+//         data joins into one baseline image with RSTn markers between them;
+//   PNG   every stripe is a raw deflate stream ending on a byte boundary, sent
+//         as its own IDAT chunk; the zlib Adler-32 is combined at the end;
+//   PDF   one Flate image per page, built the same way as the PNG data, with a
+//         PNG predictor and the stream /Length written after the stream.
+typedef struct {
+    ScanEncoderPool* pool;
+    ScanEncoderSettings settings;
+    ScanEncoderOutput output;
+    void* context;
+    pthread_mutex_t lock;  // stripe completion
+    pthread_cond_t done;
+    size_t offset;         // bytes written, for the PDF cross-reference table
+    size_t* objects;       // PDF object offsets, object n at n - 1
+    size_t objectCount;
+    size_t objectCapacity;
+    size_t* pageObjects;
+    size_t pageCount;
+    int result;
+} ScanEncoder;
+
+ScanEncoder* new_ScanEncoder(ScanEncoderPool* pool, const ScanEncoderSettings* settings,
+                             ScanEncoderOutput output, void* context);
+
+void delete_ScanEncoder(ScanEncoder* encoder);
+
+// Encode and send one page. JPEG and PNG documents hold a single page, and
+// 1-bit pages go to PNG and PDF only. Returns 0 or -1.
+int encodeScanPage(ScanEncoder* encoder, const ScanPage* page);
+
+// Send whatever ends the document (the PDF trailer). Returns 0 or -1.
+int finishScanEncoder(ScanEncoder* encoder);
+
+// ScanBatchIO.writePage for a batch whose context is a ScanEncoder.
+int writeEncodedScanPage(void* encoder, const ScanPage* page);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_ENCODER_H */
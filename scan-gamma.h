@@ -0,0 +1,50 @@
+#ifndef SCAN_GAMMA_H
+#define SCAN_GAMMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct GammaStage GammaStage;
+
+typedef void (*GammaKernel8)(const GammaStage* stage, uint8_t* samples, size_t count);
+typedef void (*GammaKernel16)(const GammaStage* stage, uint16_t* samples, size_t count);
+
+// Lookup tables for one job, built once from Options.gray_gamma or color_gamma.
+// Samples map to max * (in / max) ^ (1 / gamma).
+struct GammaStage {
+    double gamma;
+    int depth;             // 8 or 16 bits per sample
+    bool identity;         // gamma 1.0: nothing to do
+    uint8_t table8[256];
+    uint32_t wide8[256];   // table8 widened for 32-bit gathers
+    uint16_t* table16;     // 65536 entries plus one so 32-bit gathers stay in bounds
+    GammaKernel8 kernel8;
+    GammaKernel16 kernel16;
+};
+
+// Returns 0 on success, -1 on a bad depth or if the 16-bit table cannot be allocated.
+int initGammaStage(GammaStage* stage, double gamma, int depth);
+
+void deleteGammaStage(GammaStage* stage);
+
+// Apply the curve in place to one scan line of count samples (not pixels).
+void applyGamma(const GammaStage* stage, void* line, size_t count);
+
+// Portable kernels; initGammaStage uses the AVX2 gathers where they measure faster.
+void gammaScalar8(const GammaStage* stage, uint8_t* samples, size_t count);
+void gammaScalar16(const GammaStage* stage, uint16_t* samples, size_t count);
+#if defined(__x86_64__) || defined(__i386__)
+void gammaAvx2_8(const GammaStage* stage, uint8_t* samples, size_t count);
+void gammaAvx2_16(const GammaStage* stage, uint16_t* samples, size_t count);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_GAMMA_H */
@@ -0,0 +1,146 @@
+#include "scan-gray.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static GrayKernel8 selectedGray8 = grayScalar8;
+static GrayKernel16 selectedGray16 = grayScalar16;
+static pthread_once_t grayKernelsOnce = PTHREAD_ONCE_INIT;
+
+// pshufb masks that pull channel c of 16 interleaved 8-bit pixels out of the
+// k-th 16-byte chunk, and the same for 8 pixels of 16-bit samples.
+static uint8_t gather8Masks[3][3][16];
+static uint8_t gather16Masks[3][3][16];
+
+static void selectGrayKernels(void) {
+    for (int c = 0; c < 3; ++c) {
+        for (int k = 0; k < 3; ++k) {
+            for (int lane = 0; lane < 16; ++lane) {
+                int byte = 3 * lane + c - 16 * k;
+                gather8Masks[c][k][lane] = byte >= 0 && byte < 16 ? (uint8_t)byte : 0x80;
+
+                int word = 3 * (lane / 2) + c - 8 * k;
+                gather16Masks[c][k][lane] = word >= 0 && word < 8 ? (uint8_t)(2 * word + lane % 2) : 0x80;
+            }
+        }
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("ssse3"))
+        selectedGray8 = graySsse3_8;
+    if (__builtin_cpu_supports("sse4.1"))
+        selectedGray16 = graySse41_16;
+#endif
+}
+
+void synthesizeGray8(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma) {
+    pthread_once(&grayKernelsOnce, selectGrayKernels);
+    selectedGray8(rgb, gray, pixels, gamma);
+}
+
+void synthesizeGray16(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma) {
+    pthread_once(&grayKernelsOnce, selectGrayKernels);
+    selectedGray16(rgb, gray, pixels, gamma);
+}
+
+void grayScalar8(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma) {
+    const uint8_t* table = gamma && !gamma->identity ? gamma->table8 : NULL;
+    for (size_t i = 0; i < pixels; ++i) {
+        unsigned value = (77u * rgb[3 * i] + 150u * rgb[3 * i + 1] + 29u * rgb[3 * i + 2] + 128u) >> 8;
+        gray[i] = table ? table[value] : (uint8_t)value;
+    }
+}
+
+void grayScalar16(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma) {
+    const uint16_t* table = gamma && !gamma->identity ? gamma->table16 : NULL;
+    for (size_t i = 0; i < pixels; ++i) {
+        uint32_t value = (19595u * rgb[3 * i] + 38470u * rgb[3 * i + 1] + 7471u * rgb[3 * i + 2] + 32768u) >> 16;
+        gray[i] = table ? table[value] : (uint16_t)value;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3")))
+static inline __m128i gatherChannel(const uint8_t masks[3][16], __m128i in0, __m128i in1, __m128i in2) {
+    __m128i a = _mm_shuffle_epi8(in0, _mm_loadu_si128((const __m128i*)masks[0]));
+    __m128i b = _mm_shuffle_epi8(in1, _mm_loadu_si128((const __m128i*)masks[1]));
+    __m128i c = _mm_shuffle_epi8(in2, _mm_loadu_si128((const __m128i*)masks[2]));
+    return _mm_or_si128(_mm_or_si128(a, b), c);
+}
+
+__attribute__((target("ssse3")))
+void graySsse3_8(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma) {
+    const uint8_t* table = gamma && !gamma->identity ? gamma->table8 : NULL;
+    pthread_once(&grayKernelsOnce, selectGrayKernels);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightR = _mm_set1_epi16(77);
+    const __m128i weightG = _mm_set1_epi16(150);
+    const __m128i weightB = _mm_set1_epi16(29);
+    const __m128i round = _mm_set1_epi16(128);
+    size_t i = 0;
+
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i in0 = _mm_loadu_si128((const __m128i*)(rgb + 3 * i));
+        __m128i in1 = _mm_loadu_si128((const __m128i*)(rgb + 3 * i + 16));
+        __m128i in2 = _mm_loadu_si128((const __m128i*)(rgb + 3 * i + 32));
+        __m128i r = gatherChannel(gather8Masks[0], in0, in1, in2);
+        __m128i g = gatherChannel(gather8Masks[1], in0, in1, in2);
+        __m128i b = gatherChannel(gather8Masks[2], in0, in1, in2);
+
+        // 77 * 255 + 150 * 255 + 29 * 255 + 128 still fits in 16 unsigned bits
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), weightR),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), weightG)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), weightB), round));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), weightR),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), weightG)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), weightB), round));
+        __m128i out = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128((__m128i*)(gray + i), out);
+
+        if (table) {
+            for (size_t j = i; j < i + 16; ++j)
+                gray[j] = table[gray[j]];
+        }
+    }
+    grayScalar8(rgb + 3 * i, gray + i, pixels - i, gamma);
+}
+
+__attribute__((target("sse4.1")))
+void graySse41_16(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma) {
+    const uint16_t* table = gamma && !gamma->identity ? gamma->table16 : NULL;
+    pthread_once(&grayKernelsOnce, selectGrayKernels);
+    const __m128i weightR = _mm_set1_epi32(19595);
+    const __m128i weightG = _mm_set1_epi32(38470);
+    const __m128i weightB = _mm_set1_epi32(7471);
+    const __m128i round = _mm_set1_epi32(32768);
+    size_t i = 0;
+
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i in0 = _mm_loadu_si128((const __m128i*)(rgb + 3 * i));
+        __m128i in1 = _mm_loadu_si128((const __m128i*)(rgb + 3 * i + 8));
+        __m128i in2 = _mm_loadu_si128((const __m128i*)(rgb + 3 * i + 16));
+        __m128i r = gatherChannel(gather16Masks[0], in0, in1, in2);
+        __m128i g = gatherChannel(gather16Masks[1], in0, in1, in2);
+        __m128i b = gatherChannel(gather16Masks[2], in0, in1, in2);
+
+        __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(r), weightR),
+                                                 _mm_mullo_epi32(_mm_cvtepu16_epi32(g), weightG)),
+                                   _mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(b), weightB), round));
+        __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(r, 8)), weightR),
+                                                 _mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(g, 8)), weightG)),
+                                   _mm_add_epi32(_mm_mullo_epi32(_mm_cvtepu16_epi32(_mm_srli_si128(b, 8)), weightB), round));
+        __m128i out = _mm_packus_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+        _mm_storeu_si128((__m128i*)(gray + i), out);
+
+        if (table) {
+            for (size_t j = i; j < i + 8; ++j)
+                gray[j] = table[gray[j]];
+        }
+    }
+    grayScalar16(rgb + 3 * i, gray + i, pixels - i, gamma);
+}
+#endif
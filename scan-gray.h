@@ -0,0 +1,36 @@
+#ifndef SCAN_GRAY_H
+#define SCAN_GRAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "scan-gamma.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Gray synthesis for Options.synthesize_gray: Rec. 601 luma in fixed point,
+//   gray8  = (77 R + 150 G + 29 B + 128) >> 8
+//   gray16 = (19595 R + 38470 G + 7471 B + 32768) >> 16
+// followed by the job's gray gamma table when gamma is not NULL.
+// gray may alias rgb, so a scan line can be converted in place.
+
+typedef void (*GrayKernel8)(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma);
+typedef void (*GrayKernel16)(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma);
+
+void synthesizeGray8(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma);
+void synthesizeGray16(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma);
+
+// Reference kernels, and the SSE ones synthesizeGray* use when the CPU has them.
+void grayScalar8(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma);
+void grayScalar16(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma);
+#if defined(__x86_64__) || defined(__i386__)
+void graySsse3_8(const uint8_t* rgb, uint8_t* gray, size_t pixels, const GammaStage* gamma);
+void graySse41_16(const uint16_t* rgb, uint16_t* gray, size_t pixels, const GammaStage* gamma);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_GRAY_H */
@@ -11,42 +11,253 @@
 #include <stdint.h>
 #include <math.h>
 #include <regex.h>
+#include "scan-job.h"
 
-static const char* SCAN_NONE = "None";
-static const char* SCAN_SERVICE_OFF_LINE = "ServiceOffLine";
-static const char* SCAN_RESOURCES_ARE_NOT_READY = "ResourcesAreNotReady";
-static const char* SCAN_JOB_QUEUED = "JobQueued";
-static const char* SCAN_JOB_SCANNING = "JobScanning";
-static const char* SCAN_JOB_SCANNING_AND_TRANSFERRING = "JobScanningAndTransferring";
-static const char* SCAN_JOB_COMPLETED_SUCCESSFULLY = "JobCompletedSuccessfully";
-static const char* SCAN_JOB_CANCELED_BY_USER = "JobCanceledByUser";
-static const char* SCAN_INVALID_SCAN_TICKET = "InvalidScanTicket";
-static const char* SCAN_UNSUPPORTED_DOCUMENT_FORMAT = "UnsupportedDocumentFormat";
-static const char* SCAN_DOCUMENT_PERMISSION_ERROR = "DocumentPermissionError";
-static const char* SCAN_ERRORS_DETECTED = "ErrorsDetected";
-
-typedef enum State
-{
-  aborted,
-  canceled,
-  completed,
-  pending,
-  processing
-} State;
-
-typedef enum Kind
-{
-  single,
-  adfBatch,
-  adfSingle
-} Kind;
-
-typedef struct {
-    char* xml;
-} papplScanSettingsXML;
+static const char SCAN_NONE[] = "None";
+static const char SCAN_SERVICE_OFF_LINE[] = "ServiceOffLine";
+static const char SCAN_RESOURCES_ARE_NOT_READY[] = "ResourcesAreNotReady";
+static const char SCAN_JOB_QUEUED[] = "JobQueued";
+static const char SCAN_JOB_SCANNING[] = "JobScanning";
+static const char SCAN_JOB_SCANNING_AND_TRANSFERRING[] = "JobScanningAndTransferring";
+static const char SCAN_JOB_COMPLETED_SUCCESSFULLY[] = "JobCompletedSuccessfully";
+static const char SCAN_JOB_CANCELED_BY_USER[] = "JobCanceledByUser";
+static const char SCAN_INVALID_SCAN_TICKET[] = "InvalidScanTicket";
+static const char SCAN_UNSUPPORTED_DOCUMENT_FORMAT[] = "UnsupportedDocumentFormat";
+static const char SCAN_DOCUMENT_PERMISSION_ERROR[] = "DocumentPermissionError";
+static const char SCAN_ERRORS_DETECTED[] = "ErrorsDetected";
+
+static const char* const reasonNames[] = {
+    SCAN_NONE,
+    SCAN_SERVICE_OFF_LINE,
+    SCAN_RESOURCES_ARE_NOT_READY,
+    SCAN_JOB_QUEUED,
+    SCAN_JOB_SCANNING,
+    SCAN_JOB_SCANNING_AND_TRANSFERRING,
+    SCAN_JOB_COMPLETED_SUCCESSFULLY,
+    SCAN_JOB_CANCELED_BY_USER,
+    SCAN_INVALID_SCAN_TICKET,
+    SCAN_UNSUPPORTED_DOCUMENT_FORMAT,
+    SCAN_DOCUMENT_PERMISSION_ERROR,
+    SCAN_ERRORS_DETECTED,
+};
+
+static const char* const stateNames[] = {
+    "Aborted", "Canceled", "Completed", "Pending", "Processing",
+};
+
+#define JOB_STATE_BITS 3
+#define JOB_REASON_BITS 5
+#define JOB_IMAGES_BITS 14
+#define JOB_TIME_BITS 28
+
+#define JOB_REASON_SHIFT JOB_STATE_BITS
+#define JOB_SCANNED_SHIFT (JOB_REASON_SHIFT + JOB_REASON_BITS)
+#define JOB_TRANSFERRED_SHIFT (JOB_SCANNED_SHIFT + JOB_IMAGES_BITS)
+#define JOB_TIME_SHIFT (JOB_TRANSFERRED_SHIFT + JOB_IMAGES_BITS)
+
+#define JOB_FIELD(word, shift, bits) ((unsigned)(((word) >> (shift)) & ((UINT64_C(1) << (bits)) - 1)))
+
+static uint64_t packJobWord(State state, ScanJobReason reason, unsigned scanned, unsigned transferred, uint64_t seconds) {
+    uint64_t maxImages = (UINT64_C(1) << JOB_IMAGES_BITS) - 1;
+    uint64_t maxSeconds = (UINT64_C(1) << JOB_TIME_BITS) - 1;
+    return (uint64_t)state
+           | (uint64_t)reason << JOB_REASON_SHIFT
+           | (scanned < maxImages ? scanned : maxImages) << JOB_SCANNED_SHIFT
+           | (transferred < maxImages ? transferred : maxImages) << JOB_TRANSFERRED_SHIFT
+           | (seconds < maxSeconds ? seconds : maxSeconds) << JOB_TIME_SHIFT;
+}
+
+static bool isFinalState(State state) {
+    return state == aborted || state == canceled || state == completed;
+}
+
+static bool isValidTransition(State from, State to) {
+    if (from == pending)
+        return to == pending || to == processing || to == canceled || to == aborted;
+    if (from == processing)
+        return to == processing || isFinalState(to);
+    return false;
+}
+
+static void noteScanJobChange(ScanJobStatus* status) {
+    _Atomic uint64_t* changes = atomic_load_explicit(&status->changes, memory_order_acquire);
+    if (changes != NULL)
+        atomic_fetch_add_explicit(changes, 1, memory_order_release);
+}
+
+void initScanJobStatus(ScanJobStatus* status, time_t now) {
+    status->created = now;
+    atomic_init(&status->changes, NULL);
+    atomic_init(&status->word, packJobWord(pending, reasonJobQueued, 0, 0, 0));
+}
+
+bool setScanJobState(ScanJobStatus* status, State state, ScanJobReason reason, time_t now) {
+    uint64_t seconds = now > status->created ? (uint64_t)(now - status->created) : 0;
+    uint64_t word = atomic_load_explicit(&status->word, memory_order_acquire);
+    uint64_t next;
+    do {
+        if (!isValidTransition((State)JOB_FIELD(word, 0, JOB_STATE_BITS), state))
+            return false;
+        next = packJobWord(state, reason,
+                           JOB_FIELD(word, JOB_SCANNED_SHIFT, JOB_IMAGES_BITS),
+                           JOB_FIELD(word, JOB_TRANSFERRED_SHIFT, JOB_IMAGES_BITS), seconds);
+    } while (!atomic_compare_exchange_weak_explicit(&status->word, &word, next,
+                                                    memory_order_acq_rel, memory_order_acquire));
+    noteScanJobChange(status);
+    return true;
+}
+
+bool countScanJobImage(ScanJobStatus* status, bool transferred) {
+    uint64_t word = atomic_load_explicit(&status->word, memory_order_acquire);
+    uint64_t next;
+    do {
+        if (JOB_FIELD(word, 0, JOB_STATE_BITS) != processing)
+            return false;
+        unsigned scanned = JOB_FIELD(word, JOB_SCANNED_SHIFT, JOB_IMAGES_BITS);
+        unsigned sent = JOB_FIELD(word, JOB_TRANSFERRED_SHIFT, JOB_IMAGES_BITS);
+        next = packJobWord(processing, (ScanJobReason)JOB_FIELD(word, JOB_REASON_SHIFT, JOB_REASON_BITS),
+                           scanned + !transferred, sent + transferred,
+                           word >> JOB_TIME_SHIFT);
+    } while (!atomic_compare_exchange_weak_explicit(&status->word, &word, next,
+                                                    memory_order_acq_rel, memory_order_acquire));
+    noteScanJobChange(status);
+    return true;
+}
+
+ScanJobSnapshot snapshotScanJob(const ScanJobStatus* status) {
+    uint64_t word = atomic_load_explicit(&status->word, memory_order_acquire);
+    ScanJobSnapshot snapshot;
+    snapshot.state = (State)JOB_FIELD(word, 0, JOB_STATE_BITS);
+    snapshot.reason = (ScanJobReason)JOB_FIELD(word, JOB_REASON_SHIFT, JOB_REASON_BITS);
+    snapshot.imagesScanned = JOB_FIELD(word, JOB_SCANNED_SHIFT, JOB_IMAGES_BITS);
+    snapshot.imagesTransferred = JOB_FIELD(word, JOB_TRANSFERRED_SHIFT, JOB_IMAGES_BITS);
+    snapshot.created = status->created;
+    snapshot.updated = status->created + (time_t)(word >> JOB_TIME_SHIFT);
+    return snapshot;
+}
+
+const char* scanJobStateName(State state) {
+    if ((unsigned)state >= sizeof(stateNames) / sizeof(stateNames[0]))
+        return stateNames[aborted];
+    return stateNames[state];
+}
+
+const char* scanJobReasonName(ScanJobReason reason) {
+    if ((unsigned)reason >= sizeof(reasonNames) / sizeof(reasonNames[0]))
+        return SCAN_NONE;
+    return reasonNames[reason];
+}
+
+// Age counts from the last state change, so a finished job ages from its completion.
+int formatScanJobInfo(const ScanJobSnapshot* snapshot, const char* uuid, time_t now, char* buffer, size_t size) {
+    long age = now > snapshot->updated ? (long)(now - snapshot->updated) : 0;
+    unsigned pending = snapshot->imagesScanned > snapshot->imagesTransferred
+                       ? snapshot->imagesScanned - snapshot->imagesTransferred : 0;
+    return snprintf(buffer, size,
+                    "<scan:JobInfo>"
+                    "<pwg:JobUri>/eSCL/ScanJobs/%s</pwg:JobUri>"
+                    "<pwg:JobUuid>urn:uuid:%s</pwg:JobUuid>"
+                    "<scan:Age>%ld</scan:Age>"
+                    "<pwg:ImagesCompleted>%u</pwg:ImagesCompleted>"
+                    "<pwg:ImagesToTransfer>%u</pwg:ImagesToTransfer>"
+                    "<pwg:JobState>%s</pwg:JobState>"
+                    "<pwg:JobStateReasons><pwg:JobStateReason>%s</pwg:JobStateReason></pwg:JobStateReasons>"
+                    "</scan:JobInfo>",
+                    uuid, uuid, age, snapshot->imagesTransferred, pending,
+                    scanJobStateName(snapshot->state), scanJobReasonName(snapshot->reason));
+}
+
+static int compareScanSettingsNodes(const void* a, const void* b) {
+    const papplScanSettingsNode* left = (const papplScanSettingsNode*)a;
+    const papplScanSettingsNode* right = (const papplScanSettingsNode*)b;
+    int result = xmlStrcmp(left->name, right->name);
+    if (result != 0)
+        return result;
+    // Keep document order among equal names so the first occurrence wins
+    return left->order < right->order ? -1 : left->order > right->order;
+}
+
+// Returns false if the index could not grow; it then covers only part of the document.
+static bool indexScanSettingsNodes(papplScanSettingsXML* scanSettings, xmlNodePtr cur, size_t* capacity) {
+    for (; cur != NULL; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE)
+            continue;
+
+        if (scanSettings->indexCount == *capacity) {
+            size_t newCapacity = *capacity ? *capacity * 2 : 32;
+            papplScanSettingsNode* index = (papplScanSettingsNode*)realloc(scanSettings->index, sizeof(papplScanSettingsNode) * newCapacity);
+            if (index == NULL)
+                return false;
+            scanSettings->index = index;
+            *capacity = newCapacity;
+        }
+        papplScanSettingsNode* entry = &scanSettings->index[scanSettings->indexCount];
+        entry->name = cur->name;
+        entry->node = cur;
+        entry->order = scanSettings->indexCount++;
+
+        if (!indexScanSettingsNodes(scanSettings, cur->xmlChildrenNode, capacity))
+            return false;
+    }
+    return true;
+}
+
+// The first element called name in document order, as the index would find it.
+static xmlNodePtr findScanSettingsNode(xmlNodePtr cur, const char* name) {
+    for (; cur != NULL; cur = cur->next) {
+        if (cur->type != XML_ELEMENT_NODE)
+            continue;
+        if (xmlStrcmp(cur->name, (const xmlChar *)name) == 0)
+            return cur;
+        xmlNodePtr found = findScanSettingsNode(cur->xmlChildrenNode, name);
+        if (found != NULL)
+            return found;
+    }
+    return NULL;
+}
+
+// Parse the document and build the name-to-node index on first access.
+static bool loadScanSettingsXml(papplScanSettingsXML* scanSettings) {
+    if (scanSettings->doc != NULL)
+        return true;
+    if (scanSettings->parseFailed)
+        return false;
+
+    scanSettings->doc = xmlParseMemory(scanSettings->xml, strlen(scanSettings->xml));
+    if (scanSettings->doc == NULL) {
+        fprintf(stderr,"Document not parsed successfully.\n");
+        scanSettings->parseFailed = true;
+        return false;
+    }
+
+    xmlNodePtr root = xmlDocGetRootElement(scanSettings->doc);
+    if (root == NULL) {
+        fprintf(stderr,"empty document\n");
+        return true;
+    }
+
+    size_t capacity = 0;
+    if (!indexScanSettingsNodes(scanSettings, root->xmlChildrenNode, &capacity)) {
+        // A partial index would report fields as missing; walking the tree is slower but right
+        free(scanSettings->index);
+        scanSettings->index = NULL;
+        scanSettings->indexCount = 0;
+        scanSettings->unindexed = true;
+        return true;
+    }
+    qsort(scanSettings->index, scanSettings->indexCount, sizeof(papplScanSettingsNode), compareScanSettingsNodes);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < scanSettings->indexCount; ++i) {
+        if (unique == 0 || xmlStrcmp(scanSettings->index[unique - 1].name, scanSettings->index[i].name) != 0)
+            scanSettings->index[unique++] = scanSettings->index[i];
+    }
+    scanSettings->indexCount = unique;
+    return true;
+}
 
 papplScanSettingsXML* new_ScanSettingsXml(const char* s) {
-    papplScanSettingsXML* scanSettings = (papplScanSettingsXML*)malloc(sizeof(papplScanSettingsXML));
+    papplScanSettingsXML* scanSettings = (papplScanSettingsXML*)calloc(1, sizeof(papplScanSettingsXML));
 
     if(scanSettings == NULL)
     {
@@ -57,35 +268,38 @@ papplScanSettingsXML* new_ScanSettingsXml(const char* s) {
     return scanSettings;
 }
 
-char* getString(papplScanSettingsXML* scanSettings, const char* name) {
-    xmlDocPtr doc;
-    xmlNodePtr cur;
-
-    doc = xmlParseMemory(scanSettings->xml, strlen(scanSettings->xml));
-
-    if (doc == NULL ) {
-        fprintf(stderr,"Document not parsed successfully.\n");
-        return NULL;
-    }
-
-    cur = xmlDocGetRootElement(doc);
+void delete_ScanSettingsXml(papplScanSettingsXML* scanSettings) {
+    if (scanSettings == NULL)
+        return;
+    if (scanSettings->doc != NULL)
+        xmlFreeDoc(scanSettings->doc);
+    free(scanSettings->index);
+    free(scanSettings->xml);
+    free(scanSettings);
+}
 
-    if (cur == NULL) {
-        fprintf(stderr,"empty document\n");
-        xmlFreeDoc(doc);
+char* getString(papplScanSettingsXML* scanSettings, const char* name) {
+    if (!loadScanSettingsXml(scanSettings))
         return NULL;
+    if (scanSettings->unindexed) {
+        xmlNodePtr root = xmlDocGetRootElement(scanSettings->doc);
+        xmlNodePtr cur = root ? findScanSettingsNode(root->xmlChildrenNode, name) : NULL;
+        return cur ? (char*)xmlNodeListGetString(scanSettings->doc, cur->xmlChildrenNode, 1) : NULL;
     }
 
-    cur = cur->xmlChildrenNode;
-    while (cur != NULL) {
-        if ((!xmlStrcmp(cur->name, (const xmlChar *)name))) {
-            char* content = xmlNodeListGetString(doc, cur->xmlChildrenNode, 1);
-            xmlFreeDoc(doc);
-            return content;
+    size_t low = 0, high = scanSettings->indexCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int result = xmlStrcmp(scanSettings->index[mid].name, (const xmlChar *)name);
+        if (result == 0) {
+            xmlNodePtr cur = scanSettings->index[mid].node;
+            return (char*)xmlNodeListGetString(scanSettings->doc, cur->xmlChildrenNode, 1);
         }
-        cur = cur->next;
+        if (result < 0)
+            low = mid + 1;
+        else
+            high = mid;
     }
 
-    xmlFreeDoc(doc);
     return NULL;
 }
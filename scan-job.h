@@ -0,0 +1,119 @@
+#ifndef SCAN_JOB_H
+#define SCAN_JOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum State
+{
+  aborted,
+  canceled,
+  completed,
+  pending,
+  processing
+} State;
+
+// single is a flatbed page, adfSingle one sheet from the feeder and
+// adfBatch every sheet until the feeder is empty.
+typedef enum Kind
+{
+  single,
+  adfBatch,
+  adfSingle
+} Kind;
+
+// pwg:JobStateReason values, in the order of the strings in scan-job.c.
+typedef enum ScanJobReason
+{
+  reasonNone,
+  reasonServiceOffLine,
+  reasonResourcesAreNotReady,
+  reasonJobQueued,
+  reasonJobScanning,
+  reasonJobScanningAndTransferring,
+  reasonJobCompletedSuccessfully,
+  reasonJobCanceledByUser,
+  reasonInvalidScanTicket,
+  reasonUnsupportedDocumentFormat,
+  reasonDocumentPermissionError,
+  reasonErrorsDetected
+} ScanJobReason;
+
+// Everything a status poll needs, packed into one word so it can be read
+// and updated without a lock:
+//   state:3 reason:5 imagesScanned:14 imagesTransferred:14 updated:28
+// where updated is seconds since created. Image counts saturate.
+typedef struct {
+    _Atomic uint64_t word;
+    time_t created;
+    _Atomic(_Atomic uint64_t*) changes;  // bumped after every update, e.g. a ScannerStatus version; may be NULL
+} ScanJobStatus;
+
+typedef struct {
+    State state;
+    ScanJobReason reason;
+    unsigned imagesScanned;
+    unsigned imagesTransferred;
+    time_t created;
+    time_t updated;     // time of the last state change
+} ScanJobSnapshot;
+
+// A new job is pending with reason JobQueued.
+void initScanJobStatus(ScanJobStatus* status, time_t now);
+
+// Move to state, allowed only along pending -> processing -> completed, aborted
+// or canceled (pending may also be canceled or aborted directly); pending and
+// processing may change their reason. Returns false for any other transition.
+bool setScanJobState(ScanJobStatus* status, State state, ScanJobReason reason, time_t now);
+
+// Count one image read from the device, or sent to the client. Only a
+// processing job counts; returns false otherwise.
+bool countScanJobImage(ScanJobStatus* status, bool transferred);
+
+ScanJobSnapshot snapshotScanJob(const ScanJobStatus* status);
+
+// eSCL spellings: "Pending", "Processing", ...; and "JobQueued", ...
+const char* scanJobStateName(State state);
+const char* scanJobReasonName(ScanJobReason reason);
+
+// Render the scan:JobInfo element of ScannerStatus for one job. Returns the
+// length written, as snprintf does.
+int formatScanJobInfo(const ScanJobSnapshot* snapshot, const char* uuid, time_t now, char* buffer, size_t size);
+
+typedef struct {
+    const xmlChar* name;
+    xmlNodePtr node;
+    size_t order;
+} papplScanSettingsNode;
+
+// The document is parsed on first lookup and kept until delete_ScanSettingsXml.
+typedef struct {
+    char* xml;
+    xmlDocPtr doc;
+    papplScanSettingsNode* index; // sorted by element name, first occurrence only
+    size_t indexCount;
+    bool unindexed;               // no memory for the index; lookups walk the tree instead
+    bool parseFailed;
+} papplScanSettingsXML;
+
+papplScanSettingsXML* new_ScanSettingsXml(const char* s);
+
+void delete_ScanSettingsXml(papplScanSettingsXML* scanSettings);
+
+// Returns the text of the first element called name, to be released with xmlFree, or NULL
+char* getString(papplScanSettingsXML* scanSettings, const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_JOB_H */
@@ -0,0 +1,93 @@
+#include "scan-pixel.h"
+#include "scan-gray.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One luma kernel per layout. CHANNELS and SHIFT are constants, so the
+// channel test folds away and each loop is straight-line code the compiler
+// can vectorize.
+#define DEFINE_LUMA_KERNEL(name, type, CHANNELS, SHIFT)                                                     \
+    static void name(const void* line, uint8_t* luma, size_t width) {                                      \
+        const type* in = (const type*)line;                                                                 \
+        for (size_t x = 0; x < width; ++x) {                                                                \
+            if (CHANNELS == 1)                                                                              \
+                luma[x] = (uint8_t)(in[x] >> SHIFT);                                                        \
+            else                                                                                            \
+                luma[x] = (uint8_t)((77u * (in[3 * x] >> SHIFT) + 150u * (in[3 * x + 1] >> SHIFT)           \
+                                     + 29u * (in[3 * x + 2] >> SHIFT) + 128u) >> 8);                        \
+        }                                                                                                   \
+    }
+
+DEFINE_LUMA_KERNEL(lumaGray8, uint8_t, 1, 0)
+DEFINE_LUMA_KERNEL(lumaGray16, uint16_t, 1, 8)
+DEFINE_LUMA_KERNEL(lumaRgb8, uint8_t, 3, 0)
+DEFINE_LUMA_KERNEL(lumaRgb16, uint16_t, 3, 8)
+
+static void lumaGray1(const void* line, uint8_t* luma, size_t width) {
+    const uint8_t* bits = (const uint8_t*)line;
+    for (size_t x = 0; x < width; ++x)
+        luma[x] = (uint8_t)(0u - ((bits[x >> 3] >> (7 - (x & 7))) & 1u));
+}
+
+static void grayRgb8(const void* rgb, void* gray, size_t pixels, const GammaStage* gamma) {
+    synthesizeGray8((const uint8_t*)rgb, (uint8_t*)gray, pixels, gamma);
+}
+
+static void grayRgb16(const void* rgb, void* gray, size_t pixels, const GammaStage* gamma) {
+    synthesizeGray16((const uint16_t*)rgb, (uint16_t*)gray, pixels, gamma);
+}
+
+static const ScanPixelKernels layouts[] = {
+    { 1, 1, lumaGray1, NULL },
+    { 1, 8, lumaGray8, NULL },
+    { 1, 16, lumaGray16, NULL },
+    { 3, 8, lumaRgb8, grayRgb8 },
+    { 3, 16, lumaRgb16, grayRgb16 },
+};
+
+const ScanPixelKernels* scanPixelKernelsFor(int channels, int depth) {
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); ++i) {
+        if (layouts[i].channels == channels && layouts[i].depth == depth)
+            return &layouts[i];
+    }
+    return NULL;
+}
+
+void binarizeGray8(const uint8_t* gray, uint8_t* bits, size_t width, uint8_t threshold) {
+    size_t x = 0;
+    // Each output byte is written after the eight pixels it packs were read
+    for (; x + 8 <= width; x += 8) {
+        unsigned byte = 0;
+        for (int bit = 0; bit < 8; ++bit)
+            byte = byte << 1 | (unsigned)(gray[x + bit] >= threshold);
+        bits[x >> 3] = (uint8_t)byte;
+    }
+    if (x < width) {
+        unsigned byte = 0;
+        for (size_t bit = 0; x + bit < width; ++bit)
+            byte |= (unsigned)(gray[x + bit] >= threshold) << (7 - bit);
+        bits[x >> 3] = (uint8_t)byte;
+    }
+}
+
+static unsigned sampleAt(const void* line, size_t index, int depth) {
+    switch (depth) {
+    case 1:
+        return ((((const uint8_t*)line)[index >> 3] >> (7 - (index & 7))) & 1u) * 255u;
+    case 8:
+        return ((const uint8_t*)line)[index];
+    default:
+        return ((const uint16_t*)line)[index] >> 8;
+    }
+}
+
+void lumaGeneric(const void* line, uint8_t* luma, size_t width, int channels, int depth) {
+    for (size_t x = 0; x < width; ++x) {
+        if (channels == 1)
+            luma[x] = (uint8_t)sampleAt(line, x, depth);
+        else
+            luma[x] = (uint8_t)((77u * sampleAt(line, 3 * x, depth) + 150u * sampleAt(line, 3 * x + 1, depth)
+                                 + 29u * sampleAt(line, 3 * x + 2, depth) + 128u) >> 8);
+    }
+}
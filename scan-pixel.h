@@ -0,0 +1,53 @@
+#ifndef SCAN_PIXEL_H
+#define SCAN_PIXEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scan-gamma.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-line kernels for one pixel layout. Every layout a ColorMode can ask for
+// has its own copy of each kernel, generated from one macro with the channel
+// count and sample type as constants, so the layout is looked at once when a
+// job (or page) starts and never per pixel. 1-bit lines are packed MSB first
+// with 1 for white, as PNG and PDF store them.
+
+// 8-bit luma of every pixel, Rec. 601 weights as in gray synthesis.
+typedef void (*LumaKernel)(const void* line, uint8_t* luma, size_t width);
+
+// RGB to gray in place or into gray, with the gray gamma when gamma is not NULL.
+typedef void (*GrayKernel)(const void* rgb, void* gray, size_t pixels, const GammaStage* gamma);
+
+typedef struct {
+    int channels;
+    int depth;
+    LumaKernel luma;
+    GrayKernel gray;       // NULL for gray layouts
+} ScanPixelKernels;
+
+// The kernels for a layout: 1 channel of 1, 8 or 16 bits, or 3 channels of 8 or
+// 16 bits. NULL for any other layout.
+const ScanPixelKernels* scanPixelKernelsFor(int channels, int depth);
+
+// Bytes in a line of width pixels.
+static inline size_t scanLineBytes(size_t width, int channels, int depth) {
+    return (width * (size_t)channels * (size_t)depth + 7) / 8;
+}
+
+// Pack 8-bit gray to 1 bit: white where gray is at least threshold. gray and
+// bits may be the same buffer.
+void binarizeGray8(const uint8_t* gray, uint8_t* bits, size_t width, uint8_t threshold);
+
+// The same luma as the kernels, with the layout read per pixel; the reference
+// the specialized kernels are checked against.
+void lumaGeneric(const void* line, uint8_t* luma, size_t width, int channels, int depth);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_PIXEL_H */
@@ -0,0 +1,273 @@
+#include "scan-queue.h"
+#include "scan-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Wait up to seconds, or until stopping; with forJob, also until a job is
+// waiting. The lock is held.
+static void waitForQueue(ScanQueue* queue, double seconds, bool forJob) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)seconds;
+    deadline.tv_nsec += (long)((seconds - (double)(time_t)seconds) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (!queue->stopping && !(forJob && queue->head != NULL)) {
+        if (pthread_cond_timedwait(&queue->wake, &queue->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+}
+
+static void finishScanJob(ScanQueue* queue, ScanQueueJob* job, int result) {
+    time_t t = time(NULL);
+    // run may have finished the job itself; then these are refused
+    if (result == 0)
+        setScanJobState(job->status, completed, reasonJobCompletedSuccessfully, t);
+    else
+        setScanJobState(job->status, aborted, reasonErrorsDetected, t);
+    State state = snapshotScanJob(job->status).state;
+
+    pthread_mutex_lock(&queue->lock);
+    if (state == completed)
+        queue->stats.completed++;
+    else if (state == aborted)
+        queue->stats.aborted++;
+    queue->current = NULL;
+    pthread_mutex_unlock(&queue->lock);
+
+    if (queue->device.release != NULL)
+        queue->device.release(job);
+}
+
+// Runs the jobs one after another. The device is opened for the first job
+// and stays open while jobs keep coming, so a job that arrives within
+// keepWarm of the last one skips the warm-up.
+static void* dispatchScanJobs(void* arg) {
+    ScanQueue* queue = (ScanQueue*)arg;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->stopping) {
+        if (queue->head == NULL) {
+            if (!queue->opened) {
+                pthread_cond_wait(&queue->wake, &queue->lock);
+                continue;
+            }
+            if (queue->settings.keepWarm > 0)
+                waitForQueue(queue, queue->settings.keepWarm, true);
+            if (queue->head == NULL && !queue->stopping) {
+                pthread_mutex_unlock(&queue->lock);
+                queue->device.close(queue->device.device);
+                pthread_mutex_lock(&queue->lock);
+                queue->opened = false;
+            }
+            continue;
+        }
+
+        bool warm = queue->opened;
+        if (!warm) {
+            pthread_mutex_unlock(&queue->lock);
+            SCAN_STATS_START(open);
+            int result = queue->device.open(queue->device.device);
+            SCAN_STATS_STOP(open, SCAN_STAGE_DEVICE_OPEN);
+            pthread_mutex_lock(&queue->lock);
+            if (result != 0) {
+                queue->stats.openFailures++;
+                if (queue->head != NULL)
+                    setScanJobState(queue->head->status, pending, reasonResourcesAreNotReady, time(NULL));
+                waitForQueue(queue, queue->settings.retryOpen, false);
+                continue;
+            }
+            queue->opened = true;
+            queue->stats.opens++;
+            // The job may have been canceled while the device warmed up
+            if (queue->head == NULL || queue->stopping)
+                continue;
+        } else {
+            queue->stats.warmStarts++;
+        }
+
+        ScanQueueJob* job = queue->head;
+        queue->head = job->next;
+        if (queue->head == NULL)
+            queue->tail = NULL;
+        job->next = NULL;
+        queue->waiting--;
+        queue->current = job;
+        pthread_mutex_unlock(&queue->lock);
+
+        double start = now();
+        int result = -1;
+        if (setScanJobState(job->status, processing, reasonJobScanning, time(NULL)))
+            result = queue->device.run(queue->device.device, job);
+        double seconds = now() - start;
+        finishScanJob(queue, job, result);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->jobSeconds = queue->jobSeconds > 0 ? 0.8 * queue->jobSeconds + 0.2 * seconds : seconds;
+    }
+
+    // Stopping: nothing waiting gets to run
+    ScanQueueJob* job = queue->head;
+    queue->head = queue->tail = NULL;
+    queue->waiting = 0;
+    bool opened = queue->opened;
+    queue->opened = false;
+    pthread_mutex_unlock(&queue->lock);
+
+    while (job != NULL) {
+        ScanQueueJob* next = job->next;
+        job->next = NULL;
+        setScanJobState(job->status, aborted, reasonServiceOffLine, time(NULL));
+        if (queue->device.release != NULL)
+            queue->device.release(job);
+        job = next;
+    }
+    if (opened)
+        queue->device.close(queue->device.device);
+    return NULL;
+}
+
+ScanQueue* new_ScanQueue(const ScanQueueDevice* device, const ScanQueueSettings* settings) {
+    ScanQueue* queue = (ScanQueue*)calloc(1, sizeof(ScanQueue));
+    pthread_condattr_t attributes;
+
+    if (queue == NULL)
+        return NULL;
+    queue->device = *device;
+    if (settings != NULL)
+        queue->settings = *settings;
+    if (queue->settings.depth == 0)
+        queue->settings.depth = SCAN_QUEUE_DEPTH;
+    if (queue->settings.keepWarm == 0)
+        queue->settings.keepWarm = SCAN_QUEUE_KEEP_WARM;
+    if (queue->settings.retryOpen <= 0)
+        queue->settings.retryOpen = SCAN_QUEUE_RETRY_OPEN;
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+    if (pthread_create(&queue->dispatcher, NULL, dispatchScanJobs, queue) != 0) {
+        pthread_cond_destroy(&queue->wake);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void delete_ScanQueue(ScanQueue* queue) {
+    if (queue == NULL)
+        return;
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = true;
+    pthread_cond_broadcast(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->dispatcher, NULL);
+
+    pthread_cond_destroy(&queue->wake);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+static unsigned estimateRetryAfter(const ScanQueue* queue) {
+    // A slot frees up when the job scanning now is done; a whole job is the safe guess
+    if (queue->jobSeconds <= 0)
+        return SCAN_QUEUE_RETRY_AFTER;
+    double seconds = ceil(queue->jobSeconds);
+    return seconds < 1 ? 1 : seconds > 3600 ? 3600 : (unsigned)seconds;
+}
+
+int submitScanJob(ScanQueue* queue, ScanQueueJob* job, unsigned* retryAfter) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->stopping || queue->waiting >= queue->settings.depth) {
+        queue->stats.rejected++;
+        if (retryAfter != NULL)
+            *retryAfter = estimateRetryAfter(queue);
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+    }
+
+    job->next = NULL;
+    if (queue->settings.policy == SCAN_QUEUE_PRIORITY) {
+        // Behind every job of the same or higher priority
+        ScanQueueJob** link = &queue->head;
+        while (*link != NULL && (*link)->priority >= job->priority)
+            link = &(*link)->next;
+        job->next = *link;
+        *link = job;
+        if (job->next == NULL)
+            queue->tail = job;
+    } else {
+        if (queue->tail != NULL)
+            queue->tail->next = job;
+        else
+            queue->head = job;
+        queue->tail = job;
+    }
+    queue->waiting++;
+    queue->stats.submitted++;
+    pthread_cond_signal(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+bool cancelQueuedScanJob(ScanQueue* queue, ScanQueueJob* job) {
+    pthread_mutex_lock(&queue->lock);
+    ScanQueueJob* previous = NULL;
+    ScanQueueJob* cur = queue->head;
+    while (cur != NULL && cur != job) {
+        previous = cur;
+        cur = cur->next;
+    }
+    if (cur == NULL) {
+        pthread_mutex_unlock(&queue->lock);
+        return false;
+    }
+    if (previous != NULL)
+        previous->next = job->next;
+    else
+        queue->head = job->next;
+    if (queue->tail == job)
+        queue->tail = previous;
+    job->next = NULL;
+    queue->waiting--;
+    queue->stats.canceled++;
+    pthread_mutex_unlock(&queue->lock);
+
+    setScanJobState(job->status, canceled, reasonJobCanceledByUser, time(NULL));
+    if (queue->device.release != NULL)
+        queue->device.release(job);
+    return true;
+}
+
+long scanJobQueuePosition(ScanQueue* queue, const ScanQueueJob* job) {
+    pthread_mutex_lock(&queue->lock);
+    long position = queue->current != NULL;
+    const ScanQueueJob* cur = queue->head;
+    while (cur != NULL && cur != job) {
+        position++;
+        cur = cur->next;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return cur != NULL ? position : -1;
+}
+
+void getScanQueueStats(ScanQueue* queue, ScanQueueStats* stats) {
+    pthread_mutex_lock(&queue->lock);
+    *stats = queue->stats;
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,103 @@
+#ifndef SCAN_QUEUE_H
+#define SCAN_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "scan-job.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum { SCAN_QUEUE_FIFO, SCAN_QUEUE_PRIORITY } ScanQueuePolicy;
+
+// A job waiting for the device. Owned by the caller; the queue only links it.
+typedef struct ScanQueueJob {
+    struct ScanQueueJob* next;
+    ScanJobStatus* status;     // pending until dispatched, then set by the dispatcher
+    int priority;              // SCAN_QUEUE_PRIORITY: higher first, FIFO among equals
+    void* context;
+} ScanQueueJob;
+
+// The device behind one queue. open warms it up (lamp, motor, calibration) and
+// close lets it go; between back-to-back jobs it stays open. run scans one job
+// and returns 0 or -1; the job is completed or aborted accordingly unless run
+// has already moved it to a final state. release, when not NULL, is called
+// once for every job the queue lets go of: after run, or unrun when it is
+// canceled or the queue is deleted.
+typedef struct {
+    void* device;
+    int (*open)(void* device);
+    int (*run)(void* device, ScanQueueJob* job);
+    void (*close)(void* device);
+    void (*release)(ScanQueueJob* job);
+} ScanQueueDevice;
+
+#define SCAN_QUEUE_DEPTH 8
+#define SCAN_QUEUE_KEEP_WARM 20.0      // seconds
+#define SCAN_QUEUE_RETRY_OPEN 2.0      // seconds
+#define SCAN_QUEUE_RETRY_AFTER 10      // seconds, until a job has been timed
+
+typedef struct {
+    ScanQueuePolicy policy;
+    size_t depth;          // jobs waiting, not counting the one scanning; 0 for SCAN_QUEUE_DEPTH
+    double keepWarm;       // idle seconds before the device is closed; 0 for SCAN_QUEUE_KEEP_WARM, < 0 to close at once
+    double retryOpen;      // seconds between attempts to open a device that failed; 0 for SCAN_QUEUE_RETRY_OPEN
+} ScanQueueSettings;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t rejected;     // refused because the queue was full
+    uint64_t canceled;     // canceled while waiting
+    uint64_t completed;
+    uint64_t aborted;
+    uint64_t opens;        // device warm-ups
+    uint64_t warmStarts;   // jobs that found the device already open
+    uint64_t openFailures;
+} ScanQueueStats;
+
+// One queue and one dispatcher thread per device.
+typedef struct {
+    ScanQueueDevice device;
+    ScanQueueSettings settings;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;       // a job arrived, or stopping
+    pthread_t dispatcher;
+    ScanQueueJob* head;
+    ScanQueueJob* tail;
+    size_t waiting;
+    ScanQueueJob* current;     // being scanned
+    bool opened;
+    bool stopping;
+    double jobSeconds;         // moving average of run time, for Retry-After; 0 until known
+    ScanQueueStats stats;
+} ScanQueue;
+
+// NULL if the dispatcher could not be started.
+ScanQueue* new_ScanQueue(const ScanQueueDevice* device, const ScanQueueSettings* settings);
+
+// Stops the dispatcher after the job scanning now, aborts the jobs still
+// waiting and closes the device.
+void delete_ScanQueue(ScanQueue* queue);
+
+// Queue a pending job. Returns 0, or -1 when the queue is full, with
+// retryAfter set to the seconds until a slot is likely to be free: the
+// answer is 503 Service Unavailable with that Retry-After.
+int submitScanJob(ScanQueue* queue, ScanQueueJob* job, unsigned* retryAfter);
+
+// Take a job off the queue before it is dispatched and cancel it. Returns
+// false if it is no longer waiting (scanning, or done).
+bool cancelQueuedScanJob(ScanQueue* queue, ScanQueueJob* job);
+
+// Jobs ahead of job in the queue, counting the one scanning; -1 if job is not waiting.
+long scanJobQueuePosition(ScanQueue* queue, const ScanQueueJob* job);
+
+void getScanQueueStats(ScanQueue* queue, ScanQueueStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_QUEUE_H */
@@ -0,0 +1,354 @@
+#include "scan-region.h"
+#include "scan-backoff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static bool unitsAre(EsclStringView units, const char* name) {
+    // Clients write both "escl:ThreeHundredthsOfInches" and the bare local name
+    const char* colon = memchr(units.data, ':', units.length);
+    if (colon != NULL) {
+        units.length -= (size_t)(colon + 1 - units.data);
+        units.data = colon + 1;
+    }
+    return units.length == strlen(name) && memcmp(units.data, name, units.length) == 0;
+}
+
+int scanRegionToPixels(const ScanRegion* region, double xResolution, double yResolution, ScanRect* rect) {
+    double xScale, yScale;
+    if (!(xResolution > 0))
+        xResolution = SCAN_REGION_DEFAULT_RESOLUTION;
+    if (!(yResolution > 0))
+        yResolution = SCAN_REGION_DEFAULT_RESOLUTION;
+
+    if (region->contentRegionUnits.length == 0 || unitsAre(region->contentRegionUnits, "ThreeHundredthsOfInches")) {
+        xScale = xResolution / 300.0;
+        yScale = yResolution / 300.0;
+    } else if (unitsAre(region->contentRegionUnits, "Millimeters")) {
+        xScale = xResolution / 25.4;
+        yScale = yResolution / 25.4;
+    } else if (unitsAre(region->contentRegionUnits, "Pixels")) {
+        xScale = 1;
+        yScale = 1;
+    } else {
+        fprintf(stderr, "unsupported ContentRegionUnits '%.*s'\n",
+                (int)region->contentRegionUnits.length, region->contentRegionUnits.data);
+        return -1;
+    }
+
+    if (region->xOffset < 0 || region->yOffset < 0 || !(region->width > 0) || !(region->height > 0))
+        return -1;
+    // Round the edges, not the sizes, so adjacent regions meet without a gap
+    size_t left = (size_t)lround(region->xOffset * xScale);
+    size_t top = (size_t)lround(region->yOffset * yScale);
+    size_t right = (size_t)lround((region->xOffset + region->width) * xScale);
+    size_t bottom = (size_t)lround((region->yOffset + region->height) * yScale);
+    if (right <= left || bottom <= top)
+        return -1;
+
+    rect->x = left;
+    rect->y = top;
+    rect->width = right - left;
+    rect->height = bottom - top;
+    return 0;
+}
+
+typedef struct {
+    SANE_Int index;
+    const SANE_Option_Descriptor* descriptor;
+} GeometryOption;
+
+static bool findGeometryOption(SANE_Handle handle, SANE_Int optionCount, const char* name, GeometryOption* option) {
+    for (SANE_Int index = 1; index < optionCount; ++index) {
+        const SANE_Option_Descriptor* descriptor = sane_get_option_descriptor(handle, index);
+        if (descriptor == NULL || descriptor->name == NULL || strcmp(descriptor->name, name) != 0)
+            continue;
+        if (!SANE_OPTION_IS_ACTIVE(descriptor->cap) || !SANE_OPTION_IS_SETTABLE(descriptor->cap)
+            || (descriptor->type != SANE_TYPE_INT && descriptor->type != SANE_TYPE_FIXED)
+            || (descriptor->unit != SANE_UNIT_MM && descriptor->unit != SANE_UNIT_PIXEL))
+            return false;
+        option->index = index;
+        option->descriptor = descriptor;
+        return true;
+    }
+    return false;
+}
+
+// Pixels at the scan resolution in the option's own unit.
+static double pixelsToOption(const GeometryOption* option, size_t pixels, double resolution) {
+    return option->descriptor->unit == SANE_UNIT_MM ? pixels * 25.4 / resolution : (double)pixels;
+}
+
+static double optionToPixels(const GeometryOption* option, double value, double resolution) {
+    return option->descriptor->unit == SANE_UNIT_MM ? value * resolution / 25.4 : value;
+}
+
+// Round outwards to the option's quantization and clamp to its range, then set it.
+static int setGeometryOption(SANE_Handle handle, const GeometryOption* option, double value, bool roundUp) {
+    const SANE_Option_Descriptor* descriptor = option->descriptor;
+    bool fixed = descriptor->type == SANE_TYPE_FIXED;
+    double word = fixed ? value * 65536.0 : value;
+    SANE_Word setting = (SANE_Word)(roundUp ? ceil(word) : floor(word));
+
+    if (descriptor->constraint_type == SANE_CONSTRAINT_RANGE && descriptor->constraint.range != NULL) {
+        const SANE_Range* range = descriptor->constraint.range;
+        if (range->quant > 0) {
+            SANE_Word steps = (setting - range->min) / range->quant;
+            if (roundUp && range->min + steps * range->quant < setting)
+                steps++;
+            setting = range->min + steps * range->quant;
+        }
+        if (setting < range->min)
+            setting = range->min;
+        if (setting > range->max)
+            setting = range->max;
+    }
+    if (sane_control_option(handle, option->index, SANE_ACTION_SET_VALUE, &setting, NULL) != SANE_STATUS_GOOD) {
+        fprintf(stderr, "cannot set SANE option '%s'\n", descriptor->name);
+        return -1;
+    }
+    return 0;
+}
+
+// The value the backend settled on, in pixels.
+static double readGeometryOption(SANE_Handle handle, const GeometryOption* option, double resolution) {
+    SANE_Word word = 0;
+    sane_control_option(handle, option->index, SANE_ACTION_GET_VALUE, &word, NULL);
+    double value = option->descriptor->type == SANE_TYPE_FIXED ? SANE_UNFIX(word) : (double)word;
+    return optionToPixels(option, value, resolution);
+}
+
+int programScanGeometry(SANE_Handle handle, const ScanRect* rect, double xResolution, double yResolution,
+                        ScanRect* delivered) {
+    GeometryOption tlX, tlY, brX, brY;
+    SANE_Int optionCount = 0;
+
+    if (!(xResolution > 0))
+        xResolution = SCAN_REGION_DEFAULT_RESOLUTION;
+    if (!(yResolution > 0))
+        yResolution = SCAN_REGION_DEFAULT_RESOLUTION;
+
+    if (sane_control_option(handle, 0, SANE_ACTION_GET_VALUE, &optionCount, NULL) != SANE_STATUS_GOOD
+        || !findGeometryOption(handle, optionCount, "tl-x", &tlX)
+        || !findGeometryOption(handle, optionCount, "tl-y", &tlY)
+        || !findGeometryOption(handle, optionCount, "br-x", &brX)
+        || !findGeometryOption(handle, optionCount, "br-y", &brY)) {
+        // No geometry: the device reads from the platen origin and everything is cropped here
+        delivered->x = 0;
+        delivered->y = 0;
+        delivered->width = rect->x + rect->width;
+        delivered->height = rect->y + rect->height;
+        return 0;
+    }
+
+    if (setGeometryOption(handle, &tlX, pixelsToOption(&tlX, rect->x, xResolution), false) != 0
+        || setGeometryOption(handle, &tlY, pixelsToOption(&tlY, rect->y, yResolution), false) != 0
+        || setGeometryOption(handle, &brX, pixelsToOption(&brX, rect->x + rect->width, xResolution), true) != 0
+        || setGeometryOption(handle, &brY, pixelsToOption(&brY, rect->y + rect->height, yResolution), true) != 0)
+        return -1;
+
+    // Backends round geometry to their own grid; crop whatever they add
+    double left = floor(readGeometryOption(handle, &tlX, xResolution) + 0.5);
+    double top = floor(readGeometryOption(handle, &tlY, yResolution) + 0.5);
+    double right = floor(readGeometryOption(handle, &brX, xResolution) + 0.5);
+    double bottom = floor(readGeometryOption(handle, &brY, yResolution) + 0.5);
+    delivered->x = left > 0 ? (size_t)left : 0;
+    delivered->y = top > 0 ? (size_t)top : 0;
+    delivered->width = right > left ? (size_t)(right - left) : 0;
+    delivered->height = bottom > top ? (size_t)(bottom - top) : 0;
+    return 0;
+}
+
+bool scanCropFor(const ScanRect* wanted, const ScanRect* delivered, size_t bytesPerPixel, ScanCrop* crop) {
+    size_t left = wanted->x > delivered->x ? wanted->x : delivered->x;
+    size_t top = wanted->y > delivered->y ? wanted->y : delivered->y;
+    size_t right = wanted->x + wanted->width;
+    size_t bottom = wanted->y + wanted->height;
+    if (right > delivered->x + delivered->width)
+        right = delivered->x + delivered->width;
+    if (bottom > delivered->y + delivered->height)
+        bottom = delivered->y + delivered->height;
+    if (right <= left || bottom <= top)
+        return false;
+
+    crop->firstLine = top - delivered->y;
+    crop->lines = bottom - top;
+    crop->firstByte = (left - delivered->x) * bytesPerPixel;
+    crop->lineBytes = (right - left) * bytesPerPixel;
+    return true;
+}
+
+ScanImageView cropScanImage(ScanImageView image, const ScanCrop* crop) {
+    ScanImageView view = image;
+    size_t lines = crop->firstLine < image.lines ? image.lines - crop->firstLine : 0;
+    view.data = image.data + crop->firstLine * image.stride + crop->firstByte;
+    view.lines = crop->lines < lines ? crop->lines : lines;
+    view.lineBytes = crop->firstByte + crop->lineBytes <= image.lineBytes ? crop->lineBytes
+                     : (crop->firstByte < image.lineBytes ? image.lineBytes - crop->firstByte : 0);
+    return view;
+}
+
+ScanRect scanRegionBounds(const ScanRect* rects, size_t count) {
+    size_t left = rects[0].x, top = rects[0].y;
+    size_t right = rects[0].x + rects[0].width, bottom = rects[0].y + rects[0].height;
+    for (size_t i = 1; i < count; ++i) {
+        if (rects[i].x < left)
+            left = rects[i].x;
+        if (rects[i].y < top)
+            top = rects[i].y;
+        if (rects[i].x + rects[i].width > right)
+            right = rects[i].x + rects[i].width;
+        if (rects[i].y + rects[i].height > bottom)
+            bottom = rects[i].y + rects[i].height;
+    }
+    ScanRect bounds = { left, top, right - left, bottom - top };
+    return bounds;
+}
+
+// A region that has all its lines no longer holds strips back.
+#define REGION_DONE SIZE_MAX
+
+typedef struct {
+    uint8_t* buffer;               // SCAN_FANOUT_STRIPS strips of SCAN_FANOUT_STRIP_LINES lines
+    size_t stride;
+    size_t stripFirstLine[SCAN_FANOUT_STRIPS];
+    size_t stripLines[SCAN_FANOUT_STRIPS];
+    _Alignas(64) atomic_size_t produced;
+    atomic_bool ended;
+    atomic_bool stop;
+} ScanFanOut;
+
+typedef struct {
+    ScanFanOut* fanOut;
+    ScanRegionOutput* output;
+} ScanRegionWorker;
+
+// Strips come a few milliseconds apart, so waits sleep in short steps.
+static void waitBriefly(unsigned* spins) {
+    scanBackOff(spins, 100000);
+}
+
+static void* encodeRegion(void* data) {
+    ScanRegionWorker* worker = (ScanRegionWorker*)data;
+    ScanFanOut* fanOut = worker->fanOut;
+    ScanRegionOutput* output = worker->output;
+    const ScanCrop* crop = &output->crop;
+    size_t lastLine = crop->firstLine + crop->lines;
+
+    output->result = -1;
+    for (size_t strip = 0;; ++strip) {
+        unsigned spins = 0;
+        while (atomic_load_explicit(&fanOut->produced, memory_order_acquire) <= strip) {
+            // Check produced again after ended, in case the last strip came in between
+            if (atomic_load_explicit(&fanOut->stop, memory_order_relaxed)
+                || (atomic_load_explicit(&fanOut->ended, memory_order_acquire)
+                    && atomic_load_explicit(&fanOut->produced, memory_order_acquire) <= strip)) {
+                atomic_store(&output->consumed, REGION_DONE);
+                return NULL;
+            }
+            waitBriefly(&spins);
+        }
+
+        size_t slot = strip % SCAN_FANOUT_STRIPS;
+        size_t first = fanOut->stripFirstLine[slot];
+        size_t end = first + fanOut->stripLines[slot];
+        const uint8_t* lines = fanOut->buffer + slot * SCAN_FANOUT_STRIP_LINES * fanOut->stride;
+        size_t from = crop->firstLine > first ? crop->firstLine : first;
+        size_t to = lastLine < end ? lastLine : end;
+        for (size_t y = from; y < to; ++y) {
+            if (output->sink(output->context, lines + (y - first) * fanOut->stride + crop->firstByte, crop->lineBytes) != 0) {
+                atomic_store(&fanOut->stop, true);
+                atomic_store(&output->consumed, REGION_DONE);
+                return NULL;
+            }
+        }
+
+        if (end >= lastLine) {
+            output->result = 0;
+            atomic_store_explicit(&output->consumed, REGION_DONE, memory_order_release);
+            return NULL;
+        }
+        atomic_store_explicit(&output->consumed, strip + 1, memory_order_release);
+    }
+}
+
+// Strips every region is done with, so their slots can be refilled.
+static size_t oldestConsumed(ScanRegionOutput* outputs, size_t count) {
+    size_t oldest = REGION_DONE;
+    for (size_t i = 0; i < count; ++i) {
+        size_t consumed = atomic_load_explicit(&outputs[i].consumed, memory_order_acquire);
+        if (consumed < oldest)
+            oldest = consumed;
+    }
+    return oldest;
+}
+
+int fanOutScanRegions(ScanLineSource source, void* sourceContext, size_t stride,
+                      ScanRegionOutput* outputs, size_t count) {
+    ScanFanOut fanOut;
+    ScanRegionWorker* workers = (ScanRegionWorker*)calloc(count, sizeof(ScanRegionWorker));
+    memset(&fanOut, 0, sizeof(fanOut));
+    fanOut.stride = stride;
+    fanOut.buffer = (uint8_t*)malloc(SCAN_FANOUT_STRIPS * SCAN_FANOUT_STRIP_LINES * stride);
+    if (workers == NULL || fanOut.buffer == NULL) {
+        free(workers);
+        free(fanOut.buffer);
+        return -1;
+    }
+    atomic_init(&fanOut.produced, 0);
+    atomic_init(&fanOut.ended, false);
+    atomic_init(&fanOut.stop, false);
+
+    size_t started = 0;
+    for (; started < count; ++started) {
+        workers[started].fanOut = &fanOut;
+        workers[started].output = &outputs[started];
+        outputs[started].result = -1;
+        atomic_init(&outputs[started].consumed, 0);
+        if (pthread_create(&outputs[started].thread, NULL, encodeRegion, &workers[started]) != 0) {
+            atomic_store(&fanOut.stop, true);
+            break;
+        }
+    }
+
+    int result = started == count ? 0 : -1;
+    size_t line = 0;
+    for (size_t strip = 0; result == 0; ++strip) {
+        unsigned spins = 0;
+        size_t oldest;
+        // Stop reading once every region has its lines, and wait while the ring is full
+        while ((oldest = oldestConsumed(outputs, count)) != REGION_DONE && strip - oldest >= SCAN_FANOUT_STRIPS) {
+            if (atomic_load_explicit(&fanOut.stop, memory_order_relaxed))
+                break;
+            waitBriefly(&spins);
+        }
+        if (oldest == REGION_DONE || atomic_load(&fanOut.stop))
+            break;
+
+        size_t slot = strip % SCAN_FANOUT_STRIPS;
+        long lines = source(sourceContext, fanOut.buffer + slot * SCAN_FANOUT_STRIP_LINES * stride, stride,
+                            SCAN_FANOUT_STRIP_LINES);
+        if (lines < 0) {
+            atomic_store(&fanOut.stop, true);
+            result = -1;
+            break;
+        }
+        if (lines == 0)
+            break;
+        fanOut.stripFirstLine[slot] = line;
+        fanOut.stripLines[slot] = (size_t)lines;
+        line += (size_t)lines;
+        atomic_store_explicit(&fanOut.produced, strip + 1, memory_order_release);
+    }
+    atomic_store_explicit(&fanOut.ended, true, memory_order_release);
+
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(outputs[i].thread, NULL);
+        if (outputs[i].result != 0)
+            result = -1;
+    }
+    free(workers);
+    free(fanOut.buffer);
+    return result;
+}
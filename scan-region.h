@@ -0,0 +1,101 @@
+#ifndef SCAN_REGION_H
+#define SCAN_REGION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sane/sane.h>
+#include "escl-scan-settings.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A rectangle in device pixels at the scan resolution.
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+} ScanRect;
+
+// eSCL's default resolution when the ticket names none.
+#define SCAN_REGION_DEFAULT_RESOLUTION 300
+
+// Convert a ScanRegion to pixels at the requested resolution. Units may be
+// escl:ThreeHundredthsOfInches (also the default when none are given),
+// escl:Millimeters or escl:Pixels. Returns -1 on unknown units or an empty region.
+int scanRegionToPixels(const ScanRegion* region, double xResolution, double yResolution, ScanRect* rect);
+
+// Where the wanted rectangle lies within what the device delivers, in lines and bytes.
+typedef struct {
+    size_t firstLine;
+    size_t lines;
+    size_t firstByte;
+    size_t lineBytes;
+} ScanCrop;
+
+// Set the SANE tl-x/tl-y/br-x/br-y options so the device reads no more than
+// rect, rounding outwards to what the device accepts. delivered receives the
+// area the device will actually scan: the whole platen when it has no
+// geometry options. Returns -1 only if the options exist but cannot be set.
+int programScanGeometry(SANE_Handle handle, const ScanRect* rect, double xResolution, double yResolution,
+                        ScanRect* delivered);
+
+// The crop that takes wanted out of delivered; false if they don't overlap.
+bool scanCropFor(const ScanRect* wanted, const ScanRect* delivered, size_t bytesPerPixel, ScanCrop* crop);
+
+// The part of device line y that belongs to the crop, or NULL outside it.
+// No copy: the result points into line.
+static inline const uint8_t* cropScanLine(const ScanCrop* crop, size_t y, const uint8_t* line) {
+    if (y < crop->firstLine || y - crop->firstLine >= crop->lines)
+        return NULL;
+    return line + crop->firstByte;
+}
+
+// A buffered image as a first-row pointer and a stride.
+typedef struct {
+    uint8_t* data;
+    size_t lineBytes;
+    size_t lines;
+    size_t stride;
+} ScanImageView;
+
+// Crop an image by moving its first-row pointer; the stride stays that of the device lines.
+ScanImageView cropScanImage(ScanImageView image, const ScanCrop* crop);
+
+// The smallest rectangle holding all count rects; count must be at least 1.
+ScanRect scanRegionBounds(const ScanRect* rects, size_t count);
+
+// Fill up to maxLines device lines, stride bytes apart: the number read, 0 at the end, -1 on error.
+typedef long (*ScanLineSource)(void* context, uint8_t* lines, size_t stride, size_t maxLines);
+// Take one cropped line of a region: 0, or -1 to fail the scan.
+typedef int (*ScanLineSink)(void* context, const uint8_t* line, size_t length);
+
+// One region of a multi-region scan and the encoder its lines go to.
+typedef struct {
+    ScanCrop crop;             // within the device lines
+    ScanLineSink sink;
+    void* context;
+    _Alignas(64) atomic_size_t consumed;   // strips this region is done with
+    pthread_t thread;
+    int result;
+} ScanRegionOutput;
+
+#define SCAN_FANOUT_STRIP_LINES 32
+#define SCAN_FANOUT_STRIPS 8
+
+// Read the device once and hand every region its lines. Strips of device
+// lines go round a ring that all regions read from in place, each on its own
+// thread, so regions are encoded concurrently and nothing is copied or read
+// twice. Returns 0 when every region got all its lines, -1 otherwise.
+int fanOutScanRegions(ScanLineSource source, void* sourceContext, size_t stride,
+                      ScanRegionOutput* outputs, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_REGION_H */
@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include "scan-spool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#define SPOOL_FIRST_CAPACITY (64 * 1024)
+#define SPOOL_COPY_SIZE (256 * 1024)
+
+ScanSpoolStore* new_ScanSpoolStore(const char* directory, size_t ramLimit) {
+    ScanSpoolStore* store = (ScanSpoolStore*)calloc(1, sizeof(ScanSpoolStore));
+    if (store == NULL)
+        return NULL;
+    if (directory == NULL)
+        directory = getenv("TMPDIR");
+    store->directory = strdup(directory != NULL && *directory ? directory : "/tmp");
+    if (store->directory == NULL) {
+        free(store);
+        return NULL;
+    }
+    store->ramLimit = ramLimit ? ramLimit : SCAN_SPOOL_RAM_LIMIT;
+    pthread_mutex_init(&store->lock, NULL);
+    return store;
+}
+
+void delete_ScanSpoolStore(ScanSpoolStore* store) {
+    if (store == NULL)
+        return;
+    pthread_mutex_destroy(&store->lock);
+    free(store->directory);
+    free(store);
+}
+
+void getScanSpoolStats(ScanSpoolStore* store, ScanSpoolStats* stats) {
+    pthread_mutex_lock(&store->lock);
+    *stats = store->stats;
+    pthread_mutex_unlock(&store->lock);
+}
+
+static bool reserveRam(ScanSpoolStore* store, size_t bytes) {
+    bool reserved = false;
+    pthread_mutex_lock(&store->lock);
+    if (store->stats.bytesInRam + bytes <= store->ramLimit) {
+        store->stats.bytesInRam += bytes;
+        if (store->stats.bytesInRam > store->stats.highWaterRam)
+            store->stats.highWaterRam = store->stats.bytesInRam;
+        reserved = true;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return reserved;
+}
+
+static void releaseRam(ScanSpoolStore* store, size_t bytes) {
+    pthread_mutex_lock(&store->lock);
+    store->stats.bytesInRam -= bytes;
+    pthread_mutex_unlock(&store->lock);
+}
+
+static void countDisk(ScanSpoolStore* store, size_t added, size_t removed) {
+    pthread_mutex_lock(&store->lock);
+    store->stats.bytesOnDisk = store->stats.bytesOnDisk + added - removed;
+    if (store->stats.bytesOnDisk > store->stats.highWaterDisk)
+        store->stats.highWaterDisk = store->stats.bytesOnDisk;
+    pthread_mutex_unlock(&store->lock);
+}
+
+static void countSent(ScanSpoolStore* store, size_t zeroCopy, size_t copied) {
+    pthread_mutex_lock(&store->lock);
+    store->stats.bytesSentZeroCopy += zeroCopy;
+    store->stats.bytesSentCopied += copied;
+    pthread_mutex_unlock(&store->lock);
+}
+
+ScanSpool* new_ScanSpool(ScanSpoolStore* store) {
+    ScanSpool* spool = (ScanSpool*)calloc(1, sizeof(ScanSpool));
+    pthread_condattr_t attributes;
+
+    if (spool == NULL)
+        return NULL;
+    spool->store = store;
+    spool->fd = -1;
+    pthread_mutex_init(&spool->lock, NULL);
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&spool->ready, &attributes);
+    pthread_condattr_destroy(&attributes);
+    return spool;
+}
+
+// Give back what document holds; the spool lock is held.
+static void reclaimDocument(ScanSpool* spool, ScanSpoolDocument* document) {
+    if (!document->spilled) {
+        free(document->data);
+        releaseRam(spool->store, document->capacity);
+        document->data = NULL;
+        document->capacity = 0;
+        return;
+    }
+
+    // Punching the range out frees the blocks and drops the cached pages at once
+    if (document->length > 0)
+        fallocate(spool->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, document->offset, (off_t)document->length);
+    spool->onDisk -= document->length;
+    countDisk(spool->store, 0, document->length);
+    if (spool->onDisk == 0 && (spool->writing == NULL || !spool->writing->spilled)) {
+        if (ftruncate(spool->fd, 0) == 0)
+            spool->fileEnd = 0;
+    }
+}
+
+void delete_ScanSpool(ScanSpool* spool) {
+    if (spool == NULL)
+        return;
+    pthread_mutex_lock(&spool->lock);
+    ScanSpoolDocument* document = spool->head;
+    while (document != NULL) {
+        ScanSpoolDocument* next = document->next;
+        reclaimDocument(spool, document);
+        free(document);
+        document = next;
+    }
+    spool->head = spool->tail = spool->writing = NULL;
+    pthread_mutex_unlock(&spool->lock);
+
+    if (spool->fd >= 0)
+        close(spool->fd);
+    pthread_cond_destroy(&spool->ready);
+    pthread_mutex_destroy(&spool->lock);
+    free(spool);
+}
+
+// The file has no name, so nothing is left behind if the process dies.
+static int openSpoolFile(const char* directory) {
+    int fd = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL))
+        return fd;
+
+    size_t length = strlen(directory) + sizeof("/escl-spool-XXXXXX");
+    char* path = (char*)malloc(length);
+    if (path == NULL)
+        return -1;
+    snprintf(path, length, "%s/escl-spool-XXXXXX", directory);
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0)
+        unlink(path);
+    free(path);
+    return fd;
+}
+
+static int writeAt(int fd, const void* data, size_t length, off_t offset) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, p, length, offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += written;
+        offset += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+// Move what the document holds in memory to the end of the spool file; the
+// rest of it will be appended there.
+static int spillDocument(ScanSpool* spool, ScanSpoolDocument* document) {
+    if (spool->fd < 0) {
+        spool->fd = openSpoolFile(spool->store->directory);
+        if (spool->fd < 0) {
+            perror("scan spool");
+            return -1;
+        }
+    }
+    if (writeAt(spool->fd, document->data, document->length, spool->fileEnd) != 0) {
+        perror("scan spool");
+        return -1;
+    }
+    document->offset = spool->fileEnd;
+    spool->fileEnd += (off_t)document->length;
+    spool->onDisk += document->length;
+    countDisk(spool->store, document->length, 0);
+
+    free(document->data);
+    releaseRam(spool->store, document->capacity);
+    document->data = NULL;
+    document->capacity = 0;
+    document->spilled = true;
+    pthread_mutex_lock(&spool->store->lock);
+    spool->store->stats.spilled++;
+    pthread_mutex_unlock(&spool->store->lock);
+    return 0;
+}
+
+int beginSpooledDocument(ScanSpool* spool) {
+    ScanSpoolDocument* document = (ScanSpoolDocument*)calloc(1, sizeof(ScanSpoolDocument));
+    if (document == NULL)
+        return -1;
+
+    pthread_mutex_lock(&spool->lock);
+    if (spool->writing != NULL || spool->ended) {
+        pthread_mutex_unlock(&spool->lock);
+        free(document);
+        return -1;
+    }
+    if (spool->tail != NULL)
+        spool->tail->next = document;
+    else
+        spool->head = document;
+    spool->tail = document;
+    spool->writing = document;
+    pthread_mutex_unlock(&spool->lock);
+    return 0;
+}
+
+int writeSpooledDocument(void* context, const void* data, size_t length) {
+    ScanSpool* spool = (ScanSpool*)context;
+    int result = 0;
+
+    pthread_mutex_lock(&spool->lock);
+    ScanSpoolDocument* document = spool->writing;
+    if (document == NULL || spool->failed) {
+        pthread_mutex_unlock(&spool->lock);
+        return -1;
+    }
+
+    if (!document->spilled) {
+        size_t needed = document->length + length;
+        if (needed > document->capacity) {
+            size_t capacity = document->capacity ? document->capacity : SPOOL_FIRST_CAPACITY;
+            while (capacity < needed)
+                capacity *= 2;
+            if (reserveRam(spool->store, capacity - document->capacity)) {
+                uint8_t* grown = (uint8_t*)realloc(document->data, capacity);
+                if (grown != NULL) {
+                    document->data = grown;
+                    document->capacity = capacity;
+                } else {
+                    releaseRam(spool->store, capacity - document->capacity);
+                }
+            }
+        }
+        if (needed <= document->capacity) {
+            memcpy(document->data + document->length, data, length);
+            document->length = needed;
+            pthread_mutex_unlock(&spool->lock);
+            return 0;
+        }
+        // Over the store's memory: this document goes to disk
+        result = spillDocument(spool, document);
+    }
+
+    // Only the document being written grows, so it always ends the file
+    if (result == 0)
+        result = writeAt(spool->fd, data, length, spool->fileEnd);
+    if (result == 0) {
+        spool->fileEnd += (off_t)length;
+        spool->onDisk += length;
+        document->length += length;
+        countDisk(spool->store, length, 0);
+    } else {
+        spool->failed = true;
+    }
+    pthread_mutex_unlock(&spool->lock);
+    return result;
+}
+
+int finishSpooledDocument(ScanSpool* spool) {
+    pthread_mutex_lock(&spool->lock);
+    ScanSpoolDocument* document = spool->writing;
+    if (document == NULL || spool->failed) {
+        pthread_mutex_unlock(&spool->lock);
+        return -1;
+    }
+    document->finished = true;
+    spool->writing = NULL;
+    pthread_cond_broadcast(&spool->ready);
+    pthread_mutex_unlock(&spool->lock);
+
+    pthread_mutex_lock(&spool->store->lock);
+    spool->store->stats.documents++;
+    pthread_mutex_unlock(&spool->store->lock);
+    return 0;
+}
+
+void endScanSpool(ScanSpool* spool) {
+    pthread_mutex_lock(&spool->lock);
+    // A document cut off by a failed scan is never delivered
+    ScanSpoolDocument* document = spool->writing;
+    if (document != NULL) {
+        ScanSpoolDocument** link = &spool->head;
+        ScanSpoolDocument* previous = NULL;
+        while (*link != document) {
+            previous = *link;
+            link = &(*link)->next;
+        }
+        *link = NULL;
+        spool->tail = previous;
+        spool->writing = NULL;
+        reclaimDocument(spool, document);
+        free(document);
+    }
+    spool->ended = true;
+    pthread_cond_broadcast(&spool->ready);
+    pthread_mutex_unlock(&spool->lock);
+}
+
+ScanSpoolDocument* takeSpooledDocument(ScanSpool* spool, double timeout, bool* ended) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += (time_t)timeout;
+    deadline.tv_nsec += (long)((timeout - (double)(time_t)timeout) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    ScanSpoolDocument* document = NULL;
+    *ended = false;
+    pthread_mutex_lock(&spool->lock);
+    for (;;) {
+        if (spool->head != NULL && spool->head->finished) {
+            document = spool->head;
+            spool->head = document->next;
+            if (spool->head == NULL)
+                spool->tail = NULL;
+            document->next = NULL;
+            break;
+        }
+        if (spool->ended && spool->head == NULL) {
+            *ended = true;
+            break;
+        }
+        if (pthread_cond_timedwait(&spool->ready, &spool->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    pthread_mutex_unlock(&spool->lock);
+    return document;
+}
+
+static int waitWritable(int fd) {
+    struct pollfd p = { fd, POLLOUT, 0 };
+    return poll(&p, 1, -1) < 0 && errno != EINTR ? -1 : 0;
+}
+
+static int writeAll(int socket, const void* data, size_t length) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (length > 0) {
+        ssize_t written = write(socket, p, length);
+        if (written < 0) {
+            if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && waitWritable(socket) == 0))
+                continue;
+            return -1;
+        }
+        p += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+int sendSpooledDocument(ScanSpool* spool, const ScanSpoolDocument* document, int socket) {
+    size_t remaining = document->length;
+
+    if (!document->spilled) {
+        if (writeAll(socket, document->data, document->length) != 0)
+            return -1;
+        countSent(spool->store, 0, document->length);
+        return 0;
+    }
+
+    off_t offset = document->offset;
+    while (remaining > 0) {
+        ssize_t sent = sendfile(socket, spool->fd, &offset, remaining);
+        if (sent < 0) {
+            if (errno == EINTR || ((errno == EAGAIN || errno == EWOULDBLOCK) && waitWritable(socket) == 0))
+                continue;
+            return -1;
+        }
+        if (sent == 0)
+            return -1;     // the file is shorter than the document
+        remaining -= (size_t)sent;
+    }
+    countSent(spool->store, document->length, 0);
+    return 0;
+}
+
+int sendSpooledChunk(ScanSpool* spool, const ScanSpoolDocument* document, int socket) {
+    char sizeLine[24];
+
+    // A zero-length chunk would end the body
+    if (document->length == 0)
+        return 0;
+    int length = snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", document->length);
+    if (writeAll(socket, sizeLine, (size_t)length) != 0 || sendSpooledDocument(spool, document, socket) != 0)
+        return -1;
+    return writeAll(socket, "\r\n", 2);
+}
+
+int copySpooledDocument(ScanSpool* spool, const ScanSpoolDocument* document,
+                        int (*output)(void* context, const void* data, size_t length), void* context) {
+    if (!document->spilled) {
+        if (document->length > 0 && output(context, document->data, document->length) != 0)
+            return -1;
+        countSent(spool->store, 0, document->length);
+        return 0;
+    }
+
+    uint8_t* buffer = (uint8_t*)malloc(SPOOL_COPY_SIZE);
+    if (buffer == NULL)
+        return -1;
+    size_t done = 0;
+    int result = 0;
+    while (done < document->length && result == 0) {
+        size_t piece = document->length - done < SPOOL_COPY_SIZE ? document->length - done : SPOOL_COPY_SIZE;
+        ssize_t bytes = pread(spool->fd, buffer, piece, document->offset + (off_t)done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0 || output(context, buffer, (size_t)bytes) != 0)
+            result = -1;
+        else
+            done += (size_t)bytes;
+    }
+    free(buffer);
+    if (result == 0)
+        countSent(spool->store, 0, document->length);
+    return result;
+}
+
+void releaseSpooledDocument(ScanSpool* spool, ScanSpoolDocument* document) {
+    if (document == NULL)
+        return;
+    pthread_mutex_lock(&spool->lock);
+    reclaimDocument(spool, document);
+    pthread_mutex_unlock(&spool->lock);
+    free(document);
+}
@@ -0,0 +1,115 @@
+#ifndef SCAN_SPOOL_H
+#define SCAN_SPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    size_t documents;          // spooled so far
+    size_t spilled;            // documents that went to disk
+    size_t bytesInRam;
+    size_t bytesOnDisk;        // not yet delivered
+    size_t highWaterRam;
+    size_t highWaterDisk;
+    uint64_t bytesSentZeroCopy;    // sendfile from the spool file
+    uint64_t bytesSentCopied;      // written from memory, or read back for TLS
+} ScanSpoolStats;
+
+// What every job's spool shares: where spill files go and how much encoded
+// data may be held in memory across all of them.
+typedef struct {
+    pthread_mutex_t lock;
+    char* directory;
+    size_t ramLimit;
+    ScanSpoolStats stats;
+} ScanSpoolStore;
+
+#define SCAN_SPOOL_RAM_LIMIT (64 * 1024 * 1024)
+
+// directory NULL uses $TMPDIR or /tmp; ramLimit 0 selects SCAN_SPOOL_RAM_LIMIT.
+ScanSpoolStore* new_ScanSpoolStore(const char* directory, size_t ramLimit);
+void delete_ScanSpoolStore(ScanSpoolStore* store);
+
+void getScanSpoolStats(ScanSpoolStore* store, ScanSpoolStats* stats);
+
+// One encoded document (a page, or a whole PDF) waiting for NextDocument.
+// It is held in memory while the store's RAM allows and moves to the spool
+// file as soon as it does not.
+typedef struct ScanSpoolDocument {
+    struct ScanSpoolDocument* next;
+    uint8_t* data;             // in memory; NULL once spilled
+    size_t capacity;
+    off_t offset;              // in the spool file once spilled
+    size_t length;
+    bool spilled;
+    bool finished;
+} ScanSpoolDocument;
+
+// The documents of one job, in the order they were scanned. The pipeline
+// writes them and the NextDocument handler takes them, on other threads.
+typedef struct {
+    ScanSpoolStore* store;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int fd;                    // unlinked spool file; -1 until something spills
+    off_t fileEnd;
+    size_t onDisk;             // bytes in the file not yet delivered
+    ScanSpoolDocument* head;   // oldest not yet taken
+    ScanSpoolDocument* tail;
+    ScanSpoolDocument* writing;
+    bool ended;
+    bool failed;
+} ScanSpool;
+
+ScanSpool* new_ScanSpool(ScanSpoolStore* store);
+
+// Also what cancels a job's output: every document not yet delivered is
+// dropped and its memory and disk space given back. Documents already taken
+// must be released first.
+void delete_ScanSpool(ScanSpool* spool);
+
+// Start the next document. Returns 0 or -1.
+int beginSpooledDocument(ScanSpool* spool);
+
+// ScanEncoderOutput appending to the document begun last; context is the ScanSpool.
+int writeSpooledDocument(void* spool, const void* data, size_t length);
+
+// The document is complete and may be taken. Returns 0 or -1.
+int finishSpooledDocument(ScanSpool* spool);
+
+// No more documents will come.
+void endScanSpool(ScanSpool* spool);
+
+// The next complete document, waiting up to timeout seconds for one. NULL
+// with *ended set when the job has no more, NULL otherwise on timeout.
+ScanSpoolDocument* takeSpooledDocument(ScanSpool* spool, double timeout, bool* ended);
+
+// Send document to a socket: from the spool file with sendfile, so the data
+// never comes back to user space, or from memory. Returns 0 or -1.
+int sendSpooledDocument(ScanSpool* spool, const ScanSpoolDocument* document, int socket);
+
+// Send document the same way as one chunk of a chunked HTTP body: its size
+// line, the data and the closing CRLF. An empty document sends nothing, since
+// a zero-length chunk would end the body. Returns 0 or -1.
+int sendSpooledChunk(ScanSpool* spool, const ScanSpoolDocument* document, int socket);
+
+// Hand document to output in pieces, reading it back from disk if spilled;
+// for connections sendfile cannot use, such as TLS ones. Returns 0 or -1.
+int copySpooledDocument(ScanSpool* spool, const ScanSpoolDocument* document,
+                        int (*output)(void* context, const void* data, size_t length), void* context);
+
+// The document was delivered: free its memory, or punch its range out of the file.
+void releaseSpooledDocument(ScanSpool* spool, ScanSpoolDocument* document);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_SPOOL_H */
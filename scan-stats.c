@@ -0,0 +1,308 @@
+#include "scan-stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+static const char* const stageNames[SCAN_STAGES] = {
+    "ticket-parse", "options", "device-open", "page-read", "gamma",
+    "blank", "binarize", "encode", "transfer",
+};
+
+static const char* const counterNames[SCAN_COUNTERS] = {
+    "bytes-read", "bytes-sent",
+};
+
+uint64_t scanStatsBucketLimit(size_t bucket) {
+    if (bucket < (2u << SCAN_STATS_SUB_BITS))
+        return bucket;
+    int shift = (int)(bucket >> SCAN_STATS_SUB_BITS) - 1;
+    uint64_t mantissa = (bucket & ((1u << SCAN_STATS_SUB_BITS) - 1)) + (1u << SCAN_STATS_SUB_BITS);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+uint64_t scanStatsPercentile(const ScanStatsHistogram* histogram, double fraction) {
+    if (histogram->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(fraction * (double)histogram->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < SCAN_STATS_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = scanStatsBucketLimit(i);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+const char* scanStatsStageName(ScanStatsStage stage) {
+    return (unsigned)stage < SCAN_STAGES ? stageNames[stage] : "unknown";
+}
+
+int formatScanStats(const ScanStatsSnapshot* snapshot, char* buffer, size_t size) {
+    size_t length = 0;
+
+#define APPEND(...) do { \
+        int written = snprintf(length < size ? buffer + length : NULL, length < size ? size - length : 0, __VA_ARGS__); \
+        if (written < 0) \
+            return -1; \
+        length += (size_t)written; \
+    } while (0)
+
+    if (size > 0)
+        buffer[0] = '\0';
+    APPEND("%-13s %9s %9s %9s %9s %9s %9s  (microseconds)\n", "stage", "count", "p50", "p90", "p99", "max", "mean");
+    for (int stage = 0; stage < SCAN_STAGES; ++stage) {
+        const ScanStatsHistogram* histogram = &snapshot->stages[stage];
+        if (histogram->count == 0)
+            continue;
+        APPEND("%-13s %9llu %9.1f %9.1f %9.1f %9.1f %9.1f\n", stageNames[stage],
+               (unsigned long long)histogram->count,
+               scanStatsPercentile(histogram, 0.5) / 1e3, scanStatsPercentile(histogram, 0.9) / 1e3,
+               scanStatsPercentile(histogram, 0.99) / 1e3, histogram->max / 1e3,
+               (double)histogram->sum / (double)histogram->count / 1e3);
+    }
+    for (int counter = 0; counter < SCAN_COUNTERS; ++counter)
+        APPEND("%-13s %9llu\n", counterNames[counter], (unsigned long long)snapshot->counters[counter]);
+    APPEND("%-13s %9zu\n", "threads", snapshot->threads);
+
+#undef APPEND
+    return (int)length;
+}
+
+#ifdef ESCL_SCAN_STATS
+
+// Each thread records into its own block, so recording takes no lock and no
+// locked instruction; the relaxed atomics only keep a snapshot's loads whole.
+typedef struct {
+    atomic_uint_least64_t count;
+    atomic_uint_least64_t sum;
+    atomic_uint_least64_t max;
+    atomic_uint_least64_t buckets[SCAN_STATS_BUCKETS];
+} ThreadHistogram;
+
+typedef struct ThreadStats {
+    struct ThreadStats* next;
+    ThreadHistogram stages[SCAN_STAGES];
+    atomic_uint_least64_t counters[SCAN_COUNTERS];
+} ThreadStats;
+
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadStats* liveThreads;
+static size_t liveThreadCount;
+static ScanStatsSnapshot retired;     // what threads that have exited recorded
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t threadKey;
+static _Thread_local ThreadStats* current;
+
+static inline uint64_t load(atomic_uint_least64_t* value) {
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+// Only the owning thread writes, so a load and a store are enough.
+static inline void add(atomic_uint_least64_t* value, uint64_t amount) {
+    atomic_store_explicit(value, load(value) + amount, memory_order_relaxed);
+}
+
+static void addThreadStats(ScanStatsSnapshot* snapshot, ThreadStats* stats) {
+    for (int stage = 0; stage < SCAN_STAGES; ++stage) {
+        ThreadHistogram* from = &stats->stages[stage];
+        ScanStatsHistogram* to = &snapshot->stages[stage];
+        if (load(&from->count) == 0)
+            continue;
+        // The count is taken from the buckets, so percentiles add up while the thread records
+        for (size_t i = 0; i < SCAN_STATS_BUCKETS; ++i) {
+            uint64_t count = load(&from->buckets[i]);
+            to->buckets[i] += count;
+            to->count += count;
+        }
+        to->sum += load(&from->sum);
+        uint64_t max = load(&from->max);
+        if (max > to->max)
+            to->max = max;
+    }
+    for (int counter = 0; counter < SCAN_COUNTERS; ++counter)
+        snapshot->counters[counter] += load(&stats->counters[counter]);
+}
+
+// A thread's numbers outlive it: they are folded into retired when it exits.
+static void retireThread(void* data) {
+    ThreadStats* stats = (ThreadStats*)data;
+    pthread_mutex_lock(&registryLock);
+    addThreadStats(&retired, stats);
+    for (ThreadStats** p = &liveThreads; *p != NULL; p = &(*p)->next) {
+        if (*p == stats) {
+            *p = stats->next;
+            break;
+        }
+    }
+    liveThreadCount--;
+    pthread_mutex_unlock(&registryLock);
+    current = NULL;
+    free(stats);
+}
+
+static void createThreadKey(void) {
+    pthread_key_create(&threadKey, retireThread);
+}
+
+static ThreadStats* threadStats(void) {
+    if (current != NULL)
+        return current;
+    pthread_once(&threadKeyOnce, createThreadKey);
+    ThreadStats* stats = (ThreadStats*)calloc(1, sizeof(ThreadStats));
+    if (stats == NULL)
+        return NULL;
+    pthread_mutex_lock(&registryLock);
+    stats->next = liveThreads;
+    liveThreads = stats;
+    liveThreadCount++;
+    pthread_mutex_unlock(&registryLock);
+    pthread_setspecific(threadKey, stats);
+    current = stats;
+    return stats;
+}
+
+uint64_t scanStatsNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void recordScanStage(ScanStatsStage stage, uint64_t nanoseconds) {
+    ThreadStats* stats = threadStats();
+    if (stats == NULL || (unsigned)stage >= SCAN_STAGES)
+        return;
+    ThreadHistogram* histogram = &stats->stages[stage];
+    add(&histogram->buckets[scanStatsBucket(nanoseconds)], 1);
+    add(&histogram->sum, nanoseconds);
+    if (nanoseconds > load(&histogram->max))
+        atomic_store_explicit(&histogram->max, nanoseconds, memory_order_relaxed);
+    add(&histogram->count, 1);
+}
+
+void countScanStats(ScanStatsCounter counter, uint64_t amount) {
+    ThreadStats* stats = threadStats();
+    if (stats != NULL && (unsigned)counter < SCAN_COUNTERS)
+        add(&stats->counters[counter], amount);
+}
+
+bool takeScanStatsSnapshot(ScanStatsSnapshot* snapshot) {
+    pthread_mutex_lock(&registryLock);
+    memcpy(snapshot, &retired, sizeof(ScanStatsSnapshot));
+    for (ThreadStats* stats = liveThreads; stats != NULL; stats = stats->next)
+        addThreadStats(snapshot, stats);
+    snapshot->threads = liveThreadCount;
+    pthread_mutex_unlock(&registryLock);
+    return true;
+}
+
+struct ScanStatsDump {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+    unsigned interval;
+    FILE* log;
+    ScanStatsSnapshot snapshot;
+};
+
+static uint64_t snapshotEvents(const ScanStatsSnapshot* snapshot) {
+    uint64_t events = 0;
+    for (int stage = 0; stage < SCAN_STAGES; ++stage)
+        events += snapshot->stages[stage].count;
+    for (int counter = 0; counter < SCAN_COUNTERS; ++counter)
+        events += snapshot->counters[counter];
+    return events;
+}
+
+static void* dumpScanStats(void* data) {
+    ScanStatsDump* dump = (ScanStatsDump*)data;
+    uint64_t dumped = 0;
+    char text[4096];
+
+    pthread_mutex_lock(&dump->lock);
+    while (!dump->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += dump->interval;
+        while (!dump->stopping) {
+            if (pthread_cond_timedwait(&dump->wake, &dump->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+        if (dump->stopping)
+            break;
+        pthread_mutex_unlock(&dump->lock);
+
+        // Quiet while nothing is scanned
+        takeScanStatsSnapshot(&dump->snapshot);
+        uint64_t events = snapshotEvents(&dump->snapshot);
+        if (events != dumped && formatScanStats(&dump->snapshot, text, sizeof(text)) > 0) {
+            fprintf(dump->log, "scan stats:\n%s", text);
+            fflush(dump->log);
+            dumped = events;
+        }
+        pthread_mutex_lock(&dump->lock);
+    }
+    pthread_mutex_unlock(&dump->lock);
+    return NULL;
+}
+
+ScanStatsDump* new_ScanStatsDump(unsigned interval, FILE* log) {
+    ScanStatsDump* dump = (ScanStatsDump*)calloc(1, sizeof(ScanStatsDump));
+    pthread_condattr_t attributes;
+
+    if (dump == NULL)
+        return NULL;
+    dump->interval = interval ? interval : 60;
+    dump->log = log ? log : stderr;
+    pthread_mutex_init(&dump->lock, NULL);
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&dump->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+    if (pthread_create(&dump->thread, NULL, dumpScanStats, dump) != 0) {
+        pthread_cond_destroy(&dump->wake);
+        pthread_mutex_destroy(&dump->lock);
+        free(dump);
+        return NULL;
+    }
+    return dump;
+}
+
+void delete_ScanStatsDump(ScanStatsDump* dump) {
+    if (dump == NULL)
+        return;
+    pthread_mutex_lock(&dump->lock);
+    dump->stopping = true;
+    pthread_cond_signal(&dump->wake);
+    pthread_mutex_unlock(&dump->lock);
+    pthread_join(dump->thread, NULL);
+    pthread_cond_destroy(&dump->wake);
+    pthread_mutex_destroy(&dump->lock);
+    free(dump);
+}
+
+#else
+
+bool takeScanStatsSnapshot(ScanStatsSnapshot* snapshot) {
+    memset(snapshot, 0, sizeof(ScanStatsSnapshot));
+    return false;
+}
+
+ScanStatsDump* new_ScanStatsDump(unsigned interval, FILE* log) {
+    (void)interval;
+    (void)log;
+    return NULL;
+}
+
+void delete_ScanStatsDump(ScanStatsDump* dump) {
+    (void)dump;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef SCAN_STATS_H
+#define SCAN_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where a scan's time goes, stage by stage. Built with -DESCL_SCAN_STATS the
+// scan path records every stage's latency into per-thread histograms; without
+// it the SCAN_STATS_* macros below are empty and nothing is recorded.
+
+typedef enum {
+    SCAN_STAGE_TICKET_PARSE,   // ScanSettings XML to a resolved ticket, on a cache miss
+    SCAN_STAGE_OPTIONS,        // picking the device's options
+    SCAN_STAGE_DEVICE_OPEN,
+    SCAN_STAGE_PAGE_READ,      // one sheet from the device
+    SCAN_STAGE_GAMMA,          // gamma, or gray synthesis with its gamma
+    SCAN_STAGE_BLANK,          // blank page detection
+    SCAN_STAGE_BINARIZE,
+    SCAN_STAGE_ENCODE,         // one page
+    SCAN_STAGE_TRANSFER,       // one NextDocument body
+    SCAN_STAGES
+} ScanStatsStage;
+
+typedef enum {
+    SCAN_COUNTER_BYTES_READ,
+    SCAN_COUNTER_BYTES_SENT,
+    SCAN_COUNTERS
+} ScanStatsCounter;
+
+// Log-linear buckets over nanoseconds, as in HDR histograms: 16 per power of
+// two, so any value is within 1/16 of its bucket's bounds, up to about 18
+// minutes; longer ones land in the last bucket.
+#define SCAN_STATS_SUB_BITS 4
+#define SCAN_STATS_MAX_BITS 40
+#define SCAN_STATS_BUCKETS ((SCAN_STATS_MAX_BITS - SCAN_STATS_SUB_BITS + 1) << SCAN_STATS_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;              // nanoseconds
+    uint64_t max;
+    uint64_t buckets[SCAN_STATS_BUCKETS];
+} ScanStatsHistogram;
+
+// Every thread's histograms and counters added up, including threads that have exited.
+typedef struct {
+    ScanStatsHistogram stages[SCAN_STAGES];
+    uint64_t counters[SCAN_COUNTERS];
+    size_t threads;            // still running
+} ScanStatsSnapshot;
+
+static inline size_t scanStatsBucket(uint64_t nanoseconds) {
+    if (nanoseconds < (2u << SCAN_STATS_SUB_BITS))
+        return (size_t)nanoseconds;
+    int bits = 63 - __builtin_clzll(nanoseconds);
+    if (bits >= SCAN_STATS_MAX_BITS)
+        return SCAN_STATS_BUCKETS - 1;
+    int shift = bits - SCAN_STATS_SUB_BITS;
+    return ((size_t)shift << SCAN_STATS_SUB_BITS) + (size_t)(nanoseconds >> shift);
+}
+
+// The largest value that falls in bucket.
+uint64_t scanStatsBucketLimit(size_t bucket);
+
+// The value below which fraction (0 to 1) of the recorded values lie; 0 if there are none.
+uint64_t scanStatsPercentile(const ScanStatsHistogram* histogram, double fraction);
+
+const char* scanStatsStageName(ScanStatsStage stage);
+
+// False when built without ESCL_SCAN_STATS; the snapshot is then all zero.
+bool takeScanStatsSnapshot(ScanStatsSnapshot* snapshot);
+
+// One line per stage that has seen anything, times in microseconds, then the
+// counters; like snprintf, returns the length the whole text needs.
+int formatScanStats(const ScanStatsSnapshot* snapshot, char* buffer, size_t size);
+
+// A thread writing the stats to log every interval seconds while they change.
+typedef struct ScanStatsDump ScanStatsDump;
+
+// NULL when built without ESCL_SCAN_STATS or the thread cannot start.
+ScanStatsDump* new_ScanStatsDump(unsigned interval, FILE* log);
+void delete_ScanStatsDump(ScanStatsDump* dump);
+
+#ifdef ESCL_SCAN_STATS
+
+uint64_t scanStatsNow(void);
+void recordScanStage(ScanStatsStage stage, uint64_t nanoseconds);
+void countScanStats(ScanStatsCounter counter, uint64_t amount);
+
+#define SCAN_STATS_START(timer) uint64_t timer = scanStatsNow()
+#define SCAN_STATS_STOP(timer, stage) recordScanStage(stage, scanStatsNow() - (timer))
+#define SCAN_STATS_COUNT(counter, amount) countScanStats(counter, amount)
+
+#else
+
+#define SCAN_STATS_START(timer) ((void)0)
+#define SCAN_STATS_STOP(timer, stage) ((void)0)
+#define SCAN_STATS_COUNT(counter, amount) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_STATS_H */
@@ -0,0 +1,259 @@
+#include "scan-ticket.h"
+#include "scan-stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Eight bytes per multiply; good enough to spread a few hundred tickets over
+// the shards, and a match is always confirmed by comparing the documents.
+uint64_t hashScanTicket(const char* xml, size_t length) {
+    uint64_t hash = UINT64_C(0x9E3779B97F4A7C15) ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, xml + i, 8);
+        hash = (hash ^ word) * UINT64_C(0xFF51AFD7ED558CCD);
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, xml + i, length - i);
+    hash = (hash ^ tail) * UINT64_C(0xC4CEB9FE1A85EC53);
+    return hash ^ hash >> 29;
+}
+
+ScanTicket* resolveScanTicket(const char* xml, size_t length) {
+    ScanTicket* ticket = (ScanTicket*)malloc(sizeof(ScanTicket) + length + 1);
+    int channels, depth;
+
+    if (ticket == NULL)
+        return NULL;
+    memset(ticket, 0, sizeof(ScanTicket));
+    atomic_init(&ticket->refs, 1);
+    ticket->hash = hashScanTicket(xml, length);
+    ticket->length = length;
+    memcpy(ticket->body, xml, length);
+    ticket->body[length] = '\0';
+
+    ScanSettings* settings = &ticket->settings;
+    if (parseScanSettings(ticket->body, length, settings) != 0)
+        goto invalid;
+    if (scanDocumentFormatFor(settings, &ticket->format) != 0)
+        goto invalid;
+
+    ticket->xResolution = hasScanSettingsField(settings, SCAN_FIELD_X_RESOLUTION)
+                          ? settings->xResolution : SCAN_REGION_DEFAULT_RESOLUTION;
+    ticket->yResolution = hasScanSettingsField(settings, SCAN_FIELD_Y_RESOLUTION)
+                          ? settings->yResolution : ticket->xResolution;
+    if (!(ticket->xResolution > 0) || !(ticket->yResolution > 0))
+        goto invalid;
+
+    ticket->color = settings->color == SCAN_COLOR_NONE ? SCAN_COLOR_RGB24 : settings->color;
+    if (!scanColorModeLayout(ticket->color, &channels, &depth))
+        goto invalid;
+    if (depth == 1) {
+        if (ticket->format == SCAN_FORMAT_JPEG)
+            goto invalid;
+        ticket->binarize = true;
+        depth = 8;
+    }
+    ticket->kernels = scanPixelKernelsFor(channels, depth);
+
+    for (size_t i = 0; i < settings->regionCount; ++i) {
+        if (scanRegionToPixels(&settings->regions[i], ticket->xResolution, ticket->yResolution, &ticket->rects[i]) != 0)
+            goto invalid;
+    }
+    ticket->rectCount = settings->regionCount;
+    return ticket;
+
+invalid:
+    free(ticket);
+    return NULL;
+}
+
+ScanTicket* retainScanTicket(ScanTicket* ticket) {
+    atomic_fetch_add_explicit(&ticket->refs, 1, memory_order_relaxed);
+    return ticket;
+}
+
+void releaseScanTicket(ScanTicket* ticket) {
+    if (ticket != NULL && atomic_fetch_sub_explicit(&ticket->refs, 1, memory_order_acq_rel) == 1)
+        free(ticket);
+}
+
+struct ScanTicketEntry {
+    ScanTicketEntry* next;     // in the bucket
+    ScanTicketEntry* newer;
+    ScanTicketEntry* older;
+    ScanTicket* ticket;        // one reference held by the cache
+};
+
+ScanTicketCache* new_ScanTicketCache(size_t capacity) {
+    ScanTicketCache* cache = (ScanTicketCache*)calloc(1, sizeof(ScanTicketCache));
+    if (cache == NULL)
+        return NULL;
+    if (capacity == 0)
+        capacity = SCAN_TICKET_CACHE_CAPACITY;
+
+    size_t perShard = (capacity + SCAN_TICKET_CACHE_SHARDS - 1) / SCAN_TICKET_CACHE_SHARDS;
+    size_t bucketCount = 4;
+    while (bucketCount < perShard * 2)
+        bucketCount *= 2;
+    for (size_t i = 0; i < SCAN_TICKET_CACHE_SHARDS; ++i) {
+        ScanTicketShard* shard = &cache->shards[i];
+        shard->buckets = (ScanTicketEntry**)calloc(bucketCount, sizeof(ScanTicketEntry*));
+        if (shard->buckets == NULL) {
+            delete_ScanTicketCache(cache);
+            return NULL;
+        }
+        shard->bucketCount = bucketCount;
+        shard->capacity = perShard;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    return cache;
+}
+
+void delete_ScanTicketCache(ScanTicketCache* cache) {
+    if (cache == NULL)
+        return;
+    for (size_t i = 0; i < SCAN_TICKET_CACHE_SHARDS; ++i) {
+        ScanTicketShard* shard = &cache->shards[i];
+        if (shard->buckets == NULL)
+            continue;
+        ScanTicketEntry* entry = shard->newest;
+        while (entry != NULL) {
+            ScanTicketEntry* older = entry->older;
+            releaseScanTicket(entry->ticket);
+            free(entry);
+            entry = older;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+static ScanTicketShard* shardFor(ScanTicketCache* cache, uint64_t hash) {
+    // The buckets use the low bits; the shard comes from the high ones
+    return &cache->shards[(hash >> 56) % SCAN_TICKET_CACHE_SHARDS];
+}
+
+static ScanTicketEntry** bucketFor(ScanTicketShard* shard, uint64_t hash) {
+    return &shard->buckets[hash & (shard->bucketCount - 1)];
+}
+
+static ScanTicketEntry* findEntry(ScanTicketShard* shard, uint64_t hash, const char* xml, size_t length) {
+    for (ScanTicketEntry* entry = *bucketFor(shard, hash); entry != NULL; entry = entry->next) {
+        const ScanTicket* ticket = entry->ticket;
+        if (ticket->hash == hash && ticket->length == length && memcmp(ticket->body, xml, length) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static void unlinkEntry(ScanTicketShard* shard, ScanTicketEntry* entry) {
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        shard->newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void makeNewest(ScanTicketShard* shard, ScanTicketEntry* entry) {
+    if (shard->newest == entry)
+        return;
+    // Only the newest entry has nothing newer, so this one is either listed or new
+    if (entry->newer != NULL)
+        unlinkEntry(shard, entry);
+    entry->older = shard->newest;
+    if (shard->newest != NULL)
+        shard->newest->newer = entry;
+    shard->newest = entry;
+    if (shard->oldest == NULL)
+        shard->oldest = entry;
+}
+
+static void evictOldest(ScanTicketShard* shard) {
+    ScanTicketEntry* entry = shard->oldest;
+    ScanTicketEntry** link = bucketFor(shard, entry->ticket->hash);
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    unlinkEntry(shard, entry);
+    shard->count--;
+    shard->evictions++;
+    releaseScanTicket(entry->ticket);
+    free(entry);
+}
+
+ScanTicket* acquireScanTicket(ScanTicketCache* cache, const char* xml, size_t length) {
+    uint64_t hash = hashScanTicket(xml, length);
+    ScanTicketShard* shard = shardFor(cache, hash);
+    ScanTicketEntry* entry;
+    ScanTicket* ticket;
+
+    pthread_mutex_lock(&shard->lock);
+    entry = findEntry(shard, hash, xml, length);
+    if (entry != NULL) {
+        makeNewest(shard, entry);
+        shard->hits++;
+        ticket = retainScanTicket(entry->ticket);
+        pthread_mutex_unlock(&shard->lock);
+        return ticket;
+    }
+    shard->misses++;
+    pthread_mutex_unlock(&shard->lock);
+
+    // Resolve without the lock; another thread may add the same ticket meanwhile
+    SCAN_STATS_START(parse);
+    ticket = resolveScanTicket(xml, length);
+    SCAN_STATS_STOP(parse, SCAN_STAGE_TICKET_PARSE);
+    pthread_mutex_lock(&shard->lock);
+    if (ticket == NULL) {
+        shard->invalid++;
+        pthread_mutex_unlock(&shard->lock);
+        return NULL;
+    }
+    entry = findEntry(shard, hash, xml, length);
+    if (entry != NULL) {
+        makeNewest(shard, entry);
+        ScanTicket* existing = retainScanTicket(entry->ticket);
+        pthread_mutex_unlock(&shard->lock);
+        releaseScanTicket(ticket);
+        return existing;
+    }
+
+    entry = (ScanTicketEntry*)calloc(1, sizeof(ScanTicketEntry));
+    if (entry == NULL) {
+        // Still a good ticket, just not a cached one
+        pthread_mutex_unlock(&shard->lock);
+        return ticket;
+    }
+    entry->ticket = retainScanTicket(ticket);
+    ScanTicketEntry** bucket = bucketFor(shard, hash);
+    entry->next = *bucket;
+    *bucket = entry;
+    makeNewest(shard, entry);
+    if (++shard->count > shard->capacity)
+        evictOldest(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return ticket;
+}
+
+void getScanTicketCacheStats(ScanTicketCache* cache, ScanTicketCacheStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < SCAN_TICKET_CACHE_SHARDS; ++i) {
+        ScanTicketShard* shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->invalid += shard->invalid;
+        stats->entries += shard->count;
+        stats->capacity += shard->capacity;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SCAN_TICKET_H
+#define SCAN_TICKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "escl-scan-settings.h"
+#include "scan-region.h"
+#include "scan-pixel.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A ScanSettings document parsed, checked and worked out for the pipeline.
+// Immutable once made, so one ticket serves any number of jobs at once.
+typedef struct ScanTicket {
+    atomic_uint refs;
+    uint64_t hash;
+    ScanSettings settings;         // views into body
+    ScanDocumentFormat format;
+    double xResolution;            // SCAN_REGION_DEFAULT_RESOLUTION when the ticket names none
+    double yResolution;
+    ScanRect rects[SCAN_SETTINGS_MAX_REGIONS];  // settings.regions in pixels; none for the whole platen
+    size_t rectCount;
+    ScanColorMode color;           // RGB24 when the ticket names none
+    const ScanPixelKernels* kernels;   // for the lines the device delivers
+    bool binarize;                 // BlackAndWhite1: scanned as 8-bit gray
+    size_t length;
+    char body[];                   // the document, NUL-terminated
+} ScanTicket;
+
+// Parse and check a ticket without a cache. NULL if it is malformed or asks
+// for something we cannot produce. Release with releaseScanTicket.
+ScanTicket* resolveScanTicket(const char* xml, size_t length);
+
+ScanTicket* retainScanTicket(ScanTicket* ticket);
+void releaseScanTicket(ScanTicket* ticket);
+
+uint64_t hashScanTicket(const char* xml, size_t length);
+
+#define SCAN_TICKET_CACHE_CAPACITY 64
+#define SCAN_TICKET_CACHE_SHARDS 8
+
+typedef struct ScanTicketEntry ScanTicketEntry;
+
+// One lock per shard; the shard is picked by the ticket hash.
+typedef struct {
+    pthread_mutex_t lock;
+    ScanTicketEntry** buckets;
+    size_t bucketCount;        // a power of two
+    ScanTicketEntry* newest;   // LRU list, newest to oldest
+    ScanTicketEntry* oldest;
+    size_t count;
+    size_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalid;          // misses that did not resolve
+} ScanTicketShard;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalid;
+    size_t entries;
+    size_t capacity;
+} ScanTicketCacheStats;
+
+// Clients send the same few presets all day; a repeated document is
+// recognized by its hash and compared byte for byte, and skips parsing and
+// checking. Least recently used tickets go first.
+typedef struct {
+    ScanTicketShard shards[SCAN_TICKET_CACHE_SHARDS];
+} ScanTicketCache;
+
+// capacity 0 selects SCAN_TICKET_CACHE_CAPACITY
+ScanTicketCache* new_ScanTicketCache(size_t capacity);
+void delete_ScanTicketCache(ScanTicketCache* cache);
+
+// The ticket for xml, from the cache or resolved and added. NULL if it does
+// not resolve. The caller releases the result; eviction never invalidates it.
+ScanTicket* acquireScanTicket(ScanTicketCache* cache, const char* xml, size_t length);
+
+void getScanTicketCacheStats(ScanTicketCache* cache, ScanTicketCacheStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SCAN_TICKET_H */
@@ -3,44 +3,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
-
-typedef struct {
-    char* key;
-    char* value;
-} KeyValuePair;
-
-typedef struct {
-    KeyValuePair* pairs;
-    size_t count;
-} RawOptions;
-
-typedef struct {
-    char* icon;
-    char* note;
-    char* location;
-    double gray_gamma;
-    double color_gamma;
-    bool synthesize_gray;
-    RawOptions sane_options;
-} Options;
-
-typedef struct {
-    char* device_name;
-    RawOptions options;
-} DeviceOptions;
-
-typedef struct {
-    char* fileName;
-    RawOptions globalOptions;
-    DeviceOptions* deviceOptions;
-    size_t deviceOptionsCount;
-} OptionsFile;
-
-void delete_KeyValuePair(KeyValuePair* pair) {
-    free(pair->key);
-    free(pair->value);
-}
+#include <stdint.h>
+#include <stddef.h>
+#include <stdalign.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "test-scan-options.h"
+#include "escl-scan-settings.h"
+#include "scan-stats.h"
 
 RawOptions new_RawOptions() {
     RawOptions options;
@@ -49,106 +25,325 @@ RawOptions new_RawOptions() {
     return options;
 }
 
-void delete_RawOptions(RawOptions* options) {
-    for (size_t i = 0; i < options->count; ++i) {
-        delete_KeyValuePair(&options->pairs[i]);
+#define OPTIONS_ARENA_BLOCK_SIZE (64 * 1024)
+#define OPTIONS_ARENA_ALIGN alignof(max_align_t)
+
+static void* arenaAlloc(OptionsArena* arena, size_t size) {
+    size = (size + OPTIONS_ARENA_ALIGN - 1) & ~(OPTIONS_ARENA_ALIGN - 1);
+    OptionsArenaBlock* block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > OPTIONS_ARENA_BLOCK_SIZE ? size : OPTIONS_ARENA_BLOCK_SIZE;
+        block = (OptionsArenaBlock*)malloc(sizeof(OptionsArenaBlock) + blockSize);
+        if (block == NULL)
+            return NULL;
+        block->size = blockSize;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void* memory = (char*)block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+// Make sure the next `size` bytes come from a single block.
+static void arenaReserve(OptionsArena* arena, size_t size) {
+    if (arena->head == NULL || arena->head->size - arena->head->used < size) {
+        void* memory = arenaAlloc(arena, size);
+        if (memory != NULL)
+            arena->head->used -= (size + OPTIONS_ARENA_ALIGN - 1) & ~(OPTIONS_ARENA_ALIGN - 1);
+    }
+}
+
+static char* arenaStrdup(OptionsArena* arena, const char* s) {
+    size_t length = strlen(s) + 1;
+    char* copy = (char*)arenaAlloc(arena, length);
+    if (copy != NULL)
+        memcpy(copy, s, length);
+    return copy;
+}
+
+static void arenaFree(OptionsArena* arena) {
+    OptionsArenaBlock* block = arena->head;
+    while (block != NULL) {
+        OptionsArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+// Options the daemon itself understands; every other key is passed to SANE.
+static const OptionSchema optionSchema[] = {
+    { "icon", OPTION_PATH, 0, 0, NULL, offsetof(Options, icon) },
+    { "note", OPTION_STRING, 0, 0, NULL, offsetof(Options, note) },
+    { "location", OPTION_STRING, 0, 0, NULL, offsetof(Options, location) },
+    { "gray-gamma", OPTION_DOUBLE, 0.1, 10.0, "1.0", offsetof(Options, gray_gamma) },
+    { "color-gamma", OPTION_DOUBLE, 0.1, 10.0, "1.0", offsetof(Options, color_gamma) },
+    { "synthesize-gray", OPTION_BOOL, 0, 1, "0", offsetof(Options, synthesize_gray) },
+    { "blank-ink-coverage", OPTION_DOUBLE, 0, 100, "0.3", offsetof(Options, blank_ink_coverage) },
+    { "blank-edge-density", OPTION_DOUBLE, 0, 100, "0.5", offsetof(Options, blank_edge_density) },
+    { "blank-deviation", OPTION_DOUBLE, 0, 128, "16", offsetof(Options, blank_deviation) },
+};
+
+#define OPTION_SCHEMA_COUNT (sizeof(optionSchema) / sizeof(optionSchema[0]))
+
+// Perfect hash over the schema keys: slot = (length * multiplier + first + last) & mask.
+// The parameters are searched once, so editing the table never needs a hand-tuned hash.
+static struct {
+    unsigned multiplier;
+    unsigned mask;
+    signed char slots[64];
+} optionDispatch;
+static pthread_once_t optionDispatchOnce = PTHREAD_ONCE_INIT;
+
+static unsigned optionSlot(const char* key, size_t length, unsigned multiplier, unsigned mask) {
+    return ((unsigned)length * multiplier + (unsigned char)key[0] + (unsigned char)key[length - 1]) & mask;
+}
+
+static void buildOptionDispatch(void) {
+    for (unsigned mask = 7; mask < sizeof(optionDispatch.slots); mask = mask * 2 + 1) {
+        for (unsigned multiplier = 1; multiplier < 64; ++multiplier) {
+            bool collision = false;
+            memset(optionDispatch.slots, -1, sizeof(optionDispatch.slots));
+            for (size_t i = 0; i < OPTION_SCHEMA_COUNT && !collision; ++i) {
+                const char* key = optionSchema[i].key;
+                unsigned slot = optionSlot(key, strlen(key), multiplier, mask);
+                collision = optionDispatch.slots[slot] >= 0;
+                optionDispatch.slots[slot] = (signed char)i;
+            }
+            if (!collision) {
+                optionDispatch.multiplier = multiplier;
+                optionDispatch.mask = mask;
+                return;
+            }
+        }
+    }
+    // Unreachable for a handful of keys; lookupOptionSchema then finds nothing.
+    memset(optionDispatch.slots, -1, sizeof(optionDispatch.slots));
+    fprintf(stderr, "option schema: no perfect hash found\n");
+}
+
+// Index into optionSchema for key, or -1 for a SANE pass-through option.
+static int lookupOptionSchema(const char* key) {
+    size_t length = strlen(key);
+    if (length == 0)
+        return -1;
+    pthread_once(&optionDispatchOnce, buildOptionDispatch);
+    int index = optionDispatch.slots[optionSlot(key, length, optionDispatch.multiplier, optionDispatch.mask)];
+    return index >= 0 && strcmp(optionSchema[index].key, key) == 0 ? index : -1;
+}
+
+// Numbers are read without the locale, so "1.5" means the same under any LC_NUMERIC.
+static bool convertOption(const OptionSchema* schema, const char* value, double* number) {
+    switch (schema->type) {
+    case OPTION_DOUBLE:
+        return parseEsclNumber((EsclStringView){ value, strlen(value) }, number)
+               && *number >= schema->min && *number <= schema->max;
+    case OPTION_BOOL:
+        if (strcmp(value, "1") == 0 || strcmp(value, "true") == 0 || strcmp(value, "yes") == 0)
+            *number = 1;
+        else if (strcmp(value, "0") == 0 || strcmp(value, "false") == 0 || strcmp(value, "no") == 0)
+            *number = 0;
+        else
+            return false;
+        return true;
+    default:
+        return true;
+    }
+}
+
+static void setOption(Options* options, const OptionSchema* schema, const char* value, double number) {
+    char* field = (char*)options + schema->offset;
+
+    switch (schema->type) {
+    case OPTION_STRING:
+    case OPTION_PATH:
+        *(const char**)field = value;
+        break;
+    case OPTION_DOUBLE:
+        *(double*)field = number;
+        break;
+    case OPTION_BOOL:
+        *(bool*)field = number != 0;
+        break;
     }
-    free(options->pairs);
-    options->pairs = NULL;
-    options->count = 0;
 }
 
 Options new_Options() {
     Options options;
-    options.icon = NULL;
-    options.note = NULL;
-    options.location = NULL;  
-    options.gray_gamma = 1.0;
-    options.color_gamma = 1.0;
-    options.synthesize_gray = false;
+    memset(&options, 0, sizeof(options));
+    for (size_t i = 0; i < OPTION_SCHEMA_COUNT; ++i) {
+        double number = 0;
+        if (optionSchema[i].defaultValue != NULL && convertOption(&optionSchema[i], optionSchema[i].defaultValue, &number))
+            setOption(&options, &optionSchema[i], optionSchema[i].defaultValue, number);
+    }
     options.sane_options = new_RawOptions();
     return options;
 }
 
-void delete_Options(Options* options) {
-    free(options->icon);
-    free(options->note);
-    free(options->location);  
-    delete_RawOptions(&options->sane_options);
+static bool isOptionSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
 }
 
-DeviceOptions new_DeviceOptions() {
-    DeviceOptions options;
-    options.device_name = NULL;
-    options.options = new_RawOptions();
-    return options;
-}
+static uint64_t hashDeviceName(const char* name);
 
-void delete_DeviceOptions(DeviceOptions* options) {
-    free(options->device_name);
-    delete_RawOptions(&options->options);
+// Returns the one arena copy of key, so equal keys compare equal by pointer.
+static char* internKey(char** table, size_t capacity, char* key) {
+    size_t mask = capacity - 1;
+    for (size_t slot = hashDeviceName(key) & mask;; slot = (slot + 1) & mask) {
+        if (table[slot] == NULL) {
+            table[slot] = key;
+            return key;
+        }
+        if (strcmp(table[slot], key) == 0)
+            return table[slot];
+    }
 }
 
-void delete_OptionsFile(OptionsFile* instance) {
-    free(instance->fileName);
-    delete_RawOptions(&instance->globalOptions);
-    for (size_t i = 0; i < instance->deviceOptionsCount; ++i) {
-        delete_DeviceOptions(&instance->deviceOptions[i]);
-    }
-    free(instance->deviceOptions);
-    free(instance);
+// Resolve value against the directory holding the options file.
+static char* relativePath(const OptionsFile* file, OptionsArena* arena, const char* value) {
+    const char* slash = strrchr(file->fileName, '/');
+    size_t dirLength = slash ? (size_t)(slash - file->fileName + 1) : 0;
+    size_t valueLength = strlen(value);
+    char* resolved = (char*)arenaAlloc(arena, dirLength + valueLength + 1);
+    if (resolved == NULL)
+        return NULL;
+    memcpy(resolved, file->fileName, dirLength);
+    memcpy(resolved + dirLength, value, valueLength + 1);
+    return resolved;
 }
 
-OptionsFile* new_OptionsFile(const char* fileName) {
-    OptionsFile* file = (OptionsFile*)malloc(sizeof(OptionsFile));
-    file->fileName = strdup(fileName);
-    file->deviceOptions = NULL;
-    file->deviceOptionsCount = 0;
-    file->globalOptions = new_RawOptions();
+// Split the file text in place: keys, values and device names all point into text.
+// Returns false if the arena cannot grow.
+static bool parseOptionsText(OptionsFile* file, OptionsArena* arena, char* text, size_t length) {
+    char* end = text + length;
+    size_t lines = 1;
+    for (const char* p = text; (p = memchr(p, '\n', end - p)) != NULL; ++p)
+        lines++;
 
-    FILE* fp = fopen(fileName, "r");
-    if (fp == NULL) {
-        printf("no device options at '%s'\n", fileName);
-        return file;
-    }
-    printf("reading device options from '%s'\n", fileName);
+    size_t internCapacity = 16;
+    while (internCapacity < lines * 2)
+        internCapacity *= 2;
+    char** internTable = (char**)arenaAlloc(arena, sizeof(char*) * internCapacity);
+    KeyValuePair* pairs = (KeyValuePair*)arenaAlloc(arena, sizeof(KeyValuePair) * lines);
+    DeviceOptions* sections = (DeviceOptions*)arenaAlloc(arena, sizeof(DeviceOptions) * lines);
+    if (internTable == NULL || pairs == NULL || sections == NULL)
+        return false;
+    memset(internTable, 0, sizeof(char*) * internCapacity);
 
-    char line[256];
-    RawOptions* pDeviceSection = NULL;
+    size_t pairCount = 0;
+    file->globalOptions.pairs = pairs;
+    file->deviceOptions = sections;
 
-    while (fgets(line, sizeof(line), fp)) {
-        if (line[0] == '\n' || line[0] == '#')
+    size_t lineNumber = 0;
+    for (char* line = text; line < end;) {
+        char* next = memchr(line, '\n', end - line);
+        lineNumber++;
+        if (next != NULL)
+            *next++ = '\0';
+        else
+            next = end;
+
+        char* name = line;
+        line = next;
+        while (*name != '\0' && isOptionSpace(*name))
+            name++;
+        if (*name == '\0' || *name == '#')
             continue;
 
-        char* name = strtok(line, " \t\n");
-        char* value = strtok(NULL, "\n");
-        if (value) {
-            char* end = value + strlen(value) - 1;
-            while (end > value && isspace((unsigned char)*end))
-                end--;
-            end[1] = '\0';
+        char* value = name;
+        while (*value != '\0' && !isOptionSpace(*value))
+            value++;
+        if (*value != '\0') {
+            *value++ = '\0';
+            while (*value != '\0' && isOptionSpace(*value))
+                value++;
         }
+        char* valueEnd = value + strlen(value);
+        while (valueEnd > value && isOptionSpace(valueEnd[-1]))
+            valueEnd--;
+        *valueEnd = '\0';
 
         if (strcmp(name, "device") == 0) {
-            file->deviceOptions = (DeviceOptions*)realloc(file->deviceOptions, sizeof(DeviceOptions) * (file->deviceOptionsCount + 1));
-            DeviceOptions* devOpt = &file->deviceOptions[file->deviceOptionsCount];
-            devOpt->device_name = strdup(value);
-            devOpt->options = new_RawOptions();
-            pDeviceSection = &devOpt->options;
-            file->deviceOptionsCount++;
+            DeviceOptions* devOpt = &file->deviceOptions[file->deviceOptionsCount++];
+            devOpt->device_name = value;
+            devOpt->options.pairs = pairs + pairCount;
+            devOpt->options.count = 0;
         } else {
-            RawOptions* target = pDeviceSection ? pDeviceSection : &file->globalOptions;
-            target->pairs = (KeyValuePair*)realloc(target->pairs, sizeof(KeyValuePair) * (target->count + 1));
-            target->pairs[target->count].key = strdup(name);
-            target->pairs[target->count].value = strdup(value ? value : "");
+            RawOptions* target = file->deviceOptionsCount ? &file->deviceOptions[file->deviceOptionsCount - 1].options : &file->globalOptions;
+            KeyValuePair* pair = &pairs[pairCount];
+            pair->key = internKey(internTable, internCapacity, name);
+            pair->value = value;
+            pair->number = 0;
+            pair->schema = lookupOptionSchema(pair->key);
+            if (pair->schema >= 0 && !convertOption(&optionSchema[pair->schema], value, &pair->number)) {
+                fprintf(stderr, "%s:%zu: ignoring invalid value '%s' for '%s'\n", file->fileName, lineNumber, value, name);
+                continue;
+            }
+            if (pair->schema >= 0 && optionSchema[pair->schema].type == OPTION_PATH && value[0] != '/') {
+                pair->value = relativePath(file, arena, value);
+                if (pair->value == NULL)
+                    return false;
+            }
+            pairCount++;
             target->count++;
         }
     }
+    return true;
+}
+
+static bool indexDeviceOptions(OptionsFile* file, OptionsArena* arena);
+
+OptionsFile* new_OptionsFile(const char* fileName) {
+    OptionsArena arena = { NULL };
+    FILE* fp = fopen(fileName, "r");
+    struct stat info;
+    size_t size = 0;
+
+    if (fp != NULL && fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode))
+        size = (size_t)info.st_size;
+
+    // Room for the text and its parsed form, so a typical file is one allocation.
+    arenaReserve(&arena, sizeof(OptionsFile) + strlen(fileName) + 1 + size * 4 + 4096);
+    OptionsFile* file = (OptionsFile*)arenaAlloc(&arena, sizeof(OptionsFile));
+    if (file != NULL) {
+        memset(file, 0, sizeof(OptionsFile));
+        file->fileName = arenaStrdup(&arena, fileName);
+        file->globalOptions = new_RawOptions();
+    }
+    bool loaded = file != NULL && file->fileName != NULL;
 
-    fclose(fp);
+    // No file just means no device options
+    if (fp != NULL) {
+        char* text = loaded ? (char*)arenaAlloc(&arena, size + 1) : NULL;
+        size_t length = text ? fread(text, 1, size, fp) : 0;
+        fclose(fp);
+        if (text != NULL) {
+            text[length] = '\0';
+            loaded = parseOptionsText(file, &arena, text, length);
+        } else
+            loaded = false;
+    }
+
+    if (!loaded || !indexDeviceOptions(file, &arena)) {
+        fprintf(stderr, "%s: out of memory loading device options\n", fileName);
+        arenaFree(&arena);
+        return NULL;
+    }
+    atomic_init(&file->refCount, 1);
+    pthread_mutex_init(&file->pairLock, NULL);
+    file->arena = arena;
     return file;
 }
 
+void delete_OptionsFile(OptionsFile* instance) {
+    // instance itself lives in the arena
+    OptionsArena arena = instance->arena;
+    pthread_mutex_destroy(&instance->pairLock);
+    arenaFree(&arena);
+}
+
 char* path(const char* fileName) {
     char* path = NULL;
     const char* pos = strrchr(fileName, '/');
@@ -168,59 +363,413 @@ char* path(const char* fileName) {
     return path;
 }
 
-Options scannerOptions(const OptionsFile* optionsFile, pappl_scanner_t * scanner) {
-    RawOptions rawOptions = optionsFile->globalOptions;
-    for (size_t i = 0; i < optionsFile->deviceOptionsCount; ++i) {
-        DeviceOptions* section = &optionsFile->deviceOptions[i];
-        bool match = false;
-        if (strcmp(scanner->sane_name, section->device_name) == 0) {
-            fprintf(stderr, "%s: device name '%s' matches device name '%s'\n",
-                    optionsFile->fileName, section->device_name, scanner->sane_name);
-            match = true;
-        } else if (strcmp(scanner->make_and_model, section->device_name) == 0) {
-            fprintf(stderr, "%s: device make and model '%s' matches device name '%s'\n",
-                    optionsFile->fileName, scanner->make_and_model, section->device_name);
-            match = true;
+static uint64_t hashDeviceName(const char* name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *name; ++name) {
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static DeviceIndexEntry* findDeviceIndexEntry(const OptionsFile* file, const char* name) {
+    if (file->deviceIndexCapacity == 0 || name == NULL)
+        return NULL;
+    size_t mask = file->deviceIndexCapacity - 1;
+    for (size_t slot = hashDeviceName(name) & mask;; slot = (slot + 1) & mask) {
+        DeviceIndexEntry* entry = &file->deviceIndex[slot];
+        if (entry->name == NULL)
+            return NULL;
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+    }
+}
+
+// Values were validated and converted while loading; this only places them.
+// Returns false if the arena cannot grow.
+static bool processOptions(OptionsArena* arena, const KeyValuePair** rawOptions, size_t count, Options* processedOptions) {
+    *processedOptions = new_Options();
+    processedOptions->sane_options.pairs = (KeyValuePair*)arenaAlloc(arena, sizeof(KeyValuePair) * (count ? count : 1));
+    if (processedOptions->sane_options.pairs == NULL)
+        return false;
+
+    for (size_t i = 0; i < count; ++i) {
+        const KeyValuePair* option = rawOptions[i];
+        if (option->schema >= 0)
+            setOption(processedOptions, &optionSchema[option->schema], option->value, option->number);
+        else
+            processedOptions->sane_options.pairs[processedOptions->sane_options.count++] = *option;
+    }
+    return true;
+}
+
+// Global options followed by the given sections' options, in file order.
+// scratch must hold every pair in the file.
+static bool mergeSections(const OptionsFile* file, OptionsArena* arena, const KeyValuePair** scratch,
+                          const size_t* first, size_t firstCount, const size_t* second, size_t secondCount,
+                          Options* merged) {
+    size_t n = 0;
+    for (size_t i = 0; i < file->globalOptions.count; ++i)
+        scratch[n++] = &file->globalOptions.pairs[i];
+
+    size_t a = 0, b = 0;
+    while (a < firstCount || b < secondCount) {
+        size_t section;
+        if (b == secondCount || (a < firstCount && first[a] < second[b]))
+            section = first[a++];
+        else
+            section = second[b++];
+        const RawOptions* options = &file->deviceOptions[section].options;
+        for (size_t i = 0; i < options->count; ++i)
+            scratch[n++] = &options->pairs[i];
+    }
+
+    return processOptions(arena, scratch, n, merged);
+}
+
+static size_t totalPairCount(const OptionsFile* file) {
+    size_t count = file->globalOptions.count;
+    for (size_t i = 0; i < file->deviceOptionsCount; ++i)
+        count += file->deviceOptions[i].options.count;
+    return count;
+}
+
+// Hash the sections by device name and pre-merge each device's options.
+// Returns false if an allocation fails.
+static bool indexDeviceOptions(OptionsFile* file, OptionsArena* arena) {
+    size_t capacity = 16;
+    while (capacity < file->deviceOptionsCount * 2)
+        capacity *= 2;
+    file->deviceIndex = (DeviceIndexEntry*)arenaAlloc(arena, sizeof(DeviceIndexEntry) * capacity);
+    if (file->deviceIndex == NULL)
+        return false;
+    memset(file->deviceIndex, 0, sizeof(DeviceIndexEntry) * capacity);
+    file->deviceIndexCapacity = capacity;
+
+    // First pass counts sections per name so each entry gets an exact-size array.
+    size_t mask = capacity - 1;
+    size_t* slots = (size_t*)arenaAlloc(arena, sizeof(size_t) * (file->deviceOptionsCount + 1));
+    if (slots == NULL)
+        return false;
+    for (size_t i = 0; i < file->deviceOptionsCount; ++i) {
+        const char* name = file->deviceOptions[i].device_name;
+        size_t slot = hashDeviceName(name) & mask;
+        while (file->deviceIndex[slot].name != NULL && strcmp(file->deviceIndex[slot].name, name) != 0)
+            slot = (slot + 1) & mask;
+        file->deviceIndex[slot].name = name;
+        file->deviceIndex[slot].sectionCount++;
+        slots[i] = slot;
+    }
+    for (size_t slot = 0; slot < capacity; ++slot) {
+        DeviceIndexEntry* entry = &file->deviceIndex[slot];
+        if (entry->name != NULL) {
+            entry->sections = (size_t*)arenaAlloc(arena, sizeof(size_t) * entry->sectionCount);
+            if (entry->sections == NULL)
+                return false;
+            entry->sectionCount = 0;
+        }
+    }
+    for (size_t i = 0; i < file->deviceOptionsCount; ++i) {
+        DeviceIndexEntry* entry = &file->deviceIndex[slots[i]];
+        entry->sections[entry->sectionCount++] = i;
+    }
+
+    const KeyValuePair** scratch = (const KeyValuePair**)malloc(sizeof(KeyValuePair*) * (totalPairCount(file) + 1));
+    if (scratch == NULL)
+        return false;
+    bool merged = true;
+    for (size_t slot = 0; slot < capacity && merged; ++slot) {
+        DeviceIndexEntry* entry = &file->deviceIndex[slot];
+        if (entry->name != NULL)
+            merged = mergeSections(file, arena, scratch, entry->sections, entry->sectionCount, NULL, 0, &entry->options);
+    }
+    if (merged)
+        merged = mergeSections(file, arena, scratch, NULL, 0, NULL, 0, &file->defaultOptions);
+    free(scratch);
+    return merged;
+}
+
+// A scanner whose SANE name and make-and-model both have sections; merged on
+// first use and kept for the life of the file.
+static const Options* pairOptions(const OptionsFile* optionsFile, const DeviceIndexEntry* saneEntry, const DeviceIndexEntry* modelEntry) {
+    OptionsFile* file = (OptionsFile*)optionsFile;
+    const Options* options = NULL;
+
+    pthread_mutex_lock(&file->pairLock);
+    for (DevicePairOptions* pair = file->pairOptions; pair != NULL; pair = pair->next) {
+        if (pair->saneEntry == saneEntry && pair->modelEntry == modelEntry) {
+            options = &pair->options;
+            break;
+        }
+    }
+    if (options == NULL) {
+        // The arena is only grown after loading here, under pairLock.
+        DevicePairOptions* pair = (DevicePairOptions*)arenaAlloc(&file->arena, sizeof(DevicePairOptions));
+        const KeyValuePair** scratch = (const KeyValuePair**)malloc(sizeof(KeyValuePair*) * (totalPairCount(file) + 1));
+        bool merged = pair != NULL && scratch != NULL
+                      && mergeSections(file, &file->arena, scratch, saneEntry->sections, saneEntry->sectionCount,
+                                       modelEntry->sections, modelEntry->sectionCount, &pair->options);
+        free(scratch);
+        if (!merged) {
+            // Without memory to merge, the SANE name's own section is the closest match
+            pthread_mutex_unlock(&file->pairLock);
+            return &saneEntry->options;
+        }
+        pair->saneEntry = saneEntry;
+        pair->modelEntry = modelEntry;
+        pair->next = file->pairOptions;
+        file->pairOptions = pair;
+        options = &pair->options;
+    }
+    pthread_mutex_unlock(&file->pairLock);
+    return options;
+}
+
+const Options* scannerOptions(const OptionsFile* optionsFile, pappl_scanner_t * scanner) {
+    SCAN_STATS_START(start);
+    const DeviceIndexEntry* saneEntry = findDeviceIndexEntry(optionsFile, scanner->sane_name);
+    const DeviceIndexEntry* modelEntry = findDeviceIndexEntry(optionsFile, scanner->make_and_model);
+
+    const Options* options = &optionsFile->defaultOptions;
+    if (saneEntry != NULL && modelEntry != NULL && saneEntry != modelEntry)
+        options = pairOptions(optionsFile, saneEntry, modelEntry);
+    else if (saneEntry != NULL)
+        options = &saneEntry->options;
+    else if (modelEntry != NULL)
+        options = &modelEntry->options;
+    SCAN_STATS_STOP(start, SCAN_STAGE_OPTIONS);
+    return options;
+}
+
+void releaseOptionsFile(OptionsFile* file) {
+    if (file != NULL && atomic_fetch_sub(&file->refCount, 1) == 1)
+        delete_OptionsFile(file);
+}
+
+OptionsFile* acquireOptionsFile(OptionsWatcher* watcher) {
+    pthread_mutex_lock(&watcher->lock);
+    OptionsFile* file = watcher->current;
+    atomic_fetch_add(&file->refCount, 1);
+    pthread_mutex_unlock(&watcher->lock);
+    return file;
+}
+
+void reloadOptionsFile(OptionsWatcher* watcher) {
+    // Build the replacement without holding the lock, then swap it in.
+    // On failure the previous snapshot stays current.
+    OptionsFile* file = new_OptionsFile(watcher->fileName);
+    if (file == NULL)
+        return;
+
+    pthread_mutex_lock(&watcher->lock);
+    OptionsFile* previous = watcher->current;
+    watcher->current = file;
+    pthread_mutex_unlock(&watcher->lock);
+
+    // Jobs that acquired the previous snapshot keep it until they release it.
+    releaseOptionsFile(previous);
+}
+
+static bool optionsFileChanged(OptionsWatcher* watcher) {
+    struct stat info;
+    if (stat(watcher->fileName, &info) != 0)
+        return false;
+    bool changed = info.st_mtime != watcher->mtime || info.st_size != watcher->size;
+    watcher->mtime = info.st_mtime;
+    watcher->size = info.st_size;
+    return changed;
+}
+
+static void* watchOptionsFile(void* arg) {
+    OptionsWatcher* watcher = (OptionsWatcher*)arg;
+    struct pollfd fds[2];
+    int notifyFd = watcher->notifyFd;
+    const char* slash = strrchr(watcher->fileName, '/');
+    const char* baseName = slash ? slash + 1 : watcher->fileName;
+
+    fds[0].fd = watcher->wakeFds[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = notifyFd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        // Without inotify, fall back to checking the modification time.
+        int ready = poll(fds, notifyFd >= 0 ? 2 : 1, notifyFd >= 0 ? -1 : 2000);
+        if (ready < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents & POLLIN)
+            break;
+
+        bool changed = false;
+#ifdef __linux__
+        if (notifyFd >= 0 && (fds[1].revents & POLLIN)) {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t length = read(notifyFd, events, sizeof(events));
+            for (char* p = events; length > 0 && p < events + length;) {
+                struct inotify_event* event = (struct inotify_event*)p;
+                if (event->len > 0 && strcmp(event->name, baseName) == 0)
+                    changed = true;
+                p += sizeof(struct inotify_event) + event->len;
+            }
+            if (changed)
+                optionsFileChanged(watcher);
+        }
+#else
+        (void)baseName;
+#endif
+        if (notifyFd < 0 && ready == 0)
+            changed = optionsFileChanged(watcher);
+
+        if (changed) {
+            fprintf(stderr, "%s: device options changed, reloading\n", watcher->fileName);
+            reloadOptionsFile(watcher);
         }
-        if (match) {
-            
-            rawOptions.pairs = realloc(rawOptions.pairs, sizeof(KeyValuePair) * (rawOptions.count + section->options.count));
-            memcpy(rawOptions.pairs + rawOptions.count, section->options.pairs, sizeof(KeyValuePair) * section->options.count);
-            rawOptions.count += section->options.count;
+    }
+
+    return NULL;
+}
+
+OptionsWatcher* new_OptionsWatcher(const char* fileName) {
+    OptionsWatcher* watcher = (OptionsWatcher*)calloc(1, sizeof(OptionsWatcher));
+    if (watcher == NULL)
+        return NULL;
+
+    watcher->fileName = strdup(fileName);
+    if (watcher->fileName == NULL) {
+        free(watcher);
+        return NULL;
+    }
+    watcher->notifyFd = -1;
+    pthread_mutex_init(&watcher->lock, NULL);
+
+#ifdef __linux__
+    // Watch the directory, since editors usually replace the file by renaming.
+    // Set up before the first load so no change in between is missed.
+    watcher->notifyFd = inotify_init1(IN_CLOEXEC);
+    if (watcher->notifyFd >= 0) {
+        char* dir = path(fileName);
+        if (dir == NULL || inotify_add_watch(watcher->notifyFd, dir[0] ? dir : ".", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+            close(watcher->notifyFd);
+            watcher->notifyFd = -1;
         }
+        free(dir);
     }
+#endif
+    optionsFileChanged(watcher);
+    watcher->current = new_OptionsFile(fileName);
 
-    Options processedOptions = new_Options();
-    for (size_t i = 0; i < rawOptions.count; ++i) {
-        KeyValuePair* option = &rawOptions.pairs[i];
-        if (strcmp(option->key, "icon") == 0) {
-            processedOptions.icon = strdup(option->value);
-            if (processedOptions.icon[0] != '/') {
-                char* filePath = path(optionsFile->fileName);
-                size_t len = strlen(filePath) + strlen(processedOptions.icon) + 1;
-                processedOptions.icon = realloc(processedOptions.icon, len);
-                memmove(processedOptions.icon + strlen(filePath), processedOptions.icon, strlen(processedOptions.icon) + 1);
-                memcpy(processedOptions.icon, filePath, strlen(filePath));
-                free(filePath);
+    if (watcher->current == NULL || pipe(watcher->wakeFds) != 0) {
+        if (watcher->current != NULL)
+            releaseOptionsFile(watcher->current);
+        if (watcher->notifyFd >= 0)
+            close(watcher->notifyFd);
+        pthread_mutex_destroy(&watcher->lock);
+        free(watcher->fileName);
+        free(watcher);
+        return NULL;
+    }
+    watcher->running = pthread_create(&watcher->thread, NULL, watchOptionsFile, watcher) == 0;
+    return watcher;
+}
+
+void delete_OptionsWatcher(OptionsWatcher* watcher) {
+    if (watcher == NULL)
+        return;
+    if (watcher->running) {
+        char stop = 0;
+        if (write(watcher->wakeFds[1], &stop, 1) == 1)
+            pthread_join(watcher->thread, NULL);
+    }
+    close(watcher->wakeFds[0]);
+    close(watcher->wakeFds[1]);
+    if (watcher->notifyFd >= 0)
+        close(watcher->notifyFd);
+    releaseOptionsFile(watcher->current);
+    pthread_mutex_destroy(&watcher->lock);
+    free(watcher->fileName);
+    free(watcher);
+}
+
+SaneOptionBindings bindSaneOptions(const Options* options, SANE_Handle handle) {
+    SaneOptionBindings bindings = { NULL, 0 };
+    SANE_Int optionCount = 0;
+
+    if (options->sane_options.count == 0)
+        return bindings;
+    if (sane_control_option(handle, 0, SANE_ACTION_GET_VALUE, &optionCount, NULL) != SANE_STATUS_GOOD)
+        return bindings;
+    bindings.items = (SaneOptionBinding*)calloc(options->sane_options.count, sizeof(SaneOptionBinding));
+    if (bindings.items == NULL)
+        return bindings;
+
+    // Later entries override earlier ones, so bind the last pair for each name.
+    for (SANE_Int index = 1; index < optionCount; ++index) {
+        const SANE_Option_Descriptor* descriptor = sane_get_option_descriptor(handle, index);
+        if (descriptor == NULL || descriptor->name == NULL)
+            continue;
+        for (size_t i = options->sane_options.count; i-- > 0;) {
+            const KeyValuePair* option = &options->sane_options.pairs[i];
+            if (strcmp(option->key, descriptor->name) != 0)
+                continue;
+
+            // Only single values are bound; arrays such as gamma tables would
+            // read past the one word applySaneOptions passes.
+            if (descriptor->type == SANE_TYPE_STRING) {
+                if (strlen(option->value) >= (size_t)descriptor->size)
+                    break;
+            } else if (descriptor->size != (SANE_Int)sizeof(SANE_Word))
+                break;
+
+            SaneOptionBinding* binding = &bindings.items[bindings.count];
+            binding->option = option;
+            binding->index = index;
+            binding->type = descriptor->type;
+            if (descriptor->type == SANE_TYPE_INT) {
+                double number;
+                if (!parseEsclNumber((EsclStringView){ option->value, strlen(option->value) }, &number)
+                    || number < INT32_MIN || number > INT32_MAX || number != (double)(SANE_Word)number)
+                    break;
+                binding->word = (SANE_Word)number;
             }
-        } else if (strcmp(option->key, "note") == 0) {
-            processedOptions.note = strdup(option->value);
-        } else if (strcmp(option->key, "location") == 0) { 
-            processedOptions.location = strdup(option->value);
-        } else if (strcmp(option->key, "gray-gamma") == 0) {
-            processedOptions.gray_gamma = atof(option->value);
-        } else if (strcmp(option->key, "color-gamma") == 0) {
-            processedOptions.color_gamma = atof(option->value);
-        } else if (strcmp(option->key, "synthesize-gray") == 0) {
-            processedOptions.synthesize_gray = (bool)atoi(option->value);
-        } else {
-            processedOptions.sane_options.pairs = realloc(processedOptions.sane_options.pairs, sizeof(KeyValuePair) * (processedOptions.sane_options.count + 1));
-            processedOptions.sane_options.pairs[processedOptions.sane_options.count].key = strdup(option->key);
-            processedOptions.sane_options.pairs[processedOptions.sane_options.count].value = strdup(option->value);
-            processedOptions.sane_options.count++;
+            else if (descriptor->type == SANE_TYPE_FIXED) {
+                double number;
+                if (!parseEsclNumber((EsclStringView){ option->value, strlen(option->value) }, &number)
+                    || number <= -32768 || number >= 32768)
+                    break;
+                binding->word = SANE_FIX(number);
+            }
+            else if (descriptor->type == SANE_TYPE_BOOL)
+                binding->word = strcmp(option->value, "0") != 0 && strcmp(option->value, "false") != 0;
+            else if (descriptor->type != SANE_TYPE_STRING)
+                break;
+            bindings.count++;
+            break;
         }
     }
 
-    delete_RawOptions(&rawOptions);
-    return processedOptions;
+    for (size_t i = 0; i < options->sane_options.count; ++i) {
+        bool bound = false;
+        for (size_t j = 0; j < bindings.count && !bound; ++j)
+            bound = strcmp(bindings.items[j].option->key, options->sane_options.pairs[i].key) == 0;
+        if (!bound)
+            fprintf(stderr, "unknown or unsupported SANE option '%s' = '%s'\n", options->sane_options.pairs[i].key,
+                    options->sane_options.pairs[i].value);
+    }
+    return bindings;
+}
+
+void applySaneOptions(const SaneOptionBindings* bindings, SANE_Handle handle) {
+    for (size_t i = 0; i < bindings->count; ++i) {
+        const SaneOptionBinding* binding = &bindings->items[i];
+        SANE_Word word = binding->word;
+        void* value = binding->type == SANE_TYPE_STRING ? (void*)binding->option->value : (void*)&word;
+        if (sane_control_option(handle, binding->index, SANE_ACTION_SET_VALUE, value, NULL) != SANE_STATUS_GOOD)
+            fprintf(stderr, "could not set SANE option '%s' to '%s'\n", binding->option->key, binding->option->value);
+    }
+}
+
+void delete_SaneOptionBindings(SaneOptionBindings* bindings) {
+    free(bindings->items);
+    bindings->items = NULL;
+    bindings->count = 0;
 }
@@ -0,0 +1,174 @@
+#ifndef TEST_SCAN_OPTIONS_H
+#define TEST_SCAN_OPTIONS_H
+
+#include "pappl-private.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sane/sane.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Every string and array of an OptionsFile lives in its arena and is released
+// with it; keys are interned, so equal keys share one pointer.
+typedef struct OptionsArenaBlock {
+    struct OptionsArenaBlock* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} OptionsArenaBlock;
+
+typedef struct {
+    OptionsArenaBlock* head;
+} OptionsArena;
+
+typedef struct {
+    char* key;
+    char* value;
+    int schema;     // index into the option schema, or -1 for a SANE option
+    double number;  // value of a numeric or boolean schema option, converted at load
+} KeyValuePair;
+
+typedef struct {
+    KeyValuePair* pairs;
+    size_t count;
+} RawOptions;
+
+typedef struct {
+    char* icon;
+    char* note;
+    char* location;
+    double gray_gamma;
+    double color_gamma;
+    bool synthesize_gray;
+    double blank_ink_coverage;   // BlankPageDetection limits, see scan-blank.h
+    double blank_edge_density;
+    double blank_deviation;
+    RawOptions sane_options;
+} Options;
+
+typedef enum {
+    OPTION_STRING,
+    OPTION_PATH,    // relative paths are resolved against the options file
+    OPTION_DOUBLE,
+    OPTION_BOOL
+} OptionType;
+
+typedef struct {
+    const char* key;
+    OptionType type;
+    double min;
+    double max;
+    const char* defaultValue;
+    size_t offset;  // of the field in Options
+} OptionSchema;
+
+// A SANE pass-through option bound to the device's option index.
+typedef struct {
+    const KeyValuePair* option;
+    SANE_Int index;
+    SANE_Value_Type type;
+    SANE_Word word; // converted value for int, fixed and bool options
+} SaneOptionBinding;
+
+typedef struct {
+    SaneOptionBinding* items;
+    size_t count;
+} SaneOptionBindings;
+
+typedef struct {
+    char* device_name;
+    RawOptions options;
+} DeviceOptions;
+
+// Sections sharing one device name, with global options already merged in.
+typedef struct {
+    const char* name;     // borrowed from the first section's device_name
+    size_t* sections;     // indices into deviceOptions, in file order
+    size_t sectionCount;
+    Options options;
+} DeviceIndexEntry;
+
+typedef struct DevicePairOptions {
+    const DeviceIndexEntry* saneEntry;
+    const DeviceIndexEntry* modelEntry;
+    Options options;
+    struct DevicePairOptions* next;
+} DevicePairOptions;
+
+typedef struct {
+    char* fileName;
+    RawOptions globalOptions;
+    DeviceOptions* deviceOptions;
+    size_t deviceOptionsCount;
+    DeviceIndexEntry* deviceIndex; // open-addressed hash keyed by device name
+    size_t deviceIndexCapacity;    // power of two
+    Options defaultOptions;        // for scanners without a section
+    DevicePairOptions* pairOptions;
+    pthread_mutex_t pairLock;
+    atomic_int refCount;
+    OptionsArena arena;            // owns this struct and everything it points to
+} OptionsFile;
+
+// Keeps the current OptionsFile for a path and reloads it when the file changes.
+typedef struct {
+    char* fileName;
+    OptionsFile* current;
+    pthread_mutex_t lock;          // guards current while a reference is taken
+    pthread_t thread;
+    bool running;
+    int wakeFds[2];
+    int notifyFd;                  // inotify descriptor, or -1 to poll the modification time
+    time_t mtime;
+    off_t size;
+} OptionsWatcher;
+
+RawOptions new_RawOptions();
+
+Options new_Options();
+
+// A missing file loads as a snapshot without device options. Returns NULL if
+// memory runs out.
+OptionsFile* new_OptionsFile(const char* fileName);
+
+void delete_OptionsFile(OptionsFile* instance);
+
+// Options for scanner, owned by optionsFile; found by SANE name and make-and-model
+// in O(1) regardless of the number of device sections.
+const Options* scannerOptions(const OptionsFile* optionsFile, pappl_scanner_t* scanner);
+
+char* path(const char* fileName);
+
+// Resolve options->sane_options to option indices once, when the device is opened.
+// Options that are unknown, hold more than one value or have a malformed value
+// are reported on stderr and not bound. Bindings point into options and must not outlive the OptionsFile snapshot.
+SaneOptionBindings bindSaneOptions(const Options* options, SANE_Handle handle);
+
+// Set the bound options on the device, e.g. before each scan.
+void applySaneOptions(const SaneOptionBindings* bindings, SANE_Handle handle);
+
+void delete_SaneOptionBindings(SaneOptionBindings* bindings);
+
+// Start watching fileName; the first snapshot is loaded before returning.
+OptionsWatcher* new_OptionsWatcher(const char* fileName);
+
+void delete_OptionsWatcher(OptionsWatcher* watcher);
+
+// Snapshot for one scan job. It stays valid, even across reloads, until released.
+OptionsFile* acquireOptionsFile(OptionsWatcher* watcher);
+
+void releaseOptionsFile(OptionsFile* file);
+
+// Load the file again and swap it in; called by the watch thread.
+void reloadOptionsFile(OptionsWatcher* watcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_SCAN_OPTIONS_H */